@@ -60,6 +60,10 @@ func main() {
 	// Initialize engine manager and load balancer
 	engineManager := engine.NewManager(engineBinaryPath)
 	balancer := loadbalancer.New()
+	if engineBinaryPath != "" {
+		// start the idle engines now, so the first simulation doesn't wait for processes to start
+		engineManager.WarmPool()
+	}
 
 	// Initialize handlers with the manager and balancer
 	handlers.InitDistributed(engineManager, balancer)
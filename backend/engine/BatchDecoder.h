@@ -0,0 +1,501 @@
+#pragma once
+
+// Streaming decoders for the /batch body. Both take the body in whatever pieces httplib hands us while it is still receiving, call a
+// sink once per order, and say whether the body as a whole made sense at the end (Feed / Finish / Failed / Error / OrderCount).
+//
+// JsonDecoder reads the JSON format everyone can send:
+//
+//   {"orders":[{"orderid":1,"book":"AAPL","tradetype":"GTC","side":"BUY","price":100,"quantity":10}, ...]}
+//
+// Feed() takes the body in whatever pieces httplib hands us while it is still receiving, and calls the sink once per order as soon
+// as its closing brace arrives. It is one pass over the bytes with no allocations: a small state machine tracks where we are, the
+// only bytes copied are tokens (into fixed buffers), and whitespace, string contents and digit runs are classified 16 bytes at a time
+// with SSE2 where we have it (a plain loop otherwise).
+//
+// Like the old find()-based parser it is lenient about what it doesn't care about: unknown keys and values are skipped, missing fields
+// read as "" / 0, numbers are read up to the first non-digit (10.5 is 10), and strings are taken as they are, escapes and all. What it
+// does reject is a body that isn't well-formed JSON (unbalanced brackets, missing colons or commas, truncated input).
+
+#include <algorithm>
+#include <bit>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+#include <system_error>
+#include <vector>
+
+#include "Orderbook.h"
+#include "Protocol.h"
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define BATCH_DECODER_SSE2 1
+#endif
+
+namespace batch{
+
+// One decoded order, typed the way the book takes it: each decoder turns its own encoding of the type and side into the enums, so
+// the sink doesn't parse anything. book_ points into the decoder and is only valid during the sink call.
+struct Order{
+    std::uint64_t orderId_ = 0;
+    std::string_view book_;
+    OrderType tradeType_ = OrderType::GoodTillCancel;
+    Side side_ = Side::Buy;
+    std::int64_t price_ = 0;
+    std::int64_t quantity_ = 0;
+};
+
+namespace detail{
+
+inline bool IsSpace(char c){ return c == ' ' || c == '\t' || c == '\n' || c == '\r'; }
+inline bool IsDigit(char c){ return c >= '0' && c <= '9'; }
+inline bool IsNumberChar(char c){ return IsDigit(c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E'; }
+inline bool IsLetter(char c){ return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z'); }
+
+#if BATCH_DECODER_SSE2
+// bit i set if byte i of the 16 at data is whitespace / a quote or backslash / a digit.
+inline unsigned SpaceMask(const char* data){
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    __m128i space = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(' ')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\n')));
+    space = _mm_or_si128(space, _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\t')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\r'))));
+    return static_cast<unsigned>(_mm_movemask_epi8(space));
+}
+
+inline unsigned QuoteMask(const char* data){
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    __m128i quote = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')));
+    return static_cast<unsigned>(_mm_movemask_epi8(quote));
+}
+
+// signed compares are fine here: bytes >= 0x80 come out negative, so they're never digits.
+inline unsigned DigitMask(const char* data){
+    __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    __m128i digit = _mm_and_si128(_mm_cmpgt_epi8(chunk, _mm_set1_epi8('0' - 1)), _mm_cmplt_epi8(chunk, _mm_set1_epi8('9' + 1)));
+    return static_cast<unsigned>(_mm_movemask_epi8(digit));
+}
+#endif
+
+// each of these returns how many bytes at the front of data are whitespace / string content / digits.
+inline std::size_t SkipSpace(const char* data, std::size_t size){
+    std::size_t i = 0;
+    // compact JSON (what the Go side sends) has no whitespace at all, so check the first byte before loading 16
+    if (size == 0 || !IsSpace(data[0])){ return 0; }
+#if BATCH_DECODER_SSE2
+    for (; i + 16 <= size; i += 16){
+        unsigned other = ~SpaceMask(data + i) & 0xFFFF;
+        if (other != 0){ return i + std::countr_zero(other); }
+    }
+#endif
+    while (i < size && IsSpace(data[i])){ ++i; }
+    return i;
+}
+
+inline std::size_t SkipStringContent(const char* data, std::size_t size){
+    std::size_t i = 0;
+#if BATCH_DECODER_SSE2
+    for (; i + 16 <= size; i += 16){
+        unsigned quote = QuoteMask(data + i);
+        if (quote != 0){ return i + std::countr_zero(quote); }
+    }
+#endif
+    while (i < size && data[i] != '"' && data[i] != '\\'){ ++i; }
+    return i;
+}
+
+inline std::size_t SkipDigits(const char* data, std::size_t size){
+    std::size_t i = 0;
+#if BATCH_DECODER_SSE2
+    for (; i + 16 <= size; i += 16){
+        unsigned other = ~DigitMask(data + i) & 0xFFFF;
+        if (other != 0){ return i + std::countr_zero(other); }
+    }
+#endif
+    while (i < size && IsDigit(data[i])){ ++i; }
+    return i;
+}
+
+} // namespace detail
+
+class JsonDecoder{
+    public:
+        // decodes the next piece of the body, calling sink(const Order&) for every complete order. Does nothing once Failed().
+        template <typename Sink>
+        void Feed(const char* data, std::size_t size, Sink&& sink){
+            std::size_t i = 0;
+            while (i < size && error_ == nullptr){
+                switch (lexer_){
+                    case Lexer::Between: {
+                        i += detail::SkipSpace(data + i, size - i);
+                        if (i == size){ break; }
+                        char c = data[i];
+                        if (c == '"'){
+                            StartToken(Lexer::String);
+                            ++i;
+                        } else if (detail::IsDigit(c) || c == '-'){
+                            StartToken(Lexer::Number);
+                        } else if (detail::IsLetter(c)){
+                            StartToken(Lexer::Literal);
+                        } else {
+                            OnStructural(c, sink);
+                            ++i;
+                        }
+                        break;
+                    }
+                    case Lexer::String: {
+                        if (escaped_){
+                            Append(data + i, 1);
+                            escaped_ = false;
+                            ++i;
+                            break;
+                        }
+                        std::size_t run = detail::SkipStringContent(data + i, size - i);
+                        Append(data + i, run);
+                        i += run;
+                        if (i == size){ break; }
+                        if (data[i] == '\\'){
+                            escaped_ = true;
+                        } else {
+                            lexer_ = Lexer::Between;
+                            OnString();
+                        }
+                        ++i;
+                        break;
+                    }
+                    case Lexer::Number: {
+                        std::size_t run = detail::SkipDigits(data + i, size - i);
+                        while (i + run < size && detail::IsNumberChar(data[i + run])){
+                            run += 1 + detail::SkipDigits(data + i + run + 1, size - i - run - 1);
+                        }
+                        Append(data + i, run);
+                        i += run;
+                        // the byte that ended the number is looked at again as a structural character
+                        if (i < size){ EndScalar(); }
+                        break;
+                    }
+                    case Lexer::Literal: {
+                        std::size_t run = 0;
+                        while (i + run < size && detail::IsLetter(data[i + run])){ ++run; }
+                        Append(data + i, run);
+                        i += run;
+                        if (i < size){ EndScalar(); }
+                        break;
+                    }
+                }
+            }
+            offset_ += i;
+        }
+
+        // call once the whole body is in. false if it was cut off or malformed (see Error()).
+        bool Finish(){
+            if (error_ == nullptr && (lexer_ == Lexer::Number || lexer_ == Lexer::Literal)){ EndScalar(); }
+            if (error_ == nullptr && (lexer_ != Lexer::Between || expect_ != Expect::End)){ Fail("unexpected end of body"); }
+            return error_ == nullptr;
+        }
+
+        bool Failed() const { return error_ != nullptr; }
+        const char* Error() const { return error_ != nullptr ? error_ : ""; }
+        // where it went wrong: the offset into the body just past the offending byte
+        std::size_t ErrorOffset() const { return offset_; }
+
+        // objects seen in the orders array, including the ones the sink is going to skip
+        std::size_t OrderCount() const { return orderCount_; }
+
+    private:
+        enum class Lexer : std::uint8_t { Between, String, Number, Literal };
+        enum class Expect : std::uint8_t { Value, ValueOrClose, Key, KeyOrClose, Colon, CommaOrClose, End };
+        enum class Field : std::uint8_t { None, OrderId, Book, TradeType, Side, Price, Quantity };
+
+        // tokens longer than this are cut short, which doesn't change anything we do with them: no key we look for is that long, a
+        // book name that long is still too long for BookName, and a cut "GTC" or "BUY" still isn't "GTC" or "BUY".
+        static constexpr std::size_t kMaxToken = 64;
+        static constexpr int kMaxDepth = 64;
+
+        struct Text{
+            char data_[kMaxToken];
+            std::uint8_t size_ = 0;
+
+            std::string_view View() const { return std::string_view(data_, size_); }
+            void Set(std::string_view text){
+                size_ = static_cast<std::uint8_t>(text.size());
+                std::memcpy(data_, text.data(), text.size());
+            }
+        };
+
+        void StartToken(Lexer lexer){
+            if (expect_ != Expect::Value && expect_ != Expect::ValueOrClose && !(lexer == Lexer::String && IsKeyExpected())){
+                Fail("unexpected value");
+                return;
+            }
+            lexer_ = lexer;
+            token_.size_ = 0;
+        }
+
+        void Append(const char* data, std::size_t size){
+            std::size_t room = kMaxToken - token_.size_;
+            std::size_t n = size < room ? size : room;
+            std::memcpy(token_.data_ + token_.size_, data, n);
+            token_.size_ += static_cast<std::uint8_t>(n);
+        }
+
+        bool IsKeyExpected() const { return expect_ == Expect::Key || expect_ == Expect::KeyOrClose; }
+        bool TopIsObject() const { return depth_ > 0 && ((objects_ >> (depth_ - 1)) & 1) != 0; }
+        bool InOrder() const { return ordersDepth_ != 0 && depth_ == ordersDepth_ + 1; }
+
+        void OnString(){
+            if (!IsKeyExpected()){
+                OnScalar();
+                return;
+            }
+            std::string_view key = token_.View();
+            if (depth_ == 1){
+                ordersKey_ = key == "orders";
+            } else if (InOrder()){
+                field_ = key == "orderid" ? Field::OrderId
+                    : key == "book" ? Field::Book
+                    : key == "tradetype" ? Field::TradeType
+                    : key == "side" ? Field::Side
+                    : key == "price" ? Field::Price
+                    : key == "quantity" ? Field::Quantity
+                    : Field::None;
+            }
+            expect_ = Expect::Colon;
+        }
+
+        void EndScalar(){
+            lexer_ = Lexer::Between;
+            OnScalar();
+        }
+
+        void OnScalar(){
+            if (InOrder()){
+                switch (field_){
+                    case Field::OrderId: order_.orderId_ = static_cast<std::uint64_t>(ParseNumber()); break;
+                    case Field::Price: order_.price_ = ParseNumber(); break;
+                    case Field::Quantity: order_.quantity_ = ParseNumber(); break;
+                    case Field::Book: book_.Set(token_.View()); break;
+                    case Field::TradeType: tradeType_.Set(token_.View()); break;
+                    case Field::Side: side_.Set(token_.View()); break;
+                    case Field::None: break;
+                }
+                field_ = Field::None;
+            }
+            AfterValue();
+        }
+
+        // the leading integer of the token; 0 if there isn't one (a string or literal where we wanted a number)
+        std::int64_t ParseNumber(){
+            std::int64_t value = 0;
+            auto [end, ec] = std::from_chars(token_.data_, token_.data_ + token_.size_, value);
+            if (ec == std::errc::result_out_of_range){ Fail("number out of range"); }
+            return value;
+        }
+
+        void AfterValue(){
+            expect_ = depth_ == 0 ? Expect::End : Expect::CommaOrClose;
+        }
+
+        template <typename Sink>
+        void OnStructural(char c, Sink& sink){
+            switch (c){
+                case '{':
+                case '[': {
+                    if (expect_ != Expect::Value && expect_ != Expect::ValueOrClose){ return Fail("unexpected bracket"); }
+                    if (depth_ == kMaxDepth){ return Fail("nested too deeply"); }
+                    // the first array under the top-level "orders" key is the one we decode
+                    bool orders = c == '[' && depth_ == 1 && ordersKey_ && !ordersSeen_;
+                    if (c == '{'){ objects_ |= std::uint64_t{1} << depth_; } else { objects_ &= ~(std::uint64_t{1} << depth_); }
+                    ++depth_;
+                    if (orders){
+                        ordersDepth_ = depth_;
+                        ordersSeen_ = true;
+                    } else if (c == '{' && InOrder()){
+                        order_ = Order{};
+                        book_.size_ = tradeType_.size_ = side_.size_ = 0;
+                        ++orderCount_;
+                    }
+                    expect_ = c == '{' ? Expect::KeyOrClose : Expect::ValueOrClose;
+                    return;
+                }
+                case '}':
+                case ']': {
+                    bool closable = c == '}' ? (expect_ == Expect::KeyOrClose || expect_ == Expect::CommaOrClose)
+                        : (expect_ == Expect::ValueOrClose || expect_ == Expect::CommaOrClose);
+                    if (!closable || TopIsObject() != (c == '}')){ return Fail("unexpected closing bracket"); }
+                    if (c == '}' && InOrder()){
+                        order_.book_ = book_.View();
+                        // anything but "GTC" / "BUY" (missing included) reads as FAK / SELL, as the per-order endpoint has it
+                        order_.tradeType_ = tradeType_.View() == "GTC" ? OrderType::GoodTillCancel : OrderType::FillAndKill;
+                        order_.side_ = side_.View() == "BUY" ? Side::Buy : Side::Sell;
+                        sink(static_cast<const Order&>(order_));
+                    }
+                    if (depth_ == ordersDepth_){ ordersDepth_ = 0; }
+                    --depth_;
+                    AfterValue();
+                    return;
+                }
+                case ',':
+                    if (expect_ != Expect::CommaOrClose){ return Fail("unexpected comma"); }
+                    expect_ = TopIsObject() ? Expect::Key : Expect::Value;
+                    return;
+                case ':':
+                    if (expect_ != Expect::Colon){ return Fail("unexpected colon"); }
+                    expect_ = Expect::Value;
+                    return;
+                default:
+                    return Fail("unexpected character");
+            }
+        }
+
+        void Fail(const char* error){
+            if (error_ == nullptr){ error_ = error; }
+        }
+
+        Lexer lexer_ = Lexer::Between;
+        Expect expect_ = Expect::Value;
+        bool escaped_ = false;
+        Text token_;
+
+        int depth_ = 0;
+        std::uint64_t objects_ = 0; // bit d set if the container at depth d + 1 is an object
+        bool ordersKey_ = false;    // the last top-level key was "orders"
+        bool ordersSeen_ = false;
+        int ordersDepth_ = 0;       // depth of the orders array while we're inside it
+        Field field_ = Field::None;
+
+        Order order_;
+        Text book_;
+        Text tradeType_;
+        Text side_;
+        std::size_t orderCount_ = 0;
+
+        std::size_t offset_ = 0;
+        const char* error_ = nullptr;
+};
+
+// BinaryDecoder reads the binary batch format (Protocol.h, kBatchContentType) that the Go balancer sends. Records are read where they
+// sit in the buffer httplib received them into; only a record (or header, or book name) that is split between two pieces of the body
+// gets put back together in a small buffer first.
+class BinaryDecoder{
+    public:
+        template <typename Sink>
+        void Feed(const char* data, std::size_t size, Sink&& sink){
+            std::size_t start = size;
+            while (size > 0 && error_ == nullptr){
+                if (stage_ == Stage::Done){
+                    Fail("more data than the header announced");
+                    break;
+                }
+                std::size_t need = ItemSize();
+                const char* item = data;
+                if (carried_ == 0 && size >= need){
+                    data += need;
+                    size -= need;
+                } else {
+                    std::size_t n = std::min(need - carried_, size);
+                    std::memcpy(carry_ + carried_, data, n);
+                    carried_ += n;
+                    data += n;
+                    size -= n;
+                    if (carried_ < need){ break; }
+                    item = carry_;
+                    carried_ = 0;
+                }
+                OnItem(item, sink);
+            }
+            offset_ += start - size;
+        }
+
+        bool Finish(){
+            if (error_ == nullptr && stage_ != Stage::Done){ Fail("body ends early"); }
+            return error_ == nullptr;
+        }
+
+        bool Failed() const { return error_ != nullptr; }
+        const char* Error() const { return error_ != nullptr ? error_ : ""; }
+        std::size_t ErrorOffset() const { return offset_; }
+        std::size_t OrderCount() const { return orderCount_; }
+
+    private:
+        enum class Stage : std::uint8_t { Header, Books, Orders, Done };
+
+        // records can grow in later versions, but not without bound (they have to fit the carry buffer)
+        static constexpr std::size_t kMaxRecordSize = 256;
+
+        struct Book{
+            char name_[wire::kBookNameSize];
+        };
+
+        std::size_t ItemSize() const {
+            switch (stage_){
+                case Stage::Header: return sizeof(wire::BatchHeader);
+                case Stage::Books: return wire::kBookNameSize;
+                default: return header_.recordSize_;
+            }
+        }
+
+        template <typename Sink>
+        void OnItem(const char* item, Sink& sink){
+            switch (stage_){
+                case Stage::Header: {
+                    std::memcpy(&header_, item, sizeof(header_));
+                    if (header_.magic_ != wire::kBatchMagic || header_.version_ != wire::kBatchVersion){ return Fail("not a version 1 batch"); }
+                    if (header_.recordSize_ < sizeof(wire::BatchOrder) || header_.recordSize_ > kMaxRecordSize){ return Fail("bad record size"); }
+                    books_.reserve(header_.bookCount_);
+                    NextStage();
+                    return;
+                }
+                case Stage::Books: {
+                    Book book;
+                    std::memcpy(book.name_, item, sizeof(book.name_));
+                    books_.push_back(book);
+                    NextStage();
+                    return;
+                }
+                case Stage::Orders: {
+                    wire::BatchOrder record;
+                    std::memcpy(&record, item, sizeof(record));
+                    if (record.book_ >= books_.size()){ return Fail("book index out of range"); }
+                    if (record.side_ > wire::WireSide::Sell || record.orderType_ > wire::WireOrderType::FillAndKill){ return Fail("bad side or order type"); }
+                    ++orderCount_;
+                    Order order;
+                    order.orderId_ = record.orderId_;
+                    order.book_ = wire::BookView(books_[record.book_].name_);
+                    order.tradeType_ = record.orderType_ == wire::WireOrderType::GoodTillCancel ? OrderType::GoodTillCancel : OrderType::FillAndKill;
+                    order.side_ = record.side_ == wire::WireSide::Buy ? Side::Buy : Side::Sell;
+                    order.price_ = record.price_;
+                    order.quantity_ = record.quantity_;
+                    sink(static_cast<const Order&>(order));
+                    NextStage();
+                    return;
+                }
+                case Stage::Done:
+                    return;
+            }
+        }
+
+        // moves past every stage that has nothing (more) to read
+        void NextStage(){
+            if (stage_ == Stage::Header){ stage_ = Stage::Books; }
+            if (stage_ == Stage::Books && books_.size() == header_.bookCount_){ stage_ = Stage::Orders; }
+            if (stage_ == Stage::Orders && orderCount_ == header_.orderCount_){ stage_ = Stage::Done; }
+        }
+
+        void Fail(const char* error){
+            if (error_ == nullptr){ error_ = error; }
+        }
+
+        Stage stage_ = Stage::Header;
+        wire::BatchHeader header_{};
+        std::vector<Book> books_;
+        std::size_t orderCount_ = 0;
+
+        char carry_[kMaxRecordSize];
+        std::size_t carried_ = 0;
+
+        std::size_t offset_ = 0;
+        const char* error_ = nullptr;
+};
+
+} // namespace batch
@@ -0,0 +1,502 @@
+// Microbenchmarks for Orderbook (Orderbook.h): AddOrder (passive and aggressive), CancelOrder, MatchOrder (modify), GetOrderInfos and
+// GetBestPrices, over books of different shapes. It is how container and allocator variants get compared: run it before and after.
+//
+// Build (next to the engine):  g++ -std=c++23 -O2 Bench.cpp -pthread -o bench
+// Usage: bench [--only=NAME] [--ops=N] [--seed=N] [--ladder-levels=N] [--tick-size=N] [--expected-orders=N] [--huge-pages] [--id-index=hash|direct]
+//        bench --depth=N [--levels=N] [--prices=uniform|touch|zipf] [--cancel=R] [--modify=R] [--aggressive=R] [...]   (one custom scenario)
+//
+// Without --depth it runs the built-in scenarios (kScenarios): a series over book depth from 1k to 10M resting orders, then one over the
+// number of levels, the cancel ratio, the aggressive share and the price distribution, each changing one thing from the base scenario.
+// --only=NAME runs the ones whose name starts with NAME.
+//
+// A scenario:
+//   depth       resting orders, spread over `levels` price levels per side around a fixed mid (1 tick apart).
+//   prices      how far from the touch an order lands: uniform over the levels, touch (exponentially fewer further out) or zipf (s=1.1).
+//   cancel, modify, aggressive
+//               the share of operations that are cancels of a random resting order, modifies of one (new price and quantity, same side)
+//               and fillandkill orders that cross the spread (as deep as `prices` says). The rest are passive orders that rest.
+//               The book is held at its depth: when it drifts more than 1% off, the next operation is a passive order (too shallow) or
+//               a cancel (too deep) whatever the ratios say, so the printed counts are the mix that was really run.
+//
+// The operations are generated up front by playing them against a scratch book (so cancels and modifies pick orders that are really
+// there), then applied to fresh books twice: flat out for ns/op and allocations/op of the whole mix, and once more reading the clock and
+// the allocation counter around every operation for the per-operation breakdown with p50/p99/p99.9 (those include the clock reads,
+// whose cost is printed). Allocations are calls to operator new; the order pool gets its slabs from mmap, so those don't show up.
+
+#include "Orderbook.h"
+#include "Histogram.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <format>
+#include <iostream>
+#include <new>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// every operator new in the process goes through here. The benchmark is single-threaded, so a plain counter will do. (noinline: once these
+// inline, gcc sees malloc's pointer going to operator delete, or operator new's going to free(), and warns about a mismatch that isn't one.)
+static uint64_t gAllocations = 0;
+
+[[gnu::noinline]] void* operator new(std::size_t size) {
+    ++gAllocations;
+    if (void* memory = std::malloc(size == 0 ? 1 : size)) {
+        return memory;
+    }
+    throw std::bad_alloc();
+}
+
+[[gnu::noinline]] void operator delete(void* memory) noexcept { std::free(memory); }
+[[gnu::noinline]] void operator delete(void* memory, std::size_t) noexcept { std::free(memory); }
+
+namespace {
+
+enum class PriceShape : uint8_t {
+    Uniform,
+    Touch,
+    Zipf
+};
+
+struct Scenario {
+    std::string name_;
+    size_t depth_ = 100000;
+    size_t levels_ = 1000;
+    PriceShape prices_ = PriceShape::Touch;
+    double cancel_ = 0.35;
+    double modify_ = 0.10;
+    double aggressive_ = 0.10;
+};
+
+Scenario With(std::string name, auto change) {
+    Scenario scenario;
+    scenario.name_ = std::move(name);
+    change(scenario);
+    return scenario;
+}
+
+const std::vector<Scenario> kScenarios = {
+    With("depth-1k", [](Scenario& s) { s.depth_ = 1000; }),
+    With("depth-10k", [](Scenario& s) { s.depth_ = 10000; }),
+    With("depth-100k", [](Scenario&) {}),
+    With("depth-1m", [](Scenario& s) { s.depth_ = 1000000; }),
+    With("depth-10m", [](Scenario& s) { s.depth_ = 10000000; }),
+    With("levels-10", [](Scenario& s) { s.levels_ = 10; }),
+    With("levels-100", [](Scenario& s) { s.levels_ = 100; }),
+    With("levels-10k", [](Scenario& s) { s.levels_ = 10000; }),
+    With("cancel-0.05", [](Scenario& s) { s.cancel_ = 0.05; }),
+    With("cancel-0.6", [](Scenario& s) { s.cancel_ = 0.6; }),
+    With("aggressive-0", [](Scenario& s) { s.aggressive_ = 0; }),
+    With("aggressive-0.4", [](Scenario& s) { s.aggressive_ = 0.4; s.cancel_ = 0.1; }),
+    With("prices-uniform", [](Scenario& s) { s.prices_ = PriceShape::Uniform; }),
+    With("prices-zipf", [](Scenario& s) { s.prices_ = PriceShape::Zipf; }),
+};
+
+std::string_view ShapeName(PriceShape shape) {
+    switch (shape) {
+        case PriceShape::Uniform: return "uniform";
+        case PriceShape::Touch: return "touch";
+        case PriceShape::Zipf: return "zipf";
+    }
+    return "?";
+}
+
+enum class OpKind : uint8_t {
+    Passive,
+    Aggressive,
+    Cancel,
+    Modify
+};
+constexpr size_t kOpKinds = 4;
+constexpr std::array<std::string_view, kOpKinds> kOpNames = { "AddOrder passive", "AddOrder aggressive", "CancelOrder", "MatchOrder (modify)" };
+
+struct Op {
+    OrderId id_;
+    Price price_;
+    Quantity quantity_;
+    Side side_;
+    OpKind kind_;
+};
+
+constexpr Price kMid = 1000000;
+
+// Picks order prices and quantities for a scenario. A level is an offset from the touch: bids at kMid - 1 - level, asks at kMid + 1 + level.
+class Generator {
+    public:
+        Generator(const Scenario& scenario, uint64_t seed):
+            rng_(seed) {
+            std::vector<double> weights(scenario.levels_);
+            for (size_t level = 0; level < weights.size(); ++level) {
+                switch (scenario.prices_) {
+                    case PriceShape::Uniform: weights[level] = 1.0; break;
+                    case PriceShape::Touch: weights[level] = std::exp(-static_cast<double>(level) / std::max(1.0, scenario.levels_ / 10.0)); break;
+                    case PriceShape::Zipf: weights[level] = 1.0 / std::pow(static_cast<double>(level + 1), 1.1); break;
+                }
+            }
+            levels_ = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+        }
+
+        Side AnySide() { return coin_(rng_) ? Side::Buy : Side::Sell; }
+        Quantity AnyQuantity() { return quantity_(rng_); }
+        double Uniform() { return uniform_(rng_); }
+        size_t Below(size_t n) { return std::uniform_int_distribution<size_t>(0, n - 1)(rng_); }
+
+        // a price on the order's own side of the book, so it rests.
+        Price Passive(Side side) {
+            Price level = static_cast<Price>(levels_(rng_));
+            return side == Side::Buy ? kMid - 1 - level : kMid + 1 + level;
+        }
+
+        // a price on the other side, so it crosses and sweeps up to that level.
+        Price Crossing(Side side) { return Passive(side == Side::Buy ? Side::Sell : Side::Buy); }
+
+    private:
+        std::mt19937_64 rng_;
+        std::discrete_distribution<size_t> levels_;
+        std::bernoulli_distribution coin_{ 0.5 };
+        std::uniform_int_distribution<Quantity> quantity_{ 1, 100 };
+        std::uniform_real_distribution<double> uniform_{ 0.0, 1.0 };
+};
+
+// the resting orders, for picking one at random in O(1) (swap-remove, with each id's position in live_).
+class LiveOrders {
+    public:
+        explicit LiveOrders(size_t maxId):
+            position_(maxId + 1, kGone),
+            side_(maxId + 1, Side::Buy) {}
+
+        void Add(OrderId id, Side side) {
+            position_[id] = static_cast<uint32_t>(live_.size());
+            side_[id] = side;
+            live_.push_back(id);
+        }
+
+        void Remove(OrderId id) {
+            uint32_t at = position_[id];
+            if (at == kGone) {
+                return;
+            }
+            OrderId last = live_.back();
+            live_[at] = last;
+            position_[last] = at;
+            live_.pop_back();
+            position_[id] = kGone;
+        }
+
+        bool Contains(OrderId id) const { return position_[id] != kGone; }
+        size_t Size() const { return live_.size(); }
+        OrderId At(size_t index) const { return live_[index]; }
+        Side SideOf(OrderId id) const { return side_[id]; }
+
+    private:
+        static constexpr uint32_t kGone = UINT32_MAX;
+        std::vector<OrderId> live_;
+        std::vector<uint32_t> position_;
+        std::vector<Side> side_;
+};
+
+// remembers which orders traded, so the generator can tell which ones an aggressive order took out of the book.
+struct TradedIds {
+    std::vector<OrderId> ids_;
+    void OnTrade(const Trade& trade) {
+        ids_.push_back(trade.GetBidTrade().orderid_);
+        ids_.push_back(trade.GetAskTrade().orderid_);
+    }
+};
+
+struct Workload {
+    std::vector<Op> build_;  // the passive orders that make up the starting book
+    std::vector<Op> ops_;    // what gets measured
+};
+
+void Apply(Orderbook& book, const Op& op, NullSink& sink) {
+    switch (op.kind_) {
+        case OpKind::Passive:
+            book.AddOrder(Order(OrderType::GoodTillCancel, op.side_, op.price_, op.quantity_, op.id_), sink);
+            break;
+        case OpKind::Aggressive:
+            book.AddOrder(Order(OrderType::FillAndKill, op.side_, op.price_, op.quantity_, op.id_), sink);
+            break;
+        case OpKind::Cancel:
+            book.CancelOrder(op.id_, sink);
+            break;
+        case OpKind::Modify:
+            book.MatchOrder(OrderModify(op.id_, op.side_, op.price_, op.quantity_), sink);
+            break;
+    }
+}
+
+Workload Generate(const Scenario& scenario, size_t opCount, uint64_t seed, const BookConfig& config) {
+    Workload workload;
+    Generator generator(scenario, seed);
+    LiveOrders live(scenario.depth_ + opCount + 1);
+    Orderbook scratch(config);
+    TradedIds traded;
+    OrderId nextId = 1;
+
+    auto passive = [&](std::vector<Op>& out) {
+        Side side = generator.AnySide();
+        Op op{ nextId++, generator.Passive(side), generator.AnyQuantity(), side, OpKind::Passive };
+        scratch.AddOrder(Order(OrderType::GoodTillCancel, op.side_, op.price_, op.quantity_, op.id_), traded);
+        live.Add(op.id_, side);
+        out.push_back(op);
+    };
+
+    workload.build_.reserve(scenario.depth_);
+    while (live.Size() < scenario.depth_) {
+        passive(workload.build_);
+    }
+
+    size_t slack = std::max<size_t>(10, scenario.depth_ / 100);
+    workload.ops_.reserve(opCount);
+    for (size_t i = 0; i < opCount; ++i) {
+        double draw = generator.Uniform();
+        OpKind kind = OpKind::Passive;
+        if (live.Size() + slack < scenario.depth_) {
+            kind = OpKind::Passive;
+        } else if (live.Size() > scenario.depth_ + slack) {
+            kind = OpKind::Cancel;
+        } else if (draw < scenario.cancel_) {
+            kind = OpKind::Cancel;
+        } else if (draw < scenario.cancel_ + scenario.modify_) {
+            kind = OpKind::Modify;
+        } else if (draw < scenario.cancel_ + scenario.modify_ + scenario.aggressive_) {
+            kind = OpKind::Aggressive;
+        }
+        if ((kind == OpKind::Cancel || kind == OpKind::Modify) && live.Size() == 0) {
+            kind = OpKind::Passive;
+        }
+
+        switch (kind) {
+            case OpKind::Passive:
+                passive(workload.ops_);
+                break;
+            case OpKind::Aggressive: {
+                Side side = generator.AnySide();
+                Op op{ nextId++, generator.Crossing(side), generator.AnyQuantity(), side, OpKind::Aggressive };
+                traded.ids_.clear();
+                scratch.AddOrder(Order(OrderType::FillAndKill, op.side_, op.price_, op.quantity_, op.id_), traded);
+                for (OrderId id : traded.ids_) {
+                    if (id != op.id_ && live.Contains(id) && !scratch.Contains(id)) {
+                        live.Remove(id);
+                    }
+                }
+                workload.ops_.push_back(op);
+                break;
+            }
+            case OpKind::Cancel: {
+                OrderId id = live.At(generator.Below(live.Size()));
+                scratch.CancelOrder(id);
+                live.Remove(id);
+                workload.ops_.push_back(Op{ id, 0, 0, Side::Buy, OpKind::Cancel });
+                break;
+            }
+            case OpKind::Modify: {
+                OrderId id = live.At(generator.Below(live.Size()));
+                Side side = live.SideOf(id);
+                Op op{ id, generator.Passive(side), generator.AnyQuantity(), side, OpKind::Modify };
+                scratch.MatchOrder(OrderModify(op.id_, op.side_, op.price_, op.quantity_), traded);
+                workload.ops_.push_back(op);
+                break;
+            }
+        }
+    }
+    return workload;
+}
+
+Orderbook& Build(std::unique_ptr<Orderbook>& book, const Workload& workload, const BookConfig& config, NullSink& sink) {
+    book = std::make_unique<Orderbook>(config);
+    for (const Op& op : workload.build_) {
+        Apply(*book, op, sink);
+    }
+    return *book;
+}
+
+struct OpStats {
+    LatencyHistogram latency_;
+    uint64_t totalNs_ = 0;
+    uint64_t allocations_ = 0;
+
+    void Record(uint64_t ns, uint64_t allocations) {
+        latency_.Record(ns);
+        totalNs_ += ns;
+        allocations_ += allocations;
+    }
+};
+
+double Milliseconds(std::chrono::steady_clock::duration elapsed) {
+    return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+uint64_t Nanoseconds(std::chrono::steady_clock::time_point start, std::chrono::steady_clock::time_point end) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+// what a steady_clock read costs here (the median of many back-to-back pairs), since the per-operation numbers pay for two.
+uint64_t ClockOverhead() {
+    LatencyHistogram histogram;
+    for (int i = 0; i < 100000; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        histogram.Record(Nanoseconds(start, std::chrono::steady_clock::now()));
+    }
+    return histogram.Percentile(50);
+}
+
+void PrintRow(std::string_view name, const OpStats& stats) {
+    uint64_t count = stats.latency_.Count();
+    if (count == 0) {
+        return;
+    }
+    std::cout << std::format("  {:<22} {:>10} {:>10.1f} {:>10.3f} {:>8} {:>8} {:>8} {:>10}\n", name, count,
+        static_cast<double>(stats.totalNs_) / static_cast<double>(count), static_cast<double>(stats.allocations_) / static_cast<double>(count),
+        stats.latency_.Percentile(50), stats.latency_.Percentile(99), stats.latency_.Percentile(99.9), stats.latency_.Max());
+}
+
+void Run(const Scenario& scenario, size_t opCount, uint64_t seed, const BookConfig& config) {
+    std::cout << std::format("{}: depth {}, {} levels/side, prices {}, cancel {:.2f}, modify {:.2f}, aggressive {:.2f}, {} ops\n",
+        scenario.name_, scenario.depth_, scenario.levels_, ShapeName(scenario.prices_), scenario.cancel_, scenario.modify_,
+        scenario.aggressive_, opCount);
+    Workload workload = Generate(scenario, opCount, seed, config);
+    NullSink sink;
+
+    // flat out: the whole mix
+    std::unique_ptr<Orderbook> book;
+    auto buildStart = std::chrono::steady_clock::now();
+    Build(book, workload, config, sink);
+    double buildMs = Milliseconds(std::chrono::steady_clock::now() - buildStart);
+    uint64_t allocationsBefore = gAllocations;
+    auto start = std::chrono::steady_clock::now();
+    for (const Op& op : workload.ops_) {
+        Apply(*book, op, sink);
+    }
+    double runMs = Milliseconds(std::chrono::steady_clock::now() - start);
+    uint64_t allocations = gAllocations - allocationsBefore;
+    std::cout << std::format("  built {} orders in {:.1f} ms ({:.0f} ns/order), {} resting after the run\n", workload.build_.size(), buildMs,
+        buildMs * 1e6 / static_cast<double>(std::max<size_t>(1, workload.build_.size())), book->Size());
+    std::cout << std::format("  mix: {:.1f} ns/op, {:.3f} allocs/op, {:.2f}M ops/s\n", runMs * 1e6 / static_cast<double>(opCount),
+        static_cast<double>(allocations) / static_cast<double>(opCount), static_cast<double>(opCount) / runMs / 1000.0);
+    book.reset();
+
+    // every operation on its own
+    std::array<OpStats, kOpKinds> stats;
+    Orderbook& timed = Build(book, workload, config, sink);
+    for (const Op& op : workload.ops_) {
+        uint64_t before = gAllocations;
+        auto opStart = std::chrono::steady_clock::now();
+        Apply(timed, op, sink);
+        auto opEnd = std::chrono::steady_clock::now();
+        stats[static_cast<size_t>(op.kind_)].Record(Nanoseconds(opStart, opEnd), gAllocations - before);
+    }
+
+    // the queries, on the book the run left behind
+    OpStats infos;
+    for (int i = 0; i < 200; ++i) {
+        uint64_t before = gAllocations;
+        auto opStart = std::chrono::steady_clock::now();
+        OrderBookLevelInfo levels = timed.GetOrderInfos();
+        auto opEnd = std::chrono::steady_clock::now();
+        infos.Record(Nanoseconds(opStart, opEnd), gAllocations - before);
+        if (levels.GetBids().size() + levels.GetAsks().size() == 0 && timed.Size() != 0) {
+            std::cerr << "GetOrderInfos came back empty\n";
+        }
+    }
+    OpStats best;
+    [[maybe_unused]] volatile Price keep = 0; // so the calls can't be dropped
+    for (int i = 0; i < 100000; ++i) {
+        uint64_t before = gAllocations;
+        auto opStart = std::chrono::steady_clock::now();
+        auto [bid, ask] = timed.GetBestPrices();
+        auto opEnd = std::chrono::steady_clock::now();
+        keep = bid ^ ask;
+        best.Record(Nanoseconds(opStart, opEnd), gAllocations - before);
+    }
+
+    std::cout << std::format("  {:<22} {:>10} {:>10} {:>10} {:>8} {:>8} {:>8} {:>10}\n", "operation", "count", "ns/op", "allocs/op", "p50", "p99",
+        "p99.9", "max");
+    for (size_t kind = 0; kind < kOpKinds; ++kind) {
+        PrintRow(kOpNames[kind], stats[kind]);
+    }
+    PrintRow("GetOrderInfos", infos);
+    PrintRow("GetBestPrices", best);
+    std::cout << "\n";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    size_t opCount = 1000000;
+    uint64_t seed = 42;
+    std::string only;
+    BookConfig config;
+    Scenario custom;
+    custom.name_ = "custom";
+    bool isCustom = false;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        try {
+            if (arg.starts_with("--only=")) {
+                only = arg.substr(7);
+            } else if (arg.starts_with("--ops=")) {
+                opCount = std::stoull(arg.substr(6));
+            } else if (arg.starts_with("--seed=")) {
+                seed = std::stoull(arg.substr(7));
+            } else if (arg.starts_with("--depth=")) {
+                custom.depth_ = std::stoull(arg.substr(8));
+                isCustom = true;
+            } else if (arg.starts_with("--levels=")) {
+                custom.levels_ = std::max<size_t>(1, std::stoull(arg.substr(9)));
+            } else if (arg.starts_with("--prices=")) {
+                std::string shape = arg.substr(9);
+                custom.prices_ = shape == "uniform" ? PriceShape::Uniform : shape == "zipf" ? PriceShape::Zipf : PriceShape::Touch;
+            } else if (arg.starts_with("--cancel=")) {
+                custom.cancel_ = std::stod(arg.substr(9));
+            } else if (arg.starts_with("--modify=")) {
+                custom.modify_ = std::stod(arg.substr(9));
+            } else if (arg.starts_with("--aggressive=")) {
+                custom.aggressive_ = std::stod(arg.substr(13));
+            } else if (arg.starts_with("--ladder-levels=")) {
+                config.ladderLevels_ = std::stoul(arg.substr(16));
+            } else if (arg.starts_with("--tick-size=")) {
+                config.tickSize_ = std::stoi(arg.substr(12));
+            } else if (arg.starts_with("--expected-orders=")) {
+                config.expectedOrders_ = std::stoull(arg.substr(18));
+            } else if (arg == "--huge-pages") {
+                config.hugePages_ = true;
+            } else if (arg.starts_with("--id-index=")) {
+                config.indexMode_ = arg.substr(11) == "direct" ? IndexMode::Direct : IndexMode::Hashed;
+            } else {
+                std::cerr << "Unknown argument " << arg << "\n";
+                return 1;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Invalid argument " << arg << "\n";
+            return 1;
+        }
+    }
+    if (custom.cancel_ + custom.modify_ + custom.aggressive_ > 1.0) {
+        std::cerr << "--cancel, --modify and --aggressive add up to more than 1\n";
+        return 1;
+    }
+
+    std::cout << std::format("reading the clock costs ~{} ns, which the per-operation numbers include\n\n", ClockOverhead());
+    if (isCustom) {
+        Run(custom, opCount, seed, config);
+        return 0;
+    }
+    bool ran = false;
+    for (const Scenario& scenario : kScenarios) {
+        if (scenario.name_.starts_with(only)) {
+            Run(scenario, opCount, seed, config);
+            ran = true;
+        }
+    }
+    if (!ran) {
+        std::cerr << "No scenario called " << only << "\n";
+        return 1;
+    }
+    return 0;
+}
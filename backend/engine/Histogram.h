@@ -0,0 +1,100 @@
+#pragma once
+
+// Latency histograms. Log-linear buckets, HdrHistogram style: values below 16 get a bucket each, and every power of two above that is
+// split into 16 equal buckets, so a bucket is never wider than 1/16 of its values (6.25%) and the whole range of uint64 fits in under
+// a thousand counters. Recording is a couple of shifts and an increment, no allocation.
+// LatencyHistogram is the single-threaded one the tools use; the engine's per-thread ones are in Metrics.h.
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// the bucket layout, shared by every histogram.
+struct HistogramBuckets{
+    static constexpr int kSubBits = 4;
+    static constexpr std::uint64_t kSub = std::uint64_t{1} << kSubBits;
+    static constexpr std::size_t kCount = kSub + (64 - kSubBits) * kSub;
+
+    // values below kSub map to themselves; otherwise e = how far the value is shifted so its top kSubBits+1 bits remain, and the
+    // bucket is kSub + e * kSub + the kSubBits bits below the leading one.
+    static std::size_t IndexOf(std::uint64_t value){
+        if (value < kSub){ return static_cast<std::size_t>(value); }
+        int e = std::bit_width(value) - 1 - kSubBits;
+        return static_cast<std::size_t>(kSub + e * kSub + ((value >> e) - kSub));
+    }
+
+    static std::uint64_t LowerOf(std::size_t index){
+        if (index < kSub){ return index; }
+        std::size_t e = (index - kSub) / kSub;
+        std::uint64_t sub = (index - kSub) % kSub;
+        return (kSub + sub) << e;
+    }
+
+    static std::uint64_t UpperOf(std::size_t index){
+        if (index < kSub){ return index; }
+        std::size_t e = (index - kSub) / kSub;
+        return LowerOf(index) + (std::uint64_t{1} << e) - 1;
+    }
+};
+
+class LatencyHistogram{
+    public:
+        void Record(std::uint64_t value){
+            ++counts_[HistogramBuckets::IndexOf(value)];
+            ++count_;
+            if (value < min_){ min_ = value; }
+            if (value > max_){ max_ = value; }
+        }
+
+        std::uint64_t Count() const { return count_; }
+        std::uint64_t Min() const { return count_ == 0 ? 0 : min_; }
+        std::uint64_t Max() const { return max_; }
+
+        // the smallest value that at least `percentile` percent of the recorded values are at or below, to bucket precision (the
+        // bucket's upper end, but never above Max()).
+        std::uint64_t Percentile(double percentile) const{
+            if (count_ == 0){ return 0; }
+            double wanted = percentile / 100.0 * static_cast<double>(count_);
+            std::uint64_t seen = 0;
+            for (std::size_t i = 0; i < kBuckets; ++i){
+                seen += counts_[i];
+                if (counts_[i] != 0 && static_cast<double>(seen) >= wanted){
+                    std::uint64_t upper = HistogramBuckets::UpperOf(i);
+                    return upper < max_ ? upper : max_;
+                }
+            }
+            return max_;
+        }
+
+        // fn(lower, upper, count) for every bucket that has values, smallest first.
+        template <typename Fn>
+        void ForEachBucket(Fn&& fn) const{
+            for (std::size_t i = 0; i < kBuckets; ++i){
+                if (counts_[i] != 0){ fn(HistogramBuckets::LowerOf(i), HistogramBuckets::UpperOf(i), counts_[i]); }
+            }
+        }
+
+        // adds other's values to this one (for histograms kept per thread and merged at the end).
+        void Add(const LatencyHistogram& other){
+            for (std::size_t i = 0; i < kBuckets; ++i){ counts_[i] += other.counts_[i]; }
+            count_ += other.count_;
+            if (other.min_ < min_){ min_ = other.min_; }
+            if (other.max_ > max_){ max_ = other.max_; }
+        }
+
+        void Reset(){
+            counts_.fill(0);
+            count_ = 0;
+            min_ = UINT64_MAX;
+            max_ = 0;
+        }
+
+    private:
+        static constexpr std::size_t kBuckets = HistogramBuckets::kCount;
+
+        std::array<std::uint64_t, kBuckets> counts_{};
+        std::uint64_t count_ = 0;
+        std::uint64_t min_ = UINT64_MAX;
+        std::uint64_t max_ = 0;
+};
@@ -0,0 +1,603 @@
+#pragma once
+
+// Write-ahead journal (see --journal).
+//
+// Every shard appends the commands that change its books (orders, cancels, modifies, resets) to its own journal before applying them,
+// so the books can be rebuilt after the engine is killed. A journal is a series of segment files <name>-00000001.wal, ... in one
+// directory. Each segment is preallocated and mapped, so an append is a memcpy into the page cache: no write() syscall per order, and a
+// crash of the process alone loses nothing (the kernel still has the pages).
+//
+// Surviving a machine crash needs the pages on disk, which is what SyncMode is about:
+//   None     never sync; the kernel writes the pages back whenever it likes.
+//   Group    a flusher thread syncs everything appended so far, at most once per group interval, and only then releases the replies of
+//            the commands it covered. Under load one sync covers hundreds of orders instead of paying for one each.
+//   Message  sync before every reply. Slowest, but nothing is acknowledged before it is on disk.
+//
+// Segment layout: a SegmentHeader in the first kRecordsOffset bytes, then records, each a RecordHeader followed by the payload and
+// padded to kRecordAlign. Sequence numbers start at 1 and go up by one across all segments of a journal, and the file is zero past the
+// last record, so a zero sequence marks the end. The CRC (CRC32C) covers the whole record except the crc_ field itself. A reader stops
+// at the first record that is torn, corrupt or out of sequence, and the writer carries on from there.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Sequencer.h" // Completion
+
+#if defined(__SSE4_2__)
+#include <nmmintrin.h>
+#endif
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace journal{
+
+// what the engine puts in its journal (kind_): a Command record holds one binary protocol message (Protocol.h: NewOrder, Cancel or
+// Modify), a Reset record holds the name of the book it cleared, or nothing if it cleared them all.
+enum class RecordKind : std::uint8_t{
+    Command = 1,
+    Reset = 2
+};
+
+enum class SyncMode{
+    None,
+    Group,
+    Message
+};
+
+inline bool ParseSyncMode(std::string_view text, SyncMode& mode){
+    if (text == "none"){ mode = SyncMode::None; }
+    else if (text == "group"){ mode = SyncMode::Group; }
+    else if (text == "message"){ mode = SyncMode::Message; }
+    else{ return false; }
+    return true;
+}
+
+constexpr std::uint64_t kSegmentMagic = 0x4C4E524A4B4F4F42; // "BOOKJRNL"
+constexpr std::uint32_t kSegmentVersion = 1;
+constexpr std::size_t kRecordsOffset = 64;
+constexpr std::size_t kRecordAlign = 8;
+
+struct SegmentHeader{
+    std::uint64_t magic_;          // written last, so a segment that was only half set up doesn't count
+    std::uint32_t version_;
+    std::uint32_t reserved_;
+    std::uint64_t firstSequence_;  // sequence number of the first record in this segment
+};
+
+// kind_ is up to the caller (the journal only stores it).
+struct RecordHeader{
+    std::uint32_t length_;         // payload bytes (may be 0), without the header and the padding
+    std::uint32_t crc_;
+    std::uint64_t sequence_;
+    std::uint8_t kind_;
+    std::uint8_t reserved_[7];
+};
+
+static_assert(sizeof(SegmentHeader) <= kRecordsOffset && sizeof(RecordHeader) == 24);
+
+namespace detail{
+
+// CRC32C (Castagnoli), slicing-by-8 when the CPU has no crc32 instruction (or we weren't built with -msse4.2).
+constexpr std::array<std::array<std::uint32_t, 256>, 8> MakeCrcTables(){
+    std::array<std::array<std::uint32_t, 256>, 8> tables{};
+    for (std::uint32_t i = 0; i < 256; ++i){
+        std::uint32_t crc = i;
+        for (int bit = 0; bit < 8; ++bit){
+            crc = (crc >> 1) ^ (0x82F63B78u & (0u - (crc & 1u)));
+        }
+        tables[0][i] = crc;
+    }
+    for (std::uint32_t i = 0; i < 256; ++i){
+        for (std::size_t t = 1; t < 8; ++t){
+            tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xFF];
+        }
+    }
+    return tables;
+}
+
+inline constexpr auto kCrcTables = MakeCrcTables();
+
+} // namespace detail
+
+// crc of data, continuing from a previous crc (0 to start).
+inline std::uint32_t Crc32c(std::uint32_t crc, const void* data, std::size_t size){
+    const auto* bytes = static_cast<const unsigned char*>(data);
+    crc = ~crc;
+#if defined(__SSE4_2__)
+    std::uint64_t crc64 = crc;
+    for (; size >= 8; bytes += 8, size -= 8){
+        std::uint64_t word;
+        std::memcpy(&word, bytes, 8);
+        crc64 = _mm_crc32_u64(crc64, word);
+    }
+    crc = static_cast<std::uint32_t>(crc64);
+    for (; size > 0; ++bytes, --size){
+        crc = _mm_crc32_u8(crc, *bytes);
+    }
+#else
+    const auto& t = detail::kCrcTables;
+    for (; size >= 8; bytes += 8, size -= 8){
+        std::uint64_t word;
+        std::memcpy(&word, bytes, 8);
+        word ^= crc;
+        crc = t[7][word & 0xFF] ^ t[6][(word >> 8) & 0xFF] ^ t[5][(word >> 16) & 0xFF] ^ t[4][(word >> 24) & 0xFF] ^
+              t[3][(word >> 32) & 0xFF] ^ t[2][(word >> 40) & 0xFF] ^ t[1][(word >> 48) & 0xFF] ^ t[0][word >> 56];
+    }
+    for (; size > 0; ++bytes, --size){
+        crc = (crc >> 8) ^ t[0][(crc ^ *bytes) & 0xFF];
+    }
+#endif
+    return ~crc;
+}
+
+inline std::uint32_t RecordCrc(const RecordHeader& header, const void* payload){
+    std::uint32_t crc = Crc32c(0, &header.length_, sizeof(header.length_));
+    crc = Crc32c(crc, &header.sequence_, sizeof(header) - offsetof(RecordHeader, sequence_));
+    return Crc32c(crc, payload, header.length_);
+}
+
+constexpr std::size_t RecordSize(std::size_t payload){
+    return (sizeof(RecordHeader) + payload + kRecordAlign - 1) & ~(kRecordAlign - 1);
+}
+
+// Walks the records of one segment, calling visit(sequence, kind, payload) for each, with nextSequence the number the first one must
+// have. Stops at the end, or at the first record that is torn, corrupt or out of sequence. Returns the offset just past the last good
+// record (where a writer carries on) and leaves nextSequence at the number the next record gets.
+template <typename Visitor>
+std::size_t ScanSegment(const char* memory, std::size_t size, std::uint64_t& nextSequence, Visitor&& visit){
+    std::size_t offset = kRecordsOffset;
+    while (size - offset >= sizeof(RecordHeader)){
+        RecordHeader header;
+        std::memcpy(&header, memory + offset, sizeof(header));
+        if (header.sequence_ != nextSequence || RecordSize(header.length_) > size - offset){ break; }
+        const char* payload = memory + offset + sizeof(header);
+        if (RecordCrc(header, payload) != header.crc_){ break; }
+        visit(header.sequence_, header.kind_, std::string_view(payload, header.length_));
+        offset += RecordSize(header.length_);
+        ++nextSequence;
+    }
+    return offset;
+}
+
+inline std::string SegmentPath(const std::string& directory, const std::string& name, std::uint64_t index){
+    return std::format("{}/{}-{:08}.wal", directory, name, index);
+}
+
+// indexes of the segments of a journal that exist in directory, oldest first.
+inline std::vector<std::uint64_t> ListSegments(const std::string& directory, const std::string& name){
+    std::vector<std::uint64_t> indexes;
+    std::error_code ec;
+    std::string prefix = name + "-";
+    for (const auto& entry : std::filesystem::directory_iterator(directory, ec)){
+        std::string file = entry.path().filename().string();
+        if (!file.starts_with(prefix) || !file.ends_with(".wal")){ continue; }
+        std::string digits = file.substr(prefix.size(), file.size() - prefix.size() - 4);
+        if (digits.empty() || !std::all_of(digits.begin(), digits.end(), [](char c){ return c >= '0' && c <= '9'; })){ continue; }
+        indexes.push_back(std::stoull(digits));
+    }
+    std::sort(indexes.begin(), indexes.end());
+    return indexes;
+}
+
+// names of the journals that have segments in directory (shard-0, shard-1, ...), sorted.
+inline std::vector<std::string> ListJournals(const std::string& directory){
+    std::vector<std::string> names;
+    std::error_code ec;
+    for (const auto& entry : std::filesystem::directory_iterator(directory, ec)){
+        std::string file = entry.path().filename().string();
+        std::size_t dash = file.rfind('-');
+        if (dash == std::string::npos || dash == 0 || !file.ends_with(".wal")){ continue; }
+        std::string digits = file.substr(dash + 1, file.size() - dash - 5);
+        if (digits.empty() || !std::all_of(digits.begin(), digits.end(), [](char c){ return c >= '0' && c <= '9'; })){ continue; }
+        names.push_back(file.substr(0, dash));
+    }
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    return names;
+}
+
+struct Options{
+    std::string directory_;
+    std::string name_;
+    std::size_t segmentSize_ = 64 << 20;
+    SyncMode mode_ = SyncMode::Group;
+    std::chrono::microseconds groupInterval_{200};
+    std::uint64_t firstSequence_ = 1; // where a journal with no segments yet starts (after the snapshot it was restored from)
+};
+
+#if !defined(_WIN32)
+// the firstSequence_ of a segment file, 0 if it doesn't have a valid header.
+inline std::uint64_t ReadFirstSequence(const std::string& path){
+    SegmentHeader header{};
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0){ return 0; }
+    bool ok = ::pread(fd, &header, sizeof(header), 0) == static_cast<ssize_t>(sizeof(header));
+    ::close(fd);
+    return ok && header.magic_ == kSegmentMagic && header.version_ == kSegmentVersion ? header.firstSequence_ : 0;
+}
+
+// Reads a journal back: calls visit(sequence, kind, payload) for every record after the given sequence number, in order, skipping
+// the segments that hold nothing newer. Stops at the first gap, torn or corrupt record. Returns the last sequence number it got to
+// (after, if there was nothing newer). Run it before a Journal is opened on the same files.
+template <typename Visitor>
+std::uint64_t Replay(const std::string& directory, const std::string& name, std::uint64_t after, Visitor&& visit){
+    std::vector<std::uint64_t> segments = ListSegments(directory, name);
+    std::vector<std::uint64_t> firsts;
+    for (std::uint64_t index : segments){ firsts.push_back(ReadFirstSequence(SegmentPath(directory, name, index))); }
+
+    std::uint64_t last = after;
+    std::uint64_t expected = 0;
+    for (std::size_t i = 0; i < segments.size(); ++i){
+        // every record in this one is older than the next segment's first
+        if (i + 1 < segments.size() && firsts[i + 1] != 0 && firsts[i + 1] <= after + 1){ continue; }
+        // a segment that is missing (or doesn't follow on) means records are lost; replaying past that would build the wrong books
+        if (firsts[i] == 0 || (expected == 0 ? firsts[i] > after + 1 : firsts[i] != expected)){ break; }
+
+        std::string path = SegmentPath(directory, name, segments[i]);
+        int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0){ break; }
+        struct stat info;
+        void* memory = ::fstat(fd, &info) == 0 ? ::mmap(nullptr, static_cast<std::size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        ::close(fd);
+        if (memory == MAP_FAILED){ break; }
+        ::madvise(memory, static_cast<std::size_t>(info.st_size), MADV_SEQUENTIAL);
+
+        expected = firsts[i];
+        ScanSegment(static_cast<const char*>(memory), static_cast<std::size_t>(info.st_size), expected,
+            [&](std::uint64_t sequence, std::uint8_t kind, std::string_view payload){
+                if (sequence <= after){ return; }
+                visit(sequence, kind, payload);
+                last = sequence;
+            });
+        ::munmap(memory, static_cast<std::size_t>(info.st_size));
+    }
+    return last;
+}
+
+// Deletes the segments whose records are all covered by a snapshot up to sequence. Never the newest one (the writer has it open).
+inline void RemoveCovered(const std::string& directory, const std::string& name, std::uint64_t sequence){
+    std::vector<std::uint64_t> segments = ListSegments(directory, name);
+    for (std::size_t i = 0; i + 1 < segments.size(); ++i){
+        std::uint64_t nextFirst = ReadFirstSequence(SegmentPath(directory, name, segments[i + 1]));
+        if (nextFirst == 0 || nextFirst > sequence + 1){ break; }
+        std::error_code ec;
+        std::filesystem::remove(SegmentPath(directory, name, segments[i]), ec);
+    }
+}
+
+// One journal, written by one thread (the shard's sequencer); only the group-commit flusher runs beside it.
+class Journal{
+    public:
+        Journal() = default;
+        Journal(const Journal&) = delete;
+        Journal& operator=(const Journal&) = delete;
+        ~Journal() { Close(); }
+
+        // opens the journal (creating the directory and the first segment if needed) and carries on after its last good record.
+        bool Open(Options options){
+            options_ = std::move(options);
+            pageSize_ = static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+            std::error_code ec;
+            std::filesystem::create_directories(options_.directory_, ec);
+
+            // the newest segment with a valid header is where we carry on. Newer ones never got set up properly and hold nothing.
+            std::vector<std::uint64_t> segments = ListSegments(options_.directory_, options_.name_);
+            while (!segments.empty()){
+                if (MapSegment(segments.back(), false, 0)){ break; }
+                std::filesystem::remove(SegmentPath(options_.directory_, options_.name_, segments.back()), ec);
+                segments.pop_back();
+            }
+            bool fresh = memory_ == nullptr;
+            if (fresh && !MapSegment(1, true, options_.firstSequence_)){ return false; }
+
+            const auto* header = reinterpret_cast<const SegmentHeader*>(memory_);
+            nextSequence_ = header->firstSequence_;
+            end_ = ScanSegment(memory_, size_, nextSequence_, [](std::uint64_t, std::uint8_t, std::string_view){});
+            lastAppended_ = nextSequence_ - 1;
+
+            // whatever is past the last good record (a torn write, or records written after it that made it to disk while it didn't)
+            // must never line up with the records we are about to write.
+            if (!fresh && std::any_of(memory_ + end_, memory_ + size_, [](char c){ return c != 0; })){
+                std::memset(memory_ + end_, 0, size_ - end_);
+            }
+            // the snapshot we recovered from can be newer than the journal on disk (group or none mode, and the machine went down before
+            // the journal's last records were synced while the snapshot's were). Carrying on from the journal would hand out sequence
+            // numbers the snapshot already covers, and the next recovery would skip those records, so start a segment of our own there.
+            if (!fresh && nextSequence_ < options_.firstSequence_){
+                nextSequence_ = options_.firstSequence_;
+                lastAppended_ = nextSequence_ - 1;
+                try{
+                    Roll(0);
+                }catch (const std::exception&){
+                    return false;
+                }
+            }
+            syncedEnd_ = end_;
+            appendedEnd_.store(end_);
+            appendedSequence_.store(lastAppended_);
+            durable_.store(lastAppended_);
+
+            if (options_.mode_ == SyncMode::Group){
+                stopping_ = false;
+                flusher_ = std::thread([this]{ FlushLoop(); });
+            }
+            return true;
+        }
+
+        // syncs whatever is left (unless SyncMode::None), releases every reply still waiting, and unmaps the segment.
+        void Close(){
+            if (flusher_.joinable()){
+                {
+                    std::lock_guard<std::mutex> lock(ackMu_);
+                    stopping_ = true;
+                }
+                ackCv_.notify_one();
+                flusher_.join();
+            }
+            if (memory_ == nullptr){ return; }
+            std::lock_guard<std::mutex> lock(syncMu_);
+            if (options_.mode_ != SyncMode::None){ SyncRange(syncedEnd_, end_); }
+            durable_.store(lastAppended_, std::memory_order_release);
+            Release(lastAppended_);
+            ::munmap(memory_, size_);
+            memory_ = nullptr;
+        }
+
+        // writer thread only. Returns the record's sequence number; throws if a new segment can't be created (disk full and the like).
+        std::uint64_t Append(std::uint8_t kind, const void* payload, std::size_t size){
+            std::size_t recordSize = RecordSize(size);
+            if (recordSize > size_ - end_){ Roll(recordSize); }
+
+            RecordHeader header{};
+            header.length_ = static_cast<std::uint32_t>(size);
+            header.sequence_ = nextSequence_;
+            header.kind_ = kind;
+            header.crc_ = RecordCrc(header, payload);
+            std::memcpy(memory_ + end_ + sizeof(header), payload, size);
+            std::memcpy(memory_ + end_, &header, sizeof(header));
+
+            end_ += recordSize;
+            lastAppended_ = nextSequence_++;
+            // end first: the flusher reads the sequence first, so the range it syncs always covers that record.
+            appendedEnd_.store(end_, std::memory_order_release);
+            appendedSequence_.store(lastAppended_, std::memory_order_release);
+            return lastAppended_;
+        }
+
+        // writer thread only, once per command: in SyncMode::Message, syncs what the command appended (throws if that fails).
+        void Commit(){
+            if (options_.mode_ != SyncMode::Message || lastAppended_ <= durable_.load(std::memory_order_relaxed)){ return; }
+            SyncRange(syncedEnd_, end_);
+            syncedEnd_ = end_;
+            durable_.store(lastAppended_, std::memory_order_release);
+        }
+
+        // writer thread only: signals the completion once everything appended so far is as durable as the mode asks for (in Group mode
+        // that is after the flusher's next sync). Replies go out in the order they were acknowledged.
+        void Acknowledge(Completion& completion){
+            if (options_.mode_ != SyncMode::Group || lastAppended_ <= durable_.load(std::memory_order_acquire)){
+                completion.Signal();
+                return;
+            }
+            bool wasEmpty;
+            {
+                std::lock_guard<std::mutex> lock(ackMu_);
+                wasEmpty = acks_.empty();
+                acks_.emplace_back(lastAppended_, &completion);
+            }
+            if (wasEmpty){ ackCv_.notify_one(); }
+        }
+
+        std::uint64_t LastSequence() const { return lastAppended_; }
+        const Options& GetOptions() const { return options_; }
+
+    private:
+        // maps segment index; create makes a fresh one starting at firstSequence.
+        bool MapSegment(std::uint64_t index, bool create, std::uint64_t firstSequence){
+            std::string path = SegmentPath(options_.directory_, options_.name_, index);
+            int fd = ::open(path.c_str(), O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_EXCL : 0), 0644);
+            if (fd < 0){ return false; }
+
+            std::size_t size = options_.segmentSize_;
+            if (create){
+#if defined(__linux__)
+                bool allocated = ::posix_fallocate(fd, 0, static_cast<off_t>(size)) == 0;
+#else
+                bool allocated = ::ftruncate(fd, static_cast<off_t>(size)) == 0;
+#endif
+                if (!allocated){
+                    ::close(fd);
+                    ::unlink(path.c_str());
+                    return false;
+                }
+            }else{
+                struct stat info;
+                if (::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < kRecordsOffset){
+                    ::close(fd);
+                    return false;
+                }
+                size = static_cast<std::size_t>(info.st_size);
+            }
+
+            void* memory = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (memory == MAP_FAILED){ return false; }
+
+            auto* header = static_cast<SegmentHeader*>(memory);
+            if (create){
+                header->version_ = kSegmentVersion;
+                header->firstSequence_ = firstSequence;
+                header->magic_ = kSegmentMagic;
+                if (options_.mode_ != SyncMode::None){
+                    ::msync(memory, pageSize_, MS_SYNC);
+                    SyncDirectory();
+                }
+            }else if (header->magic_ != kSegmentMagic || header->version_ != kSegmentVersion){
+                ::munmap(memory, size);
+                return false;
+            }
+
+            memory_ = static_cast<char*>(memory);
+            size_ = size;
+            index_ = index;
+            return true;
+        }
+
+        // moves on to a new segment. Everything in the old one is synced first (unless SyncMode::None), so the flusher never has to
+        // look at a segment that is no longer mapped.
+        void Roll(std::size_t recordSize){
+            if (recordSize > options_.segmentSize_ - kRecordsOffset){
+                throw std::length_error(std::format("journal record of {} bytes doesn't fit in a segment", recordSize));
+            }
+            std::lock_guard<std::mutex> lock(syncMu_);
+            if (options_.mode_ != SyncMode::None){ SyncRange(syncedEnd_, end_); }
+
+            char* old = memory_;
+            std::size_t oldSize = size_;
+            memory_ = nullptr;
+            if (!MapSegment(index_ + 1, true, nextSequence_)){
+                memory_ = old;
+                throw std::runtime_error(std::format("could not create journal segment {}",
+                    SegmentPath(options_.directory_, options_.name_, index_ + 1)));
+            }
+            ::munmap(old, oldSize);
+
+            end_ = kRecordsOffset;
+            syncedEnd_ = end_;
+            appendedEnd_.store(end_, std::memory_order_release);
+            durable_.store(lastAppended_, std::memory_order_release);
+            Release(lastAppended_);
+        }
+
+        // msync wants a page-aligned start.
+        void SyncRange(std::size_t from, std::size_t to){
+            if (to <= from){ return; }
+            std::size_t start = from & ~(pageSize_ - 1);
+            if (::msync(memory_ + start, to - start, MS_SYNC) != 0){
+                throw std::runtime_error("journal msync failed");
+            }
+        }
+
+        // a newly created segment file is only there for sure once its directory entry is.
+        void SyncDirectory(){
+            int fd = ::open(options_.directory_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd >= 0){
+                ::fsync(fd);
+                ::close(fd);
+            }
+        }
+
+        // Group mode. Sleeps until a reply is waiting, then syncs everything appended so far (not just up to that reply), at most once
+        // per group interval. Whatever arrives while a sync runs goes into the next one.
+        void FlushLoop(){
+            auto lastSync = std::chrono::steady_clock::now() - options_.groupInterval_;
+            std::unique_lock<std::mutex> lock(ackMu_);
+            while (true){
+                ackCv_.wait(lock, [this]{ return stopping_ || !acks_.empty(); });
+                if (stopping_){ break; }
+                lock.unlock();
+
+                std::this_thread::sleep_until(lastSync + options_.groupInterval_);
+                lastSync = std::chrono::steady_clock::now();
+                std::uint64_t durable;
+                {
+                    std::lock_guard<std::mutex> syncLock(syncMu_);
+                    std::uint64_t sequence = appendedSequence_.load(std::memory_order_acquire);
+                    std::size_t end = appendedEnd_.load(std::memory_order_acquire);
+                    durable = durable_.load(std::memory_order_relaxed);
+                    if (sequence > durable){
+                        try{
+                            SyncRange(syncedEnd_, end);
+                        }catch (const std::exception&){
+                            // the pages are still in the page cache; try again next round rather than lying about them
+                            lock.lock();
+                            continue;
+                        }
+                        syncedEnd_ = end;
+                        durable = sequence;
+                        durable_.store(durable, std::memory_order_release);
+                    }
+                }
+                Release(durable);
+                lock.lock();
+            }
+        }
+
+        // signals every waiting reply whose commands are covered by durable.
+        void Release(std::uint64_t durable){
+            std::lock_guard<std::mutex> lock(ackMu_);
+            while (!acks_.empty() && acks_.front().first <= durable){
+                acks_.front().second->Signal();
+                acks_.pop_front();
+            }
+        }
+
+        Options options_;
+        std::size_t pageSize_ = 4096;
+
+        // writer thread (memory_ and size_ only change under syncMu_, the flusher reads them under it)
+        char* memory_ = nullptr;
+        std::size_t size_ = 0;
+        std::uint64_t index_ = 0;
+        std::size_t end_ = kRecordsOffset;
+        std::uint64_t nextSequence_ = 1;
+        std::uint64_t lastAppended_ = 0;
+
+        // what the flusher may sync, published by Append
+        std::atomic<std::size_t> appendedEnd_{kRecordsOffset};
+        std::atomic<std::uint64_t> appendedSequence_{0};
+        std::atomic<std::uint64_t> durable_{0};
+
+        std::mutex syncMu_;         // held around every msync and around Roll
+        std::size_t syncedEnd_ = kRecordsOffset;
+
+        std::mutex ackMu_;
+        std::condition_variable ackCv_;
+        std::deque<std::pair<std::uint64_t, Completion*>> acks_; // (last sequence the reply depends on, reply), in sequence order
+        bool stopping_ = false;
+        std::thread flusher_;
+};
+#else
+// Windows has no mmap/msync; --journal says so and the engine runs without one.
+template <typename Visitor>
+std::uint64_t Replay(const std::string&, const std::string&, std::uint64_t after, Visitor&&){ return after; }
+
+inline void RemoveCovered(const std::string&, const std::string&, std::uint64_t){}
+
+class Journal{
+    public:
+        bool Open(Options){ return false; }
+        void Close(){}
+        void Commit(){}
+        std::uint64_t Append(std::uint8_t, const void*, std::size_t){ throw std::runtime_error("the journal needs a POSIX system"); }
+        void Acknowledge(Completion& completion){ completion.Signal(); }
+        std::uint64_t LastSequence() const { return 0; }
+        const Options& GetOptions() const { return options_; }
+
+    private:
+        Options options_;
+};
+#endif
+
+} // namespace journal
@@ -0,0 +1,667 @@
+// Load generator for a running engine: /trade and /cancel, /batch, or the binary order-entry port, over many connections, either as fast
+// as the engine answers (closed loop) or at a fixed arrival rate (open loop), with latency percentiles corrected for coordinated omission.
+//
+// Build (next to the engine):  g++ -std=c++23 -O2 LoadGen.cpp -pthread -o loadgen
+// Usage: loadgen [--host=HOST] [--port=N] [--unix-socket=PATH] [--mode=http|batch|binary] [--binary-port=N] [--connections=N] [--rate=R]
+//                [--duration=S] [--warmup=S] [--books=N] [--batch-size=N] [--cancel=R] [--aggressive=R] [--levels=N]
+//                [--prices=uniform|touch|zipf] [--drift=T] [--id-base=N] [--seed=N]
+//
+// Modes:
+//   http    every order is a request: POST /trade for new orders, POST /cancel for cancels, form encoded (what the Go gateway sends).
+//           --unix-socket sends them to an engine started with --unix-socket instead of host:port.
+//   batch   every request is a POST /batch of --batch-size orders in the binary batch format (a batch has no cancels, so --cancel is
+//           ignored).
+//   binary  NewOrder and Cancel messages (Protocol.h) on the engine's --binary-port.
+//
+// Every connection has a thread of its own and one request in flight. With --rate=0 (the default) each connection sends its next request
+// as soon as the last one is answered: the closed loop, which finds the engine's throughput but hides queueing, because when the engine
+// stalls the load stops too. With --rate=R the connections share R requests/s on a fixed schedule: the open loop. A request's latency then
+// counts from when the schedule said to send it, not from when its connection got round to it, so a stall shows up in every request that
+// should have gone out during it (the coordinated omission correction); the service time, from the actual send, is printed next to it.
+// A connection that falls behind sends its backlog back to back, still sending everything that was due before the end (only the
+// scheduling of new requests stops there), and the achieved rate is taken over however long that took.
+//
+// The order flow (per connection, from --seed):
+//   new order   a passive GTC order on a random side, at one of --levels price levels from the mid (spread as --prices says, like bench),
+//               1-100 shares.
+//   aggressive  an --aggressive share of fillandkill orders that cross the mid, as deep as --prices says.
+//   cancel      a --cancel share of cancels of a random order this connection left resting. It may have been filled since; that is
+//               counted as a miss, not an error.
+// The mid is a random walk every connection follows (--drift ticks per second, one standard deviation), so the book moves, and orders
+// left behind on the wrong side of it get taken out. The orders are spread over --books books, LG0, LG1, ...
+// Order ids are --id-base + n * connections + connection, dense so they suit --id-index=direct too. The default base comes from the clock,
+// so runs against the same engine don't reuse each other's ids.
+
+#include "httplib.h"
+#include "Protocol.h"
+#include "Histogram.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+enum class Mode : uint8_t {
+    Http,
+    Batch,
+    Binary
+};
+
+enum class PriceShape : uint8_t {
+    Uniform,
+    Touch,
+    Zipf
+};
+
+// what a request was, for the report.
+enum class Kind : uint8_t {
+    NewOrder,
+    Aggressive,
+    Cancel,
+    Batch
+};
+constexpr size_t kKinds = 4;
+constexpr std::array<std::string_view, kKinds> kKindNames = { "new order", "aggressive", "cancel", "batch" };
+
+enum class Outcome : uint8_t {
+    Ok,
+    Miss,   // a cancel of an order that was already gone
+    Error
+};
+
+struct Options {
+    Mode mode_ = Mode::Http;
+    std::string host_ = "localhost";
+    int port_ = 6060;
+    std::string unixSocket_;
+    int binaryPort_ = 0;
+    size_t connections_ = 8;
+    double rate_ = 0;
+    double duration_ = 10;
+    double warmup_ = 1;
+    size_t books_ = 1;
+    size_t batchSize_ = 1000;
+    double cancel_ = 0.3;
+    double aggressive_ = 0.1;
+    size_t levels_ = 100;
+    PriceShape prices_ = PriceShape::Touch;
+    double drift_ = 5;
+    uint64_t idBase_ = 0;
+    uint64_t seed_ = 42;
+};
+
+struct Order {
+    Kind kind_;
+    uint16_t book_;
+    bool buy_;
+    uint64_t id_;
+    int32_t price_;
+    uint32_t quantity_;
+};
+
+std::string BookName(size_t book) {
+    return std::format("LG{}", book);
+}
+
+constexpr double kBaseMid = 100000;
+
+// the mid for every millisecond of the run, in ticks. One random walk, worked out up front, that every connection reads, so they all
+// agree on where the market is.
+class MidPath {
+    public:
+        MidPath(double driftPerSecond, double seconds, uint64_t seed) {
+            std::mt19937_64 rng(seed ^ 0x9e3779b97f4a7c15ULL);
+            std::normal_distribution<double> step(0.0, driftPerSecond / std::sqrt(1000.0));
+            mids_.resize(static_cast<size_t>(seconds * 1000) + 1);
+            double mid = kBaseMid;
+            for (double& value : mids_) {
+                value = mid;
+                mid = std::max(1000.0, mid + step(rng));
+            }
+        }
+
+        double At(Clock::duration sinceStart) const {
+            auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(sinceStart).count();
+            return mids_[static_cast<size_t>(std::clamp<int64_t>(ms, 0, static_cast<int64_t>(mids_.size()) - 1))];
+        }
+
+    private:
+        std::vector<double> mids_;
+};
+
+// One connection's orders. A level is a distance from the mid in ticks: a passive bid at mid - 1 - level, an ask at mid + 1 + level, an
+// aggressive buy at mid + level and an aggressive sell at mid - level.
+class OrderFlow {
+    public:
+        OrderFlow(const Options& options, const MidPath& mids, size_t connection):
+            options_(options), mids_(mids), rng_(options.seed_ * 1000003 + connection), nextId_(options.idBase_ + connection) {
+            std::vector<double> weights(options.levels_);
+            for (size_t level = 0; level < weights.size(); ++level) {
+                switch (options.prices_) {
+                    case PriceShape::Uniform: weights[level] = 1.0; break;
+                    case PriceShape::Touch: weights[level] = std::exp(-static_cast<double>(level) / std::max(1.0, options.levels_ / 10.0)); break;
+                    case PriceShape::Zipf: weights[level] = 1.0 / std::pow(static_cast<double>(level + 1), 1.1); break;
+                }
+            }
+            levels_ = std::discrete_distribution<size_t>(weights.begin(), weights.end());
+        }
+
+        Order Next(Clock::duration sinceStart, bool allowCancel) {
+            double kind = unit_(rng_);
+            if (allowCancel && kind < options_.cancel_ && !resting_.empty()) {
+                size_t pick = std::uniform_int_distribution<size_t>(0, resting_.size() - 1)(rng_);
+                Order order = resting_[pick];
+                resting_[pick] = resting_.back();
+                resting_.pop_back();
+                order.kind_ = Kind::Cancel;
+                return order;
+            }
+
+            Order order{};
+            order.kind_ = kind >= 1.0 - options_.aggressive_ ? Kind::Aggressive : Kind::NewOrder;
+            order.book_ = static_cast<uint16_t>(std::uniform_int_distribution<size_t>(0, options_.books_ - 1)(rng_));
+            order.buy_ = (rng_() & 1) != 0;
+            order.id_ = nextId_;
+            nextId_ += options_.connections_;
+            order.quantity_ = static_cast<uint32_t>(std::uniform_int_distribution<int>(1, 100)(rng_));
+
+            auto mid = static_cast<int32_t>(std::lround(mids_.At(sinceStart)));
+            auto level = static_cast<int32_t>(levels_(rng_));
+            if (order.kind_ == Kind::NewOrder) {
+                order.price_ = order.buy_ ? mid - 1 - level : mid + 1 + level;
+                // only these can be cancelled later; past kMaxTracked a new one takes a random old one's place
+                if (allowCancel) {
+                    if (resting_.size() < kMaxTracked) {
+                        resting_.push_back(order);
+                    } else {
+                        resting_[std::uniform_int_distribution<size_t>(0, kMaxTracked - 1)(rng_)] = order;
+                    }
+                }
+            } else {
+                order.price_ = order.buy_ ? mid + level : mid - level;
+            }
+            return order;
+        }
+
+    private:
+        static constexpr size_t kMaxTracked = 1 << 20;
+
+        const Options& options_;
+        const MidPath& mids_;
+        std::mt19937_64 rng_;
+        std::uniform_real_distribution<double> unit_{0.0, 1.0};
+        std::discrete_distribution<size_t> levels_;
+        std::vector<Order> resting_;
+        uint64_t nextId_;
+};
+
+// /trade, /cancel and /batch over one keep-alive HTTP connection.
+class HttpConnection {
+    public:
+        explicit HttpConnection(const Options& options):
+            client_(options.unixSocket_.empty() ? httplib::Client(options.host_, options.port_) : httplib::Client(options.unixSocket_)) {
+            if (!options.unixSocket_.empty()) {
+                client_.set_address_family(AF_UNIX);
+            }
+            client_.set_keep_alive(true);
+            // httplib writes the headers and the body separately; with Nagle on, the body waits for the engine's delayed ACK
+            client_.set_tcp_nodelay(true);
+            client_.set_read_timeout(30, 0);
+            for (size_t book = 0; book < options.books_; ++book) {
+                books_.push_back(BookName(book));
+            }
+        }
+
+        // false if the engine isn't answering (before the run starts, so a typo in the port fails fast).
+        bool Connect() {
+            auto res = client_.Get("/metrics");
+            return res && res->status == 200;
+        }
+
+        Outcome Send(const std::vector<Order>& orders) {
+            httplib::Result res;
+            if (orders.size() == 1 && orders[0].kind_ == Kind::Cancel) {
+                const Order& order = orders[0];
+                body_ = std::format("orderid={}&book={}", order.id_, books_[order.book_]);
+                res = client_.Post("/cancel", body_, "application/x-www-form-urlencoded");
+                if (res && res->status == 404) {
+                    return Outcome::Miss;
+                }
+            } else if (orders.size() == 1) {
+                const Order& order = orders[0];
+                body_ = std::format("orderid={}&tradetype={}&side={}&price={}&quantity={}&book={}", order.id_,
+                    order.kind_ == Kind::Aggressive ? "FAK" : "GTC", order.buy_ ? "BUY" : "SELL", order.price_, order.quantity_, books_[order.book_]);
+                res = client_.Post("/trade", body_, "application/x-www-form-urlencoded");
+            } else {
+                EncodeBatch(orders);
+                res = client_.Post("/batch", body_, std::string(wire::kBatchContentType));
+            }
+            return res && res->status == 200 ? Outcome::Ok : Outcome::Error;
+        }
+
+    private:
+        // BatchHeader, the book table, then the orders (Protocol.h).
+        void EncodeBatch(const std::vector<Order>& orders) {
+            body_.clear();
+            wire::BatchHeader header{};
+            header.magic_ = wire::kBatchMagic;
+            header.version_ = wire::kBatchVersion;
+            header.bookCount_ = static_cast<uint16_t>(books_.size());
+            header.orderCount_ = static_cast<uint32_t>(orders.size());
+            header.recordSize_ = sizeof(wire::BatchOrder);
+            body_.append(reinterpret_cast<const char*>(&header), sizeof(header));
+            for (const std::string& book : books_) {
+                char name[wire::kBookNameSize];
+                wire::SetBook(name, book);
+                body_.append(name, sizeof(name));
+            }
+            for (const Order& order : orders) {
+                wire::BatchOrder record{};
+                record.orderId_ = order.id_;
+                record.price_ = order.price_;
+                record.quantity_ = order.quantity_;
+                record.book_ = order.book_;
+                record.side_ = order.buy_ ? wire::WireSide::Buy : wire::WireSide::Sell;
+                record.orderType_ = order.kind_ == Kind::Aggressive ? wire::WireOrderType::FillAndKill : wire::WireOrderType::GoodTillCancel;
+                body_.append(reinterpret_cast<const char*>(&record), sizeof(record));
+            }
+        }
+
+        httplib::Client client_;
+        std::vector<std::string> books_;
+        std::string body_;
+};
+
+// NewOrder and Cancel on the binary port: write the message, then read replies until the one flagged kFlagLastInReply.
+class BinaryConnection {
+    public:
+        explicit BinaryConnection(const Options& options): options_(options) {
+            for (size_t book = 0; book < options.books_; ++book) {
+                books_.push_back(BookName(book));
+            }
+        }
+
+        BinaryConnection(const BinaryConnection&) = delete;
+        BinaryConnection& operator=(const BinaryConnection&) = delete;
+
+        ~BinaryConnection() {
+            Close();
+        }
+
+        bool Connect() {
+            Close();
+            addrinfo hints{};
+            hints.ai_family = AF_UNSPEC;
+            hints.ai_socktype = SOCK_STREAM;
+            addrinfo* addresses = nullptr;
+            if (getaddrinfo(options_.host_.c_str(), std::to_string(options_.binaryPort_).c_str(), &hints, &addresses) != 0) {
+                return false;
+            }
+            for (addrinfo* address = addresses; address != nullptr && fd_ < 0; address = address->ai_next) {
+                int fd = socket(address->ai_family, address->ai_socktype, address->ai_protocol);
+                if (fd < 0) continue;
+                if (connect(fd, address->ai_addr, address->ai_addrlen) == 0) {
+                    int one = 1;
+                    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                    fd_ = fd;
+                } else {
+                    close(fd);
+                }
+            }
+            freeaddrinfo(addresses);
+            in_.clear();
+            return fd_ >= 0;
+        }
+
+        Outcome Send(const std::vector<Order>& orders) {
+            if (fd_ < 0 && !Connect()) {
+                return Outcome::Error;
+            }
+            const Order& order = orders[0];
+            if (order.kind_ == Kind::Cancel) {
+                wire::Cancel cancel{};
+                cancel.header_ = wire::HeaderFor<wire::Cancel>(wire::MessageType::Cancel);
+                cancel.orderId_ = order.id_;
+                wire::SetBook(cancel.book_, books_[order.book_]);
+                if (!WriteAll(&cancel, sizeof(cancel))) return Fail();
+            } else {
+                wire::NewOrder message{};
+                message.header_ = wire::HeaderFor<wire::NewOrder>(wire::MessageType::NewOrder);
+                message.orderId_ = order.id_;
+                message.price_ = order.price_;
+                message.quantity_ = order.quantity_;
+                message.side_ = order.buy_ ? wire::WireSide::Buy : wire::WireSide::Sell;
+                message.orderType_ = order.kind_ == Kind::Aggressive ? wire::WireOrderType::FillAndKill : wire::WireOrderType::GoodTillCancel;
+                wire::SetBook(message.book_, books_[order.book_]);
+                if (!WriteAll(&message, sizeof(message))) return Fail();
+            }
+
+            Outcome outcome = Outcome::Ok;
+            while (true) {
+                wire::MessageHeader header;
+                if (!ReadMessage(header)) return Fail();
+                if (header.type_ == wire::MessageType::Reject && header.length_ >= sizeof(wire::Reject)) {
+                    wire::Reject reject;
+                    std::memcpy(&reject, message_.data(), sizeof(reject));
+                    // a fillandkill with nothing to match is an answer, not a failure
+                    if (reject.reason_ == wire::RejectReason::UnknownOrder) {
+                        outcome = Outcome::Miss;
+                    } else if (reject.reason_ != wire::RejectReason::NoLiquidity) {
+                        outcome = Outcome::Error;
+                    }
+                }
+                if (header.flags_ & wire::kFlagLastInReply) {
+                    return outcome;
+                }
+            }
+        }
+
+    private:
+        Outcome Fail() {
+            Close();
+            return Outcome::Error;
+        }
+
+        void Close() {
+            if (fd_ >= 0) {
+                close(fd_);
+                fd_ = -1;
+            }
+        }
+
+        bool WriteAll(const void* data, size_t size) {
+            const char* bytes = static_cast<const char*>(data);
+            while (size > 0) {
+                ssize_t written = write(fd_, bytes, size);
+                if (written <= 0) return false;
+                bytes += written;
+                size -= static_cast<size_t>(written);
+            }
+            return true;
+        }
+
+        // the next whole message into message_.
+        bool ReadMessage(wire::MessageHeader& header) {
+            while (true) {
+                if (in_.size() >= sizeof(header)) {
+                    std::memcpy(&header, in_.data(), sizeof(header));
+                    if (header.length_ < sizeof(header)) return false;
+                    if (in_.size() >= header.length_) {
+                        message_.assign(in_, 0, header.length_);
+                        in_.erase(0, header.length_);
+                        return true;
+                    }
+                }
+                char buffer[4096];
+                ssize_t got = read(fd_, buffer, sizeof(buffer));
+                if (got <= 0) return false;
+                in_.append(buffer, static_cast<size_t>(got));
+            }
+        }
+
+        const Options& options_;
+        std::vector<std::string> books_;
+        int fd_ = -1;
+        std::string in_;
+        std::string message_;
+};
+
+// what one connection saw during the measured part of the run.
+struct Stats {
+    std::array<LatencyHistogram, kKinds> latency_;  // from when the request was due (the same as service_ in a closed loop)
+    std::array<LatencyHistogram, kKinds> service_;  // from when it was actually sent
+    uint64_t requests_ = 0;
+    uint64_t orders_ = 0;
+    uint64_t misses_ = 0;
+    uint64_t errors_ = 0;
+    double seconds_ = 0;  // the measured part: --duration, or longer if the last requests due in it were answered after the end
+
+    void Add(const Stats& other) {
+        for (size_t i = 0; i < kKinds; ++i) {
+            latency_[i].Add(other.latency_[i]);
+            service_[i].Add(other.service_[i]);
+        }
+        requests_ += other.requests_;
+        orders_ += other.orders_;
+        misses_ += other.misses_;
+        errors_ += other.errors_;
+        seconds_ = std::max(seconds_, other.seconds_);
+    }
+};
+
+struct Schedule {
+    Clock::time_point start_;
+    Clock::time_point measureFrom_;   // after the warmup
+    Clock::time_point end_;
+};
+
+template <typename Connection>
+void RunConnection(const Options& options, const Schedule& schedule, size_t index, Connection& connection, OrderFlow& flow, Stats& stats) {
+    bool openLoop = options.rate_ > 0;
+    // connection i sends requests i, i + connections, i + 2 * connections, ... of a schedule of rate_ requests/s
+    double interval = openLoop ? 1e9 / options.rate_ : 0;
+    std::vector<Order> orders;
+    Clock::time_point lastDone = schedule.measureFrom_;
+    std::this_thread::sleep_until(schedule.start_);
+    for (uint64_t n = 0;; ++n) {
+        Clock::time_point due;
+        if (openLoop) {
+            due = schedule.start_ + std::chrono::nanoseconds(static_cast<int64_t>(interval * static_cast<double>(n * options.connections_ + index)));
+            // a connection that is behind still works off its backlog: every request due before the end is sent, however late
+            if (due >= schedule.end_) break;
+            std::this_thread::sleep_until(due);
+        } else {
+            due = Clock::now();
+            if (due >= schedule.end_) break;
+        }
+
+        orders.clear();
+        size_t count = options.mode_ == Mode::Batch ? options.batchSize_ : 1;
+        for (size_t i = 0; i < count; ++i) {
+            orders.push_back(flow.Next(due - schedule.start_, options.mode_ != Mode::Batch));
+        }
+
+        Clock::time_point sent = Clock::now();
+        Outcome outcome = connection.Send(orders);
+        Clock::time_point done = Clock::now();
+
+        if (due < schedule.measureFrom_) continue;
+        Kind kind = options.mode_ == Mode::Batch ? Kind::Batch : orders[0].kind_;
+        stats.latency_[static_cast<size_t>(kind)].Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(done - due).count()));
+        stats.service_[static_cast<size_t>(kind)].Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(done - sent).count()));
+        ++stats.requests_;
+        stats.orders_ += orders.size();
+        if (outcome == Outcome::Miss) ++stats.misses_;
+        if (outcome == Outcome::Error) ++stats.errors_;
+        lastDone = done;
+    }
+    stats.seconds_ = std::max(options.duration_, std::chrono::duration<double>(lastDone - schedule.measureFrom_).count());
+}
+
+template <typename Connection>
+bool Run(const Options& options, std::vector<Stats>& stats) {
+    MidPath mids(options.drift_, options.warmup_ + options.duration_ + 60, options.seed_);
+    std::vector<std::unique_ptr<Connection>> connections;
+    std::vector<std::unique_ptr<OrderFlow>> flows;
+    for (size_t i = 0; i < options.connections_; ++i) {
+        connections.push_back(std::make_unique<Connection>(options));
+        if (!connections.back()->Connect()) {
+            std::cerr << std::format("Could not reach the engine ({})\n", options.mode_ == Mode::Binary
+                ? std::format("{}:{}", options.host_, options.binaryPort_)
+                : options.unixSocket_.empty() ? std::format("{}:{}", options.host_, options.port_) : options.unixSocket_);
+            return false;
+        }
+        flows.push_back(std::make_unique<OrderFlow>(options, mids, i));
+    }
+
+    // everyone starts together, a moment from now so the threads are all up
+    Schedule schedule;
+    schedule.start_ = Clock::now() + std::chrono::milliseconds(50);
+    schedule.measureFrom_ = schedule.start_ + std::chrono::nanoseconds(static_cast<int64_t>(options.warmup_ * 1e9));
+    schedule.end_ = schedule.measureFrom_ + std::chrono::nanoseconds(static_cast<int64_t>(options.duration_ * 1e9));
+
+    stats.assign(options.connections_, Stats{});
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i < options.connections_; ++i) {
+        threads.emplace_back([&, i] { RunConnection(options, schedule, i, *connections[i], *flows[i], stats[i]); });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+    return true;
+}
+
+void PrintTable(std::string_view title, const std::array<LatencyHistogram, kKinds>& histograms) {
+    std::cout << title << "\n";
+    std::cout << std::format("  {:<12} {:>10} {:>9} {:>9} {:>9} {:>9} {:>9} {:>9}\n", "request", "count", "p50", "p90", "p99", "p99.9", "p99.99", "max");
+    auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    auto row = [&](std::string_view name, const LatencyHistogram& histogram) {
+        std::cout << std::format("  {:<12} {:>10} {:>9.1f} {:>9.1f} {:>9.1f} {:>9.1f} {:>9.1f} {:>9.1f}\n", name, histogram.Count(),
+            us(histogram.Percentile(50)), us(histogram.Percentile(90)), us(histogram.Percentile(99)), us(histogram.Percentile(99.9)),
+            us(histogram.Percentile(99.99)), us(histogram.Max()));
+    };
+    LatencyHistogram all;
+    size_t kinds = 0;
+    for (size_t i = 0; i < kKinds; ++i) {
+        if (histograms[i].Count() == 0) continue;
+        row(kKindNames[i], histograms[i]);
+        all.Add(histograms[i]);
+        ++kinds;
+    }
+    if (kinds > 1) {
+        row("all", all);
+    }
+}
+
+std::string_view ModeName(Mode mode) {
+    switch (mode) {
+        case Mode::Http: return "http";
+        case Mode::Batch: return "batch";
+        case Mode::Binary: return "binary";
+    }
+    return "?";
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    options.idBase_ = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count()) * 1'000'000'000ULL;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        try {
+            if (arg.starts_with("--mode=")) {
+                std::string mode = arg.substr(7);
+                if (mode == "http") options.mode_ = Mode::Http;
+                else if (mode == "batch") options.mode_ = Mode::Batch;
+                else if (mode == "binary") options.mode_ = Mode::Binary;
+                else throw std::invalid_argument(mode);
+            } else if (arg.starts_with("--host=")) {
+                options.host_ = arg.substr(7);
+            } else if (arg.starts_with("--port=")) {
+                options.port_ = std::stoi(arg.substr(7));
+            } else if (arg.starts_with("--unix-socket=")) {
+                options.unixSocket_ = arg.substr(14);
+            } else if (arg.starts_with("--binary-port=")) {
+                options.binaryPort_ = std::stoi(arg.substr(14));
+            } else if (arg.starts_with("--connections=")) {
+                options.connections_ = std::max<size_t>(1, std::stoull(arg.substr(14)));
+            } else if (arg.starts_with("--rate=")) {
+                options.rate_ = std::stod(arg.substr(7));
+            } else if (arg.starts_with("--duration=")) {
+                options.duration_ = std::stod(arg.substr(11));
+            } else if (arg.starts_with("--warmup=")) {
+                options.warmup_ = std::stod(arg.substr(9));
+            } else if (arg.starts_with("--books=")) {
+                options.books_ = std::clamp<size_t>(std::stoull(arg.substr(8)), 1, 65535);
+            } else if (arg.starts_with("--batch-size=")) {
+                options.batchSize_ = std::max<size_t>(1, std::stoull(arg.substr(13)));
+            } else if (arg.starts_with("--cancel=")) {
+                options.cancel_ = std::stod(arg.substr(9));
+            } else if (arg.starts_with("--aggressive=")) {
+                options.aggressive_ = std::stod(arg.substr(13));
+            } else if (arg.starts_with("--levels=")) {
+                options.levels_ = std::max<size_t>(1, std::stoull(arg.substr(9)));
+            } else if (arg.starts_with("--prices=")) {
+                std::string shape = arg.substr(9);
+                options.prices_ = shape == "uniform" ? PriceShape::Uniform : shape == "zipf" ? PriceShape::Zipf : PriceShape::Touch;
+            } else if (arg.starts_with("--drift=")) {
+                options.drift_ = std::stod(arg.substr(8));
+            } else if (arg.starts_with("--id-base=")) {
+                options.idBase_ = std::stoull(arg.substr(10));
+            } else if (arg.starts_with("--seed=")) {
+                options.seed_ = std::stoull(arg.substr(7));
+            } else {
+                std::cerr << "Unknown argument " << arg << "\n";
+                return 1;
+            }
+        } catch (const std::exception&) {
+            std::cerr << "Invalid argument " << arg << "\n";
+            return 1;
+        }
+    }
+    if (options.cancel_ + options.aggressive_ > 1.0) {
+        std::cerr << "--cancel and --aggressive add up to more than 1\n";
+        return 1;
+    }
+    if (options.mode_ == Mode::Binary && options.binaryPort_ == 0) {
+        std::cerr << "--mode=binary needs --binary-port\n";
+        return 1;
+    }
+
+    bool openLoop = options.rate_ > 0;
+    std::cout << std::format("{} mode, {} connections, {}, {:g} s after {:g} s of warmup\n", ModeName(options.mode_), options.connections_,
+        openLoop ? std::format("open loop at {:g} requests/s", options.rate_) : std::string("closed loop"), options.duration_, options.warmup_);
+    std::cout << std::format("orders: {:.0f}% cancels, {:.0f}% aggressive, {} levels ({} prices), mid drifting {:g} ticks/s, {} book(s)\n",
+        options.mode_ == Mode::Batch ? 0.0 : options.cancel_ * 100, options.aggressive_ * 100, options.levels_,
+        options.prices_ == PriceShape::Uniform ? "uniform" : options.prices_ == PriceShape::Zipf ? "zipf" : "touch", options.drift_, options.books_);
+
+    std::vector<Stats> perConnection;
+    bool ran = options.mode_ == Mode::Binary ? Run<BinaryConnection>(options, perConnection) : Run<HttpConnection>(options, perConnection);
+    if (!ran) {
+        return 1;
+    }
+    Stats stats;
+    for (const Stats& connection : perConnection) {
+        stats.Add(connection);
+    }
+
+    double requestRate = static_cast<double>(stats.requests_) / stats.seconds_;
+    std::cout << std::format("\n{} requests, {:.0f}/s{}; {} orders, {:.0f}/s; {} cancels of orders already gone, {} errors\n", stats.requests_,
+        requestRate, openLoop ? std::format(" (target {:g})", options.rate_) : std::string(), stats.orders_,
+        static_cast<double>(stats.orders_) / stats.seconds_, stats.misses_, stats.errors_);
+    if (openLoop && stats.seconds_ > options.duration_ * 1.001) {
+        std::cout << std::format("the requests due in the {:g} s took {:.2f} s to get answered\n", options.duration_, stats.seconds_);
+    }
+    if (openLoop && requestRate < options.rate_ * 0.99) {
+        std::cout << "the engine (or the load generator) could not keep up with the target rate; the latencies include the backlog\n";
+    }
+    std::cout << "\n";
+    if (openLoop) {
+        PrintTable("latency in us, from when each request was due (corrected for coordinated omission):", stats.latency_);
+        std::cout << "\n";
+        PrintTable("service time in us, from when each request was actually sent:", stats.service_);
+    } else {
+        PrintTable("latency in us (closed loop: each request is sent when the last one is answered):", stats.service_);
+    }
+    return 0;
+}
@@ -0,0 +1,303 @@
+#pragma once
+
+// Asynchronous logger for the engine.
+//
+// Logging from a request handler used to mean std::cout << ... << std::flush while holding gLock, so the engine ran at the speed of the terminal.
+// Here a LOG_* call only copies a small binary record (format string pointer + raw argument values) into a ring owned by the calling thread.
+// A background thread drains every ring, does the actual formatting, and writes to the log file. Producers never format, lock or make a syscall.
+//
+// Levels below ENGINE_LOG_LEVEL are removed at compile time (the macro expands to nothing, so the arguments are never even evaluated).
+// Build with -DENGINE_LOG_LEVEL=0 to get the debug lines back.
+//
+// If a ring is full the record is dropped and counted. The writer thread reports how many records were dropped, so we never block the engine.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+enum class LogLevel : std::uint8_t{
+    Debug = 0,
+    Info = 1,
+    Warn = 2,
+    Error = 3
+};
+
+#ifndef ENGINE_LOG_LEVEL
+#define ENGINE_LOG_LEVEL 1 // Info
+#endif
+
+// One log call. The format string must be a string literal (we only keep the pointer); arguments are copied by value.
+// Strings up to kTextSize - 1 characters (book names, ids) are copied inline. Longer ones (exception messages, paths, strerror text)
+// get a copy on the heap that the writer thread frees; that allocation is only paid by the lines that carry such text, which are the
+// rare ones. Past kMaxLongText a string is cut, and the line shows it with "...".
+struct LogRecord{
+    static constexpr std::size_t kMaxArgs = 6;
+    static constexpr std::size_t kTextSize = 24;
+    static constexpr std::size_t kMaxLongText = 4096;
+
+    enum class ArgType : std::uint8_t{ Signed, Unsigned, Double, Text, LongText };
+
+    union ArgValue{
+        std::int64_t signed_;
+        std::uint64_t unsigned_;
+        double double_;
+        char text_[kTextSize];
+        char* longText_; // new[]'d, owned by whoever holds the record last (the writer thread, or Log() if the ring was full)
+    };
+
+    std::int64_t timestampNs_;
+    const char* format_;
+    LogLevel level_;
+    std::uint8_t argCount_;
+    ArgType types_[kMaxArgs];
+    ArgValue values_[kMaxArgs];
+
+    void FreeLongText(){
+        for (std::size_t i = 0; i < argCount_; ++i){
+            if (types_[i] == ArgType::LongText){ delete[] values_[i].longText_; }
+        }
+    }
+};
+
+// Single-producer / single-consumer ring. The producer is the thread that owns it, the consumer is the writer thread.
+class LogRing{
+    public:
+        static constexpr std::size_t kCapacity = 1024; // power of two
+
+        bool TryPush(const LogRecord& record){
+            std::uint64_t head = head_.load(std::memory_order_relaxed);
+            if (head - cachedTail_ == kCapacity){
+                cachedTail_ = tail_.load(std::memory_order_acquire);
+                if (head - cachedTail_ == kCapacity){
+                    dropped_.fetch_add(1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+            records_[head & (kCapacity - 1)] = record;
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        bool TryPop(LogRecord& record){
+            std::uint64_t tail = tail_.load(std::memory_order_relaxed);
+            if (tail == head_.load(std::memory_order_acquire)){ return false; }
+            record = records_[tail & (kCapacity - 1)];
+            tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        std::uint64_t TakeDropped() { return dropped_.exchange(0, std::memory_order_relaxed); }
+
+    private:
+        alignas(64) std::atomic<std::uint64_t> head_{0};
+        std::uint64_t cachedTail_ = 0; // producer's last look at tail_, so a push usually touches no shared cache line
+        alignas(64) std::atomic<std::uint64_t> tail_{0};
+        alignas(64) std::atomic<std::uint64_t> dropped_{0};
+        LogRecord records_[kCapacity];
+};
+
+class AsyncLogger{
+    public:
+        static AsyncLogger& Instance(){
+            static AsyncLogger logger;
+            return logger;
+        }
+
+        // opens the log file (appending) and starts the writer thread. "-" logs to stdout.
+        bool Start(const std::string& path){
+            if (running_.load()){ return true; }
+            file_ = path == "-" ? stdout : std::fopen(path.c_str(), "a");
+            if (file_ == nullptr){ return false; }
+            running_.store(true);
+            writer_ = std::thread([this]{ Run(); });
+            return true;
+        }
+
+        // drains whatever is still queued and stops the writer thread.
+        void Stop(){
+            if (!running_.exchange(false)){ return; }
+            writer_.join();
+            if (file_ != stdout){ std::fclose(file_); }
+            file_ = nullptr;
+        }
+
+        ~AsyncLogger() { Stop(); }
+
+        template <typename... Args>
+        void Log(LogLevel level, const char* format, const Args&... args){
+            static_assert(sizeof...(Args) <= LogRecord::kMaxArgs, "too many arguments for one log record");
+            LogRecord record;
+            record.timestampNs_ = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+            record.format_ = format;
+            record.level_ = level;
+            record.argCount_ = static_cast<std::uint8_t>(sizeof...(Args));
+            std::size_t index = 0;
+            (Store(record, index++, args), ...);
+            if (!LocalRing().TryPush(record)){ record.FreeLongText(); }
+        }
+
+    private:
+        AsyncLogger() = default;
+
+        // each thread gets its own ring the first time it logs (the only time a producer takes a lock).
+        LogRing& LocalRing(){
+            thread_local LogRing* ring = nullptr;
+            if (ring == nullptr){
+                auto owned = std::make_unique<LogRing>();
+                ring = owned.get();
+                std::lock_guard<std::mutex> lock(ringsLock_);
+                rings_.push_back(std::move(owned));
+            }
+            return *ring;
+        }
+
+        template <typename T>
+        static void Store(LogRecord& record, std::size_t index, const T& value){
+            if constexpr (std::is_same_v<T, bool>){
+                record.types_[index] = LogRecord::ArgType::Unsigned;
+                record.values_[index].unsigned_ = value ? 1 : 0;
+            }else if constexpr (std::is_integral_v<T> && std::is_signed_v<T>){
+                record.types_[index] = LogRecord::ArgType::Signed;
+                record.values_[index].signed_ = value;
+            }else if constexpr (std::is_integral_v<T>){
+                record.types_[index] = LogRecord::ArgType::Unsigned;
+                record.values_[index].unsigned_ = value;
+            }else if constexpr (std::is_floating_point_v<T>){
+                record.types_[index] = LogRecord::ArgType::Double;
+                record.values_[index].double_ = value;
+            }else if constexpr (std::is_enum_v<T>){
+                record.types_[index] = LogRecord::ArgType::Signed;
+                record.values_[index].signed_ = static_cast<std::int64_t>(value);
+            }else{
+                std::string_view text(value);
+                if (text.size() < LogRecord::kTextSize){
+                    record.types_[index] = LogRecord::ArgType::Text;
+                    std::memcpy(record.values_[index].text_, text.data(), text.size());
+                    record.values_[index].text_[text.size()] = '\0';
+                    return;
+                }
+                std::size_t length = std::min(text.size(), LogRecord::kMaxLongText);
+                char* copy = new char[length + 1];
+                std::memcpy(copy, text.data(), length);
+                if (length < text.size()){ std::memcpy(copy + length - 3, "...", 3); }
+                copy[length] = '\0';
+                record.types_[index] = LogRecord::ArgType::LongText;
+                record.values_[index].longText_ = copy;
+            }
+        }
+
+        void Run(){
+            std::string line;
+            std::vector<LogRing*> rings;
+            while (true){
+                bool stopping = !running_.load();
+                {
+                    std::lock_guard<std::mutex> lock(ringsLock_);
+                    rings.clear();
+                    for (auto& ring : rings_){ rings.push_back(ring.get()); }
+                }
+
+                bool wroteAny = false;
+                LogRecord record;
+                for (LogRing* ring : rings){
+                    while (ring->TryPop(record)){
+                        Format(record, line);
+                        record.FreeLongText();
+                        std::fwrite(line.data(), 1, line.size(), file_);
+                        wroteAny = true;
+                    }
+                    if (std::uint64_t dropped = ring->TakeDropped()){
+                        std::fprintf(file_, "[LOG] ring full, dropped %llu records\n", static_cast<unsigned long long>(dropped));
+                        wroteAny = true;
+                    }
+                }
+
+                if (wroteAny){ std::fflush(file_); }
+                if (stopping){ break; }
+                if (!wroteAny){ std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+            }
+        }
+
+        // "[2026-01-01 12:00:00.123456Z] [INFO] " + the format string with each {} replaced by the next argument ({{ and }} are literal braces).
+        static void Format(const LogRecord& record, std::string& line){
+            static constexpr const char* kNames[] = { "DEBUG", "INFO", "WARN", "ERROR" };
+            char buffer[64];
+
+            std::time_t seconds = static_cast<std::time_t>(record.timestampNs_ / 1000000000);
+            std::tm utc{};
+#if defined(_WIN32)
+            gmtime_s(&utc, &seconds);
+#else
+            gmtime_r(&seconds, &utc);
+#endif
+            std::size_t length = std::strftime(buffer, sizeof(buffer), "[%Y-%m-%d %H:%M:%S", &utc);
+            std::snprintf(buffer + length, sizeof(buffer) - length, ".%06lldZ] [%s] ",
+                static_cast<long long>(record.timestampNs_ % 1000000000 / 1000), kNames[static_cast<int>(record.level_)]);
+            line.assign(buffer);
+
+            std::size_t arg = 0;
+            for (const char* c = record.format_; *c != '\0'; ++c){
+                if ((c[0] == '{' && c[1] == '{') || (c[0] == '}' && c[1] == '}')){
+                    line += *c++;
+                }else if (c[0] == '{' && c[1] == '}' && arg < record.argCount_){
+                    AppendArg(record, arg++, line);
+                    ++c;
+                }else{
+                    line += *c;
+                }
+            }
+            line += '\n';
+        }
+
+        static void AppendArg(const LogRecord& record, std::size_t index, std::string& line){
+            const LogRecord::ArgValue& value = record.values_[index];
+            switch (record.types_[index]){
+                case LogRecord::ArgType::Signed: line += std::to_string(value.signed_); break;
+                case LogRecord::ArgType::Unsigned: line += std::to_string(value.unsigned_); break;
+                case LogRecord::ArgType::Double: line += std::to_string(value.double_); break;
+                case LogRecord::ArgType::Text: line += value.text_; break;
+                case LogRecord::ArgType::LongText: line += value.longText_; break;
+            }
+        }
+
+        std::atomic<bool> running_{false};
+        std::thread writer_;
+        std::FILE* file_ = nullptr;
+        std::mutex ringsLock_;
+        std::vector<std::unique_ptr<LogRing>> rings_;
+};
+
+#if ENGINE_LOG_LEVEL <= 0
+#define LOG_DEBUG(...) AsyncLogger::Instance().Log(LogLevel::Debug, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...) ((void)0)
+#endif
+
+#if ENGINE_LOG_LEVEL <= 1
+#define LOG_INFO(...) AsyncLogger::Instance().Log(LogLevel::Info, __VA_ARGS__)
+#else
+#define LOG_INFO(...) ((void)0)
+#endif
+
+#if ENGINE_LOG_LEVEL <= 2
+#define LOG_WARN(...) AsyncLogger::Instance().Log(LogLevel::Warn, __VA_ARGS__)
+#else
+#define LOG_WARN(...) ((void)0)
+#endif
+
+#if ENGINE_LOG_LEVEL <= 3
+#define LOG_ERROR(...) AsyncLogger::Instance().Log(LogLevel::Error, __VA_ARGS__)
+#else
+#define LOG_ERROR(...) ((void)0)
+#endif
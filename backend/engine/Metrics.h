@@ -0,0 +1,239 @@
+#pragma once
+
+// Stage timing for GET /metrics: where a request's time goes, as latency histograms (Histogram.h buckets) per stage.
+//   decode      turning the request into commands (query parameters, a /batch body, a binary message)
+//   queue_wait  a command waiting in its shard's queue before the shard gets to it (the engine has no locks; this is where it waits)
+//   match       the shard applying a command to its books
+//   serialize   building the response body
+//
+// Every thread records into histograms of its own, so recording is a few relaxed loads and stores with no lock and no shared cache line.
+// Only a scrape takes the registry lock, to walk every thread's histograms and add them up. A thread's histograms go back to the
+// registry (counts and all) when it exits, and the next new thread picks them up, so counts never go backwards and threads that come and
+// go don't pile up memory.
+//
+// Timestamps are TSC ticks (Now()), calibrated against steady_clock once at startup: rdtsc is one instruction where clock_gettime is a
+// vDSO call a few times slower, and a request takes half a dozen of them. rdtsc isn't serializing, so a stage can be off by the few
+// instructions the CPU ran out of order around it, which is far below what we measure. On a CPU without an invariant TSC (or off x86)
+// Now() is just steady_clock in nanoseconds.
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#include <x86intrin.h>
+#endif
+
+#include "Histogram.h"
+
+namespace metrics{
+
+inline std::uint64_t SteadyNanoseconds(){
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+// an invariant TSC ticks at the same rate whatever the core's frequency or power state, and in step on every core (CPUID 0x80000007, EDX bit 8).
+inline bool DetectInvariantTsc(){
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned eax = 0, ebx = 0, ecx = 0, edx = 0;
+    return __get_cpuid(0x80000007, &eax, &ebx, &ecx, &edx) && (edx & (1u << 8)) != 0;
+#else
+    return false;
+#endif
+}
+
+inline const bool kInvariantTsc = DetectInvariantTsc();
+
+inline std::uint64_t Now(){
+#if defined(__x86_64__) || defined(__i386__)
+    if (kInvariantTsc){ return __rdtsc(); }
+#endif
+    return SteadyNanoseconds();
+}
+
+// nanoseconds per tick, measured the first time it's asked for (main() asks before serving, so no request pays the ~10 ms).
+inline double NanosecondsPerTick(){
+    static const double perTick = []{
+        if (!kInvariantTsc){ return 1.0; }
+        std::uint64_t startNs = SteadyNanoseconds();
+        std::uint64_t startTicks = Now();
+        std::uint64_t endNs = startNs;
+        while (endNs - startNs < 10'000'000){ endNs = SteadyNanoseconds(); }
+        std::uint64_t endTicks = Now();
+        return static_cast<double>(endNs - startNs) / static_cast<double>(endTicks - startTicks);
+    }();
+    return perTick;
+}
+
+inline std::uint64_t ToNanoseconds(std::uint64_t ticks){
+    return static_cast<std::uint64_t>(static_cast<double>(ticks) * NanosecondsPerTick());
+}
+
+// ticks since start (0 if the clock reads earlier, which an unsynchronised TSC could do across cores).
+inline std::uint64_t Since(std::uint64_t start){
+    std::uint64_t now = Now();
+    return now > start ? now - start : 0;
+}
+
+enum class Stage : std::uint8_t{
+    Decode,
+    QueueWait,
+    Match,
+    Serialize
+};
+
+constexpr std::size_t kStages = 4;
+constexpr std::array<std::string_view, kStages> kStageNames = { "decode", "queue_wait", "match", "serialize" };
+
+// one thread's histograms. Only the owning thread writes (load + store, not an atomic add: there is a single writer), a scrape reads.
+class StageHistograms{
+    public:
+        void Record(Stage stage, std::uint64_t nanoseconds){
+            Histogram& histogram = stages_[static_cast<std::size_t>(stage)];
+            Bump(histogram.counts_[HistogramBuckets::IndexOf(nanoseconds)], 1);
+            Bump(histogram.count_, 1);
+            Bump(histogram.sum_, nanoseconds);
+        }
+
+        // adds this thread's counts for stage to counts (kCount buckets), count and sum.
+        void AddTo(Stage stage, std::vector<std::uint64_t>& counts, std::uint64_t& count, std::uint64_t& sum) const{
+            const Histogram& histogram = stages_[static_cast<std::size_t>(stage)];
+            for (std::size_t i = 0; i < HistogramBuckets::kCount; ++i){
+                counts[i] += histogram.counts_[i].load(std::memory_order_relaxed);
+            }
+            count += histogram.count_.load(std::memory_order_relaxed);
+            sum += histogram.sum_.load(std::memory_order_relaxed);
+        }
+
+    private:
+        struct Histogram{
+            std::array<std::atomic<std::uint64_t>, HistogramBuckets::kCount> counts_{};
+            std::atomic<std::uint64_t> count_{0};
+            std::atomic<std::uint64_t> sum_{0};
+        };
+
+        static void Bump(std::atomic<std::uint64_t>& value, std::uint64_t by){
+            value.store(value.load(std::memory_order_relaxed) + by, std::memory_order_relaxed);
+        }
+
+        std::array<Histogram, kStages> stages_;
+};
+
+class Registry{
+    public:
+        static Registry& Instance(){
+            static Registry registry;
+            return registry;
+        }
+
+        StageHistograms* Acquire(){
+            std::lock_guard<std::mutex> lock(mu_);
+            if (!free_.empty()){
+                StageHistograms* histograms = free_.back();
+                free_.pop_back();
+                return histograms;
+            }
+            all_.push_back(std::make_unique<StageHistograms>());
+            return all_.back().get();
+        }
+
+        void Release(StageHistograms* histograms){
+            std::lock_guard<std::mutex> lock(mu_);
+            free_.push_back(histograms);
+        }
+
+        // Prometheus text format: one histogram family with a series per stage. The buckets are powers of two nanoseconds from 64 ns to
+        // ~1 s, in seconds as Prometheus likes them. They fall on edges of the log-linear buckets, so each count is exact (except that a
+        // value of exactly 2^k ns is counted in the next one up).
+        void Render(std::string& out){
+            out += "# HELP engine_stage_seconds Time spent per request stage.\n# TYPE engine_stage_seconds histogram\n";
+            std::vector<std::uint64_t> counts(HistogramBuckets::kCount);
+            for (std::size_t stage = 0; stage < kStages; ++stage){
+                std::fill(counts.begin(), counts.end(), 0);
+                std::uint64_t count = 0;
+                std::uint64_t sum = 0;
+                {
+                    std::lock_guard<std::mutex> lock(mu_);
+                    for (const auto& histograms : all_){
+                        histograms->AddTo(static_cast<Stage>(stage), counts, count, sum);
+                    }
+                }
+                std::uint64_t below = 0;
+                std::size_t bucket = 0;
+                for (int power = kFirstPower; power <= kLastPower; ++power){
+                    std::uint64_t bound = std::uint64_t{1} << power;
+                    for (; bucket < counts.size() && HistogramBuckets::UpperOf(bucket) < bound; ++bucket){ below += counts[bucket]; }
+                    out += std::format("engine_stage_seconds_bucket{{stage=\"{}\",le=\"{}.{:09}\"}} {}\n", kStageNames[stage], bound / 1000000000,
+                        bound % 1000000000, below);
+                }
+                out += std::format("engine_stage_seconds_bucket{{stage=\"{}\",le=\"+Inf\"}} {}\n", kStageNames[stage], count);
+                out += std::format("engine_stage_seconds_sum{{stage=\"{}\"}} {:.9f}\n", kStageNames[stage], sum * 1e-9);
+                out += std::format("engine_stage_seconds_count{{stage=\"{}\"}} {}\n", kStageNames[stage], count);
+            }
+        }
+
+    private:
+        static constexpr int kFirstPower = 6;
+        static constexpr int kLastPower = 30;
+
+        std::mutex mu_;
+        std::vector<std::unique_ptr<StageHistograms>> all_;
+        std::vector<StageHistograms*> free_;
+};
+
+// the calling thread's histograms, taken from the registry the first time and handed back when the thread exits.
+inline StageHistograms& Local(){
+    struct Handle{
+        StageHistograms* histograms_ = Registry::Instance().Acquire();
+        ~Handle(){ Registry::Instance().Release(histograms_); }
+    };
+    thread_local Handle handle;
+    return *handle.histograms_;
+}
+
+// ticks is a duration in Now() ticks.
+inline void Record(Stage stage, std::uint64_t ticks){
+    Local().Record(stage, ToNanoseconds(ticks));
+}
+
+// records the time from construction to destruction (or to Stop()) under stage.
+class StageTimer{
+    public:
+        explicit StageTimer(Stage stage): stage_(stage), start_(Now()) {}
+        StageTimer(const StageTimer&) = delete;
+        StageTimer& operator=(const StageTimer&) = delete;
+        ~StageTimer(){ Stop(); }
+
+        void Stop(){
+            if (!stopped_){
+                stopped_ = true;
+                Record(stage_, Since(start_));
+            }
+        }
+
+    private:
+        Stage stage_;
+        std::uint64_t start_;
+        bool stopped_ = false;
+};
+
+// a Prometheus label value: backslash, double quote and newline escaped.
+inline void AppendLabel(std::string& out, std::string_view value){
+    for (char c : value){
+        if (c == '\\' || c == '"'){ out += '\\'; out += c; }
+        else if (c == '\n'){ out += "\\n"; }
+        else{ out += c; }
+    }
+}
+
+} // namespace metrics
@@ -0,0 +1,1224 @@
+#pragma once
+
+// The matching engine itself: orders, the order pool, the price ladders, the id index and Orderbook. Header-only and free of any
+// server code, so the tools (Replay.cpp) run the very same matching core as the engine.
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <format>
+#include <functional>
+#include <map>
+#include <new>
+#include <span>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#if !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
+#include "Logger.h"
+
+// "Order"s will have two Time Enforcement options.
+enum class OrderType{
+    GoodTillCancel,
+    FillAndKill
+};
+
+// "Order"s will have a Side. Side::Buy or Side::Sell
+enum class Side{
+    Buy,
+    Sell
+};
+
+// alias types
+using Price = std::int32_t; // price can be negative
+using Quantity = std::uint32_t;
+using OrderId = std::uint64_t;
+
+// in cpp we denote "member varaibles" (i.e not parameters) with a "_".
+
+struct LevelInfo{
+    Price price_;
+    Quantity quantity_;
+    std::uint32_t orderCount_;
+};
+
+// LevelInfos stores all the Quantity's at a certain price (level).
+using LevelInfos = std::vector<LevelInfo>;
+
+// OrderBookLevelInfo stores the vectors for asks and bids for all prices.
+class OrderBookLevelInfo{
+    // we need seperate vectors for bids and asks
+    public:
+        OrderBookLevelInfo(const LevelInfos& asks, const LevelInfos& bids):
+        // constructor instantiation
+        asks_(asks),
+        bids_(bids) {}
+
+        const LevelInfos& GetBids() const { return bids_; }
+        const LevelInfos& GetAsks() const { return asks_; }
+    
+    private:
+        LevelInfos bids_;
+        LevelInfos asks_;
+};
+
+// Every resting order lives in a slot of its book's OrderPool, and is referred to by that slot index.
+using OrderSlot = std::uint32_t;
+constexpr OrderSlot kNoSlot = static_cast<OrderSlot>(-1);
+
+// What is added to the order book? Objets that have the order type, key, side, price, quantity, and bool(s) for filled or not
+// Order stores instances of an order (with all needed properties).
+class Order {
+    // A PUBLIC constructor can initialize private fields.
+    public:
+        Order(OrderType orderType, Side side, Price price, Quantity quantity, OrderId orderId): 
+            orderType_(orderType),
+            orderId_(orderId),
+            price_(price),
+            side_(side),
+            initialQuantity_(quantity),
+            remainingQuantity_(quantity) {}
+
+        // const in the function sig. means it will NOT alter the members (getts and setters, bools).
+        OrderId GetOrderId() const { return orderId_; }
+        Side GetSide() const { return side_; }
+        Price GetPrice() const { return price_; }
+        OrderType GetOrderType() const { return orderType_; }
+        Quantity GetInitialQuantity() const { return initialQuantity_; }
+        Quantity GetRemainingQuantity() const { return remainingQuantity_; }
+        Quantity FilledQuantity() const { return GetInitialQuantity() - GetRemainingQuantity();}
+        bool IsFilled() const { return GetRemainingQuantity() == 0;}
+
+        void Fill(Quantity quantity){
+            // validate if the # of orders can actually be filled
+            if (quantity > GetRemainingQuantity()){
+                throw std::logic_error(std::format("Order ({}) cannot be filled for more than it's remaining quantity", GetOrderId()));
+            }
+
+            remainingQuantity_ -= quantity; // it has been filled
+        }
+
+        // the FIFO at a price level is threaded through the orders themselves (prev_/next_), so we don't need a list node per order.
+        friend class OrderPool;
+        friend struct OrderQueue;
+
+        // the reason we need this private section here is because without it, we declare the variables in our public: modifier, but never assign them a type.
+    private:
+        OrderType orderType_;
+        OrderId orderId_;
+        Price price_;
+        Side side_;
+        Quantity initialQuantity_;
+        Quantity remainingQuantity_;
+        OrderSlot prev_ = kNoSlot;
+        OrderSlot next_ = kNoSlot;
+};
+
+// Slabs are big, fixed-size blocks of Order slots. On POSIX systems they come straight from mmap (optionally backed by huge pages),
+// so a book's orders never go through malloc, and freeing a book is one munmap per slab instead of one free per order.
+inline void* MapSlab(std::size_t bytes, bool hugePages, bool prefault){
+#if defined(_WIN32)
+    (void)hugePages; (void)prefault;
+    return ::operator new(bytes, std::align_val_t{64});
+#else
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#if defined(__linux__)
+    if (prefault){ flags |= MAP_POPULATE; }
+    if (hugePages){
+        void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED){ return memory; }
+        // no hugetlbfs pages reserved on this box. fall back to normal pages and ask for transparent huge pages instead.
+    }
+#else
+    (void)prefault;
+#endif
+    void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+    if (memory == MAP_FAILED){ throw std::bad_alloc(); }
+#if defined(__linux__)
+    if (hugePages){ madvise(memory, bytes, MADV_HUGEPAGE); }
+#endif
+    return memory;
+#endif
+}
+
+inline void UnmapSlab(void* memory, std::size_t bytes){
+#if defined(_WIN32)
+    (void)bytes;
+    ::operator delete(memory, std::align_val_t{64});
+#else
+    munmap(memory, bytes);
+#endif
+}
+
+// Orders go into multiple data structures (their price level, and the orders_ lookup), so every structure refers to an order by its slot in the pool.
+// OrderPool is a slab allocator owned by one book: slot -> (slab, offset), so an Order never moves once it is placed.
+// Freed slots are recycled through a free list that reuses next_, and new slots are handed out with a bump cursor,
+// so once the pool has grown, adding and cancelling orders never allocates. Reset() throws every order away in O(1) (Order is trivially destructible).
+class OrderPool{
+    public:
+        static constexpr unsigned kSlabShift = 16;
+        static constexpr std::size_t kSlabSlots = std::size_t{1} << kSlabShift; // 64k orders (~2.5MB) per slab
+
+        // expectedOrders is a sizing hint: we map (and prefault) enough slabs for it up front, so the first big batch doesn't page fault its way in.
+        explicit OrderPool(std::size_t expectedOrders = 0, bool hugePages = false):
+            hugePages_(hugePages) {
+            while (slabs_.size() * kSlabSlots < expectedOrders){ AddSlab(true); }
+        }
+
+        ~OrderPool(){
+            for (Order* slab : slabs_){ UnmapSlab(slab, SlabBytes()); }
+        }
+
+        OrderPool(const OrderPool&) = delete;
+        OrderPool& operator=(const OrderPool&) = delete;
+
+        OrderSlot Allocate(const Order& order){
+            OrderSlot slot;
+            if (freeHead_ != kNoSlot){
+                slot = freeHead_;
+                freeHead_ = (*this)[slot].next_;
+            }else{
+                if (used_ == slabs_.size() * kSlabSlots){ AddSlab(false); }
+                slot = static_cast<OrderSlot>(used_++);
+            }
+            std::construct_at(&(*this)[slot], order);
+            return slot;
+        }
+
+        void Free(OrderSlot slot){
+            (*this)[slot].next_ = freeHead_;
+            freeHead_ = slot;
+        }
+
+        Order& operator[](OrderSlot slot) { return slabs_[slot >> kSlabShift][slot & (kSlabSlots - 1)]; }
+        const Order& operator[](OrderSlot slot) const { return slabs_[slot >> kSlabShift][slot & (kSlabSlots - 1)]; }
+
+        // forget every order at once. The slabs stay mapped so the book can refill them without going back to the OS.
+        void Reset(){
+            used_ = 0;
+            freeHead_ = kNoSlot;
+        }
+
+    private:
+        static_assert(std::is_trivially_destructible_v<Order>, "OrderPool::Reset() relies on Orders needing no destructor");
+
+        std::size_t SlabBytes() const{
+            std::size_t bytes = kSlabSlots * sizeof(Order);
+            constexpr std::size_t kHugePage = std::size_t{2} << 20;
+            return hugePages_ ? (bytes + kHugePage - 1) / kHugePage * kHugePage : bytes;
+        }
+
+        void AddSlab(bool prefault){
+            slabs_.push_back(static_cast<Order*>(MapSlab(SlabBytes(), hugePages_, prefault)));
+        }
+
+        std::vector<Order*> slabs_;
+        std::size_t used_ = 0; // bump cursor: slots below this have been handed out at least once
+        OrderSlot freeHead_ = kNoSlot;
+        bool hugePages_;
+};
+
+// OrderQueue is the FIFO of orders at one price level. It only keeps the first and last slot, the links live in the Orders.
+// we want a FIFO because if we have orders at the same price, the one that came first gets filled first.
+// It also keeps the level's totals up to date on every add, fill and remove, so nobody has to walk the queue to get them.
+struct OrderQueue{
+    OrderSlot head_ = kNoSlot;
+    OrderSlot tail_ = kNoSlot;
+    std::uint64_t quantity_ = 0; // sum of the remaining quantity of every order in the level
+    std::uint32_t count_ = 0;    // number of orders in the level
+
+    bool empty() const { return head_ == kNoSlot; }
+    OrderSlot front() const { return head_; }
+
+    void PushBack(OrderPool& pool, OrderSlot slot){
+        Order& order = pool[slot];
+        quantity_ += order.GetRemainingQuantity();
+        ++count_;
+        order.prev_ = tail_;
+        order.next_ = kNoSlot;
+        if (tail_ == kNoSlot){ head_ = slot; }
+        else{ pool[tail_].next_ = slot; }
+        tail_ = slot;
+    }
+
+    // O(1) unlink from anywhere in the queue (this is what makes cancel cheap).
+    void Remove(OrderPool& pool, OrderSlot slot){
+        Order& order = pool[slot];
+        quantity_ -= order.GetRemainingQuantity();
+        --count_;
+        if (order.prev_ == kNoSlot){ head_ = order.next_; }
+        else{ pool[order.prev_].next_ = order.next_; }
+        if (order.next_ == kNoSlot){ tail_ = order.prev_; }
+        else{ pool[order.next_].prev_ = order.prev_; }
+    }
+
+    // an order in this level was (partially) filled for "quantity".
+    void Fill(Quantity quantity){ quantity_ -= quantity; }
+
+    template <typename Fn>
+    void ForEach(const OrderPool& pool, Fn&& fn) const{
+        for (OrderSlot slot = head_; slot != kNoSlot; slot = pool[slot].next_){
+            fn(pool[slot]);
+        }
+    }
+};
+
+// Common functionality we need to support for orders:
+
+// Add() => we need a new order.
+// Cancel() => we need an existing valid order id.
+// Modify() => we need a way to modify existing orders, and we need to retrieve orders in a well manner.
+
+class OrderModify{
+    public:
+        OrderModify(OrderId orderId, Side side, Price price, Quantity quantity):
+        orderId_(orderId),
+        side_(side),
+        price_(price),
+        quantity_(quantity) {}
+
+    OrderId GetOrderId() const {return orderId_;}
+    Price GetPrice() const {return price_;}
+    Side GetSide() const {return side_;}
+    Quantity GetQuantity() const {return quantity_;}
+
+    // "const" in this function denotes the function does NOT modify any member variables.
+    Order ToOrder(OrderType type) const {
+    return Order(type, GetSide(), GetPrice(), GetQuantity(), GetOrderId());
+}
+
+    private:
+        OrderId orderId_;
+        Side side_;
+        Price price_;
+        Quantity quantity_;
+};
+
+// TradeInfo may exist by itself, but Trade can contain or reference one or more TradeInfo objects.
+struct TradeInfo{
+    OrderId orderid_;
+    Price price_;
+    Quantity quantity_;
+};
+
+// A trade consists of a bid and ask, which will hava TradeInfo objects for eahch.
+class Trade{
+    public:
+
+        Trade(const TradeInfo& bidTrade, const TradeInfo& askTrade):
+        bidTrade_ { bidTrade},
+        askTrade_ { askTrade} {}
+
+        const TradeInfo& GetBidTrade() const {return bidTrade_;}
+        const TradeInfo& GetAskTrade() const {return askTrade_;}
+
+    private:
+        TradeInfo bidTrade_;
+        TradeInfo askTrade_;
+};
+
+
+// vector of trade object, representing bids and asks
+using Trades = std::vector<Trade>;
+
+// The Orderbook reports what happened to an order through an "execution sink" instead of returning a vector of trades.
+// A sink only needs OnTrade(const Trade&). It can also have OnRest(const Order&) (the remainder went into the book),
+// OnCancel(const Order&) and OnReject(const Order&) (duplicate id, or a fillandkill that could not match); if it doesn't, those events are skipped.
+// Sinks are template parameters, so the calls inline and nothing is allocated per order.
+template <typename Sink>
+concept ExecutionSink = requires(Sink& sink, const Trade& trade){ sink.OnTrade(trade); };
+
+template <typename Sink>
+void NotifyRest(Sink& sink, const Order& order){
+    if constexpr (requires { sink.OnRest(order); }){ sink.OnRest(order); }
+}
+
+template <typename Sink>
+void NotifyCancel(Sink& sink, const Order& order){
+    if constexpr (requires { sink.OnCancel(order); }){ sink.OnCancel(order); }
+}
+
+template <typename Sink>
+void NotifyReject(Sink& sink, const Order& order){
+    if constexpr (requires { sink.OnReject(order); }){ sink.OnReject(order); }
+}
+
+// for callers that don't care about fills.
+struct NullSink{
+    void OnTrade(const Trade&) {}
+};
+
+// TradeBuffer collects trades in a vector that is reused between orders (Clear() keeps the capacity, so it stops allocating once warm).
+class TradeBuffer{
+    public:
+        void OnTrade(const Trade& trade) { trades_.push_back(trade); }
+        const Trades& GetTrades() const { return trades_; }
+        void Clear() { trades_.clear(); }
+
+    private:
+        Trades trades_;
+};
+
+// SinkFanout lets several subscribers (stats, a journal, a market data feed...) listen to the same order flow.
+// Every event goes to each sink that handles it, in the order the sinks were given.
+template <ExecutionSink... Sinks>
+class SinkFanout{
+    public:
+        explicit SinkFanout(Sinks&... sinks): sinks_(sinks...) {}
+
+        void OnTrade(const Trade& trade) { std::apply([&](auto&... sink){ (sink.OnTrade(trade), ...); }, sinks_); }
+        void OnRest(const Order& order) { std::apply([&](auto&... sink){ (NotifyRest(sink, order), ...); }, sinks_); }
+        void OnCancel(const Order& order) { std::apply([&](auto&... sink){ (NotifyCancel(sink, order), ...); }, sinks_); }
+        void OnReject(const Order& order) { std::apply([&](auto&... sink){ (NotifyReject(sink, order), ...); }, sinks_); }
+
+    private:
+        std::tuple<Sinks&...> sinks_;
+};
+
+// Settings for a single Orderbook. Our symbols trade inside a known tick band, so each side of the book keeps a dense
+// "ladder" of price levels around the touch. ladderLevels_ = 0 turns the ladder off, and every level lives in a std::map like before.
+// How a book finds an order by id. Hashed works for any ids. Direct is a plain array indexed by (id - base), for when ids come in
+// dense and increasing (like the ones api.GetNextOrderId hands out); it switches itself to Hashed if the ids turn out to be sparse.
+enum class IndexMode{
+    Hashed,
+    Direct
+};
+
+// expectedOrders_ pre-sizes the order pool and the id index, and hugePages_ asks for huge-page backed slabs (both are hints, the book works without them).
+struct BookConfig{
+    Price tickSize_ = 1;
+    std::size_t ladderLevels_ = 4096;
+    std::size_t expectedOrders_ = 0;
+    bool hugePages_ = false;
+    IndexMode indexMode_ = IndexMode::Hashed;
+};
+
+// PriceLadder is ONE side of the book (bids or asks). Levels inside the band [base_, base_ + levels * tick) live in a flat array
+// indexed by (price - base_) / tick, so finding a level is O(1), there is no node allocation, and the hot top-of-book levels sit together in cache.
+// A bitmap marks which slots hold a live level, so finding the next best price skips 64 empty slots at a time.
+// Prices outside the band (or not on a tick) fall back to a std::map, which keeps the same ordering as the array (Compare).
+template <typename Level, typename Compare>
+class PriceLadder{
+    public:
+        PriceLadder(std::size_t levels, Price tickSize):
+            levels_(levels),
+            occupied_((levels + 63) / 64, 0),
+            tickSize_(tickSize > 0 ? tickSize : 1) {}
+
+        bool Empty() const { return inBand_ == 0 && overflow_.empty(); }
+        std::size_t Size() const { return inBand_ + overflow_.size(); }
+
+        // returns the level at a price, creating it if it does not exist yet (same behaviour as std::map::operator[]).
+        // if the price is outside the band we first try to recenter the band around it, and only use the map if that fails.
+        Level& operator[](Price price){
+            if (!InBand(price) && !Recenter(price)){
+                return overflow_[price];
+            }
+            std::size_t index = IndexOf(price);
+            if (!IsOccupied(index)){
+                SetOccupied(index);
+                if (inBand_++ == 0 || IsBetter(index, bestIndex_)){
+                    bestIndex_ = index;
+                }
+            }
+            return levels_[index];
+        }
+
+        Level* Find(Price price){
+            if (InBand(price)){
+                std::size_t index = IndexOf(price);
+                return IsOccupied(index) ? &levels_[index] : nullptr;
+            }
+            auto it = overflow_.find(price);
+            return it == overflow_.end() ? nullptr : &it->second;
+        }
+
+        // removes an (empty) level. If the array runs dry while the map still has levels, we move the band to where the prices went.
+        void Erase(Price price){
+            if (!InBand(price)){
+                overflow_.erase(price);
+                return;
+            }
+            std::size_t index = IndexOf(price);
+            if (!IsOccupied(index)){ return; }
+
+            levels_[index] = Level{};
+            ClearOccupied(index);
+            --inBand_;
+
+            if (inBand_ == 0){
+                if (!overflow_.empty()){ Rebase(overflow_.begin()->first); }
+            }else if (index == bestIndex_){
+                bestIndex_ = NextWorse(index);
+            }
+        }
+
+        // best price on this side (highest bid / lowest ask). Only valid when !Empty().
+        Price BestPrice() const { return BestInBand() ? PriceOf(bestIndex_) : overflow_.begin()->first; }
+        Level& BestLevel() { return BestInBand() ? levels_[bestIndex_] : overflow_.begin()->second; }
+
+        // visits every live level from best to worst, merging the array and the overflow map.
+        template <typename Fn>
+        void ForEach(Fn&& fn) const{
+            std::size_t index = inBand_ ? bestIndex_ : npos;
+            auto it = overflow_.begin();
+            while (index != npos || it != overflow_.end()){
+                if (index != npos && (it == overflow_.end() || Compare{}(PriceOf(index), it->first))){
+                    fn(PriceOf(index), levels_[index]);
+                    index = NextWorse(index);
+                }else{
+                    fn(it->first, it->second);
+                    ++it;
+                }
+            }
+        }
+
+        void Clear(){
+            for (std::size_t index = ScanUp(0); index != npos; index = ScanUp(index + 1)){
+                levels_[index] = Level{};
+            }
+            std::fill(occupied_.begin(), occupied_.end(), 0);
+            overflow_.clear();
+            inBand_ = 0;
+            anchored_ = false;
+        }
+
+    private:
+        static constexpr std::size_t npos = static_cast<std::size_t>(-1);
+        // bids want the highest price first, so for them "better" means a higher slot in the array.
+        static constexpr bool kDescending = std::is_same_v<Compare, std::greater<Price>>;
+
+        bool InBand(Price price) const{
+            if (!anchored_){ return false; }
+            std::int64_t offset = static_cast<std::int64_t>(price) - base_;
+            return offset >= 0 && offset % tickSize_ == 0 && offset / tickSize_ < static_cast<std::int64_t>(levels_.size());
+        }
+
+        std::size_t IndexOf(Price price) const { return static_cast<std::size_t>((static_cast<std::int64_t>(price) - base_) / tickSize_); }
+        Price PriceOf(std::size_t index) const { return static_cast<Price>(base_ + static_cast<std::int64_t>(index) * tickSize_); }
+
+        bool IsOccupied(std::size_t index) const { return (occupied_[index / 64] >> (index % 64)) & 1; }
+        void SetOccupied(std::size_t index) { occupied_[index / 64] |= (std::uint64_t{1} << (index % 64)); }
+        void ClearOccupied(std::size_t index) { occupied_[index / 64] &= ~(std::uint64_t{1} << (index % 64)); }
+
+        bool IsBetter(std::size_t a, std::size_t b) const { return kDescending ? a > b : a < b; }
+
+        bool BestInBand() const{
+            if (inBand_ == 0){ return false; }
+            return overflow_.empty() || Compare{}(PriceOf(bestIndex_), overflow_.begin()->first);
+        }
+
+        // lowest live slot >= index
+        std::size_t ScanUp(std::size_t index) const{
+            std::size_t word = index / 64;
+            if (word >= occupied_.size()){ return npos; }
+            std::uint64_t bits = occupied_[word] & (~std::uint64_t{0} << (index % 64));
+            while (bits == 0){
+                if (++word == occupied_.size()){ return npos; }
+                bits = occupied_[word];
+            }
+            return word * 64 + std::countr_zero(bits);
+        }
+
+        // highest live slot <= index
+        std::size_t ScanDown(std::size_t index) const{
+            std::size_t word = index / 64;
+            std::uint64_t bits = occupied_[word] & (~std::uint64_t{0} >> (63 - index % 64));
+            while (bits == 0){
+                if (word-- == 0){ return npos; }
+                bits = occupied_[word];
+            }
+            return word * 64 + 63 - std::countl_zero(bits);
+        }
+
+        std::size_t FirstBest() const { return kDescending ? ScanDown(levels_.size() - 1) : ScanUp(0); }
+
+        std::size_t NextWorse(std::size_t index) const{
+            if (kDescending){ return index == 0 ? npos : ScanDown(index - 1); }
+            return ScanUp(index + 1);
+        }
+
+        // tries to move the band so that "price" fits. Returns false (use the map) if the live levels plus the new price are wider than the band.
+        bool Recenter(Price price){
+            if (levels_.empty()){ return false; }
+            if (inBand_ == 0){
+                Rebase(price);
+                return InBand(price); // an off-tick price still goes to the map
+            }
+
+            std::int64_t low = std::min<std::int64_t>(price, PriceOf(ScanUp(0)));
+            std::int64_t high = std::max<std::int64_t>(price, PriceOf(ScanDown(levels_.size() - 1)));
+            if ((price - base_) % tickSize_ != 0){ return false; }
+
+            std::int64_t span = (high - low) / tickSize_ + 1;
+            if (span > static_cast<std::int64_t>(levels_.size())){ return false; }
+
+            // leave the same amount of slack on both sides, so a slow drift does not recenter on every order.
+            std::int64_t newBase = low - ((static_cast<std::int64_t>(levels_.size()) - span) / 2) * tickSize_;
+            Shift(newBase);
+            MigrateOverflow();
+            bestIndex_ = FirstBest();
+            return true;
+        }
+
+        // only called when the array holds no levels: centers the band on "price" and pulls in any map levels that now fit.
+        // The base is kept on a multiple of the tick, so an off-tick first price cannot push every on-tick price out of the array.
+        void Rebase(Price price){
+            std::int64_t tick = static_cast<std::int64_t>(price) / tickSize_;
+            if (tick * tickSize_ > static_cast<std::int64_t>(price)){ --tick; } // round down for negative prices too
+            base_ = (tick - static_cast<std::int64_t>(levels_.size() / 2)) * tickSize_;
+            anchored_ = true;
+            MigrateOverflow();
+            if (inBand_ > 0){ bestIndex_ = FirstBest(); }
+        }
+
+        // moves every live level to its slot under newBase. Everything fits (Recenter checked the span).
+        void Shift(std::int64_t newBase){
+            std::int64_t delta = (base_ - newBase) / tickSize_;
+            std::vector<std::uint64_t> old(occupied_.size(), 0);
+            old.swap(occupied_);
+
+            auto move = [&](std::size_t from){
+                std::size_t to = static_cast<std::size_t>(static_cast<std::int64_t>(from) + delta);
+                if (to != from){
+                    levels_[to] = std::move(levels_[from]);
+                    levels_[from] = Level{};
+                }
+                SetOccupied(to);
+            };
+
+            auto isSet = [&](std::size_t index){ return (old[index / 64] >> (index % 64)) & 1; };
+            // walk in the direction of the shift so we never overwrite a level we have not moved yet.
+            if (delta > 0){
+                for (std::size_t index = levels_.size(); index-- > 0;){ if (isSet(index)) move(index); }
+            }else{
+                for (std::size_t index = 0; index < levels_.size(); ++index){ if (isSet(index)) move(index); }
+            }
+            base_ = newBase;
+        }
+
+        void MigrateOverflow(){
+            for (auto it = overflow_.begin(); it != overflow_.end();){
+                if (InBand(it->first)){
+                    std::size_t index = IndexOf(it->first);
+                    levels_[index] = std::move(it->second);
+                    SetOccupied(index);
+                    ++inBand_;
+                    it = overflow_.erase(it);
+                }else{
+                    ++it;
+                }
+            }
+        }
+
+        std::vector<Level> levels_;
+        std::vector<std::uint64_t> occupied_;
+        std::map<Price, Level, Compare> overflow_;
+        std::int64_t base_ = 0;
+        std::int64_t tickSize_;
+        std::size_t inBand_ = 0;    // live levels in the array
+        std::size_t bestIndex_ = 0; // valid while inBand_ > 0
+        bool anchored_ = false;     // the band is placed on the first price we see
+};
+
+// OrderIndex maps OrderId -> OrderSlot for one book. It replaces std::unordered_map, which cost a heap node per order and
+// several hash probes per operation (contains + insert, contains + at + erase).
+// Hashed mode is a flat open-addressing table with linear probing. Deleting shifts the following entries back into the hole
+// (backward-shift deletion), so there are no tombstones and lookups never slow down as orders come and go.
+// Every operation below is a single probe sequence.
+// Clear() is O(1) in both modes: hashed buckets carry the epoch they were written in and a bucket from an older epoch counts as
+// empty, and the direct array is simply emptied and filled back in (with kNoSlot) as new ids need cells.
+class OrderIndex{
+    public:
+        OrderIndex(std::size_t expectedOrders, IndexMode mode):
+            mode_(mode) {
+            if (mode_ == IndexMode::Hashed){ Rehash(CapacityFor(expectedOrders)); }
+        }
+
+        std::size_t Size() const { return size_; }
+
+        // bulk load into an empty index (a snapshot). The ids come in no useful order, and millions of them scattered over a table much
+        // bigger than the cache cost a miss each, so they are first partitioned by where they land (one radix pass on the top bits of
+        // the position) and then each partition goes in while its stretch of the table is in cache.
+        // Returns false if an id is in there twice (the index is then only fit for Clear()).
+        bool InsertAll(std::span<const std::pair<OrderId, OrderSlot>> entries){
+            if (entries.empty()){ return true; }
+            auto [lowest, highest] = std::minmax_element(entries.begin(), entries.end(),
+                [](const auto& a, const auto& b){ return a.first < b.first; });
+            std::size_t capacity = 0;
+            if (mode_ == IndexMode::Direct){
+                std::size_t span = static_cast<std::size_t>(highest->first - lowest->first) + 1;
+                if (size_ != 0 || span > std::max(kMaxDirectSpan, entries.size() * 4)){
+                    ToHashed();
+                }else{
+                    base_ = lowest->first;
+                    direct_.assign(std::bit_ceil(span), kNoSlot);
+                    capacity = direct_.size();
+                }
+            }
+            if (mode_ == IndexMode::Hashed){
+                if ((size_ + entries.size()) * 10 > table_.size() * 7){ Rehash(CapacityFor(size_ + entries.size())); }
+                capacity = table_.size();
+            }
+
+            auto position = [&](OrderId id){ return mode_ == IndexMode::Direct ? DirectCell(id) : Home(id); };
+            int shift = std::max(0, std::countr_zero(capacity) - kLoadPartitionBits);
+            std::vector<std::size_t> starts((std::size_t{1} << kLoadPartitionBits) + 1, 0);
+            for (const auto& entry : entries){ ++starts[(position(entry.first) >> shift) + 1]; }
+            for (std::size_t i = 1; i < starts.size(); ++i){ starts[i] += starts[i - 1]; }
+            std::vector<std::pair<OrderId, OrderSlot>> partitioned(entries.size());
+            for (const auto& entry : entries){ partitioned[starts[position(entry.first) >> shift]++] = entry; }
+
+            for (const auto& [id, slot] : partitioned){
+                if (mode_ == IndexMode::Direct){
+                    OrderSlot& cell = direct_[DirectCell(id)];
+                    if (cell != kNoSlot){ return false; }
+                    cell = slot;
+                    ++size_;
+                }else if (!TryEmplace(id, slot)){
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        // where a lookup left off in hashed mode: the bucket a missing id would go in, good until the index next changes.
+        struct Hint{
+            std::size_t position_ = 0;
+            std::uint64_t changes_ = ~std::uint64_t{0};
+        };
+
+        // the duplicate check for a new order: true if the id is in the book. If it isn't, hint remembers where it would go, so an
+        // order that ends up resting is inserted without walking the probe sequence again (see Insert).
+        bool Contains(OrderId id, Hint& hint) const{
+            if (mode_ == IndexMode::Direct){ return Find(id) != kNoSlot; }
+            for (std::size_t i = Home(id);; i = (i + 1) & mask_){
+                const Entry& entry = table_[i];
+                if (!Live(entry)){
+                    hint = Hint{ i, changes_ };
+                    return false;
+                }
+                if (entry.id_ == id){ return true; }
+            }
+        }
+
+        // adds an id Contains() said is missing. If nothing was added or removed since (a passive order, or an aggressor that filled
+        // no resting order completely) and the table doesn't need to grow, that is a single store; otherwise it probes again.
+        void Insert(OrderId id, OrderSlot slot, const Hint& hint){
+            if (mode_ == IndexMode::Hashed && hint.changes_ == changes_ && (size_ + 1) * 10 <= table_.size() * 7){
+                table_[hint.position_] = Entry{ id, slot, epoch_ };
+                ++size_;
+                ++changes_;
+                return;
+            }
+            TryEmplace(id, slot);
+        }
+
+        // inserts id -> slot. Returns false (and changes nothing) if the id is already in the book.
+        bool TryEmplace(OrderId id, OrderSlot slot){
+            if (mode_ == IndexMode::Direct){
+                if (!FitDirect(id)){
+                    ToHashed();
+                    return TryEmplace(id, slot);
+                }
+                OrderSlot& entry = direct_[DirectCell(id)];
+                if (entry != kNoSlot){ return false; }
+                entry = slot;
+                ++size_;
+                return true;
+            }
+
+            if ((size_ + 1) * 10 > table_.size() * 7){ Rehash(table_.size() * 2); }
+            for (std::size_t i = Home(id);; i = (i + 1) & mask_){
+                Entry& entry = table_[i];
+                if (!Live(entry)){
+                    entry = Entry{ id, slot, epoch_ };
+                    ++size_;
+                    ++changes_;
+                    return true;
+                }
+                if (entry.id_ == id){ return false; }
+            }
+        }
+
+        // kNoSlot if the id is not in the book.
+        OrderSlot Find(OrderId id) const{
+            if (mode_ == IndexMode::Direct){
+                return InDirect(id) ? direct_[DirectCell(id)] : kNoSlot;
+            }
+            for (std::size_t i = Home(id);; i = (i + 1) & mask_){
+                const Entry& entry = table_[i];
+                if (!Live(entry)){ return kNoSlot; }
+                if (entry.id_ == id){ return entry.slot_; }
+            }
+        }
+
+        // find + erase in one go. Returns the slot the order was in, or kNoSlot if the id is not in the book.
+        OrderSlot Extract(OrderId id){
+            if (mode_ == IndexMode::Direct){
+                if (!InDirect(id)){ return kNoSlot; }
+                OrderSlot slot = std::exchange(direct_[DirectCell(id)], kNoSlot);
+                if (slot != kNoSlot){ --size_; }
+                return slot;
+            }
+
+            std::size_t hole = Home(id);
+            while (true){
+                if (!Live(table_[hole])){ return kNoSlot; }
+                if (table_[hole].id_ == id){ break; }
+                hole = (hole + 1) & mask_;
+            }
+            OrderSlot slot = table_[hole].slot_;
+            --size_;
+            ++changes_;
+
+            // backward shift: pull later entries of the cluster into the hole, as long as that does not move them before their home.
+            for (std::size_t i = (hole + 1) & mask_; Live(table_[i]); i = (i + 1) & mask_){
+                std::size_t home = Home(table_[i].id_);
+                if (((i - home) & mask_) >= ((i - hole) & mask_)){
+                    table_[hole] = table_[i];
+                    hole = i;
+                }
+            }
+            table_[hole].slot_ = kNoSlot;
+            return slot;
+        }
+
+        void Clear(){
+            ++changes_;
+            if (mode_ == IndexMode::Direct){
+                direct_.clear(); // keeps the capacity, FitDirect refills what the next ids need
+            }else if (++epoch_ == 0){
+                // the epoch wrapped, so a bucket written 2^32 clears ago would look live again: wipe them for real this once.
+                std::fill(table_.begin(), table_.end(), Entry{});
+            }
+            size_ = 0;
+        }
+
+    private:
+        struct Entry{
+            OrderId id_ = 0;
+            OrderSlot slot_ = kNoSlot; // kNoSlot marks an empty bucket
+            std::uint32_t epoch_ = 0;  // sits in what was padding, so buckets stay 16 bytes
+        };
+        static_assert(sizeof(Entry) == 16);
+
+        bool Live(const Entry& entry) const { return entry.slot_ != kNoSlot && entry.epoch_ == epoch_; }
+
+        // the direct array may cover at most this many ids (or 4x the live orders), past that the ids are too sparse and we hash them.
+        static constexpr std::size_t kMaxDirectSpan = std::size_t{1} << 22;
+        // InsertAll splits the table into this many (2^n) stretches
+        static constexpr int kLoadPartitionBits = 10;
+
+        static std::size_t CapacityFor(std::size_t expectedOrders){
+            return std::bit_ceil(std::max<std::size_t>(1024, expectedOrders * 2));
+        }
+
+        // fibonacci hashing: ids are usually sequential, so multiply to spread them and keep the top bits.
+        std::size_t Home(OrderId id) const { return static_cast<std::size_t>((id * 0x9E3779B97F4A7C15ULL) >> shift_); }
+
+        void Rehash(std::size_t capacity){
+            ++changes_;
+            std::vector<Entry> old(capacity);
+            old.swap(table_);
+            mask_ = capacity - 1;
+            shift_ = 64 - std::countr_zero(capacity);
+            size_ = 0;
+            for (const Entry& entry : old){
+                if (Live(entry)){ TryEmplace(entry.id_, entry.slot_); }
+            }
+        }
+
+        // the direct array is a ring over the window [base_, base_ + size): an id's cell is its low bits, so sliding the window
+        // forward moves nothing, the cells of the ids it drops are (empty and) the cells of the ids it takes in.
+        bool InDirect(OrderId id) const { return id >= base_ && id - base_ < direct_.size(); }
+        std::size_t DirectCell(OrderId id) const { return static_cast<std::size_t>(id) & (direct_.size() - 1); }
+
+        // makes sure "id" has a cell in the direct array, sliding the window past ids that are gone. False if the ids are too spread out.
+        // base_ only moves forward over empty cells and the array only ever doubles, so in a steady flow (orders arrive and leave in
+        // roughly id order) this is amortized O(1).
+        bool FitDirect(OrderId id){
+            if (InDirect(id)){ return true; }
+            if (size_ == 0){
+                base_ = id; // nothing live, so every cell is already kNoSlot
+                if (direct_.empty()){ direct_.resize(1024, kNoSlot); }
+                return true;
+            }
+            if (id < base_){ return false; }
+
+            while (direct_[DirectCell(base_)] == kNoSlot){ ++base_; }
+            std::size_t span = static_cast<std::size_t>(id - base_) + 1;
+            if (span <= direct_.size()){ return true; }
+            if (span > std::max(kMaxDirectSpan, size_ * 4)){ return false; }
+
+            // the live orders span more than the ring: double it (at least), each live cell moves to where its id lands in the bigger one
+            std::vector<OrderSlot> grown(std::bit_ceil(span), kNoSlot);
+            for (OrderId current = base_; current - base_ < direct_.size(); ++current){
+                grown[static_cast<std::size_t>(current) & (grown.size() - 1)] = direct_[DirectCell(current)];
+            }
+            direct_.swap(grown);
+            return true;
+        }
+
+        void ToHashed(){
+            std::vector<OrderSlot> direct;
+            direct.swap(direct_);
+            mode_ = IndexMode::Hashed;
+            size_ = 0;
+            Rehash(CapacityFor(direct.size()));
+            for (std::size_t i = 0; i < direct.size(); ++i){
+                // cell i holds the one id in the window with those low bits
+                if (direct[i] != kNoSlot){ TryEmplace(base_ + ((i - static_cast<std::size_t>(base_)) & (direct.size() - 1)), direct[i]); }
+            }
+        }
+
+        IndexMode mode_;
+        std::size_t size_ = 0;
+        // Hashed
+        std::vector<Entry> table_;
+        std::size_t mask_ = 0;
+        int shift_ = 64;
+        std::uint32_t epoch_ = 0;   // bumped by Clear()
+        std::uint64_t changes_ = 0; // bumped by every change to the table, so a Hint knows when it went stale
+        // Direct
+        std::vector<OrderSlot> direct_;
+        OrderId base_ = 0;
+};
+
+// running totals of what a book has seen, for /metrics. They only ever go up (Clear() keeps them), as Prometheus counters should.
+// A modify counts as a cancel plus a new order, since that is what it does to the book.
+struct BookActivity{
+    std::uint64_t orders_ = 0;
+    std::uint64_t trades_ = 0;
+    std::uint64_t cancels_ = 0;
+    std::uint64_t rejects_ = 0;
+};
+
+class Orderbook{
+    // An OrderBook holds orders, and we want to be easily able to access these orders (preferrable, in O(1) time). Any any point in time, the bids and asks we are about are:
+    // The bid with the HIGHEST price, and the ask with the LOWEST price.
+
+    private:
+        // every order in this book lives in pool_.
+        OrderPool pool_;
+        // each side maps Price -> 'OrderQueue'. std::greater<Price> is a custom comparator to sort upon, where it's in descending order. (highest BID first!).
+        // the ladder keeps the levels near the touch in a flat array, and only uses a std::map for prices outside its band.
+        PriceLadder<OrderQueue, std::greater<Price>> bids_;
+        PriceLadder<OrderQueue, std::less<Price>> asks_;
+        // we don't need to sort our actual orders. these are just for the record: OrderId -> the slot the order lives in.
+        // The slot also tells us where it sits in its level (prev_/next_).
+        OrderIndex orders_;
+        // resting orders per side, kept up to date as orders are added, filled and cancelled.
+        std::size_t bidCount_ = 0;
+        std::size_t askCount_ = 0;
+        BookActivity activity_;
+
+        // We need CanMatch() for fillandkill orders, because if it's can't match now, we never do it (now or never).
+        // otherwise, if we have a goodtillcancel order, we match what we can and add the rest to the orderbook.
+        // Upon match, we need to REMOVE the filled orders from the orderbook. This may be completely filled orders, or partially filled orders stay.
+
+        bool CanMatch(Side side, Price price) const{
+              if (side == Side::Buy){
+
+                if (asks_.Empty()){
+                    return false;
+                }else{
+                    Price bestAsk = asks_.BestPrice(); // starts at the best ask (lowest price!).
+                    return price >= bestAsk; // we return the best match possible, and return if it is valid or not.
+                }
+              }
+
+            //   copying for other side
+              if (side == Side::Sell){
+                if (bids_.Empty()){
+                    return false;
+                }else{
+                    Price bestBid = bids_.BestPrice();
+                    return price <= bestBid;
+                }
+              }
+
+              return false; // Default case (should never reach here)
+          }
+
+        // takes an order (already gone from orders_) out of its price level and gives its slot back to the pool.
+        void RemoveResting(OrderSlot slot){
+            const Order& order = pool_[slot];
+
+            // if it's a sell order, we remove it from the asks_ data structure. if it's empty after, we need to remove the price altogether from it (memory cleanup).
+            if (order.GetSide() == Side::Sell){
+                auto price = order.GetPrice();
+                auto& orders = *asks_.Find(price);
+                orders.Remove(pool_, slot);
+                --askCount_;
+                if (orders.empty()){
+                    asks_.Erase(price);
+                }
+            }else{
+                auto price = order.GetPrice();
+                auto& orders = *bids_.Find(price);
+                orders.Remove(pool_, slot);
+                --bidCount_;
+                if (orders.empty()){
+                    bids_.Erase(price);
+                }
+            }
+            pool_.Free(slot);
+        }
+
+        // We also need a Match() function that runs when a match actually occurs.
+        // Only the incoming (aggressor) order can cross the book, since the book was not crossed before it arrived.
+        // So we match it against the opposite side from the best level outwards, until it is filled or the prices stop crossing.
+        // Trades are recorded as {bid, ask}, with each side's own order price.
+        template <typename Ladder, ExecutionSink Sink>
+        void MatchAggressor(Order& incoming, Ladder& opposite, std::size_t& oppositeCount, Sink& sink){
+            bool isBuy = incoming.GetSide() == Side::Buy;
+
+            while (!incoming.IsFilled() && !opposite.Empty()){
+                Price levelPrice = opposite.BestPrice();
+                if (isBuy ? incoming.GetPrice() < levelPrice : incoming.GetPrice() > levelPrice){
+                    break;
+                }
+
+                auto& level = opposite.BestLevel();
+                while (!incoming.IsFilled() && !level.empty()){
+                    OrderSlot restingSlot = level.front();
+                    Order* resting = &pool_[restingSlot];
+
+                    Quantity quantity = std::min(incoming.GetRemainingQuantity(), resting->GetRemainingQuantity());
+                    incoming.Fill(quantity);
+                    resting->Fill(quantity);
+                    level.Fill(quantity);
+
+                    const Order* bid = isBuy ? &incoming : resting;
+                    const Order* ask = isBuy ? resting : &incoming;
+                    sink.OnTrade(Trade{
+                        TradeInfo{ bid->GetOrderId(), bid->GetPrice(), quantity},
+                        TradeInfo{ ask->GetOrderId(), ask->GetPrice(), quantity}
+                    });
+                    ++activity_.trades_;
+                    LOG_DEBUG("fill bid={} ask={} price={} qty={}", bid->GetOrderId(), ask->GetOrderId(), levelPrice, quantity);
+
+                    if (resting->IsFilled()){
+                        orders_.Extract(resting->GetOrderId());
+                        level.Remove(pool_, restingSlot);
+                        pool_.Free(restingSlot);
+                        --oppositeCount;
+                    }
+                }
+
+                if (level.empty()){
+                    opposite.Erase(levelPrice);
+                }
+            }
+        }
+
+        // need to add, cancel, and modify order(s).
+
+        // Given a new Order, this method matches it against the book and adds whatever is left to our orderbook.
+        // it checks if the order already exists, if the order is a fillandkill and can NOT be immediately matched (both cases where we do NOT add).
+        public:
+            Orderbook(const BookConfig& config = BookConfig{}):
+                pool_(config.expectedOrders_, config.hugePages_),
+                bids_(config.ladderLevels_, config.tickSize_),
+                asks_(config.ladderLevels_, config.tickSize_),
+                orders_(config.expectedOrders_, config.indexMode_) {}
+
+            // every fill goes to the sink as it happens, so nothing is allocated here per order.
+            template <ExecutionSink Sink>
+            void AddOrder(const Order& order, Sink& sink){
+                ++activity_.orders_;
+                if (order.GetOrderType() == OrderType::FillAndKill && !CanMatch(order.GetSide(), order.GetPrice())){
+                    ++activity_.rejects_;
+                    NotifyReject(sink, order);
+                    return;
+                }
+                
+                // the duplicate check. It is the only probe of orders_ for an order that never rests (filled, or a fillandkill): the id
+                // only goes into orders_ once we know it stays, and then usually straight into the bucket this probe found.
+                OrderIndex::Hint hint;
+                if (orders_.Contains(order.GetOrderId(), hint)){
+                    ++activity_.rejects_;
+                    NotifyReject(sink, order);
+                    return;
+                }
+
+                // the order gets copied into a slot of our pool. From here on, the slot index is how we reach it (O(1) remove/cancellation).
+                // bids_ is our buy-side storage, whereas asks_ is our sell-side storage.
+                OrderSlot slot = pool_.Allocate(order);
+
+                // match the new order first. Only what is left over (if anything) goes into the book.
+                Order& incoming = pool_[slot];
+                if (incoming.GetSide() == Side::Buy){
+                    MatchAggressor(incoming, asks_, askCount_, sink);
+                }else{
+                    MatchAggressor(incoming, bids_, bidCount_, sink);
+                }
+
+                // a fully filled order never rests, and a fillandkill remainder is dropped right here (now or never).
+                if (incoming.IsFilled() || incoming.GetOrderType() == OrderType::FillAndKill){
+                    pool_.Free(slot);
+                    return;
+                }
+                orders_.Insert(incoming.GetOrderId(), slot, hint);
+
+                if (incoming.GetSide() == Side::Buy){
+                    auto& orders = bids_[incoming.GetPrice()]; 
+                    // this line causes INSERTION, where the price of the order is used as the key, and simultaneously gives an "orders" alias which is the queue of orders at the specific price level.
+                    // so we insert an order (with Price as the key) and retrieve the reference to the queue (value).
+                    orders.PushBack(pool_, slot);
+                    // the order is linked at the back of the queue (FIFO).
+                    ++bidCount_;
+                }else{
+                    auto& orders = asks_[incoming.GetPrice()];
+                    orders.PushBack(pool_, slot);
+                    ++askCount_;
+                }
+                NotifyRest(sink, incoming);
+            }
+
+            // convenience version that hands the trades back in a vector.
+            Trades AddOrder(const Order& order){
+                TradeBuffer trades;
+                AddOrder(order, trades);
+                return trades.GetTrades();
+            }
+            
+            // method to REMOVE an order from the orderbook if it is cancelled. The slot gives us the order AND its place in the level, so this is O(1) with no allocation.
+            // returns false if the order is not in the book.
+            template <ExecutionSink Sink>
+            bool CancelOrder(OrderId orderId, Sink& sink){
+                OrderSlot slot = orders_.Extract(orderId);
+                if (slot == kNoSlot){
+                    return false;
+                }
+                ++activity_.cancels_;
+                NotifyCancel(sink, pool_[slot]);
+                RemoveResting(slot);
+                return true;
+            }
+
+            bool CancelOrder(OrderId orderId){
+                NullSink sink;
+                return CancelOrder(orderId, sink);
+            }
+
+            
+            template <ExecutionSink Sink>
+            void MatchOrder(OrderModify order, Sink& sink){
+                OrderSlot slot = orders_.Extract(order.GetOrderId());
+                if (slot == kNoSlot){
+                    return;
+                }
+
+                // fetch information of an order, cancel the order, and add the modified version back.
+                OrderType type = pool_[slot].GetOrderType();
+                ++activity_.cancels_;
+                NotifyCancel(sink, pool_[slot]);
+                RemoveResting(slot);
+                AddOrder(order.ToOrder(type), sink);
+            }
+
+            Trades MatchOrder(OrderModify order){
+                TradeBuffer trades;
+                MatchOrder(order, trades);
+                return trades.GetTrades();
+            }
+
+            std::size_t Size() const { return orders_.Size();}
+
+            bool Contains(OrderId orderId) const { return orders_.Find(orderId) != kNoSlot; }
+
+            // Clear all orders from the orderbook. The pool drops every order in O(1), so this only costs O(levels) for the ladders.
+            void Clear() {
+                bids_.Clear();
+                asks_.Clear();
+                orders_.Clear();
+                pool_.Reset();
+                bidCount_ = 0;
+                askCount_ = 0;
+            }
+
+            // Get the best bid and ask prices (-1 if empty)
+            std::pair<Price, Price> GetBestPrices() const {
+                Price bestBid = bids_.Empty() ? -1 : bids_.BestPrice();
+                Price bestAsk = asks_.Empty() ? -1 : asks_.BestPrice();
+                return {bestBid, bestAsk};
+            }
+
+            // Count remaining bids and asks (O(1), the counts are maintained as orders come and go)
+            std::pair<std::size_t, std::size_t> GetOrderCounts() const {
+                return {bidCount_, askCount_};
+            }
+
+            const BookActivity& GetActivity() const { return activity_; }
+
+            // Get number of price levels
+            std::pair<std::size_t, std::size_t> GetLevelCounts() const {
+                return {bids_.Size(), asks_.Size()};
+            }
+
+            OrderBookLevelInfo GetOrderInfos() const{
+                // alias for a LevelInfo vector, and we allocate memory in each LevelInfos (one entry per live level).
+                LevelInfos askinfos, bidinfos;
+                bidinfos.reserve(bids_.Size());
+                askinfos.reserve(asks_.Size());
+
+                // this is a lambda function that takes a Price and the queue of orders at that price, and returns a LevelInfo struct (struct has Price and TotalQuantity).
+                // the queue already keeps the total remaining quantity of its orders, so this is O(1) per level. Tells us how many shares are "up for consideration".
+                auto CreateLevelInfos = [](Price price, const OrderQueue& orders){
+                    return LevelInfo{ price, static_cast<Quantity>(orders.quantity_), orders.count_ };
+                };
+
+                // finally, for each pricelevel in bids_, we take the pricelevel & OrderQueue (which holds the level's totals)
+                // and push that number back to bidinfos and askinfos.
+                bids_.ForEach([&](Price price, const OrderQueue& orders){
+                    bidinfos.push_back(CreateLevelInfos(price, orders));
+                });
+                
+                asks_.ForEach([&](Price price, const OrderQueue& orders){
+                    askinfos.push_back(CreateLevelInfos(price, orders));
+                });
+                // in the end, bidinfos and askinfos is a vector of the "LevelInfo" object, which stores price-totalquantity pair(s). 
+                // helps us find the liquidity of shares at certain prices, using asks/bids.
+                return OrderBookLevelInfo(askinfos, bidinfos);
+            }
+
+            // for snapshots: onLevel(side, price, count) for every level from the best price outwards (bids, then asks), each followed by
+            // onOrder(order) for its orders in FIFO order.
+            template <typename LevelFn, typename OrderFn>
+            void ForEachLevel(LevelFn&& onLevel, OrderFn&& onOrder) const{
+                bids_.ForEach([&](Price price, const OrderQueue& orders){
+                    onLevel(Side::Buy, price, orders.count_);
+                    orders.ForEach(pool_, onOrder);
+                });
+                asks_.ForEach([&](Price price, const OrderQueue& orders){
+                    onLevel(Side::Sell, price, orders.count_);
+                    orders.ForEach(pool_, onOrder);
+                });
+            }
+
+            // for loading a snapshot: puts the order straight at the back of its level, no matching (the book in a snapshot wasn't crossed,
+            // and its orders come in FIFO order). The order isn't in the id index yet: hand every (id, slot) to IndexRestored() once the
+            // book is loaded, which indexes them far faster than one at a time.
+            OrderSlot RestoreOrder(const Order& order){
+                OrderSlot slot = pool_.Allocate(order);
+                if (order.GetSide() == Side::Buy){
+                    bids_[order.GetPrice()].PushBack(pool_, slot);
+                    ++bidCount_;
+                }else{
+                    asks_[order.GetPrice()].PushBack(pool_, slot);
+                    ++askCount_;
+                }
+                return slot;
+            }
+
+            // false if an id came up twice (the book is then only fit to be thrown away).
+            bool IndexRestored(std::span<const std::pair<OrderId, OrderSlot>> restored){ return orders_.InsertAll(restored); }
+
+};
@@ -0,0 +1,196 @@
+#pragma once
+
+// Binary order-entry protocol (the TCP port next to the HTTP endpoints, see --binary-port).
+//
+// Every message is a fixed-layout, packed, little-endian struct that starts with a MessageHeader. length_ is the size of the whole
+// message (header included), so a reader can always tell where the next message starts. A session is a plain TCP connection that
+// stays open; clients may pipeline as many messages as they like without waiting for the replies, which come back in request order.
+//
+//  client -> engine: NewOrder, Cancel, Modify, Summary
+//  engine -> client: ExecReport (one or more per request), Reject, BookSummary
+//
+// Every request gets at least one reply message, and the last one has kFlagLastInReply set in its header, so a client that pipelines
+// can tell where the replies to one request end and the next ones begin.
+//
+// Book names are at most kBookNameSize - 1 characters, zero padded.
+//
+// The same encoding also serves as a compact /batch body (Content-Type kBatchContentType), which saves the Go side marshalling and the
+// engine parsing hundreds of thousands of JSON objects:
+//
+//   BatchHeader, then bookCount_ book names (kBookNameSize each), then orderCount_ records of recordSize_ bytes each, starting with a
+//   BatchOrder. Orders name their book by its index in the table, so every name is sent (and looked up) once.
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+static_assert(std::endian::native == std::endian::little, "the wire format is little-endian and we copy structs straight onto the wire");
+
+namespace wire{
+
+constexpr std::size_t kBookNameSize = 32;
+
+enum class MessageType : std::uint8_t{
+    NewOrder = 1,
+    Cancel = 2,
+    Modify = 3,
+    ExecReport = 4,
+    Reject = 5,
+    Summary = 6,
+    BookSummary = 7
+};
+
+constexpr std::uint8_t kFlagLastInReply = 1;
+
+enum class WireSide : std::uint8_t{
+    Buy = 0,
+    Sell = 1
+};
+
+enum class WireOrderType : std::uint8_t{
+    GoodTillCancel = 0,
+    FillAndKill = 1
+};
+
+enum class ExecType : std::uint8_t{
+    New = 0,        // (remainder) rests in the book, leaves_ is what rests
+    Trade = 1,      // one fill: price_/quantity_ of the fill, counterparty_ is the resting order
+    Cancelled = 2,  // cancel ack, or the unfilled part of a fillandkill that was dropped (quantity_)
+    Replaced = 3    // modify accepted: the old order is gone, the reports for the new one follow
+};
+
+enum class RejectReason : std::uint8_t{
+    Malformed = 0,        // unknown message type or bad field
+    DuplicateOrderId = 1,
+    UnknownOrder = 2,     // cancel/modify for an id that is not in the book
+    NoLiquidity = 3,      // fillandkill that could not match anything
+    EngineError = 4
+};
+
+#pragma pack(push, 1)
+
+struct MessageHeader{
+    std::uint16_t length_;
+    MessageType type_;
+    std::uint8_t flags_;
+};
+
+struct NewOrder{
+    MessageHeader header_;
+    std::uint64_t orderId_;
+    std::int32_t price_;
+    std::uint32_t quantity_;
+    WireSide side_;
+    WireOrderType orderType_;
+    std::uint8_t reserved_[2];
+    char book_[kBookNameSize];
+};
+
+struct Cancel{
+    MessageHeader header_;
+    std::uint64_t orderId_;
+    char book_[kBookNameSize];
+};
+
+// same order id, new side/price/quantity. The order keeps its type and loses its time priority.
+struct Modify{
+    MessageHeader header_;
+    std::uint64_t orderId_;
+    std::int32_t price_;
+    std::uint32_t quantity_;
+    WireSide side_;
+    std::uint8_t reserved_[3];
+    char book_[kBookNameSize];
+};
+
+struct ExecReport{
+    MessageHeader header_;
+    std::uint64_t orderId_;
+    std::uint64_t counterparty_;
+    std::int32_t price_;
+    std::uint32_t quantity_;
+    std::uint32_t leaves_;
+    ExecType execType_;
+    std::uint8_t reserved_[3];
+};
+
+struct Reject{
+    MessageHeader header_;
+    std::uint64_t orderId_;
+    MessageType rejected_;
+    RejectReason reason_;
+    std::uint8_t reserved_[2];
+};
+
+// asks for the state of one book (what /batch reports per book).
+struct Summary{
+    MessageHeader header_;
+    char book_[kBookNameSize];
+};
+
+// prices are -1 for an empty side.
+struct BookSummary{
+    MessageHeader header_;
+    std::uint32_t bidCount_;
+    std::uint32_t askCount_;
+    std::int32_t bestBid_;
+    std::int32_t bestAsk_;
+    std::uint32_t bidLevels_;
+    std::uint32_t askLevels_;
+};
+
+struct BatchHeader{
+    std::uint32_t magic_;       // kBatchMagic
+    std::uint16_t version_;     // kBatchVersion
+    std::uint16_t bookCount_;
+    std::uint32_t orderCount_;
+    std::uint16_t recordSize_;  // at least sizeof(BatchOrder); readers skip whatever a newer writer appends to each record
+    std::uint16_t reserved_;
+};
+
+struct BatchOrder{
+    std::uint64_t orderId_;
+    std::int32_t price_;
+    std::uint32_t quantity_;
+    std::uint16_t book_;        // index into the book table
+    WireSide side_;
+    WireOrderType orderType_;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(NewOrder) == 56);
+static_assert(sizeof(Cancel) == 44);
+static_assert(sizeof(Modify) == 56);
+static_assert(sizeof(ExecReport) == 36);
+static_assert(sizeof(Reject) == 16);
+static_assert(sizeof(Summary) == 36);
+static_assert(sizeof(BookSummary) == 28);
+static_assert(sizeof(BatchHeader) == 16);
+static_assert(sizeof(BatchOrder) == 20);
+
+constexpr std::string_view kBatchContentType = "application/x-orderbook-batch";
+constexpr std::uint32_t kBatchMagic = 0x3142424F; // "OBB1"
+constexpr std::uint16_t kBatchVersion = 1;
+
+// largest message a client can send; anything claiming to be longer means the stream is corrupt.
+constexpr std::size_t kMaxMessageSize = 64;
+
+template <typename Message>
+constexpr MessageHeader HeaderFor(MessageType type){
+    return MessageHeader{ static_cast<std::uint16_t>(sizeof(Message)), type, 0 };
+}
+
+inline std::string_view BookView(const char (&book)[kBookNameSize]){
+    return std::string_view(book, std::find(book, book + kBookNameSize, '\0') - book);
+}
+
+inline void SetBook(char (&book)[kBookNameSize], std::string_view name){
+    std::memset(book, 0, kBookNameSize);
+    std::memcpy(book, name.data(), name.size() < kBookNameSize ? name.size() : kBookNameSize - 1);
+}
+
+} // namespace wire
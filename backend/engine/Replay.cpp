@@ -0,0 +1,362 @@
+// Replays a recorded journal (Journal.h) straight through Orderbook, with no server, HTTP, JSON or Go in the way, so changes to the
+// matching core can be measured on their own and reproduced exactly.
+//
+// Build (next to the engine):  g++ -std=c++23 -O2 Replay.cpp -pthread -o replay
+// Usage: replay DIR [--name=NAME] [--after=SEQ] [--ladder-levels=N] [--tick-size=N] [--expected-orders=N] [--huge-pages] [--id-index=hash|direct]
+//
+// DIR is an engine's --journal directory. To record a workload, run the engine with --journal=DIR (and without --snapshot-interval, which
+// deletes the journal a snapshot covers) and send it the orders. Every journal in DIR (shard-0, shard-1, ...) is replayed one after the
+// other unless --name picks one; the shards' books are disjoint, so that ends with the same books the engine had. The book options are
+// the engine's, and should match what it ran with.
+//
+// The journal is mapped and decoded up front (CRC checks, wire decoding and finding the book are not what we are measuring). Then it is
+// replayed twice, each time on fresh books:
+//   1. flat out, for messages per second;
+//   2. with a clock read around every message, for the latency histogram (so it includes the clock's own cost, which is printed too).
+// Both runs have to end with the same book checksum (FNV-1a over every resting order, by book, level and FIFO position). It is printed
+// so runs before and after a change can be compared: an optimisation must not change it.
+
+#include "Orderbook.h"
+#include "Protocol.h"
+#include "Journal.h"
+#include "Histogram.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <format>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+
+enum class StepType : uint8_t {
+    NewOrder,
+    Cancel,
+    Modify,
+    Reset
+};
+
+// one decoded journal record. book_ is an index into Recording::books_ (for a Reset, kAllBooks unless it cleared just one book).
+struct Step {
+    OrderId id_;
+    Price price_;
+    Quantity quantity_;
+    uint32_t book_;
+    StepType type_;
+    Side side_;
+    OrderType orderType_;
+};
+
+constexpr uint32_t kAllBooks = UINT32_MAX;
+
+struct Recording {
+    std::vector<std::string> books_;
+    std::unordered_map<std::string, uint32_t> bookIndex_;
+    std::vector<Step> steps_;
+    size_t newOrders_ = 0;
+    size_t cancels_ = 0;
+    size_t modifies_ = 0;
+    size_t resets_ = 0;
+    size_t skipped_ = 0; // records the engine would have rejected as malformed (it doesn't apply those either)
+
+    uint32_t BookOf(const char (&name)[wire::kBookNameSize]) {
+        return BookOf(wire::BookView(name));
+    }
+
+    uint32_t BookOf(std::string_view name) {
+        std::string book(name);
+        auto [it, inserted] = bookIndex_.try_emplace(book, static_cast<uint32_t>(books_.size()));
+        if (inserted) {
+            books_.push_back(book);
+        }
+        return it->second;
+    }
+
+    // same checks as the engine's DecodeWireCommand, so the same records get applied.
+    void Add(uint8_t kind, std::string_view payload) {
+        if (kind == static_cast<uint8_t>(journal::RecordKind::Reset)) {
+            // the payload names the one book that was cleared, or is empty if they all were
+            uint32_t book = payload.empty() ? kAllBooks : BookOf(payload);
+            steps_.push_back(Step{ 0, 0, 0, book, StepType::Reset, Side::Buy, OrderType::GoodTillCancel });
+            ++resets_;
+            return;
+        }
+        wire::MessageHeader header;
+        if (kind != static_cast<uint8_t>(journal::RecordKind::Command) || payload.size() < sizeof(header)) {
+            ++skipped_;
+            return;
+        }
+        std::memcpy(&header, payload.data(), sizeof(header));
+        if (header.type_ == wire::MessageType::NewOrder && payload.size() == sizeof(wire::NewOrder)) {
+            wire::NewOrder message;
+            std::memcpy(&message, payload.data(), sizeof(message));
+            if (message.side_ > wire::WireSide::Sell || message.orderType_ > wire::WireOrderType::FillAndKill) {
+                ++skipped_;
+                return;
+            }
+            steps_.push_back(Step{ message.orderId_, message.price_, message.quantity_, BookOf(message.book_), StepType::NewOrder,
+                message.side_ == wire::WireSide::Buy ? Side::Buy : Side::Sell,
+                message.orderType_ == wire::WireOrderType::GoodTillCancel ? OrderType::GoodTillCancel : OrderType::FillAndKill });
+            ++newOrders_;
+        } else if (header.type_ == wire::MessageType::Cancel && payload.size() == sizeof(wire::Cancel)) {
+            wire::Cancel message;
+            std::memcpy(&message, payload.data(), sizeof(message));
+            steps_.push_back(Step{ message.orderId_, 0, 0, BookOf(message.book_), StepType::Cancel, Side::Buy, OrderType::GoodTillCancel });
+            ++cancels_;
+        } else if (header.type_ == wire::MessageType::Modify && payload.size() == sizeof(wire::Modify)) {
+            wire::Modify message;
+            std::memcpy(&message, payload.data(), sizeof(message));
+            if (message.side_ > wire::WireSide::Sell) {
+                ++skipped_;
+                return;
+            }
+            steps_.push_back(Step{ message.orderId_, message.price_, message.quantity_, BookOf(message.book_), StepType::Modify,
+                message.side_ == wire::WireSide::Buy ? Side::Buy : Side::Sell, OrderType::GoodTillCancel });
+            ++modifies_;
+        } else {
+            ++skipped_;
+        }
+    }
+};
+
+// counts what came out, so the work can't be optimised away and the two runs can be compared.
+struct CountingSink {
+    uint64_t trades_ = 0;
+    uint64_t rested_ = 0;
+    uint64_t cancelled_ = 0;
+    uint64_t rejected_ = 0;
+
+    void OnTrade(const Trade&) { ++trades_; }
+    void OnRest(const Order&) { ++rested_; }
+    void OnCancel(const Order&) { ++cancelled_; }
+    void OnReject(const Order&) { ++rejected_; }
+
+    bool operator==(const CountingSink&) const = default;
+};
+
+// the books of one run. Like the engine, a book comes into being with the first command that names it, and a reset drops every book
+// or the one it names (they are only freed after the run, the engine also unmaps them off the matching thread).
+class Replayer {
+    public:
+        Replayer(const Recording& recording, const BookConfig& config):
+            recording_(recording),
+            config_(config),
+            books_(recording.books_.size()) {}
+
+        void Apply(const Step& step) {
+            if (step.type_ == StepType::Reset) {
+                if (step.book_ != kAllBooks) {
+                    if (books_[step.book_]) {
+                        retired_.push_back(std::move(books_[step.book_]));
+                    }
+                    return;
+                }
+                for (auto& book : books_) {
+                    if (book) {
+                        retired_.push_back(std::move(book));
+                    }
+                }
+                return;
+            }
+            std::unique_ptr<Orderbook>& book = books_[step.book_];
+            if (!book) {
+                book = std::make_unique<Orderbook>(config_);
+            }
+            switch (step.type_) {
+                case StepType::NewOrder:
+                    book->AddOrder(Order(step.orderType_, step.side_, step.price_, step.quantity_, step.id_), sink_);
+                    break;
+                case StepType::Cancel:
+                    book->CancelOrder(step.id_, sink_);
+                    break;
+                case StepType::Modify:
+                    book->MatchOrder(OrderModify(step.id_, step.side_, step.price_, step.quantity_), sink_);
+                    break;
+                case StepType::Reset:
+                    break;
+            }
+        }
+
+        const CountingSink& Sink() const { return sink_; }
+
+        // FNV-1a over the books in name order: each book's name, then every level (side, price, order count) from the best price out,
+        // each followed by its orders (id, quantities, type) in FIFO order.
+        uint64_t Checksum(size_t& bookCount, size_t& orderCount) const {
+            uint64_t hash = 0xcbf29ce484222325ULL;
+            auto mix = [&](const void* data, size_t size) {
+                const unsigned char* bytes = static_cast<const unsigned char*>(data);
+                for (size_t i = 0; i < size; ++i) {
+                    hash = (hash ^ bytes[i]) * 0x100000001b3ULL;
+                }
+            };
+            std::vector<uint32_t> order(books_.size());
+            for (uint32_t i = 0; i < order.size(); ++i) {
+                order[i] = i;
+            }
+            std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return recording_.books_[a] < recording_.books_[b]; });
+
+            bookCount = 0;
+            orderCount = 0;
+            for (uint32_t index : order) {
+                if (!books_[index]) {
+                    continue;
+                }
+                ++bookCount;
+                orderCount += books_[index]->Size();
+                mix(recording_.books_[index].data(), recording_.books_[index].size() + 1);
+                books_[index]->ForEachLevel(
+                    [&](Side side, Price price, uint32_t count) {
+                        uint8_t sideByte = side == Side::Buy ? 0 : 1;
+                        mix(&sideByte, sizeof(sideByte));
+                        mix(&price, sizeof(price));
+                        mix(&count, sizeof(count));
+                    },
+                    [&](const Order& resting) {
+                        OrderId id = resting.GetOrderId();
+                        Quantity initial = resting.GetInitialQuantity();
+                        Quantity remaining = resting.GetRemainingQuantity();
+                        uint8_t type = resting.GetOrderType() == OrderType::GoodTillCancel ? 0 : 1;
+                        mix(&id, sizeof(id));
+                        mix(&initial, sizeof(initial));
+                        mix(&remaining, sizeof(remaining));
+                        mix(&type, sizeof(type));
+                    });
+            }
+            return hash;
+        }
+
+    private:
+        const Recording& recording_;
+        BookConfig config_;
+        std::vector<std::unique_ptr<Orderbook>> books_;
+        std::vector<std::unique_ptr<Orderbook>> retired_;
+        CountingSink sink_;
+};
+
+double Milliseconds(std::chrono::steady_clock::duration elapsed) {
+    return std::chrono::duration<double, std::milli>(elapsed).count();
+}
+
+// what a steady_clock read costs here (the median of many back-to-back pairs), since run 2 pays it for every message.
+uint64_t ClockOverhead() {
+    LatencyHistogram histogram;
+    for (int i = 0; i < 100000; ++i) {
+        auto start = std::chrono::steady_clock::now();
+        auto end = std::chrono::steady_clock::now();
+        histogram.Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+    }
+    return histogram.Percentile(50);
+}
+
+} // namespace
+
+int main(int argc, char* argv[]) {
+    if (argc < 2 || std::string_view(argv[1]).starts_with("--")) {
+        std::cerr << "Usage: replay DIR [--name=NAME] [--after=SEQ] [--ladder-levels=N] [--tick-size=N] [--expected-orders=N] [--huge-pages] [--id-index=hash|direct]\n";
+        return 1;
+    }
+    std::string directory = argv[1];
+    std::vector<std::string> names;
+    uint64_t after = 0;
+    BookConfig config;
+    for (int i = 2; i < argc; i++) {
+        std::string arg = argv[i];
+        try {
+            if (arg.starts_with("--name=")) {
+                names.push_back(arg.substr(7));
+            } else if (arg.starts_with("--after=")) {
+                after = std::stoull(arg.substr(8));
+            } else if (arg.starts_with("--ladder-levels=")) {
+                config.ladderLevels_ = std::stoul(arg.substr(16));
+            } else if (arg.starts_with("--tick-size=")) {
+                config.tickSize_ = std::stoi(arg.substr(12));
+            } else if (arg.starts_with("--expected-orders=")) {
+                config.expectedOrders_ = std::stoull(arg.substr(18));
+            } else if (arg == "--huge-pages") {
+                config.hugePages_ = true;
+            } else if (arg.starts_with("--id-index=")) {
+                config.indexMode_ = arg.substr(11) == "direct" ? IndexMode::Direct : IndexMode::Hashed;
+            } else {
+                std::cerr << "Unknown argument " << arg << "\n";
+                return 1;
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Invalid argument " << arg << "\n";
+            return 1;
+        }
+    }
+    if (names.empty()) {
+        names = journal::ListJournals(directory);
+    }
+
+    // load: map every journal and decode it into steps.
+    Recording recording;
+    auto loadStart = std::chrono::steady_clock::now();
+    for (const std::string& name : names) {
+        size_t before = recording.steps_.size() + recording.skipped_;
+        uint64_t last = journal::Replay(directory, name, after, [&](uint64_t, uint8_t kind, std::string_view payload) {
+            recording.Add(kind, payload);
+        });
+        std::cout << std::format("{}: {} records, up to sequence {}\n", name, recording.steps_.size() + recording.skipped_ - before, last);
+    }
+    double loadMs = Milliseconds(std::chrono::steady_clock::now() - loadStart);
+    if (recording.steps_.empty()) {
+        std::cerr << "No journal records to replay in " << directory
+                  << " (a journal that snapshots deleted the start of needs --after=SEQ, the sequence before its first segment)\n";
+        return 1;
+    }
+    std::cout << std::format("loaded {} messages for {} books in {:.1f} ms: {} new orders, {} cancels, {} modifies, {} resets ({} malformed records skipped)\n",
+        recording.steps_.size(), recording.books_.size(), loadMs, recording.newOrders_, recording.cancels_, recording.modifies_,
+        recording.resets_, recording.skipped_);
+
+    // run 1: throughput
+    Replayer flatOut(recording, config);
+    auto runStart = std::chrono::steady_clock::now();
+    for (const Step& step : recording.steps_) {
+        flatOut.Apply(step);
+    }
+    double runMs = Milliseconds(std::chrono::steady_clock::now() - runStart);
+    const CountingSink& sink = flatOut.Sink();
+    std::cout << std::format("run 1: {} messages in {:.1f} ms, {:.2f}M msgs/s, {:.0f} ns/msg ({} trades, {} rested, {} cancelled, {} rejected)\n",
+        recording.steps_.size(), runMs, static_cast<double>(recording.steps_.size()) / runMs / 1000.0,
+        runMs * 1e6 / static_cast<double>(recording.steps_.size()), sink.trades_, sink.rested_, sink.cancelled_, sink.rejected_);
+
+    // run 2: latency of every message
+    uint64_t overhead = ClockOverhead();
+    LatencyHistogram histogram;
+    Replayer timed(recording, config);
+    for (const Step& step : recording.steps_) {
+        auto start = std::chrono::steady_clock::now();
+        timed.Apply(step);
+        auto end = std::chrono::steady_clock::now();
+        histogram.Record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count()));
+    }
+    std::cout << std::format("run 2: latency per message in ns (includes ~{} ns of clock reads)\n", overhead);
+    std::cout << std::format("  min {}  p50 {}  p90 {}  p99 {}  p99.9 {}  p99.99 {}  max {}\n", histogram.Min(), histogram.Percentile(50),
+        histogram.Percentile(90), histogram.Percentile(99), histogram.Percentile(99.9), histogram.Percentile(99.99), histogram.Max());
+    std::cout << std::format("  {:>12} {:>12} {:>12} {:>8} {:>8}\n", "from", "to", "count", "%", "cum %");
+    uint64_t seen = 0;
+    histogram.ForEachBucket([&](uint64_t lower, uint64_t upper, uint64_t count) {
+        seen += count;
+        std::cout << std::format("  {:>12} {:>12} {:>12} {:>8.3f} {:>8.3f}\n", lower, upper, count,
+            100.0 * static_cast<double>(count) / static_cast<double>(histogram.Count()),
+            100.0 * static_cast<double>(seen) / static_cast<double>(histogram.Count()));
+    });
+
+    size_t bookCount = 0;
+    size_t orderCount = 0;
+    uint64_t checksum = flatOut.Checksum(bookCount, orderCount);
+    size_t timedBooks = 0;
+    size_t timedOrders = 0;
+    if (timed.Checksum(timedBooks, timedOrders) != checksum || !(timed.Sink() == flatOut.Sink())) {
+        std::cerr << "The two runs ended with different books: the replay is not deterministic\n";
+        return 1;
+    }
+    std::cout << std::format("checksum {:016x} ({} books, {} resting orders)\n", checksum, bookCount, orderCount);
+    return 0;
+}
@@ -0,0 +1,227 @@
+#pragma once
+
+// Single-writer sequencer.
+//
+// HTTP worker threads used to take one global mutex around every book, so with many clients they spent their time queueing on that lock
+// (and being put to sleep / woken up by the kernel). Now they only decode the request, push a small fixed-size command into a bounded
+// lock-free ring, and wait on a completion slot. One sequencer thread pops commands and applies them in order, so it is the only thread
+// that ever touches the books: no lock in the matching path, and a single well defined order of events.
+//
+// The sequencer spins for a short while when the ring is empty and then parks on an atomic, so an idle engine doesn't burn a core.
+// It can be pinned to a CPU (see PinCurrentThread) when the machine has cores to spare.
+
+#include <atomic>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+inline void CpuRelax(){
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+// pins the calling thread to one CPU. Only Linux lets us do that; elsewhere it's a no-op and returns false.
+inline bool PinCurrentThread(int cpu){
+#if defined(__linux__)
+    if (cpu < 0){ return false; }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+// Bounded multi-producer / single-consumer ring (Dmitry Vyukov's bounded queue, with the pop side simplified because only one thread pops).
+// Every cell carries a sequence number: a producer claims a position with a CAS on enqueuePos_, writes the value, then publishes it by
+// bumping the cell's sequence. The consumer only reads a cell once its sequence says it has been published.
+template <typename T, std::size_t Capacity>
+class MpscRing{
+    static_assert(std::has_single_bit(Capacity), "capacity must be a power of two");
+    static_assert(std::is_trivially_copyable_v<T>, "ring elements are copied around with plain assignment");
+
+    public:
+        MpscRing(){
+            for (std::size_t i = 0; i < Capacity; ++i){
+                cells_[i].sequence_.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        MpscRing(const MpscRing&) = delete;
+        MpscRing& operator=(const MpscRing&) = delete;
+
+        // false if the ring is full.
+        bool TryPush(const T& value){
+            std::size_t position = enqueuePos_.load(std::memory_order_relaxed);
+            while (true){
+                Cell& cell = cells_[position & kMask];
+                std::size_t sequence = cell.sequence_.load(std::memory_order_acquire);
+                auto diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(position);
+                if (diff == 0){
+                    if (enqueuePos_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)){
+                        cell.value_ = value;
+                        cell.sequence_.store(position + 1, std::memory_order_release);
+                        return true;
+                    }
+                }else if (diff < 0){
+                    return false;
+                }else{
+                    position = enqueuePos_.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // consumer only.
+        bool TryPop(T& value){
+            Cell& cell = cells_[dequeuePos_ & kMask];
+            if (cell.sequence_.load(std::memory_order_acquire) != dequeuePos_ + 1){ return false; }
+            value = cell.value_;
+            cell.sequence_.store(dequeuePos_ + Capacity, std::memory_order_release);
+            ++dequeuePos_;
+            return true;
+        }
+
+        // consumer only: is there something published at the head?
+        bool HasPending() const{
+            return cells_[dequeuePos_ & kMask].sequence_.load(std::memory_order_acquire) == dequeuePos_ + 1;
+        }
+
+    private:
+        static constexpr std::size_t kMask = Capacity - 1;
+
+        struct alignas(64) Cell{
+            std::atomic<std::size_t> sequence_;
+            T value_;
+        };
+
+        alignas(64) std::atomic<std::size_t> enqueuePos_{0};
+        alignas(64) std::size_t dequeuePos_ = 0;
+        Cell cells_[Capacity];
+};
+
+// Where the sequencer leaves the outcome of a command. It lives on the waiting thread's stack.
+// Signal() goes 0 -> 1 (result written), notifies, then 1 -> 2. The waiter only returns once it sees 2, so the sequencer is completely
+// done with the slot (including the notify) before the slot can go out of scope.
+class Completion{
+    public:
+        void Signal(){
+            state_.store(1, std::memory_order_release);
+            state_.notify_one();
+            state_.store(2, std::memory_order_release);
+        }
+
+        void Wait(){
+            while (true){
+                std::uint32_t state = state_.load(std::memory_order_acquire);
+                if (state == 2){ return; }
+                if (state == 0){ state_.wait(0, std::memory_order_acquire); }
+                else{ CpuRelax(); }
+            }
+        }
+
+        // makes the slot usable for another command. Only once Wait() has returned (nobody else refers to it by then).
+        void Rearm() { state_.store(0, std::memory_order_relaxed); }
+
+    private:
+        std::atomic<std::uint32_t> state_{0};
+};
+
+// Owns the ring and the thread that drains it. Handler is called on the sequencer thread, once per command, in ring order.
+template <typename Command, std::size_t Capacity = 4096>
+class Sequencer{
+    public:
+        using Handler = std::function<void(Command&)>;
+
+        Sequencer() = default;
+        Sequencer(const Sequencer&) = delete;
+        Sequencer& operator=(const Sequencer&) = delete;
+        ~Sequencer() { Stop(); }
+
+        // cpu < 0 leaves the thread unpinned.
+        void Start(Handler handler, int cpu = -1){
+            handler_ = std::move(handler);
+            stopping_.store(false);
+            thread_ = std::thread([this, cpu]{
+                PinCurrentThread(cpu);
+                Run();
+            });
+        }
+
+        // applies everything already queued, then stops the thread.
+        void Stop(){
+            if (!thread_.joinable()){ return; }
+            stopping_.store(true);
+            Wake();
+            thread_.join();
+        }
+
+        // called from any thread. If the ring is full we back off until the sequencer catches up (backpressure, nothing is dropped).
+        void Submit(const Command& command){
+            while (!ring_.TryPush(command)){
+                Wake();
+                std::this_thread::yield();
+            }
+            Wake();
+        }
+
+    private:
+        static constexpr int kSpinsBeforePark = 4096;
+
+        void Run(){
+            Command command;
+            int idle = 0;
+            while (true){
+                if (ring_.TryPop(command)){
+                    handler_(command);
+                    idle = 0;
+                    continue;
+                }
+                if (stopping_.load()){ break; }
+                if (++idle < kSpinsBeforePark){
+                    CpuRelax();
+                    continue;
+                }
+                Park();
+                idle = 0;
+            }
+        }
+
+        // Dekker style handshake with Wake(): we announce we're going to sleep and then look at the ring again, the producer publishes
+        // its command and then looks at sleeping_. With seq_cst on both sides at least one of us sees the other.
+        void Park(){
+            sleeping_.store(true, std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (ring_.HasPending() || stopping_.load()){
+                sleeping_.store(false, std::memory_order_relaxed);
+                return;
+            }
+            sleeping_.wait(true, std::memory_order_acquire);
+        }
+
+        void Wake(){
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (sleeping_.load(std::memory_order_relaxed) && sleeping_.exchange(false)){
+                sleeping_.notify_one();
+            }
+        }
+
+        MpscRing<Command, Capacity> ring_;
+        alignas(64) std::atomic<bool> sleeping_{false};
+        std::atomic<bool> stopping_{false};
+        Handler handler_;
+        std::thread thread_;
+};
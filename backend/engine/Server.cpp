@@ -1,603 +1,1158 @@
 #include "httplib.h"
+#include "Logger.h"
+#include "Sequencer.h"
+#include "Protocol.h"
+#include "ShmRing.h"
+#include "BatchDecoder.h"
+#include "Journal.h"
+#include "Snapshot.h"
+#include "Orderbook.h"
+#include "Metrics.h"
 #include <iostream>
 #include <string>
 #include <map>
 #include <unordered_map>
 #include <set>
-#include <list>
 #include <cmath>
 #include <ctime>
+#include <cstddef>
 #include <cstdint>
+#include <cstring>
 #include <vector>
 #include <format>
 #include <stdexcept>
 #include <memory>
 #include <iterator>
-#include <numeric>
+#include <exception>
+#include <string_view>
+#include <span>
 #include <atomic>
-#include <mutex>
+#include <bit>
+#include <algorithm>
+#include <type_traits>
+#include <new>
+#include <utility>
+#include <tuple>
+#include <chrono>
+#include <filesystem>
+
+#if defined(__linux__)
+#include <cerrno>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+#if defined(__APPLE__)
+#include <cerrno>
+#include <unistd.h> // SignalReady
+#endif
 
 using namespace std;
 
-// "Order"s will have two Time Enforcement options.
-enum class OrderType{
-    GoodTillCancel,
-    FillAndKill
-};
-
-// "Order"s will have a Side. Side::Buy or Side::Sell
-enum class Side{
-    Buy,
-    Sell
-};
+OrderType setType(string type){
+    if (type == "goodtillcancel"){
+        return OrderType::GoodTillCancel;
+    }else{
+        return OrderType::FillAndKill;
+    }
+}
 
-// alias types
-using Price = std::int32_t; // price can be negative
-using Quantity = std::uint32_t;
-using OrderId = std::uint64_t;
+Side setSide(string side){
+    if (side == "buy"){
+        return Side::Buy;
+    }else{
+        return Side::Sell;
+    }
+}
 
-// in cpp we denote "member varaibles" (i.e not parameters) with a "_".
+struct Counter{
+    uint64_t count = 0;
 
-struct LevelInfo{
-    Price price_;
-    Quantity quantity_;
+    uint64_t GetNext(){
+        return ++count;
+    }
+    uint64_t GetCurrent(){
+        return count;
+    }
 };
 
-// LevelInfos stores all the Quantity's at a certain price (level).
-using LevelInfos = std::vector<LevelInfo>;
+using BookMap = std::unordered_map<string, Orderbook>; // each shard owns one of these (see Shard)
+BookConfig gBookConfig; // set once in main() from the command line, used for every book we create.
 
-// OrderBookLevelInfo stores the vectors for asks and bids for all prices.
-class OrderBookLevelInfo{
-    // we need seperate vectors for bids and asks
-    public:
-        OrderBookLevelInfo(const LevelInfos& asks, const LevelInfos& bids):
-        // constructor instantiation
-        asks_(asks),
-        bids_(bids) {}
-
-        const LevelInfos& GetBids() const { return bids_; }
-        const LevelInfos& GetAsks() const { return asks_; }
-    
-    private:
-        LevelInfos bids_;
-        LevelInfos asks_;
-};
+// returns the book for a symbol, creating it with gBookConfig the first time we see the symbol. (owning shard's thread only)
+Orderbook& GetOrCreateBook(BookMap& books, const string& name){
+    return books.try_emplace(name, gBookConfig).first->second;
+}
 
-// What is added to the order book? Objets that have the order type, key, side, price, quantity, and bool(s) for filled or not
-// Order stores instances of an order (with all needed properties).
-class Order {
-    // A PUBLIC constructor can initialize private fields.
-    public:
-        Order(OrderType orderType, Side side, Price price, Quantity quantity, OrderId orderId): 
-            orderType_(orderType),
-            orderId_(orderId),
-            price_(price),
-            side_(side),
-            initialQuantity_(quantity),
-            remainingQuantity_(quantity) {}
+OrderType parse_ordertype(std::string_view type){
+    if (type == "GTC"){return OrderType::GoodTillCancel;}
+    else{return OrderType::FillAndKill;}
+}
 
-        // const in the function sig. means it will NOT alter the members (getts and setters, bools).
-        OrderId GetOrderId() const { return orderId_; }
-        Side GetSide() const { return side_; }
-        Price GetPrice() const { return price_; }
-        OrderType GetOrderType() const { return orderType_; }
-        Quantity GetInitialQuantity() const { return initialQuantity_; }
-        Quantity GetRemainingQuantity() const { return remainingQuantity_; }
-        Quantity FilledQuantity() const { return GetInitialQuantity() - GetRemainingQuantity();}
-        bool IsFilled() const { return GetRemainingQuantity() == 0;}
+Side parse_side(std::string_view side){
+    if (side=="BUY"){return Side::Buy;}
+    else{return Side::Sell;}
+}
 
-        void Fill(Quantity quantity){
-            // validate if the # of orders can actually be filled
-            if (quantity > GetRemainingQuantity()){
-                throw std::logic_error(std::format("Order ({}) cannot be filled for more than it's remaining quantity", GetOrderId()));
-            }
+// Use stoull (string to unsigned long long) for OrderId (uint64_t)
+OrderId parse_id(string id){
+    // This supports values up to 18 quintillion (uint64_t max)
+    uint64_t res = std::stoull(id); 
+    return res;
+}
 
-            remainingQuantity_ -= quantity; // it has been filled
-        }
+// Use stoul (string to unsigned long) for Quantity (uint32_t)
+Quantity parse_quantity(string quantity){
+    // This supports values up to 4.2 billion (uint32_t max)
+    uint32_t res = static_cast<uint32_t>(std::stoul(quantity));
+    return res;
+}
+
+// Keep parse_price as stoi since Price (int32_t) is a signed 32-bit integer.
+Price parse_price(string price){
+    return std::stoi(price);
+}
 
+// Structure to track batch statistics per book. It is an execution sink, so the book feeds it fills directly.
+struct BookStats {
+    int tradesExecuted = 0;
+    int64_t volumeTraded = 0;
 
-        // the reason we need this private section here is because without it, we declare the variables in our public: modifier, but never assign them a type.
-    private:
-        OrderType orderType_;
-        OrderId orderId_;
-        Price price_;
-        Side side_;
-        Quantity initialQuantity_;
-        Quantity remainingQuantity_;
+    void OnTrade(const Trade& trade) {
+        tradesExecuted++;
+        volumeTraded += trade.GetBidTrade().quantity_;
+    }
 };
 
-// Orders go into multiple data structures, so we will keep a pointer to orders. (reference semantics) so we can easily reference them.
-// std::make_shared<type>(); allocates order(s) on the heap, and returns a pointer pointing at it.
+using BatchStats = std::unordered_map<std::string, BookStats>;
 
-// So here, we have a vector of POINTERS to orders.
-using OrderPointer = std::shared_ptr<Order>;
-using OrderPointers = std::list<OrderPointer>; // we use a LIST because if we have orders at the same price, we want a FIFO order.
+std::string level_infos_to_json(const OrderBookLevelInfo& info, size_t size) {
+    auto convert_levels = [](const LevelInfos& levels, const std::string& type) {
+        std::string json_array = "[";
+        bool first = true;
+        for (const auto& level : levels) {
+            if (!first) {
+                json_array += ",";
+            }
+            json_array += std::format(
+                R"({{"type":"{}", "price":{}, "quantity":{}, "orders":{}}})",
+                type, level.price_, level.quantity_, level.orderCount_
+            );
+            first = false;
+        }
+        json_array += "]";
+        return json_array;
+    };
+
+    return std::format(
+        R"({{"bids":{}, "asks":{}, "size":{}}})",
+        convert_levels(info.GetBids(), "Bid"),
+        convert_levels(info.GetAsks(), "Ask"),
+        size
+    );
+}
 
-// Common functionality we need to support for orders:
+// NOTE: This relies on the OrderBookLevelInfo, LevelInfos, Price, and Quantity types being correctly defined earlier in Server.cpp.
 
-// Add() => we need a new order.
-// Cancel() => we need an existing valid order id.
-// Modify() => we need a way to modify existing orders, and we need to retrieve orders in a well manner.
+// "name":{...} for every book in one shard, comma separated, without the outer braces (the handler merges the shards and adds them).
+std::string orderbooks_to_json_entries(const BookMap& books) {
+    std::string json_output;
+    bool first = true;
 
-class OrderModify{
-    public:
-        OrderModify(OrderId orderId, Side side, Price price, Quantity quantity):
-        orderId_(orderId),
-        side_(side),
-        price_(price),
-        quantity_(quantity) {}
+    for (const auto& pair : books) {
+        if (!first) {
+            json_output += ",";
+        }
+        std::string book_name = pair.first;
+        const Orderbook& book = pair.second;
 
-    OrderId GetOrderId() const {return orderId_;}
-    Price GetPrice() const {return price_;}
-    Side GetSide() const {return side_;}
-    Quantity GetQuantity() const {return quantity_;}
+        // Uses the existing utility to get the JSON for one book
+        std::string book_json_content = level_infos_to_json(book.GetOrderInfos(), book.Size());
 
-    // "const" in this function denotes the function does NOT modify any member variables.
-    OrderPointer ToOrderPointer(OrderType type) const {
-    return std::make_shared<Order>(type, GetSide(), GetPrice(), GetQuantity(), GetOrderId());
+        // Format the book name as the key, and insert the book's JSON content
+        json_output += std::format(R"("{}":{})", book_name, book_json_content);
+        first = false;
+    }
+    return json_output;
 }
 
-    private:
-        OrderId orderId_;
-        Side side_;
-        Price price_;
-        Quantity quantity_;
+// Commands for the shard sequencers (see Sequencer.h).
+// The books are split into shards by name. Each shard owns its books and has its own sequencer thread, so books on different shards
+// are matched in parallel while each book still sees one well defined order of events.
+// The HTTP handlers parse the request into a Command, send it to the shard(s) that own the book(s), and wait for the reply.
+
+// Book names are copied inline so a Command stays fixed-size and trivially copyable (symbols are a handful of characters).
+struct BookName {
+    static constexpr size_t kMaxSize = 31;
+
+    char data_[kMaxSize + 1];
+    uint8_t size_;
+
+    static BookName From(std::string_view name) {
+        if (name.size() > kMaxSize) {
+            throw std::invalid_argument(std::format("book name longer than {} characters", kMaxSize));
+        }
+        BookName book{};
+        std::copy(name.begin(), name.end(), book.data_);
+        book.size_ = static_cast<uint8_t>(name.size());
+        return book;
+    }
+
+    std::string_view View() const { return std::string_view(data_, size_); }
 };
 
-// TradeInfo may exist by itself, but Trade can contain or reference one or more TradeInfo objects.
-struct TradeInfo{
-    OrderId orderid_;
+// one decoded order, for /trade, /cancel (only book_ and id_), each entry of /batch, and the binary NewOrder/Cancel/Modify.
+struct OrderRequest {
+    BookName book_;
+    OrderId id_;
+    OrderType type_;
+    Side side_;
     Price price_;
     Quantity quantity_;
 };
 
-// A trade consists of a bid and ask, which will hava TradeInfo objects for eahch.
-class Trade{
-    public:
-
-        Trade(const TradeInfo& bidTrade, const TradeInfo& askTrade):
-        bidTrade_ { bidTrade},
-        askTrade_ { askTrade} {}
+enum class CommandType : uint8_t {
+    Trade,
+    Cancel,
+    Status,
+    Reset,
+    Batch,
+    Modify, // binary protocol only
+    Summary, // binary protocol only
+    Snapshot, // from the Snapshotter
+    Metrics
+};
 
-        const TradeInfo& GetBidTrade() const {return bidTrade_;}
-        const TradeInfo& GetAskTrade() const {return askTrade_;}
+struct EngineReply;
 
-    private:
-        TradeInfo bidTrade_;
-        TradeInfo askTrade_;
+struct Command {
+    CommandType type_;
+    OrderRequest order_;                      // Trade, Cancel, Modify
+    std::span<const OrderRequest> batch_;     // Batch (this shard's part of the batch, owned by the waiting handler)
+    BatchStats* stats_;                       // Batch: running totals of a streamed batch (see BatchStream), null for a plain one
+    EngineReply* reply_;
+    uint64_t submitted_;                      // metrics::Now() when Shard::Submit queued it, for the queue_wait metric (0 while recovering)
 };
 
+// what /metrics reports about one book.
+struct BookSample {
+    std::string name_;
+    BookActivity activity_;
+    size_t bids_ = 0;
+    size_t asks_ = 0;
+};
 
-// vector of trade object, representing bids and asks
-using Trades = std::vector<Trade>;
+// Filled in by the shard. If applying the command threw, error_ holds the exception and the handler rethrows it,
+// so every endpoint keeps answering errors exactly like it did before.
+struct EngineReply : Completion {
+    int status_ = 200;
+    size_t count_ = 0;
+    std::string body_;
+    BookMap retired_; // books taken out by /reset, destroyed on the handler's thread
+    std::exception_ptr error_;
+    bool binary_ = false; // Trade/Cancel/Modify from a binary session, or a streamed Batch: the shard writes ExecReport/Reject messages into wire_
+    std::string wire_;
+    int snapshotPid_ = 0;              // Snapshot: the child writing it into body_ (0 if nothing changed since the last one)
+    uint64_t snapshotSequence_ = 0;    // Snapshot: the last journal record it holds
+    std::vector<BookSample> samples_;  // Metrics: one per book in the shard
+    uint64_t queueTicks_ = 0;          // how long the command waited for the shard, and how long the shard took to apply it
+    uint64_t applyTicks_ = 0;          // (metrics::Now() ticks, for the Server-Timing header)
+
+    // reuse the reply for another command (the binary sessions keep a few around); wire_ keeps its capacity.
+    void Rearm() {
+        Completion::Rearm();
+        status_ = 200;
+        count_ = 0;
+        body_.clear();
+        error_ = nullptr;
+        wire_.clear();
+        snapshotPid_ = 0;
+        snapshotSequence_ = 0;
+        samples_.clear();
+        queueTicks_ = 0;
+        applyTicks_ = 0;
+    }
+};
 
-class Orderbook{
-    // An OrderBook holds orders, and we want to be easily able to access these orders (preferrable, in O(1) time). Any any point in time, the bids and asks we are about are:
-    // The bid with the HIGHEST price, and the ask with the LOWEST price.
+template <typename Message>
+void AppendWire(std::string& out, const Message& message) {
+    out.append(reinterpret_cast<const char*>(&message), sizeof(message));
+}
 
-    private:
-        // when an entry is to be ordered, we take the pointer to the specified entries.
-        struct OrderEntry{
-            OrderPointer order_ { nullptr };
-            OrderPointers::iterator location_;
-        };
+void AppendReject(std::string& out, OrderId orderId, wire::MessageType rejected, wire::RejectReason reason) {
+    wire::Reject reject{};
+    reject.header_ = wire::HeaderFor<wire::Reject>(wire::MessageType::Reject);
+    reject.orderId_ = orderId;
+    reject.rejected_ = rejected;
+    reject.reason_ = reason;
+    AppendWire(out, reject);
+}
 
-        // hashmap of key Price, and mapped value 'OrderPointers'. std::greater<Price> is a custom comparator to sort upon, where it's in descending order. (highest ASK first!).
-        std::map<Price, OrderPointers, std::greater<Price>> bids_;
-        std::map<Price, OrderPointers, std::less<Price>> asks_;
-        // we don't need to sort our actual orders. these are just for the record.
-        std::unordered_map<OrderId, OrderEntry> orders_;
+// Turns what a book reports about one binary request into ExecReport / Reject messages for the session that sent it.
+// quantity is what the request asked for, so we can tell how much is left after each fill.
+class WireReportSink {
+    public:
+        WireReportSink(std::string& out, const Orderbook& book, const OrderRequest& order, wire::MessageType request):
+            out_(out), book_(book), order_(order), request_(request), leaves_(order.quantity_) {}
+
+        void OnTrade(const Trade& trade) {
+            bool incomingIsBid = trade.GetBidTrade().orderid_ == order_.id_;
+            const TradeInfo& resting = incomingIsBid ? trade.GetAskTrade() : trade.GetBidTrade();
+            leaves_ -= resting.quantity_;
+            // fills happen at the resting order's price.
+            Report(wire::ExecType::Trade, resting.orderid_, resting.price_, resting.quantity_, leaves_);
+        }
 
-        // We need CanMatch() for fillandkill orders, because if it's can't match now, we never do it (now or never).
-        // otherwise, if we have a goodtillcancel order, we can add it to the orderbook, and then match it when possible.
-        // Upon match, we need to REMOVE the order from the orderbook. This may be completely remaining orders, or partially filled orders.
+        void OnRest(const Order& order) {
+            rested_ = true;
+            Report(wire::ExecType::New, 0, order.GetPrice(), order.GetRemainingQuantity(), order.GetRemainingQuantity());
+        }
 
-        bool CanMatch(Side side, Price price) const{
-              if (side == Side::Buy){
+        // a cancel ack, or the old order going away in a modify.
+        void OnCancel(const Order& order) {
+            found_ = true;
+            wire::ExecType type = request_ == wire::MessageType::Modify ? wire::ExecType::Replaced : wire::ExecType::Cancelled;
+            Report(type, 0, order.GetPrice(), order.GetRemainingQuantity(), 0);
+        }
 
-                if (asks_.empty()){
-                    return false;
-                }else{
-                    const auto& [bestAsk, _] = *asks_.begin(); // starts at the best ask (lowest price!).
-                    return price >= bestAsk; // we return the best match possible, and return if it is valid or not.
-                }
-              }
-
-            //   copying for other side
-              if (side == Side::Sell){
-                if (bids_.empty()){
-                    return false;
-                }else{
-                    const auto& [bestBid, _] = *bids_.begin();
-                    return price <= bestBid;
-                }
-              }
+        // AddOrder rejects duplicate ids and fillandkill orders with nothing to match; if the id is in the book it was the former.
+        void OnReject(const Order& order) {
+            rejected_ = true;
+            AppendReject(out_, order.GetOrderId(), request_, book_.Contains(order.GetOrderId()) ? wire::RejectReason::DuplicateOrderId : wire::RejectReason::NoLiquidity);
+        }
 
-              return false; // Default case (should never reach here)
-          }
+        // after AddOrder: a fillandkill that was partly filled has its remainder dropped without an event, so we report it here.
+        void FinishNewOrder() {
+            if (!rested_ && !rejected_ && leaves_ > 0) {
+                Report(wire::ExecType::Cancelled, 0, order_.price_, leaves_, 0);
+            }
+        }
 
-        // We also need a Match() function that runs when a match actually occurs. 
-        // Replace your MatchOrders() function with this debug version:
+        bool Found() const { return found_; }
 
-Trades MatchOrders(){
-    std::cout << "\n[DEBUG] MatchOrders called" << std::flush;
-    Trades trades;
-    trades.reserve(orders_.size());
+    private:
+        void Report(wire::ExecType type, OrderId counterparty, Price price, Quantity quantity, Quantity leaves) {
+            wire::ExecReport report{};
+            report.header_ = wire::HeaderFor<wire::ExecReport>(wire::MessageType::ExecReport);
+            report.orderId_ = order_.id_;
+            report.counterparty_ = counterparty;
+            report.price_ = price;
+            report.quantity_ = quantity;
+            report.leaves_ = leaves;
+            report.execType_ = type;
+            AppendWire(out_, report);
+        }
 
-    std::cout << "\n[DEBUG] Bids empty: " << bids_.empty() << ", Asks empty: " << asks_.empty() << std::flush;
+        std::string& out_;
+        const Orderbook& book_;
+        const OrderRequest& order_;
+        wire::MessageType request_;
+        Quantity leaves_;
+        bool rested_ = false;
+        bool rejected_ = false;
+        bool found_ = false;
+};
 
-    while (true){
-        if (bids_.empty() || asks_.empty()){ 
-            std::cout << "\n[DEBUG] One side empty, breaking" << std::flush;
-            break;
+// Applies this shard's part of a batch, counting the fills per book into stats. With reports set, every order's ExecReport/Reject
+// messages are appended to it as well (streamed batches). Returns the per-book results (for every book of the shard) as JSON entries.
+std::string ApplyBatch(BookMap& books, std::span<const OrderRequest> orders, BatchStats& bookStats, size_t& processedCount, std::string* reports) {
+    // Process each order
+    for (const OrderRequest& order : orders) {
+        std::string book(order.book_.View());
+        Orderbook& orderbook = GetOrCreateBook(books, book);
+
+        // Track statistics (the book reports fills straight into the stats)
+        BookStats& stats = bookStats[book];
+        Order incoming(order.type_, order.side_, order.price_, order.quantity_, order.id_);
+        if (reports != nullptr) {
+            WireReportSink reportSink(*reports, orderbook, order, wire::MessageType::NewOrder);
+            SinkFanout<BookStats, WireReportSink> sink(stats, reportSink);
+            orderbook.AddOrder(incoming, sink);
+            reportSink.FinishNewOrder();
+        } else {
+            orderbook.AddOrder(incoming, stats);
         }
-        
-        std::cout << "\n[DEBUG] Getting best bid and ask" << std::flush;
-        auto& [askPrice, asks] = *asks_.begin();
-        auto& [bidPrice, bids] = *bids_.begin();
-        
-        std::cout << "\n[DEBUG] BidPrice: " << bidPrice << ", AskPrice: " << askPrice << std::flush;
-    
-        if (bidPrice < askPrice){ 
-            std::cout << "\n[DEBUG] No match possible, breaking" << std::flush;
-            break; 
-        }
-
-        std::cout << "\n[DEBUG] Starting match loop" << std::flush;
-        while (!bids.empty() && !asks.empty()){
-            std::cout << "\n[DEBUG] Getting front orders" << std::flush;
-            auto& bid = bids.front();
-            auto& ask = asks.front();
-
-            std::cout << "\n[DEBUG] Bid ID: " << bid->GetOrderId() << ", Ask ID: " << ask->GetOrderId() << std::flush;
-
-            Quantity quantity = std::min(bid->GetRemainingQuantity(), ask->GetRemainingQuantity());
-            std::cout << "\n[DEBUG] Matching quantity: " << quantity << std::flush;
-            
-            bid->Fill(quantity);
-            ask->Fill(quantity);
-            
-            std::cout << "\n[DEBUG] Creating trade log" << std::flush;
-            trades.push_back(Trade{
-                TradeInfo{ bid->GetOrderId(), bid->GetPrice(), quantity},
-                TradeInfo{ ask->GetOrderId(), ask->GetPrice(), quantity}
-            });
-            
-            std::cout << "\n[DEBUG] Checking if orders filled" << std::flush;
-            if (bid->IsFilled()){
-                std::cout << "\n[DEBUG] Removing filled bid" << std::flush;
-                OrderId bidId = bid->GetOrderId();
-                bids.pop_front();
-                orders_.erase(bidId);
-            }
-            if (ask->IsFilled()){
-                std::cout << "\n[DEBUG] Removing filled ask" << std::flush;
-                OrderId askId = ask->GetOrderId();
-                asks.pop_front();
-                orders_.erase(askId);
+
+        processedCount++;
+    }
+
+    std::string resultJson;
+    bool first = true;
+    for (const auto& [bookName, book] : books) {
+        if (!first) resultJson += ",";
+        first = false;
+
+        auto [bestBid, bestAsk] = book.GetBestPrices();
+        auto [bidCount, askCount] = book.GetOrderCounts();
+        auto [bidLevels, askLevels] = book.GetLevelCounts();
+
+        // Get stats for this book (may be zero if no orders were for this book)
+        const BookStats& stats = bookStats[bookName];
+
+        resultJson += std::format(
+            R"("{}":{{"tradesExecuted":{},"volumeTraded":{},"remainingBids":{},"remainingAsks":{},"bestBidPrice":{},"bestAskPrice":{},"bidLevels":{},"askLevels":{}}})",
+            bookName,
+            stats.tradesExecuted,
+            stats.volumeTraded,
+            bidCount,
+            askCount,
+            bestBid,
+            bestAsk,
+            bidLevels,
+            askLevels
+        );
+    }
+    return resultJson;
+}
+
+// fills in the command for a well-formed binary request (Protocol.h). Otherwise writes the Reject into out and returns false.
+// Used by the binary transports and when the journal is read back.
+bool DecodeWireCommand(const char* data, const wire::MessageHeader& header, Command& command, std::string& out) {
+    OrderRequest& order = command.order_;
+    switch (header.type_) {
+        case wire::MessageType::NewOrder: {
+            wire::NewOrder message;
+            if (header.length_ != sizeof(message)) { break; }
+            std::memcpy(&message, data, sizeof(message));
+            if (message.side_ > wire::WireSide::Sell || message.orderType_ > wire::WireOrderType::FillAndKill) {
+                AppendReject(out, message.orderId_, header.type_, wire::RejectReason::Malformed);
+                return false;
             }
+            command.type_ = CommandType::Trade;
+            order.book_ = BookName::From(wire::BookView(message.book_));
+            order.id_ = message.orderId_;
+            order.type_ = message.orderType_ == wire::WireOrderType::GoodTillCancel ? OrderType::GoodTillCancel : OrderType::FillAndKill;
+            order.side_ = message.side_ == wire::WireSide::Buy ? Side::Buy : Side::Sell;
+            order.price_ = message.price_;
+            order.quantity_ = message.quantity_;
+            return true;
+        }
+        case wire::MessageType::Cancel: {
+            wire::Cancel message;
+            if (header.length_ != sizeof(message)) { break; }
+            std::memcpy(&message, data, sizeof(message));
+            command.type_ = CommandType::Cancel;
+            order.book_ = BookName::From(wire::BookView(message.book_));
+            order.id_ = message.orderId_;
+            return true;
         }
-        
-        std::cout << "\n[DEBUG] Inner loop done, checking empty" << std::flush;
-        if (bids.empty()){ 
-            std::cout << "\n[DEBUG] Erasing bid price level" << std::flush;
-            bids_.erase(bidPrice);
+        case wire::MessageType::Modify: {
+            wire::Modify message;
+            if (header.length_ != sizeof(message)) { break; }
+            std::memcpy(&message, data, sizeof(message));
+            if (message.side_ > wire::WireSide::Sell) {
+                AppendReject(out, message.orderId_, header.type_, wire::RejectReason::Malformed);
+                return false;
+            }
+            command.type_ = CommandType::Modify;
+            order.book_ = BookName::From(wire::BookView(message.book_));
+            order.id_ = message.orderId_;
+            order.side_ = message.side_ == wire::WireSide::Buy ? Side::Buy : Side::Sell;
+            order.price_ = message.price_;
+            order.quantity_ = message.quantity_;
+            return true;
         }
-        if (asks.empty()){ 
-            std::cout << "\n[DEBUG] Erasing ask price level" << std::flush;
-            asks_.erase(askPrice);
+        case wire::MessageType::Summary: {
+            wire::Summary message;
+            if (header.length_ != sizeof(message)) { break; }
+            std::memcpy(&message, data, sizeof(message));
+            command.type_ = CommandType::Summary;
+            order.book_ = BookName::From(wire::BookView(message.book_));
+            return true;
         }
+        default:
+            break;
     }
+    AppendReject(out, 0, header.type_, wire::RejectReason::Malformed);
+    return false;
+}
 
-    std::cout << "\n[DEBUG] Main matching done, checking FillAndKill" << std::flush;
-
-    // Handle FillAndKill orders that didn't fully fill
-    if (!bids_.empty()){
-        std::cout << "\n[DEBUG] Checking bids for FillAndKill" << std::flush;
-        auto bidIter = bids_.begin();
-        auto& [_, bidsRef] = *bidIter;
-        if (!bidsRef.empty()) {
-            auto& order = bidsRef.front();
-            if (order->GetOrderType() == OrderType::FillAndKill && !order->IsFilled()){
-                std::cout << "\n[DEBUG] Canceling unfilled FillAndKill bid" << std::flush;
-                OrderId orderId = order->GetOrderId();
-                CancelOrder(orderId);
-            }
+// What a shard writes to its journal (Journal.h). A Command record holds the binary protocol message for the command (NewOrder, Cancel
+// or Modify), so it takes the same decoding as an order from a binary client when it is read back. A /batch is journaled as one NewOrder
+// per order. Commands are journaled as they were asked for, not as they turned out: one that was rejected is rejected again on replay.
+void JournalOrder(journal::Journal& journal, CommandType type, const OrderRequest& order) {
+    wire::WireSide side = order.side_ == Side::Buy ? wire::WireSide::Buy : wire::WireSide::Sell;
+    switch (type) {
+        case CommandType::Trade: {
+            wire::NewOrder message{};
+            message.header_ = wire::HeaderFor<wire::NewOrder>(wire::MessageType::NewOrder);
+            message.orderId_ = order.id_;
+            message.price_ = order.price_;
+            message.quantity_ = order.quantity_;
+            message.side_ = side;
+            message.orderType_ = order.type_ == OrderType::GoodTillCancel ? wire::WireOrderType::GoodTillCancel : wire::WireOrderType::FillAndKill;
+            wire::SetBook(message.book_, order.book_.View());
+            journal.Append(static_cast<uint8_t>(journal::RecordKind::Command), &message, sizeof(message));
+            break;
+        }
+        case CommandType::Cancel: {
+            wire::Cancel message{};
+            message.header_ = wire::HeaderFor<wire::Cancel>(wire::MessageType::Cancel);
+            message.orderId_ = order.id_;
+            wire::SetBook(message.book_, order.book_.View());
+            journal.Append(static_cast<uint8_t>(journal::RecordKind::Command), &message, sizeof(message));
+            break;
         }
+        case CommandType::Modify: {
+            wire::Modify message{};
+            message.header_ = wire::HeaderFor<wire::Modify>(wire::MessageType::Modify);
+            message.orderId_ = order.id_;
+            message.price_ = order.price_;
+            message.quantity_ = order.quantity_;
+            message.side_ = side;
+            wire::SetBook(message.book_, order.book_.View());
+            journal.Append(static_cast<uint8_t>(journal::RecordKind::Command), &message, sizeof(message));
+            break;
+        }
+        default:
+            break;
+    }
+}
+
+// Runs in the forked snapshot writer (Snapshot.h), so no allocating and no logging in here.
+bool WriteSnapshot(const BookMap& books, uint64_t sequence, snapshot::FileWriter& writer) {
+    snapshot::FileHeader header{};
+    header.magic_ = snapshot::kMagic;
+    header.version_ = snapshot::kVersion;
+    header.bookCount_ = static_cast<uint32_t>(books.size());
+    header.sequence_ = sequence;
+    for (const auto& [name, book] : books) {
+        header.orderCount_ += book.Size();
+    }
+    writer.Put(header);
+
+    for (const auto& [name, book] : books) {
+        snapshot::BookHeader bookHeader{};
+        std::memcpy(bookHeader.name_, name.data(), std::min(name.size(), snapshot::kBookNameSize - 1));
+        auto [bidLevels, askLevels] = book.GetLevelCounts();
+        bookHeader.levelCount_ = static_cast<uint32_t>(bidLevels + askLevels);
+        bookHeader.orderCount_ = book.Size();
+        writer.Put(bookHeader);
+
+        book.ForEachLevel(
+            [&](Side side, Price price, uint32_t count) {
+                snapshot::LevelHeader level{};
+                level.price_ = price;
+                level.count_ = count;
+                level.side_ = side == Side::Buy ? 0 : 1;
+                writer.Put(level);
+            },
+            [&](const Order& order) {
+                snapshot::OrderRecord record{};
+                record.orderId_ = order.GetOrderId();
+                record.initialQuantity_ = order.GetInitialQuantity();
+                record.remainingQuantity_ = order.GetRemainingQuantity();
+                record.orderType_ = order.GetOrderType() == OrderType::GoodTillCancel ? 0 : 1;
+                writer.Put(record);
+            });
     }
+    return true;
+}
 
-    if (!asks_.empty()){
-        std::cout << "\n[DEBUG] Checking asks for FillAndKill" << std::flush;
-        auto askIter = asks_.begin();
-        auto& [_, asksRef] = *askIter;
-        if (!asksRef.empty()) {
-            auto& order = asksRef.front();
-            if (order->GetOrderType() == OrderType::FillAndKill && !order->IsFilled()){
-                std::cout << "\n[DEBUG] Canceling unfilled FillAndKill ask" << std::flush;
-                OrderId orderId = order->GetOrderId();
-                CancelOrder(orderId);
+// bulk-loads a snapshot into books (which should be empty). Each book is sized for its orders up front. Returns how many orders it
+// loaded; throws if the file doesn't add up.
+size_t LoadSnapshot(BookMap& books, snapshot::FileReader& reader) {
+    const snapshot::FileHeader& header = reader.Header();
+    size_t loaded = 0;
+    for (uint32_t b = 0; b < header.bookCount_; ++b) {
+        snapshot::BookHeader bookHeader;
+        if (!reader.Get(bookHeader)) {
+            throw std::runtime_error("snapshot ends in the middle of the book table");
+        }
+        BookConfig config = gBookConfig;
+        config.expectedOrders_ = std::max<size_t>(config.expectedOrders_, bookHeader.orderCount_);
+        Orderbook& book = books.try_emplace(string(wire::BookView(bookHeader.name_)), config).first->second;
+        std::vector<std::pair<OrderId, OrderSlot>> restored;
+        restored.reserve(bookHeader.orderCount_);
+
+        for (uint32_t l = 0; l < bookHeader.levelCount_; ++l) {
+            snapshot::LevelHeader level;
+            if (!reader.Get(level) || level.side_ > 1) {
+                throw std::runtime_error("bad level in snapshot");
+            }
+            Side side = level.side_ == 0 ? Side::Buy : Side::Sell;
+            for (uint32_t i = 0; i < level.count_; ++i) {
+                snapshot::OrderRecord record;
+                if (!reader.Get(record) || record.remainingQuantity_ == 0 || record.remainingQuantity_ > record.initialQuantity_) {
+                    throw std::runtime_error("bad order in snapshot");
+                }
+                Order order(record.orderType_ == 0 ? OrderType::GoodTillCancel : OrderType::FillAndKill, side, level.price_,
+                    record.initialQuantity_, record.orderId_);
+                order.Fill(record.initialQuantity_ - record.remainingQuantity_);
+                restored.emplace_back(record.orderId_, book.RestoreOrder(order));
             }
         }
+        if (!book.IndexRestored(restored)) {
+            throw std::runtime_error(std::format("book {} has an order id twice", wire::BookView(bookHeader.name_)));
+        }
+        loaded += restored.size();
+    }
+    if (!reader.AtEnd()) {
+        throw std::runtime_error("snapshot has trailing data");
     }
-    
-    std::cout << "\n[DEBUG] MatchOrders returning" << std::flush;
-    return trades;
+    return loaded;
 }
 
-        // need to add, cancel, and modify order(s).
-
-        // Given a new Order (the pointer to it), this method adds it to our orderbook.
-        // it checks if the order already exists, if the order is a fillandkill and can NOT be immediately matched (both cases where we do NOT add).
-        public:
-            Trades AddOrder(OrderPointer order){
-                if (orders_.contains(order->GetOrderId())){ return { };}
+class Shard {
+    public:
+        // journal may be null (no --journal). The shard owns it from here on.
+        void Start(int cpu, std::unique_ptr<journal::Journal> journal = nullptr) {
+            cpu_ = cpu;
+            journal_ = std::move(journal);
+            sequencer_.Start([this](Command& command) { Apply(command); }, cpu);
+        }
 
-                if (order->GetOrderType() == OrderType::FillAndKill && !CanMatch(order->GetSide(), order->GetPrice())){
-                    return { };
-                }
-                
-                // iteator to OrderPointers, which is simply a LIST. allows access for O(1) remove/cancellation.
-                // bids_ is our buy-side storage, whereas asks_ is our sell-side storage.
-                OrderPointers::iterator iterator;
-
-                if (order->GetSide() == Side::Buy){
-                    auto& orders = bids_[order->GetPrice()]; 
-                    // this line causes INSERTION, where the price of the order is used as the key, and simultaneously gives an "orders" alias which is the list of orders at the specific price level.
-                    // so we insert an order (with Price as the key) and retrieve the reference to the list (value).
-                    orders.push_back(order);
-                    iterator = std::next(orders.begin(), orders.size()-1);
-                    // the order is added to the back of the list (FIFO), and the iterator wil calculate the exact position of the order we just inserted. (for O(1) removal later if needed).
-                }else{
-                    auto& orders = asks_[order->GetPrice()];
-                    orders.push_back(order);
-                    iterator = std::next(orders.begin(), orders.size()-1);
+        // Before Start(): loads the newest snapshot in the journal's directory and replays the journal records after it, so the books are
+        // back to where they were when the engine went down. Returns the last journal sequence number it saw.
+        uint64_t Recover(const journal::Options& options) {
+            auto start = std::chrono::steady_clock::now();
+            uint64_t sequence = 0;
+            size_t loaded = 0;
+            std::vector<uint64_t> snapshots = snapshot::ListSnapshots(options.directory_, options.name_);
+            // they are only published once complete, so falling back to an older one is just for a disk that went bad under us
+            while (!snapshots.empty()) {
+                std::string path = snapshot::SnapshotPath(options.directory_, options.name_, snapshots.back());
+                snapshot::FileReader reader;
+                try {
+                    if (reader.Open(path) && reader.Header().sequence_ == snapshots.back()) {
+                        loaded = LoadSnapshot(books_, reader);
+                        sequence = snapshots.back();
+                        break;
+                    }
+                } catch (const std::exception& e) {
+                    LOG_ERROR("Could not load snapshot {} of {}: {}", snapshots.back(), options.name_, e.what());
                 }
-
-                // general bookkeeping in the orders_ OrderBook.
-                orders_.insert({order->GetOrderId(), OrderEntry{ order, iterator}});
-                return MatchOrders();
-            }
-            
-            // method to REMOVE an order from the orderbook if it is cancelled.
-            void CancelOrder(OrderId orderId){
-            if (!orders_.contains(orderId)){
-                return;
+                LOG_WARN("Skipping snapshot {} of {}", snapshots.back(), options.name_);
+                books_.clear();
+                snapshots.pop_back();
             }
-            // we need aliases to the order and iterator (retrieved from orders_ using the orderId). Then we can remove it from the orders_.
-            const auto& [order, orderIterator] = orders_.at(orderId);
-            orders_.erase(orderId);
 
-            // if it's a sell order, we remove it from the asks_ data structure. if it's empty after, we need to remove the price altogether from it (memory cleanup).
+            // the journal goes through Apply like live commands (journal_ isn't set yet, so nothing is journaled twice).
+            EngineReply reply;
+            std::string rejects;
+            size_t replayed = 0;
+            uint64_t last = journal::Replay(options.directory_, options.name_, sequence,
+                [&](uint64_t, uint8_t kind, std::string_view payload) {
+                    Command command{};
+                    if (kind == static_cast<uint8_t>(journal::RecordKind::Reset)) {
+                        command.type_ = CommandType::Reset;
+                        if (payload.size() > BookName::kMaxSize) { return; }
+                        command.order_.book_ = BookName::From(payload);
+                    } else {
+                        wire::MessageHeader header;
+                        if (kind != static_cast<uint8_t>(journal::RecordKind::Command) || payload.size() < sizeof(header)) { return; }
+                        std::memcpy(&header, payload.data(), sizeof(header));
+                        rejects.clear();
+                        if (header.length_ != payload.size() || !DecodeWireCommand(payload.data(), header, command, rejects)) { return; }
+                    }
+                    reply.Rearm();
+                    reply.retired_.clear();
+                    command.reply_ = &reply;
+                    Apply(command);
+                    ++replayed;
+                });
+            snapshotSequence_ = sequence;
+
+            auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+            LOG_INFO("Recovered {}: {} orders from the snapshot at {}, then {} journal records up to {}, in {} ms", options.name_, loaded, sequence, replayed, last, elapsed);
+            return last;
+        }
 
-            if (order->GetSide() == Side::Sell){
-                auto price = order->GetPrice();
-                auto& orders = asks_.at(price);
-                orders.erase(orderIterator);
-                if (orders.empty()){
-                    asks_.erase(price);
-                }
-            }else{
-                auto price = order->GetPrice();
-                auto& orders = bids_.at(price);
-                orders.erase(orderIterator);
-                if (orders.empty()){
-                    bids_.erase(price);
-                }
-            }}
+        // only read by the Snapshotter, and never changes once the shard has started.
+        const journal::Options* JournalOptions() const { return journal_ ? &journal_->GetOptions() : nullptr; }
 
-            
-            Trades MatchOrder(OrderModify order){
-                if (!orders_.contains(order.GetOrderId())){
-                    return { };
-                }
+        // the core the sequencer is pinned to, -1 if it isn't. Set once by Start().
+        int Cpu() const { return cpu_; }
 
-                // fetch information of an order, cancel the order, and add the modified version back.
-                const auto& [existingOrder, _] = orders_.at(order.GetOrderId());
-                CancelOrder(order.GetOrderId());
-                return AddOrder(order.ToOrderPointer(existingOrder->GetOrderType()));
+        // the journal outlives the sequencer, so the replies it still holds back get released.
+        void Stop() {
+            sequencer_.Stop();
+            if (journal_) {
+                journal_->Close();
             }
+        }
 
-            std::size_t Size() const { return orders_.size();}
+        // hands the command to this shard and returns straight away; the caller waits on the reply.
+        void Submit(Command command, EngineReply& reply) {
+            command.reply_ = &reply;
+            command.submitted_ = metrics::Now();
+            sequencer_.Submit(command);
+        }
 
-            // Clear all orders from the orderbook
-            void Clear() {
-                bids_.clear();
-                asks_.clear();
-                orders_.clear();
+    private:
+        // write-ahead: whatever changes the books goes to the journal before it is applied.
+        void Record(const Command& command) {
+            switch (command.type_) {
+                case CommandType::Trade:
+                case CommandType::Cancel:
+                case CommandType::Modify:
+                    JournalOrder(*journal_, command.type_, command.order_);
+                    break;
+                case CommandType::Batch:
+                    for (const OrderRequest& order : command.batch_) {
+                        JournalOrder(*journal_, CommandType::Trade, order);
+                    }
+                    break;
+                case CommandType::Reset:
+                    // the payload is the book for a one-book reset, empty for all of them
+                    journal_->Append(static_cast<uint8_t>(journal::RecordKind::Reset), command.order_.book_.data_, command.order_.book_.size_);
+                    break;
+                case CommandType::Status:
+                case CommandType::Summary:
+                case CommandType::Snapshot:
+                case CommandType::Metrics:
+                    break;
             }
+        }
 
-            // Get the best bid and ask prices (-1 if empty)
-            std::pair<Price, Price> GetBestPrices() const {
-                Price bestBid = bids_.empty() ? -1 : bids_.begin()->first;
-                Price bestAsk = asks_.empty() ? -1 : asks_.begin()->first;
-                return {bestBid, bestAsk};
+        // runs on the shard's sequencer thread, the only thread that touches books_.
+        void Apply(Command& command) {
+            EngineReply& reply = *command.reply_;
+            if (command.submitted_ != 0) {
+                reply.queueTicks_ = metrics::Since(command.submitted_);
+                metrics::Record(metrics::Stage::QueueWait, reply.queueTicks_);
             }
-
-            // Count remaining bids and asks
-            std::pair<std::size_t, std::size_t> GetOrderCounts() const {
-                std::size_t bidCount = 0;
-                std::size_t askCount = 0;
-                for (const auto& [price, orders] : bids_) {
-                    bidCount += orders.size();
+            try {
+                if (journal_) {
+                    Record(command);
                 }
-                for (const auto& [price, orders] : asks_) {
-                    askCount += orders.size();
+                uint64_t applyStart = metrics::Now();
+                switch (command.type_) {
+                    case CommandType::Trade: {
+                        const OrderRequest& order = command.order_;
+                        Orderbook& book = GetOrCreateBook(books_, string(order.book_.View()));
+                        Order incoming(order.type_, order.side_, order.price_, order.quantity_, order.id_);
+                        if (reply.binary_) {
+                            WireReportSink sink(reply.wire_, book, order, wire::MessageType::NewOrder);
+                            book.AddOrder(incoming, sink);
+                            sink.FinishNewOrder();
+                        } else {
+                            NullSink sink;
+                            book.AddOrder(incoming, sink);
+                        }
+                        LOG_DEBUG("trade {} book={} size={}", order.id_, order.book_.View(), book.Size());
+                        break;
+                    }
+                    case CommandType::Cancel: {
+                        const OrderRequest& order = command.order_;
+                        Orderbook& book = GetOrCreateBook(books_, string(order.book_.View()));
+                        bool cancelled;
+                        if (reply.binary_) {
+                            WireReportSink sink(reply.wire_, book, order, wire::MessageType::Cancel);
+                            cancelled = book.CancelOrder(order.id_, sink);
+                        } else {
+                            cancelled = book.CancelOrder(order.id_);
+                        }
+                        if (!cancelled && reply.binary_) {
+                            AppendReject(reply.wire_, order.id_, wire::MessageType::Cancel, wire::RejectReason::UnknownOrder);
+                        }
+                        reply.status_ = cancelled ? 200 : 404;
+                        LOG_DEBUG("Cancel OrderID: {} in book: {} status: {} new size: {}", order.id_, order.book_.View(), reply.status_, book.Size());
+                        break;
+                    }
+                    case CommandType::Modify: {
+                        const OrderRequest& order = command.order_;
+                        Orderbook& book = GetOrCreateBook(books_, string(order.book_.View()));
+                        WireReportSink sink(reply.wire_, book, order, wire::MessageType::Modify);
+                        book.MatchOrder(OrderModify(order.id_, order.side_, order.price_, order.quantity_), sink);
+                        if (sink.Found()) {
+                            sink.FinishNewOrder();
+                        } else {
+                            AppendReject(reply.wire_, order.id_, wire::MessageType::Modify, wire::RejectReason::UnknownOrder);
+                        }
+                        break;
+                    }
+                    case CommandType::Status:
+                        reply.body_ = orderbooks_to_json_entries(books_);
+                        break;
+                    case CommandType::Reset:
+                        // hand the books to the waiting handler, so their slabs are unmapped off the sequencer thread.
+                        if (command.order_.book_.size_ == 0) {
+                            reply.count_ = books_.size();
+                            reply.retired_.swap(books_);
+                        } else {
+                            auto node = books_.extract(string(command.order_.book_.View()));
+                            reply.count_ = node.empty() ? 0 : 1;
+                            if (!node.empty()) {
+                                reply.retired_.insert(std::move(node));
+                            }
+                        }
+                        break;
+                    case CommandType::Batch: {
+                        BatchStats stats;
+                        reply.body_ = ApplyBatch(books_, command.batch_, command.stats_ != nullptr ? *command.stats_ : stats, reply.count_,
+                            reply.binary_ ? &reply.wire_ : nullptr);
+                        break;
+                    }
+                    case CommandType::Summary: {
+                        wire::BookSummary summary{};
+                        summary.header_ = wire::HeaderFor<wire::BookSummary>(wire::MessageType::BookSummary);
+                        summary.bestBid_ = -1;
+                        summary.bestAsk_ = -1;
+                        // asking about a book doesn't create it (like /status).
+                        auto it = books_.find(string(command.order_.book_.View()));
+                        if (it != books_.end()) {
+                            const Orderbook& book = it->second;
+                            auto [bidCount, askCount] = book.GetOrderCounts();
+                            auto [bidLevels, askLevels] = book.GetLevelCounts();
+                            auto [bestBid, bestAsk] = book.GetBestPrices();
+                            summary.bestBid_ = bestBid;
+                            summary.bestAsk_ = bestAsk;
+                            summary.bidCount_ = static_cast<uint32_t>(bidCount);
+                            summary.askCount_ = static_cast<uint32_t>(askCount);
+                            summary.bidLevels_ = static_cast<uint32_t>(bidLevels);
+                            summary.askLevels_ = static_cast<uint32_t>(askLevels);
+                        }
+                        AppendWire(reply.wire_, summary);
+                        break;
+                    }
+                    case CommandType::Snapshot: {
+                        // a forked child writes the books as they are right now while we carry on matching. The Snapshotter waits for it.
+                        if (!journal_) {
+                            throw std::logic_error("snapshots need the journal");
+                        }
+                        uint64_t sequence = journal_->LastSequence();
+                        if (sequence == snapshotSequence_) {
+                            break; // nothing changed since the last one
+                        }
+                        const journal::Options& options = journal_->GetOptions();
+                        reply.body_ = snapshot::SnapshotPath(options.directory_, options.name_, sequence);
+                        int pid = snapshot::WriteInChild(reply.body_ + ".tmp", [this, sequence](snapshot::FileWriter& writer) {
+                            return WriteSnapshot(books_, sequence, writer);
+                        });
+                        if (pid < 0) {
+                            throw std::runtime_error(std::format("could not start writing snapshot {}", reply.body_));
+                        }
+                        snapshotSequence_ = sequence;
+                        reply.snapshotPid_ = pid;
+                        reply.snapshotSequence_ = sequence;
+                        break;
+                    }
+                    case CommandType::Metrics:
+                        reply.samples_.reserve(books_.size());
+                        for (const auto& [name, book] : books_) {
+                            auto [bids, asks] = book.GetOrderCounts();
+                            reply.samples_.push_back(BookSample{ name, book.GetActivity(), bids, asks });
+                        }
+                        break;
                 }
-                return {bidCount, askCount};
-            }
-
-            // Get number of price levels
-            std::pair<std::size_t, std::size_t> GetLevelCounts() const {
-                return {bids_.size(), asks_.size()};
+                reply.applyTicks_ = metrics::Since(applyStart);
+                if (command.type_ == CommandType::Trade || command.type_ == CommandType::Cancel || command.type_ == CommandType::Modify
+                    || command.type_ == CommandType::Batch) {
+                    metrics::Record(metrics::Stage::Match, reply.applyTicks_);
+                } else if (command.type_ == CommandType::Status) {
+                    metrics::Record(metrics::Stage::Serialize, reply.applyTicks_);
+                }
+                if (journal_) {
+                    journal_->Commit();
+                }
+            } catch (...) {
+                reply.error_ = std::current_exception();
             }
-
-            OrderBookLevelInfo GetOrderInfos() const{
-                // alias for a LevelInfo vector, and we allocate memory in each LevelInfos (orders_ is conservative, we can use asks_ and bids_ if we really wanted to).
-                LevelInfos askinfos, bidinfos;
-                bidinfos.reserve(orders_.size());
-                askinfos.reserve(orders_.size());
-
-                // this is a lambda function that takes a Price and list of OrderPointers at that price, and returns a LevelInfo struct containing all of them (struct has Price and TotalQuantity).
-                // accumulate iterates from orders.start to orders.end, starts with a value of 0, and adds the sum of OrderPointer() in an order.'
-
-                // so within OrderPointers -> OrderPointer -> OrderPointer Quantity is what we want the sum of. Tells us how many shares are "up for consideration".
-                auto CreateLevelInfos = [](Price price, const OrderPointers& orders){
-                    return LevelInfo{ price, std::accumulate(orders.begin(), orders.end(), (Quantity)0, [](std::size_t runningSum, const OrderPointer& order){
-                        return runningSum + order->GetRemainingQuantity();
-                    })};
-                };
-
-                // finally, for each pricelevel in bids_, we take the pricelevel & OrderPointers (which point to all the live orders)
-                // we calcualte the total sum/quantity of shares in all orders at the price level COMBINED.
-                // push that number back to bidinfos and askinfos.
-                for (const auto& [price, orders] : bids_)
-                    bidinfos.push_back(CreateLevelInfos(price, orders));
-                
-                for (const auto& [price, orders] : asks_)
-                    askinfos.push_back(CreateLevelInfos(price, orders));
-                // in the end, bidinfos and askinfos is a vector of the "LevelInfo" object, which stores price-totalquantity pair(s). 
-                // helps us find the liquidity of shares at certain prices, using asks/bids.
-                return OrderBookLevelInfo(askinfos, bidinfos);
+            if (journal_) {
+                // with group commit the reply waits for the flusher's next sync
+                journal_->Acknowledge(reply);
+            } else {
+                reply.Signal();
             }
+        }
 
+        BookMap books_;
+        int cpu_ = -1;
+        std::unique_ptr<journal::Journal> journal_;
+        uint64_t snapshotSequence_ = 0; // journal sequence of the last snapshot we started
+        Sequencer<Command> sequencer_;
 };
 
-OrderType setType(string type){
-    if (type == "goodtillcancel"){
-        return OrderType::GoodTillCancel;
-    }else{
-        return OrderType::FillAndKill;
-    }
+std::vector<std::unique_ptr<Shard>> gShards; // created in main() before the server starts, never resized afterwards
+
+size_t ShardIndex(std::string_view book) {
+    return std::hash<std::string_view>{}(book) % gShards.size();
 }
 
-Side setSide(string side){
-    if (side == "buy"){
-        return Side::Buy;
-    }else{
-        return Side::Sell;
+// sends the command to the shard that owns the book and blocks until it has been applied. Rethrows whatever the shard caught.
+void Execute(const Command& command, EngineReply& reply) {
+    gShards[ShardIndex(command.order_.book_.View())]->Submit(command, reply);
+    reply.Wait();
+    if (reply.error_) {
+        std::rethrow_exception(reply.error_);
     }
 }
 
-struct Counter{
-    uint64_t count = 0;
-
-    uint64_t GetNext(){
-        return ++count;
+// sends one command to every shard (commands[i] goes to shard i), so they all work on it at the same time, then waits for all of them.
+void ExecuteOnAllShards(const std::vector<Command>& commands, std::vector<EngineReply>& replies) {
+    for (size_t i = 0; i < gShards.size(); ++i) {
+        gShards[i]->Submit(commands[i], replies[i]);
     }
-    uint64_t GetCurrent(){
-        return count;
+    for (EngineReply& reply : replies) {
+        reply.Wait();
+    }
+    for (EngineReply& reply : replies) {
+        if (reply.error_) {
+            std::rethrow_exception(reply.error_);
+        }
     }
-};
-
-std::mutex gLock;
-std::unordered_map<string, Orderbook> MyMap;
-
-OrderType parse_ordertype(string type){
-    if (type == "GTC"){return OrderType::GoodTillCancel;}
-    else{return OrderType::FillAndKill;}
 }
 
-Side parse_side(string side){
-    if (side=="BUY"){return Side::Buy;}
-    else{return Side::Sell;}
+// merges the JSON entries returned by each shard into one object.
+std::string MergeShardEntries(const std::vector<EngineReply>& replies) {
+    std::string json_output = "{";
+    bool first = true;
+    for (const EngineReply& reply : replies) {
+        if (reply.body_.empty()) continue;
+        if (!first) json_output += ",";
+        first = false;
+        json_output += reply.body_;
+    }
+    json_output += "}";
+    return json_output;
 }
 
-// Use stoull (string to unsigned long long) for OrderId (uint64_t)
-OrderId parse_id(string id){
-    // This supports values up to 18 quintillion (uint64_t max)
-    uint64_t res = std::stoull(id); 
-    return res;
-}
+// The stages of one HTTP request, timed with metrics::Now(): decode, waiting for the shard (queue), the shard applying the command
+// (match), and building the response (serialize). Decode and serialize go into this thread's stage histograms as they finish (the
+// shard records queue and match on its own thread), and Finish() sends them all back as a Server-Timing header, in milliseconds:
+//   Server-Timing: decode;dur=0.0021, queue;dur=0.0034, match;dur=0.0012, serialize;dur=0.0004, engine;dur=0.0093
+// engine is the whole handler, so whatever it has on top of the four stages is waiting for the reply to be handed back. For a command
+// that went to every shard, queue and match are the slowest shard's.
+class RequestTiming {
+    public:
+        RequestTiming(): received_(metrics::Now()), last_(received_) {}
 
-// Use stoul (string to unsigned long) for Quantity (uint32_t)
-Quantity parse_quantity(string quantity){
-    // This supports values up to 4.2 billion (uint32_t max)
-    uint32_t res = static_cast<uint32_t>(std::stoul(quantity));
-    return res;
-}
+        void Decoded() {
+            AddDecode(metrics::Since(last_));
+        }
 
-// Keep parse_price as stoi since Price (int32_t) is a signed 32-bit integer.
-Price parse_price(string price){
-    return std::stoi(price);
-}
+        // for a body decoded a piece at a time as it arrives: only the decoding counts, not waiting for the next piece.
+        void AddDecode(uint64_t ticks) {
+            decode_ += ticks;
+            metrics::Record(metrics::Stage::Decode, ticks);
+            last_ = metrics::Now();
+        }
 
-// JSON parsing helpers for batch endpoint
-std::string extract_json_string(const std::string& json, const std::string& key) {
-    std::string search_key = "\"" + key + "\":";
-    size_t key_pos = json.find(search_key);
-    if (key_pos == std::string::npos) return "";
+        // the shard's part was its work on a command of this type (Status builds JSON, so that is serialize rather than match).
+        void Executed(const EngineReply& reply, CommandType type = CommandType::Trade) {
+            Executed(std::span<const EngineReply>(&reply, 1), type);
+        }
 
-    size_t start = json.find("\"", key_pos + search_key.length());
-    if (start == std::string::npos) return "";
-    start++;
+        void Executed(std::span<const EngineReply> replies, CommandType type = CommandType::Trade) {
+            for (const EngineReply& reply : replies) {
+                queue_ = std::max(queue_, reply.queueTicks_);
+                uint64_t& applied = type == CommandType::Status ? serialize_ : match_;
+                applied = std::max(applied, reply.applyTicks_);
+            }
+            last_ = metrics::Now();
+        }
 
-    size_t end = json.find("\"", start);
-    if (end == std::string::npos) return "";
+        void Built() {
+            uint64_t ticks = metrics::Since(last_);
+            serialize_ += ticks;
+            metrics::Record(metrics::Stage::Serialize, ticks);
+            last_ = metrics::Now();
+        }
 
-    return json.substr(start, end - start);
-}
+        void Finish(httplib::Response& res) const {
+            auto ms = [](uint64_t ticks) { return static_cast<double>(metrics::ToNanoseconds(ticks)) / 1e6; };
+            res.set_header("Server-Timing", std::format("decode;dur={:.4f}, queue;dur={:.4f}, match;dur={:.4f}, serialize;dur={:.4f}, engine;dur={:.4f}",
+                ms(decode_), ms(queue_), ms(match_), ms(serialize_), ms(metrics::Since(received_))));
+        }
 
-int64_t extract_json_number(const std::string& json, const std::string& key) {
-    std::string search_key = "\"" + key + "\":";
-    size_t key_pos = json.find(search_key);
-    if (key_pos == std::string::npos) return 0;
+    private:
+        uint64_t received_;
+        uint64_t last_;
+        uint64_t decode_ = 0;
+        uint64_t queue_ = 0;
+        uint64_t match_ = 0;
+        uint64_t serialize_ = 0;
+};
 
-    size_t start = key_pos + search_key.length();
-    // Skip whitespace
-    while (start < json.length() && (json[start] == ' ' || json[start] == '\t')) start++;
+std::string_view ExecName(wire::ExecType type) {
+    switch (type) {
+        case wire::ExecType::New: return "rested";
+        case wire::ExecType::Trade: return "fill";
+        case wire::ExecType::Cancelled: return "cancelled";
+        case wire::ExecType::Replaced: return "replaced";
+    }
+    return "unknown";
+}
 
-    size_t end = start;
-    while (end < json.length() && (isdigit(json[end]) || json[end] == '-')) end++;
+std::string_view RejectReasonName(wire::RejectReason reason) {
+    switch (reason) {
+        case wire::RejectReason::Malformed: return "malformed";
+        case wire::RejectReason::DuplicateOrderId: return "duplicate_order_id";
+        case wire::RejectReason::UnknownOrder: return "unknown_order";
+        case wire::RejectReason::NoLiquidity: return "no_liquidity";
+        case wire::RejectReason::EngineError: return "engine_error";
+    }
+    return "unknown";
+}
 
-    if (start == end) return 0;
-    return std::stoll(json.substr(start, end - start));
+// one JSON line per ExecReport/Reject message in wire.
+void AppendReportLines(std::string_view wire, std::string& out) {
+    for (size_t offset = 0; offset + sizeof(wire::MessageHeader) <= wire.size();) {
+        wire::MessageHeader header;
+        std::memcpy(&header, wire.data() + offset, sizeof(header));
+        if (header.type_ == wire::MessageType::ExecReport) {
+            wire::ExecReport report;
+            std::memcpy(&report, wire.data() + offset, sizeof(report));
+            out += std::format(R"({{"orderid":{},"exec":"{}","price":{},"quantity":{},"leaves":{})",
+                static_cast<uint64_t>(report.orderId_), ExecName(report.execType_), static_cast<int32_t>(report.price_),
+                static_cast<uint32_t>(report.quantity_), static_cast<uint32_t>(report.leaves_));
+            if (report.execType_ == wire::ExecType::Trade) {
+                out += std::format(R"(,"counterparty":{})", static_cast<uint64_t>(report.counterparty_));
+            }
+            out += "}\n";
+        } else if (header.type_ == wire::MessageType::Reject) {
+            wire::Reject reject;
+            std::memcpy(&reject, wire.data() + offset, sizeof(reject));
+            out += std::format(R"({{"orderid":{},"exec":"rejected","reason":"{}"}})" "\n",
+                static_cast<uint64_t>(reject.orderId_), RejectReasonName(reject.reason_));
+        }
+        offset += header.length_;
+    }
 }
 
-std::vector<std::string> extract_json_array(const std::string& json, const std::string& key) {
-    std::vector<std::string> result;
-    std::string search_key = "\"" + key + "\":";
-    size_t key_pos = json.find(search_key);
-    if (key_pos == std::string::npos) return result;
+// /batch?stream=1 answers with chunked NDJSON instead of one object at the end: a line per execution report while the batch runs
+// (a fill, the remainder resting in the book, the remainder of a fillandkill being dropped, or the order being rejected), then the usual
+// {"processedCount":...,"results":...} as the last line.
+//
+// The orders go to the shards kSliceOrders per shard at a time. While httplib writes out one slice's reports, the shards are already
+// matching the next one, so at most two slices of reports are ever buffered however big the batch is. The shards only record the
+// reports as ExecReport/Reject messages; turning them into text happens here, on the handler's thread.
+//
+// What the caller gets is therefore different from a plain /batch in two ways:
+//  - it is NOT atomic per book. Each slice is its own command on the shard, so orders from other requests can reach a book between
+//    two slices of this batch (a plain /batch runs a shard's whole part as one command). Only kSliceOrders orders per shard are
+//    matched back to back without anything in between.
+//  - only the reports are bounded. httplib lets a handler start its response only after it has read the whole body, so the decoded
+//    orders (an OrderRequest each) are all held until the stream ends; what does not grow with the batch is the text and report buffers.
+class BatchStream {
+    public:
+        explicit BatchStream(std::vector<std::vector<OrderRequest>> ordersByShard):
+            ordersByShard_(std::move(ordersByShard)), stats_(gShards.size()) {
+            for (size_t i = 0; i < ordersByShard_.size(); ++i) {
+                rounds_ = std::max(rounds_, (ordersByShard_[i].size() + kSliceOrders - 1) / kSliceOrders);
+            }
+            rounds_ = std::max<size_t>(rounds_, 1);
+        }
+
+        // the shards may still be working on our orders when httplib gives up on the client
+        ~BatchStream() {
+            for (Slice& slice : slices_) {
+                WaitFor(slice);
+            }
+        }
+
+        // the chunked content provider: httplib calls it until it calls sink.done(), or until it returns false (client gone).
+        bool Next(httplib::DataSink& sink) {
+            if (submitted_ == 0) {
+                Submit();
+            }
+            Slice& slice = slices_[finished_ % 2];
+            WaitFor(slice);
+            ++finished_;
+            for (const EngineReply& reply : slice.replies_) {
+                if (reply.error_) {
+                    return Fail(sink, reply.error_);
+                }
+            }
+            bool last = finished_ == rounds_;
+            if (submitted_ < rounds_) {
+                Submit();
+            }
 
-    size_t array_start = json.find("[", key_pos);
-    if (array_start == std::string::npos) return result;
+            metrics::StageTimer serialize(metrics::Stage::Serialize);
+            out_.clear();
+            for (const EngineReply& reply : slice.replies_) {
+                AppendReportLines(reply.wire_, out_);
+                processedCount_ += reply.count_;
+            }
+            if (last) {
+                // every slice goes to every shard, so the last one has the results for every book
+                out_ += std::format(R"({{"processedCount":{},"results":)", processedCount_);
+                out_ += MergeShardEntries(slice.replies_);
+                out_ += "}\n";
+            }
+            serialize.Stop();
+            if (!out_.empty() && !sink.write(out_.data(), out_.size())) {
+                return false;
+            }
+            if (last) {
+                LOG_INFO("[BATCH] Streamed {} orders", processedCount_);
+                sink.done();
+            }
+            return true;
+        }
 
-    size_t array_end = json.find("]", array_start);
-    if (array_end == std::string::npos) return result;
+    private:
+        static constexpr size_t kSliceOrders = 4096;
 
-    // Parse individual objects in the array
-    size_t pos = array_start + 1;
-    while (pos < array_end) {
-        size_t obj_start = json.find("{", pos);
-        if (obj_start == std::string::npos || obj_start >= array_end) break;
+        struct Slice {
+            std::vector<EngineReply> replies_ = std::vector<EngineReply>(gShards.size());
+            bool inFlight_ = false;
+        };
 
-        // Find matching closing brace
-        int brace_count = 1;
-        size_t obj_end = obj_start + 1;
-        while (obj_end < json.length() && brace_count > 0) {
-            if (json[obj_end] == '{') brace_count++;
-            else if (json[obj_end] == '}') brace_count--;
-            obj_end++;
+        // sends the next slice to every shard (an empty one if a shard has no orders left, it still reports its books).
+        void Submit() {
+            Slice& slice = slices_[submitted_ % 2];
+            size_t begin = submitted_ * kSliceOrders;
+            for (size_t i = 0; i < gShards.size(); ++i) {
+                const std::vector<OrderRequest>& orders = ordersByShard_[i];
+                size_t from = std::min(begin, orders.size());
+                size_t to = std::min(begin + kSliceOrders, orders.size());
+
+                EngineReply& reply = slice.replies_[i];
+                reply.Rearm();
+                reply.binary_ = true;
+                Command command{};
+                command.type_ = CommandType::Batch;
+                command.batch_ = std::span<const OrderRequest>(orders).subspan(from, to - from);
+                command.stats_ = &stats_[i];
+                gShards[i]->Submit(command, reply);
+            }
+            slice.inFlight_ = true;
+            ++submitted_;
         }
 
-        if (brace_count == 0) {
-            result.push_back(json.substr(obj_start, obj_end - obj_start));
+        void WaitFor(Slice& slice) {
+            if (!slice.inFlight_) return;
+            for (EngineReply& reply : slice.replies_) {
+                reply.Wait();
+            }
+            slice.inFlight_ = false;
         }
-        pos = obj_end;
-    }
 
-    return result;
-}
+        // the 200 and the reports so far are already out, so all we can do is say so on the last line.
+        bool Fail(httplib::DataSink& sink, std::exception_ptr error) {
+            std::string line = R"({"error":"Unknown internal server error during batch processing."})" "\n";
+            try {
+                std::rethrow_exception(error);
+            } catch (const std::exception& e) {
+                LOG_ERROR("Exception in server_batch: {}", e.what());
+                line = std::format(R"({{"error":"Engine error during batch processing: {}"}})" "\n", e.what());
+            } catch (...) {
+            }
+            sink.write(line.data(), line.size());
+            sink.done();
+            return true;
+        }
 
-// Structure to track batch statistics per book
-struct BookStats {
-    int tradesExecuted = 0;
-    int64_t volumeTraded = 0;
+        std::vector<std::vector<OrderRequest>> ordersByShard_;
+        std::vector<BatchStats> stats_; // per shard, only touched by that shard while a slice is in flight
+        Slice slices_[2];
+        size_t rounds_ = 0;
+        size_t submitted_ = 0;
+        size_t finished_ = 0;
+        size_t processedCount_ = 0;
+        std::string out_;
 };
 
-
 void server_trade(const httplib::Request& req, httplib::Response& res){
     try{
+        RequestTiming timing;
         // parse content'
         string s_orderid = req.get_param_value("orderid");
         string s_type = req.get_param_value("tradetype");
@@ -611,39 +1166,40 @@ void server_trade(const httplib::Request& req, httplib::Response& res){
                     res.set_content(R"({"error":"Missing required parameters"})", "application/json");
                     return;
                 }
-        OrderId id = parse_id(s_orderid);
-        OrderType type = parse_ordertype(s_type);
-        Side side = parse_side(s_side);
-        Price price = parse_price(s_price);
-        Quantity quantity = parse_quantity(s_quantity);
-
-        {
-        std::lock_guard<std::mutex> lock(gLock);;
-        Orderbook& book = MyMap[s_book];
-        book.AddOrder(std::make_shared<Order>(type, side, price, quantity, id));
-        
-        cout << "\n " << book.Size();
-        }
+        Command command{};
+        command.type_ = CommandType::Trade;
+        command.order_.book_ = BookName::From(s_book);
+        command.order_.id_ = parse_id(s_orderid);
+        command.order_.type_ = parse_ordertype(s_type);
+        command.order_.side_ = parse_side(s_side);
+        command.order_.price_ = parse_price(s_price);
+        command.order_.quantity_ = parse_quantity(s_quantity);
+        timing.Decoded();
+
+        EngineReply reply;
+        Execute(command, reply);
+        timing.Executed(reply);
+
         res.status = 200; // or httplib::StatusCode::OK_200
         res.set_content("{\"message\": \"Order placed successfully\"}", "application/json");
+        timing.Built();
+        timing.Finish(res);
     }catch(const std::exception& e) {
         // Catch standard C++ errors (like bad numeric conversion)
         res.status = 500; // Internal Server Error is better for conversion errors
-        std::cerr << "Error in server_trade: " << e.what() << std::endl;
+        LOG_ERROR("Error in server_trade: {}", e.what());
         res.set_content(std::format(R"({{"error":"Engine error during processing: {}"}})", e.what()), "application/json");
     } catch(...) {
         // Catch-all for unknown errors
-        res.status = 500; 
+        res.status = 500;
         res.set_content(R"({"error":"Unknown internal server error."})", "application/json");
     }
 
 }
 
-// Note: This assumes the global map std::unordered_map<string, Orderbook> MyMap;
-// and conversion functions like parse_id are globally defined.
-
 void server_cancel(const httplib::Request& req, httplib::Response& res) {
     try{
+        RequestTiming timing;
         // parse content
         string s_orderid = req.get_param_value("orderid");
         string s_book = req.get_param_value("book");
@@ -654,112 +1210,195 @@ void server_cancel(const httplib::Request& req, httplib::Response& res) {
             return;
         }
 
-        OrderId id = parse_id(s_orderid);
-        
-        std::lock_guard<std::mutex> lock(gLock);
-        Orderbook& book = MyMap[s_book];
-        size_t before = book.Size();
-        book.CancelOrder(id);
-        size_t after = book.Size();
-        
+        Command command{};
+        command.type_ = CommandType::Cancel;
+        command.order_.book_ = BookName::From(s_book);
+        command.order_.id_ = parse_id(s_orderid);
+        timing.Decoded();
 
-        if (after < before){
-            cout << "\n " << s_orderid << " " << s_book;
+        EngineReply reply;
+        Execute(command, reply);
+        timing.Executed(reply);
+
+        if (reply.status_ == 200){
         res.status = 200;
         res.set_content("{\"message\": \"Order Info Received\"}", "application/json");
-        cout << "\n Cancelled OrderID: " << s_orderid << " in book: " << s_book << " new size:  " << book.Size();
         }else {
             res.status = 404;
             res.set_content("{\"message\": \"Order ID not found\"}", "application/json");
         }
+        timing.Built();
+        timing.Finish(res);
     }catch(...){
         res.status = 500;
         res.set_content(R"({"error":"Unknown internal server error."})", "application/json");
-        cout << "\n There was an error";
+        LOG_ERROR("Unknown error in server_cancel");
     }
 }
 
-std::string level_infos_to_json(const OrderBookLevelInfo& info, size_t size) {
-    auto convert_levels = [](const LevelInfos& levels, const std::string& type) {
-        std::string json_array = "[";
-        bool first = true;
-        for (const auto& level : levels) {
-            if (!first) {
-                json_array += ",";
-            }
-            json_array += std::format(
-                R"({{"type":"{}", "price":{}, "quantity":{}}})",
-                type, level.price_, level.quantity_
-            );
-            first = false;
-        }
-        json_array += "]";
-        return json_array;
-    };
+void server_status(const httplib::Request& req, httplib::Response& res) {
+    try {
+        RequestTiming timing;
+        Command command{};
+        command.type_ = CommandType::Status;
 
-    return std::format(
-        R"({{"bids":{}, "asks":{}, "size":{}}})",
-        convert_levels(info.GetBids(), "Bid"),
-        convert_levels(info.GetAsks(), "Ask"),
-        size
-    );
-}
+        std::vector<Command> commands(gShards.size(), command);
+        std::vector<EngineReply> replies(gShards.size());
+        ExecuteOnAllShards(commands, replies);
+        timing.Executed(replies, CommandType::Status);
 
-// NOTE: This relies on the OrderBookLevelInfo, LevelInfos, Price, and Quantity types being correctly defined earlier in Server.cpp.
+        res.set_content(MergeShardEntries(replies), "application/json");
+        res.status = 200;
+        timing.Built();
+        timing.Finish(res);
+    } catch (const std::exception& e) {
+        res.status = 500;
+        LOG_ERROR("Exception in server_status: {}", e.what());
+        res.set_content(std::format(R"({{"error":"Engine error getting status: {}"}})", e.what()), "application/json");
+    } catch (...) {
+        res.status = 500;
+        res.set_content(R"({"error":"Unknown internal server error getting status."})", "application/json");
+    }
+}
 
-std::string all_orderbooks_to_json() {
-    std::string json_output = "{";
-    bool first = true;
-    
-    // MyMap is the global std::unordered_map<string, Orderbook>
-    for (const auto& pair : MyMap) { 
-        if (!first) {
-            json_output += ",";
-        }
-        std::string book_name = pair.first;
-        const Orderbook& book = pair.second;
+// Prometheus text format: per-book counters and resting orders from every shard, then the stage histograms (Metrics.h). The books are
+// read on their shards like /status, but this only copies a few numbers per book, so it's cheap enough to scrape every few seconds
+// (and the Go side uses it as its health probe).
+void server_metrics(const httplib::Request&, httplib::Response& res) {
+    try {
+        Command command{};
+        command.type_ = CommandType::Metrics;
+
+        std::vector<Command> commands(gShards.size(), command);
+        std::vector<EngineReply> replies(gShards.size());
+        ExecuteOnAllShards(commands, replies);
+
+        std::string out;
+        // each family's samples have to be together, so one pass over the books per family
+        auto appendFamily = [&](std::string_view name, std::string_view type, std::string_view help, auto value) {
+            out += std::format("# HELP {} {}\n# TYPE {} {}\n", name, help, name, type);
+            for (const EngineReply& reply : replies) {
+                for (const BookSample& sample : reply.samples_) {
+                    out += name;
+                    out += "{book=\"";
+                    metrics::AppendLabel(out, sample.name_);
+                    out += std::format("\"}} {}\n", value(sample));
+                }
+            }
+        };
+        appendFamily("engine_orders_total", "counter", "Orders received per book, including rejected ones.",
+            [](const BookSample& sample) { return sample.activity_.orders_; });
+        appendFamily("engine_trades_total", "counter", "Fills per book.",
+            [](const BookSample& sample) { return sample.activity_.trades_; });
+        appendFamily("engine_cancels_total", "counter", "Orders cancelled per book, including the cancel half of a modify.",
+            [](const BookSample& sample) { return sample.activity_.cancels_; });
+        appendFamily("engine_rejects_total", "counter", "Orders rejected per book (duplicate id, or a fillandkill that could not match).",
+            [](const BookSample& sample) { return sample.activity_.rejects_; });
+        appendFamily("engine_resting_orders", "gauge", "Orders resting in the book.",
+            [](const BookSample& sample) { return sample.bids_ + sample.asks_; });
+        metrics::Registry::Instance().Render(out);
 
-        // Uses the existing utility to get the JSON for one book
-        std::string book_json_content = level_infos_to_json(book.GetOrderInfos(), book.Size());
-        
-        // Format the book name as the key, and insert the book's JSON content
-        // We remove the outer braces from book_json_content to embed it correctly
-        json_output += std::format(R"("{}":{})", book_name, book_json_content);
-        first = false;
+        res.status = 200;
+        res.set_content(out, "text/plain; version=0.0.4");
+    } catch (const std::exception& e) {
+        res.status = 500;
+        LOG_ERROR("Exception in server_metrics: {}", e.what());
+        res.set_content(std::format(R"({{"error":"Engine error getting metrics: {}"}})", e.what()), "application/json");
+    } catch (...) {
+        res.status = 500;
+        res.set_content(R"({"error":"Unknown internal server error getting metrics."})", "application/json");
     }
-    json_output += "}";
-    return json_output;
 }
 
-void server_status(const httplib::Request& req, httplib::Response& res) {
+// Which shard owns which book, for a balancer putting many symbols in one engine. GET /routes lists the books the engine holds; with
+// book=X (repeatable) it says where those books would go whether they exist yet or not. cpus[i] is the core shard i is pinned to (-1: not pinned).
+//   {"shards":4,"cpus":[0,1,2,3],"routes":{"AAPL":2,"MSFT":0}}
+void server_routes(const httplib::Request& req, httplib::Response& res) {
     try {
-        std::lock_guard<std::mutex> lock(gLock);
-        std::string status_json = all_orderbooks_to_json();
+        std::vector<std::pair<std::string, size_t>> routes;
+        size_t asked = req.get_param_value_count("book");
+        if (asked > 0) {
+            for (size_t i = 0; i < asked; ++i) {
+                std::string book = req.get_param_value("book", i);
+                BookName::From(book); // same length limit as an order for it
+                routes.emplace_back(book, ShardIndex(book));
+            }
+        } else {
+            // the per-book samples /metrics uses already name every book in the shard
+            Command command{};
+            command.type_ = CommandType::Metrics;
+            std::vector<Command> commands(gShards.size(), command);
+            std::vector<EngineReply> replies(gShards.size());
+            ExecuteOnAllShards(commands, replies);
+            for (size_t i = 0; i < replies.size(); ++i) {
+                for (const BookSample& sample : replies[i].samples_) {
+                    routes.emplace_back(sample.name_, i);
+                }
+            }
+            std::sort(routes.begin(), routes.end());
+        }
+
+        std::string out = std::format(R"({{"shards":{},"cpus":[)", gShards.size());
+        for (size_t i = 0; i < gShards.size(); ++i) {
+            out += std::format("{}{}", i == 0 ? "" : ",", gShards[i]->Cpu());
+        }
+        out += R"(],"routes":{)";
+        for (size_t i = 0; i < routes.size(); ++i) {
+            out += std::format(R"({}"{}":{})", i == 0 ? "" : ",", routes[i].first, routes[i].second);
+        }
+        out += "}}";
 
-        res.set_content(status_json, "application/json");
         res.status = 200;
+        res.set_content(out, "application/json");
     } catch (const std::exception& e) {
         res.status = 500;
-        std::cerr << "Exception in server_status: " << e.what() << std::endl;
-        res.set_content(std::format(R"({{"error":"Engine error getting status: {}"}})", e.what()), "application/json");
+        LOG_ERROR("Exception in server_routes: {}", e.what());
+        res.set_content(std::format(R"({{"error":"Engine error getting routes: {}"}})", e.what()), "application/json");
     } catch (...) {
         res.status = 500;
-        res.set_content(R"({"error":"Unknown internal server error getting status."})", "application/json");
+        res.set_content(R"({"error":"Unknown internal server error getting routes."})", "application/json");
     }
 }
 
+// POST /reset clears every book; /reset?book=X only that one (on the shard that owns it), leaving the other books in the process alone.
 void server_reset(const httplib::Request& req, httplib::Response& res) {
     try {
-        std::lock_guard<std::mutex> lock(gLock);
-        size_t count = MyMap.size();
-        MyMap.clear();
+        Command command{};
+        command.type_ = CommandType::Reset;
+
+        if (req.has_param("book")) {
+            std::string book = req.get_param_value("book");
+            if (book.empty()) {
+                res.status = 400;
+                res.set_content(R"({"error":"Missing required parameters"})", "application/json");
+                return;
+            }
+            command.order_.book_ = BookName::From(book);
+            EngineReply reply;
+            Execute(command, reply);
+
+            res.status = 200;
+            res.set_content(std::format(R"({{"message":"Orderbook cleared","booksCleared":{}}})", reply.count_), "application/json");
+            LOG_INFO("[RESET] Cleared orderbook {} ({} found)", book, reply.count_);
+            return;
+        }
+
+        // each shard swaps its books out into its reply; they are destroyed here when the replies go out of scope.
+        std::vector<Command> commands(gShards.size(), command);
+        std::vector<EngineReply> replies(gShards.size());
+        ExecuteOnAllShards(commands, replies);
+
+        size_t count = 0;
+        for (const EngineReply& reply : replies) {
+            count += reply.count_;
+        }
 
         res.status = 200;
         res.set_content(std::format(R"({{"message":"All orderbooks cleared","booksCleared":{}}})", count), "application/json");
-        std::cout << "\n[RESET] Cleared " << count << " orderbooks" << std::flush;
+        LOG_INFO("[RESET] Cleared {} orderbooks", count);
     } catch (const std::exception& e) {
         res.status = 500;
-        std::cerr << "Exception in server_reset: " << e.what() << std::endl;
+        LOG_ERROR("Exception in server_reset: {}", e.what());
         res.set_content(std::format(R"({{"error":"Engine error during reset: {}"}})", e.what()), "application/json");
     } catch (...) {
         res.status = 500;
@@ -767,124 +1406,763 @@ void server_reset(const httplib::Request& req, httplib::Response& res) {
     }
 }
 
-void server_batch(const httplib::Request& req, httplib::Response& res) {
+// Feeds the whole body to the decoder while httplib is still receiving it. false (with the 400 already in res) if it isn't a usable batch.
+template <typename Decoder, typename Sink>
+bool ReceiveBatch(const httplib::ContentReader& content_reader, Sink& sink, httplib::Response& res, RequestTiming& timing) {
+    Decoder decoder;
+    // keep reading to the end of the body even after an error, so the connection can be reused; the error is rethrown below
+    std::exception_ptr error;
+    uint64_t decoding = 0;
+    bool received = content_reader([&](const char* data, size_t length) {
+        if (!error && !decoder.Failed()) {
+            uint64_t start = metrics::Now();
+            try {
+                decoder.Feed(data, length, sink);
+            } catch (...) {
+                error = std::current_exception();
+            }
+            decoding += metrics::Since(start);
+        }
+        return true;
+    });
+    timing.AddDecode(decoding);
+    if (!received) {
+        if (res.status < 400) res.status = 400;
+        res.set_content(R"({"error":"Could not read the batch body"})", "application/json");
+        return false;
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+    if (!decoder.Finish()) {
+        res.status = 400;
+        res.set_content(std::format(R"({{"error":"Malformed batch: {} at byte {}"}})", decoder.Error(), decoder.ErrorOffset()), "application/json");
+        return false;
+    }
+    if (decoder.OrderCount() == 0) {
+        res.status = 400;
+        res.set_content(R"({"error":"No orders provided in batch"})", "application/json");
+        return false;
+    }
+    return true;
+}
+
+// The body is either JSON or, when the Content-Type says so, the binary batch format (Protocol.h) the Go balancer sends. Either way it is
+// decoded while httplib is still receiving it (BatchDecoder.h), straight into the per-shard order lists.
+// A plain batch runs each shard's part as one command, so nothing else touches a book in the middle of it. With ?stream=1 the batch
+// is matched in slices and other requests may interleave with it (see BatchStream); callers that need the batch to be atomic per book
+// must not ask for a stream.
+void server_batch(const httplib::Request& req, httplib::Response& res, const httplib::ContentReader& content_reader) {
     try {
-        // Parse the JSON body
-        std::string body = req.body;
-        std::vector<std::string> orders = extract_json_array(body, "orders");
+        RequestTiming timing;
+        // Split the orders by shard as they're decoded (keeping their order within each book).
+        // Every shard gets its part, even an empty one, because the results list every book in the engine.
+        std::vector<std::vector<OrderRequest>> ordersByShard(gShards.size());
+        // consecutive orders are nearly always for the same book, so only look the name up when it changes
+        BookName book{};
+        size_t shard = 0;
+        auto addOrder = [&](const batch::Order& order) {
+            if (order.book_.empty() || order.orderId_ == 0) return;
+            if (order.book_ != book.View()) {
+                book = BookName::From(order.book_);
+                shard = ShardIndex(order.book_);
+            }
+            ordersByShard[shard].push_back(OrderRequest{ book, order.orderId_, order.tradeType_, order.side_,
+                static_cast<Price>(order.price_), static_cast<Quantity>(order.quantity_) });
+        };
 
-        if (orders.empty()) {
-            res.status = 400;
-            res.set_content(R"({"error":"No orders provided in batch"})", "application/json");
+        bool binary = std::string_view(req.get_header_value("Content-Type")).starts_with(wire::kBatchContentType);
+        bool decoded = binary ? ReceiveBatch<batch::BinaryDecoder>(content_reader, addOrder, res, timing)
+                              : ReceiveBatch<batch::JsonDecoder>(content_reader, addOrder, res, timing);
+        if (!decoded) {
             return;
         }
 
-        // Track statistics per book
-        std::unordered_map<std::string, BookStats> bookStats;
-        int processedCount = 0;
+        if (req.get_param_value("stream") == "1") {
+            auto stream = std::make_shared<BatchStream>(std::move(ordersByShard));
+            res.status = 200;
+            res.set_chunked_content_provider("application/x-ndjson", [stream](size_t, httplib::DataSink& sink) { return stream->Next(sink); });
+            return;
+        }
 
-        {
-            std::lock_guard<std::mutex> lock(gLock);
+        std::vector<Command> commands(gShards.size());
+        for (size_t i = 0; i < gShards.size(); ++i) {
+            commands[i].type_ = CommandType::Batch;
+            commands[i].batch_ = ordersByShard[i];
+        }
+        std::vector<EngineReply> replies(gShards.size());
+        ExecuteOnAllShards(commands, replies);
+        timing.Executed(replies);
 
-            // Process each order
-            for (const auto& orderJson : orders) {
-                OrderId id = static_cast<OrderId>(extract_json_number(orderJson, "orderid"));
-                std::string book = extract_json_string(orderJson, "book");
-                std::string typeStr = extract_json_string(orderJson, "tradetype");
-                std::string sideStr = extract_json_string(orderJson, "side");
-                Price price = static_cast<Price>(extract_json_number(orderJson, "price"));
-                Quantity quantity = static_cast<Quantity>(extract_json_number(orderJson, "quantity"));
+        size_t processedCount = 0;
+        for (const EngineReply& reply : replies) {
+            processedCount += reply.count_;
+        }
 
-                if (book.empty() || id == 0) continue;
+        // Build response JSON with per-book results
+        std::string resultJson = std::format(R"({{"processedCount":{},"results":)", processedCount);
+        resultJson += MergeShardEntries(replies);
+        resultJson += "}";
 
-                OrderType type = parse_ordertype(typeStr);
-                Side side = parse_side(sideStr);
+        res.status = 200;
+        res.set_content(resultJson, "application/json");
+        timing.Built();
+        timing.Finish(res);
+        LOG_INFO("[BATCH] Processed {} orders", processedCount);
 
-                Orderbook& orderbook = MyMap[book];
-                Trades trades = orderbook.AddOrder(std::make_shared<Order>(type, side, price, quantity, id));
+    } catch (const std::exception& e) {
+        res.status = 500;
+        LOG_ERROR("Exception in server_batch: {}", e.what());
+        res.set_content(std::format(R"({{"error":"Engine error during batch processing: {}"}})", e.what()), "application/json");
+    } catch (...) {
+        res.status = 500;
+        res.set_content(R"({"error":"Unknown internal server error during batch processing."})", "application/json");
+    }
+}
 
-                // Track statistics
-                BookStats& stats = bookStats[book];
-                stats.tradesExecuted += trades.size();
-                for (const auto& trade : trades) {
-                    stats.volumeTraded += trade.GetBidTrade().quantity_;
+// Decodes binary requests (Protocol.h) into Commands, hands them to the shards together (up to kMaxInFlight at a time, so a client that
+// pipelines gets its orders matched back to back), and collects the replies in request order. Used by every binary transport.
+class WireDispatcher {
+    public:
+        // handles every complete message at the front of in and appends the replies to out. consumed is how many bytes were used
+        // (a message cut off at the end is left for the next call). false if the stream can't be framed any more.
+        bool Dispatch(std::string_view in, size_t& consumed, std::string& out) {
+            size_t offset = 0;
+            while (true) {
+                size_t inFlight = 0;
+                bool submitted[kMaxInFlight];
+                OrderId ids[kMaxInFlight];
+                wire::MessageType types[kMaxInFlight];
+                while (inFlight < kMaxInFlight && in.size() - offset >= sizeof(wire::MessageHeader)) {
+                    wire::MessageHeader header;
+                    std::memcpy(&header, in.data() + offset, sizeof(header));
+                    if (!ValidLength(header)) {
+                        LOG_WARN("binary client sent a bad message length {}", header.length_);
+                        consumed = offset;
+                        return false;
+                    }
+                    if (in.size() - offset < header.length_) { break; }
+
+                    EngineReply& reply = replies_[inFlight];
+                    reply.Rearm();
+                    reply.binary_ = true;
+                    Command command{};
+                    metrics::StageTimer decode(metrics::Stage::Decode);
+                    submitted[inFlight] = DecodeWireCommand(in.data() + offset, header, command, reply.wire_);
+                    decode.Stop();
+                    ids[inFlight] = command.order_.id_;
+                    types[inFlight] = header.type_;
+                    if (submitted[inFlight]) {
+                        gShards[ShardIndex(command.order_.book_.View())]->Submit(command, reply);
+                    }
+                    offset += header.length_;
+                    ++inFlight;
+                }
+                if (inFlight == 0) { break; }
+
+                for (size_t i = 0; i < inFlight; ++i) {
+                    EngineReply& reply = replies_[i];
+                    if (submitted[i]) {
+                        reply.Wait();
+                        if (reply.error_) {
+                            reply.wire_.clear();
+                            AppendReject(reply.wire_, ids[i], types[i], wire::RejectReason::EngineError);
+                        }
+                    }
+                    size_t start = out.size();
+                    out += reply.wire_;
+                    MarkLastInReply(out, start);
                 }
+            }
+            consumed = offset;
+            return true;
+        }
+
+        static bool ValidLength(const wire::MessageHeader& header) {
+            return header.length_ >= sizeof(header) && header.length_ <= wire::kMaxMessageSize;
+        }
 
-                processedCount++;
+    private:
+        static constexpr size_t kMaxInFlight = 64;
+
+        // flags the last message of the reply that starts at out[start].
+        static void MarkLastInReply(std::string& out, size_t start) {
+            size_t last = start;
+            for (size_t offset = start; offset < out.size();) {
+                wire::MessageHeader header;
+                std::memcpy(&header, out.data() + offset, sizeof(header));
+                last = offset;
+                offset += header.length_;
+            }
+            if (last < out.size()) {
+                out[last + offsetof(wire::MessageHeader, flags_)] |= wire::kFlagLastInReply;
+            }
+        }
+
+        std::vector<EngineReply> replies_ = std::vector<EngineReply>(kMaxInFlight);
+};
+
+#if defined(__linux__)
+// Binary order entry (Protocol.h) on its own TCP port, next to the HTTP endpoints.
+// One thread runs an epoll loop over every session; whatever complete messages a read brings in go through the WireDispatcher in one go,
+// and the replies are written back in request order. No HTTP parsing, no JSON, and the socket stays open between orders.
+// That thread waits for the shards' replies before it goes on to the next session, so a shard that is slow to answer (a big book, a
+// journal sync in --journal-sync=message) holds up every binary session, not just the ones with orders for it. Run more engines (or
+// use the shared-memory channel, which has a thread of its own) if that matters more than the lower latency of one tight loop.
+class BinaryServer {
+    public:
+        ~BinaryServer() { Stop(); }
+
+        bool Start(int port) {
+            listenFd_ = ::socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+            if (listenFd_ < 0) { return false; }
+            int one = 1;
+            ::setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+            sockaddr_in address{};
+            address.sin_family = AF_INET;
+            address.sin_addr.s_addr = htonl(INADDR_ANY);
+            address.sin_port = htons(static_cast<uint16_t>(port));
+            if (::bind(listenFd_, reinterpret_cast<sockaddr*>(&address), sizeof(address)) < 0 || ::listen(listenFd_, SOMAXCONN) < 0) {
+                ::close(listenFd_);
+                listenFd_ = -1;
+                return false;
             }
 
-            // Build response JSON with per-book results
-            std::string resultJson = "{";
-            resultJson += std::format(R"("processedCount":{},"results":{{)", processedCount);
+            epollFd_ = ::epoll_create1(EPOLL_CLOEXEC);
+            wakeFd_ = ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+            Watch(listenFd_, EPOLLIN, EPOLL_CTL_ADD);
+            Watch(wakeFd_, EPOLLIN, EPOLL_CTL_ADD);
 
-            bool first = true;
-            for (const auto& [bookName, book] : MyMap) {
-                if (!first) resultJson += ",";
-                first = false;
+            running_.store(true);
+            thread_ = std::thread([this] { Run(); });
+            return true;
+        }
+
+        void Stop() {
+            if (!thread_.joinable()) { return; }
+            running_.store(false);
+            uint64_t one = 1;
+            [[maybe_unused]] auto written = ::write(wakeFd_, &one, sizeof(one));
+            thread_.join();
+            for (auto& [fd, session] : sessions_) { ::close(fd); }
+            sessions_.clear();
+            ::close(listenFd_);
+            ::close(epollFd_);
+            ::close(wakeFd_);
+        }
 
-                auto [bestBid, bestAsk] = book.GetBestPrices();
-                auto [bidCount, askCount] = book.GetOrderCounts();
-                auto [bidLevels, askLevels] = book.GetLevelCounts();
+    private:
+        static constexpr size_t kMaxPendingOutput = 1 << 20; // stop reading from a client that doesn't read its replies
+        static constexpr size_t kMaxReadPerEvent = 256 * 1024; // then dispatch; epoll is level triggered, so the rest comes next time
+
+        struct Session {
+            int fd_;
+            std::string in_;
+            std::string out_;
+            uint32_t events_ = 0;
+        };
 
-                // Get stats for this book (may be zero if no orders were for this book)
-                const BookStats& stats = bookStats[bookName];
+        void Watch(int fd, uint32_t events, int op) {
+            epoll_event event{};
+            event.events = events;
+            event.data.fd = fd;
+            ::epoll_ctl(epollFd_, op, fd, &event);
+        }
 
-                resultJson += std::format(
-                    R"("{}":{{"tradesExecuted":{},"volumeTraded":{},"remainingBids":{},"remainingAsks":{},"bestBidPrice":{},"bestAskPrice":{},"bidLevels":{},"askLevels":{}}})",
-                    bookName,
-                    stats.tradesExecuted,
-                    stats.volumeTraded,
-                    bidCount,
-                    askCount,
-                    bestBid,
-                    bestAsk,
-                    bidLevels,
-                    askLevels
-                );
+        void Run() {
+            epoll_event events[64];
+            while (running_.load()) {
+                int ready = ::epoll_wait(epollFd_, events, 64, -1);
+                for (int i = 0; i < ready; ++i) {
+                    int fd = events[i].data.fd;
+                    if (fd == wakeFd_) { continue; }
+                    if (fd == listenFd_) {
+                        Accept();
+                        continue;
+                    }
+
+                    auto it = sessions_.find(fd);
+                    if (it == sessions_.end()) { continue; }
+                    Session& session = *it->second;
+                    bool open = (events[i].events & (EPOLLHUP | EPOLLERR)) == 0;
+                    if (open && (events[i].events & EPOLLIN)) { open = Read(session); }
+                    if (open) { open = Flush(session); }
+                    if (open) {
+                        UpdateInterest(session);
+                    } else {
+                        ::close(fd);
+                        sessions_.erase(it);
+                    }
+                }
             }
+        }
 
-            resultJson += "}}";
+        void Accept() {
+            while (true) {
+                int fd = ::accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                if (fd < 0) { return; }
+                int one = 1;
+                ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+                auto session = std::make_unique<Session>();
+                session->fd_ = fd;
+                session->events_ = EPOLLIN;
+                Watch(fd, EPOLLIN, EPOLL_CTL_ADD);
+                sessions_.emplace(fd, std::move(session));
+            }
+        }
 
-            res.status = 200;
-            res.set_content(resultJson, "application/json");
-            std::cout << "\n[BATCH] Processed " << processedCount << " orders" << std::flush;
+        // false when the client went away or sent something we can't frame. Reads at most kMaxReadPerEvent before dispatching it, so
+        // in_ never holds more than that plus a partial message, and nothing while the client is behind on its replies: that keeps a
+        // client that writes faster than it reads from growing our buffers (and from starving the other sessions).
+        bool Read(Session& session) {
+            char buffer[64 * 1024];
+            size_t received = 0;
+            while (received < kMaxReadPerEvent && session.out_.size() < kMaxPendingOutput) {
+                ssize_t count = ::read(session.fd_, buffer, sizeof(buffer));
+                if (count > 0) {
+                    session.in_.append(buffer, static_cast<size_t>(count));
+                    received += static_cast<size_t>(count);
+                    continue;
+                }
+                if (count == 0) { return false; }
+                if (errno == EINTR) { continue; }
+                if (errno == EAGAIN || errno == EWOULDBLOCK) { break; }
+                return false;
+            }
+            return Process(session);
         }
 
-    } catch (const std::exception& e) {
-        res.status = 500;
-        std::cerr << "Exception in server_batch: " << e.what() << std::endl;
-        res.set_content(std::format(R"({{"error":"Engine error during batch processing: {}"}})", e.what()), "application/json");
-    } catch (...) {
-        res.status = 500;
-        res.set_content(R"({"error":"Unknown internal server error during batch processing."})", "application/json");
+        bool Process(Session& session) {
+            size_t consumed = 0;
+            bool ok = dispatcher_.Dispatch(session.in_, consumed, session.out_);
+            session.in_.erase(0, consumed);
+            return ok;
+        }
+
+        // false if the connection broke.
+        bool Flush(Session& session) {
+            size_t written = 0;
+            while (written < session.out_.size()) {
+                ssize_t count = ::send(session.fd_, session.out_.data() + written, session.out_.size() - written, MSG_NOSIGNAL);
+                if (count > 0) {
+                    written += static_cast<size_t>(count);
+                    continue;
+                }
+                if (count < 0 && errno == EINTR) { continue; }
+                if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) { break; }
+                return false;
+            }
+            session.out_.erase(0, written);
+            return true;
+        }
+
+        // read while the client keeps up with its replies, and ask for EPOLLOUT while we still have something to send.
+        void UpdateInterest(Session& session) {
+            uint32_t events = (session.out_.size() < kMaxPendingOutput ? EPOLLIN : 0u) | (session.out_.empty() ? 0u : EPOLLOUT);
+            if (events != session.events_) {
+                session.events_ = events;
+                Watch(session.fd_, events, EPOLL_CTL_MOD);
+            }
+        }
+
+        int listenFd_ = -1;
+        int epollFd_ = -1;
+        int wakeFd_ = -1;
+        std::atomic<bool> running_{false};
+        std::thread thread_;
+        std::unordered_map<int, std::unique_ptr<Session>> sessions_;
+        WireDispatcher dispatcher_;
+};
+// Serves the shared-memory channel (ShmRing.h) the Go balancer uses to reach an engine on the same host.
+// One thread takes requests off the request ring in bursts, runs them through the WireDispatcher, and pushes the replies onto the
+// response ring in order.
+class ShmServer {
+    public:
+        ~ShmServer() { Stop(); }
+
+        bool Start(const std::string& path) {
+            if (!channel_.Create(path)) { return false; }
+            running_.store(true);
+            thread_ = std::thread([this] { Run(); });
+            return true;
+        }
+
+        void Stop() {
+            if (!thread_.joinable()) { return; }
+            running_.store(false);
+            channel_.Requests().Interrupt();
+            thread_.join();
+            channel_.Close();
+        }
+
+    private:
+        static constexpr int kBurst = 64;
+        static constexpr long kIdleWaitNs = 100'000'000; // wake up now and then to notice Stop()
+
+        void Run() {
+            shm::Ring requests = channel_.Requests();
+            shm::Ring responses = channel_.Responses();
+            char slot[shm::kSlotSize];
+            std::string in;
+            std::string out;
+            while (running_.load()) {
+                in.clear();
+                for (int i = 0; i < kBurst && requests.TryPop(slot); ++i) {
+                    wire::MessageHeader header;
+                    std::memcpy(&header, slot, sizeof(header));
+                    if (!WireDispatcher::ValidLength(header) || header.length_ > shm::kSlotSize) {
+                        // each slot is its own message, so a bad length only spoils that one: pass on a bare header (with its length
+                        // fixed in the copy we dispatch, not just in ours), which gets it rejected in order.
+                        header.length_ = sizeof(header);
+                        size_t start = in.size();
+                        in.append(slot, sizeof(header));
+                        std::memcpy(in.data() + start, &header, sizeof(header));
+                        continue;
+                    }
+                    in.append(slot, header.length_);
+                }
+                if (in.empty()) {
+                    requests.WaitForData(kIdleWaitNs);
+                    continue;
+                }
+
+                // every message in the burst is complete and framed, so this goes through all of them; if it ever stops early the
+                // rest would get no reply and their callers would wait forever, so say so loudly.
+                out.clear();
+                for (size_t offset = 0; offset < in.size();) {
+                    size_t consumed = 0;
+                    bool ok = dispatcher_.Dispatch(std::string_view(in).substr(offset), consumed, out);
+                    offset += consumed;
+                    if (!ok || consumed == 0) {
+                        LOG_ERROR("Shared-memory burst could not be framed, dropping its last {} bytes", in.size() - offset);
+                        break;
+                    }
+                }
+
+                for (size_t offset = 0; offset < out.size();) {
+                    wire::MessageHeader header;
+                    std::memcpy(&header, out.data() + offset, sizeof(header));
+                    while (!responses.TryPush(out.data() + offset, header.length_)) {
+                        // the balancer is behind on reading replies; let it catch up.
+                        responses.WakeConsumer();
+                        if (!running_.load()) { return; }
+                        std::this_thread::yield();
+                    }
+                    offset += header.length_;
+                }
+                responses.WakeConsumer();
+            }
+        }
+
+        shm::Channel channel_;
+        WireDispatcher dispatcher_;
+        std::atomic<bool> running_{false};
+        std::thread thread_;
+};
+#endif
+
+// Every --snapshot-interval seconds, asks every shard for a snapshot (Snapshot.h) and waits for the writers on its own thread, so the
+// shards only pay for the fork. Once a snapshot is published, older ones and the journal segments it covers are deleted.
+class Snapshotter {
+    public:
+        ~Snapshotter() { Stop(); }
+
+        void Start(std::chrono::seconds interval) {
+            thread_ = std::thread([this, interval] { Run(interval); });
+        }
+
+        void Stop() {
+            {
+                std::lock_guard<std::mutex> lock(mu_);
+                stopping_ = true;
+            }
+            cv_.notify_one();
+            if (thread_.joinable()) {
+                thread_.join();
+            }
+        }
+
+    private:
+        void Run(std::chrono::seconds interval) {
+            std::unique_lock<std::mutex> lock(mu_);
+            while (!cv_.wait_for(lock, interval, [this] { return stopping_; })) {
+                lock.unlock();
+                TakeSnapshots();
+                lock.lock();
+            }
+        }
+
+        void TakeSnapshots() {
+            std::vector<EngineReply> replies(gShards.size());
+            for (size_t i = 0; i < gShards.size(); ++i) {
+                Command command{};
+                command.type_ = CommandType::Snapshot;
+                gShards[i]->Submit(command, replies[i]);
+            }
+            for (EngineReply& reply : replies) {
+                reply.Wait();
+            }
+
+            for (size_t i = 0; i < gShards.size(); ++i) {
+                const EngineReply& reply = replies[i];
+                if (reply.error_) {
+                    try {
+                        std::rethrow_exception(reply.error_);
+                    } catch (const std::exception& e) {
+                        LOG_ERROR("Snapshot of shard {} failed: {}", i, e.what());
+                    }
+                    continue;
+                }
+                if (reply.snapshotPid_ == 0) {
+                    continue;
+                }
+
+                auto start = std::chrono::steady_clock::now();
+                const journal::Options& options = *gShards[i]->JournalOptions();
+                if (!snapshot::WaitForWriter(reply.snapshotPid_) || !snapshot::Publish(options.directory_, reply.body_)) {
+                    LOG_ERROR("Writing the snapshot of {} at {} failed", options.name_, reply.snapshotSequence_);
+                    std::error_code ec;
+                    std::filesystem::remove(reply.body_ + ".tmp", ec);
+                    continue;
+                }
+                snapshot::RemoveOlder(options.directory_, options.name_, reply.snapshotSequence_);
+                journal::RemoveCovered(options.directory_, options.name_, reply.snapshotSequence_);
+                auto elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+                LOG_INFO("Snapshot of {} at {} written ({} ms after the fork)", options.name_, reply.snapshotSequence_, elapsed);
+            }
+        }
+
+        std::thread thread_;
+        std::mutex mu_;
+        std::condition_variable cv_;
+        bool stopping_ = false;
+};
+
+// --ready-fd=N: writes "ready\n" to N (a pipe inherited from whoever started us) once every endpoint is bound, then closes it. The
+// parent blocks on the read instead of polling us, and if we die before getting there it sees the pipe close without the line.
+void SignalReady(int fd) {
+#if defined(__linux__) || defined(__APPLE__)
+    if (fd < 0) return;
+    const char line[] = "ready\n";
+    if (::write(fd, line, sizeof(line) - 1) < 0) {
+        LOG_WARN("Could not signal readiness on fd {}: {}", fd, std::strerror(errno));
     }
+    ::close(fd);
+#else
+    (void)fd;
+#endif
 }
 
 int main(int argc, char* argv[]) {
-    // Parse port from command line argument, default to 6060
+    // Usage: server [port] [--ladder-levels=N] [--tick-size=N] [--expected-orders=N] [--huge-pages] [--id-index=hash|direct] [--log-file=PATH] [--shards=N] [--sequencer-cpu=N] [--binary-port=N] [--shm=PATH] [--unix-socket=PATH] [--ready-fd=N]
+    //               [--journal=DIR] [--journal-sync=none|group|message] [--journal-group-us=N] [--journal-segment-mb=N] [--snapshot-interval=SECONDS]
+    // Parse port from command line argument, default to 6060. Logs go to engine-<port>.log unless --log-file says otherwise ("-" is stdout).
+    // --shards splits the books over N matching threads (default: one per core, at most 8). An engine that only ever holds one book wants --shards=1.
+    // --sequencer-cpu=N pins shard i to core N+i (Linux only); leave it off when several engines share a machine.
     int port = 6060;
-    if (argc > 1) {
+    size_t shards = std::clamp<size_t>(std::thread::hardware_concurrency(), 1, 8);
+    // --binary-port=N also serves the binary order-entry protocol (Protocol.h) on that port, and --shm=PATH serves the same messages over a
+    // shared-memory ring pair in that file (ShmRing.h) for the Go balancer. Both are Linux only.
+    // --unix-socket=PATH serves the HTTP endpoints on a Unix domain socket instead of the TCP port (the port then only names the log file),
+    // which skips the loopback TCP stack and means nobody has to hand out free ports.
+    // --ready-fd=N says when we're serving by writing to an inherited pipe (see SignalReady); the Go manager uses it instead of polling.
+    // --journal=DIR makes every shard write the commands that change its books to a write-ahead journal in DIR (Journal.h) before applying
+    // them. --journal-sync picks when a reply may go out: none (the journal survives the process being killed, not the machine), group
+    // (default: one sync per --journal-group-us, 200 by default, covers every command that arrived meanwhile), or message (a sync per command).
+    // Keep --shards the same across restarts of an engine with a journal: shard i's journal is shard-i-*.wal.
+    // With a journal, the engine starts from what it finds in DIR: the newest snapshot of each shard plus the journal after it. Snapshots are
+    // taken every --snapshot-interval seconds (0, the default, takes none, and a restart replays the whole journal).
+    journal::Options journalOptions;
+    int snapshotInterval = 0;
+    int sequencerCpu = -1;
+    int binaryPort = 0;
+    std::string shmPath;
+    std::string unixSocket;
+    std::string logFile;
+    int readyFd = -1;
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
         try {
-            port = std::stoi(argv[1]);
-            if (port < 1024 || port > 65535) {
-                std::cerr << "Port must be between 1024 and 65535, using default 6060\n";
-                port = 6060;
+            if (arg.starts_with("--ladder-levels=")) {
+                gBookConfig.ladderLevels_ = std::stoul(arg.substr(16));
+            } else if (arg.starts_with("--tick-size=")) {
+                gBookConfig.tickSize_ = parse_price(arg.substr(12));
+            } else if (arg.starts_with("--expected-orders=")) {
+                gBookConfig.expectedOrders_ = std::stoull(arg.substr(18));
+            } else if (arg == "--huge-pages") {
+                gBookConfig.hugePages_ = true;
+            } else if (arg.starts_with("--id-index=")) {
+                gBookConfig.indexMode_ = arg.substr(11) == "direct" ? IndexMode::Direct : IndexMode::Hashed;
+            } else if (arg.starts_with("--log-file=")) {
+                logFile = arg.substr(11);
+            } else if (arg.starts_with("--shards=")) {
+                shards = std::max<size_t>(1, std::stoul(arg.substr(9)));
+            } else if (arg.starts_with("--binary-port=")) {
+                binaryPort = std::stoi(arg.substr(14));
+            } else if (arg.starts_with("--shm=")) {
+                shmPath = arg.substr(6);
+            } else if (arg.starts_with("--unix-socket=")) {
+                unixSocket = arg.substr(14);
+            } else if (arg.starts_with("--journal=")) {
+                journalOptions.directory_ = arg.substr(10);
+            } else if (arg.starts_with("--journal-sync=")) {
+                if (!journal::ParseSyncMode(arg.substr(15), journalOptions.mode_)) {
+                    std::cerr << "Unknown journal sync mode " << arg.substr(15) << ", using group\n";
+                }
+            } else if (arg.starts_with("--journal-group-us=")) {
+                journalOptions.groupInterval_ = std::chrono::microseconds(std::stoul(arg.substr(19)));
+            } else if (arg.starts_with("--snapshot-interval=")) {
+                snapshotInterval = std::stoi(arg.substr(20));
+            } else if (arg.starts_with("--journal-segment-mb=")) {
+                journalOptions.segmentSize_ = std::max<size_t>(1, std::stoul(arg.substr(21))) << 20;
+            } else if (arg.starts_with("--sequencer-cpu=")) {
+                sequencerCpu = std::stoi(arg.substr(16));
+            } else if (arg.starts_with("--ready-fd=")) {
+                readyFd = std::stoi(arg.substr(11));
+            } else {
+                port = std::stoi(arg);
+                if (port < 1024 || port > 65535) {
+                    std::cerr << "Port must be between 1024 and 65535, using default 6060\n";
+                    port = 6060;
+                }
             }
         } catch (const std::exception& e) {
-            std::cerr << "Invalid port argument, using default 6060\n";
+            std::cerr << "Invalid argument " << arg << ", ignoring\n";
         }
     }
 
-    // we currently access "MyMap" in all functions, which we know may run concurrently. This can be a race condition (trade + cancel at the same time).
+    // the handlers run on httplib's worker threads and never touch a book themselves: everything goes through the shards.
     httplib::Server svr;
+    // httplib writes a response's headers and body separately. With Nagle on, the body of every response after the first on a
+    // keep-alive connection waits ~40 ms for the client's delayed ACK.
+    svr.set_tcp_nodelay(true);
 
     svr.Post("/trade", server_trade);
     svr.Post("/cancel", server_cancel);
     svr.Get("/status", server_status);
+    svr.Get("/metrics", server_metrics);
     svr.Post("/reset", server_reset);
+    svr.Get("/routes", server_routes);
     svr.Post("/batch", server_batch);
 
-    std::cout << "C++ server listening on http://localhost:" << port << "\n" << std::flush;
-    svr.listen("0.0.0.0", port);
+    if (logFile.empty()) {
+        logFile = std::format("engine-{}.log", port);
+    }
+    if (!AsyncLogger::Instance().Start(logFile)) {
+        std::cerr << "Could not open log file " << logFile << ", logging to stdout\n";
+        AsyncLogger::Instance().Start("-");
+    }
+
+    // calibrate the stage timestamps' clock now rather than on the first request (Metrics.h)
+    LOG_INFO("Stage timing: {} ns per tick{}", metrics::NanosecondsPerTick(), metrics::kInvariantTsc ? " (TSC)" : "");
+
+    for (size_t i = 0; i < shards; ++i) {
+        gShards.push_back(std::make_unique<Shard>());
+    }
+
+    std::vector<std::unique_ptr<journal::Journal>> journals(shards);
+    if (!journalOptions.directory_.empty()) {
+        // the shards recover side by side; nothing is listening yet, so nobody sees a half-loaded book.
+        std::vector<journal::Options> options(shards, journalOptions);
+        std::vector<std::thread> recovery;
+        for (size_t i = 0; i < shards; ++i) {
+            options[i].name_ = std::format("shard-{}", i);
+            recovery.emplace_back([&options, i] { options[i].firstSequence_ = gShards[i]->Recover(options[i]) + 1; });
+        }
+        for (std::thread& thread : recovery) {
+            thread.join();
+        }
+
+        for (size_t i = 0; i < shards; ++i) {
+            // running without the journal that was asked for would quietly lose orders, so don't start at all
+            journals[i] = std::make_unique<journal::Journal>();
+            if (!journals[i]->Open(options[i])) {
+                std::cerr << "Could not open journal " << options[i].name_ << " in " << options[i].directory_ << "\n";
+                AsyncLogger::Instance().Stop();
+                return 1;
+            }
+            LOG_INFO("Journal {} continues at sequence {}", options[i].name_, journals[i]->LastSequence() + 1);
+        }
+    }
+
+    for (size_t i = 0; i < shards; ++i) {
+        gShards[i]->Start(sequencerCpu < 0 ? -1 : sequencerCpu + static_cast<int>(i), std::move(journals[i]));
+    }
+
+    Snapshotter snapshotter;
+    if (snapshotInterval > 0) {
+        if (journalOptions.directory_.empty()) {
+            std::cerr << "--snapshot-interval needs --journal, not taking snapshots\n";
+        } else {
+            snapshotter.Start(std::chrono::seconds(snapshotInterval));
+        }
+    }
+
+#if defined(__linux__)
+    BinaryServer binaryServer;
+    if (binaryPort != 0) {
+        if (binaryServer.Start(binaryPort)) {
+            LOG_INFO("Binary order entry listening on port {}", binaryPort);
+        } else {
+            std::cerr << "Could not listen on binary port " << binaryPort << "\n";
+        }
+    }
+    ShmServer shmServer;
+    if (!shmPath.empty()) {
+        if (shmServer.Start(shmPath)) {
+            LOG_INFO("Shared-memory transport at {}", shmPath);
+        } else {
+            std::cerr << "Could not create shared-memory transport at " << shmPath << "\n";
+        }
+    }
+#else
+    if (binaryPort != 0 || !shmPath.empty()) {
+        std::cerr << "The binary order-entry port and the shared-memory transport need Linux, ignoring them\n";
+    }
+#endif
+
+#if !defined(_WIN32) || defined(CPPHTTPLIB_HAVE_AFUNIX_H)
+    if (!unixSocket.empty()) {
+        // a socket left behind by an engine that got killed would make bind fail. Only ever remove a socket, never some other file.
+        std::error_code ec;
+        if (std::filesystem::is_socket(unixSocket, ec)) {
+            std::filesystem::remove(unixSocket, ec);
+        }
+        svr.set_address_family(AF_UNIX);
+        std::cout << "C++ server listening on unix:" << unixSocket << "\n" << std::flush;
+        LOG_INFO("C++ server listening on unix:{} with {} shards", unixSocket, shards);
+        if (svr.bind_to_port(unixSocket, 80)) {
+            SignalReady(readyFd);
+            svr.listen_after_bind();
+        } else {
+            std::cerr << "Could not listen on " << unixSocket << "\n";
+        }
+        std::filesystem::remove(unixSocket, ec);
+    } else
+#else
+    if (!unixSocket.empty()) {
+        std::cerr << "Unix domain sockets need afunix.h on Windows, using the TCP port\n";
+    }
+#endif
+    {
+        std::cout << "C++ server listening on http://localhost:" << port << "\n" << std::flush;
+        LOG_INFO("C++ server listening on http://localhost:{} with {} shards", port, shards);
+        if (svr.bind_to_port("0.0.0.0", port)) {
+            SignalReady(readyFd);
+            svr.listen_after_bind();
+        } else {
+            std::cerr << "Could not listen on port " << port << "\n";
+        }
+    }
+    snapshotter.Stop();
+#if defined(__linux__)
+    binaryServer.Stop();
+    shmServer.Stop();
+#endif
+    for (auto& shard : gShards) {
+        shard->Stop();
+    }
+    AsyncLogger::Instance().Stop();
 }
 
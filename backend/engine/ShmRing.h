@@ -0,0 +1,181 @@
+#pragma once
+
+// Shared-memory transport between the Go balancer and an engine on the same host (Linux only, see --shm).
+//
+// The engine creates a file (normally under /dev/shm) holding two single-producer / single-consumer rings: requests (Go -> engine) and
+// responses (engine -> Go). Each slot holds one binary protocol message (Protocol.h), so the engine handles it exactly like a message
+// from a TCP session, minus the kernel network stack. A consumer with nothing to read spins for a moment and then sleeps on a futex;
+// the producer only makes the wake-up syscall when the consumer has said it is sleeping.
+//
+// The Go side (backend/internal/transport) maps the same file and hard-codes this layout, so change both together:
+//
+//     0  magic u64, version u32, slots u32, slotSize u32
+//    64  request ring:  head u64 @+0, tail u64 @+64, signal u32 @+128, waiting u32 @+132
+//   256  response ring: same
+//  4096  request slots  (slots * slotSize)
+//        response slots (slots * slotSize)
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string>
+
+#include "Sequencer.h" // CpuRelax
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+namespace shm{
+
+constexpr std::uint64_t kMagic = 0x474E495248534B42; // "BKSHRING"
+constexpr std::uint32_t kVersion = 1;
+constexpr std::uint32_t kSlots = 4096;
+constexpr std::uint32_t kSlotSize = 64;
+constexpr std::size_t kSlotsOffset = 4096;
+constexpr std::size_t kFileSize = kSlotsOffset + 2 * static_cast<std::size_t>(kSlots) * kSlotSize;
+
+static_assert(std::atomic<std::uint32_t>::is_always_lock_free && std::atomic<std::uint64_t>::is_always_lock_free,
+    "the other process sees these as plain integers");
+
+struct RingHeader{
+    alignas(64) std::atomic<std::uint64_t> head_;
+    alignas(64) std::atomic<std::uint64_t> tail_;
+    alignas(64) std::atomic<std::uint32_t> signal_;  // futex word, bumped when a sleeping consumer has to wake up
+    std::atomic<std::uint32_t> waiting_;             // 1 while the consumer is (about to be) asleep
+};
+
+struct Control{
+    std::atomic<std::uint64_t> magic_; // written last, once the rest is set up
+    std::uint32_t version_;
+    std::uint32_t slots_;
+    std::uint32_t slotSize_;
+    alignas(64) RingHeader requests_;
+    RingHeader responses_;
+};
+
+static_assert(sizeof(RingHeader) == 192 && sizeof(Control) == 448);
+
+// shared futexes (no FUTEX_PRIVATE_FLAG): the other side of the ring is another process.
+inline void FutexWait(std::atomic<std::uint32_t>& word, std::uint32_t expected, long timeoutNs){
+    timespec timeout{ 0, timeoutNs };
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT, expected, &timeout, nullptr, 0);
+}
+
+inline void FutexWake(std::atomic<std::uint32_t>& word){
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE, 1, nullptr, nullptr, 0);
+}
+
+// One direction of the channel. Each side only ever uses the producer half or the consumer half.
+class Ring{
+    public:
+        Ring(RingHeader& header, char* slots): header_(header), slots_(slots) {}
+
+        // producer: false if the ring is full.
+        bool TryPush(const char* message, std::size_t size){
+            std::uint64_t head = header_.head_.load(std::memory_order_relaxed);
+            if (head - header_.tail_.load(std::memory_order_acquire) == kSlots){ return false; }
+            std::memcpy(slots_ + (head % kSlots) * kSlotSize, message, size);
+            header_.head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // producer: call after pushing (once per burst is enough).
+        void WakeConsumer(){
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (header_.waiting_.load(std::memory_order_relaxed) != 0){
+                header_.signal_.fetch_add(1);
+                FutexWake(header_.signal_);
+            }
+        }
+
+        // consumer: copies the next slot into out (kSlotSize bytes).
+        bool TryPop(char* out){
+            std::uint64_t tail = header_.tail_.load(std::memory_order_relaxed);
+            if (tail == header_.head_.load(std::memory_order_acquire)){ return false; }
+            std::memcpy(out, slots_ + (tail % kSlots) * kSlotSize, kSlotSize);
+            header_.tail_.store(tail + 1, std::memory_order_release);
+            return true;
+        }
+
+        // consumer: spins for a bit, then sleeps until the producer wakes us (or timeoutNs passes).
+        void WaitForData(long timeoutNs){
+            for (int i = 0; i < 2048; ++i){
+                if (HasData()){ return; }
+                CpuRelax();
+            }
+            std::uint32_t signal = header_.signal_.load();
+            header_.waiting_.store(1);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (!HasData()){ FutexWait(header_.signal_, signal, timeoutNs); }
+            header_.waiting_.store(0);
+        }
+
+        // wakes a consumer sleeping in WaitForData, e.g. to shut it down.
+        void Interrupt(){
+            header_.signal_.fetch_add(1);
+            FutexWake(header_.signal_);
+        }
+
+    private:
+        bool HasData() const{
+            return header_.tail_.load(std::memory_order_relaxed) != header_.head_.load(std::memory_order_acquire);
+        }
+
+        RingHeader& header_;
+        char* slots_;
+};
+
+// The engine's end: creates and maps the file, and removes it again when done.
+class Channel{
+    public:
+        Channel() = default;
+        Channel(const Channel&) = delete;
+        Channel& operator=(const Channel&) = delete;
+        ~Channel() { Close(); }
+
+        bool Create(const std::string& path){
+            int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+            if (fd < 0){ return false; }
+            if (::ftruncate(fd, static_cast<off_t>(kFileSize)) != 0){
+                ::close(fd);
+                return false;
+            }
+            void* memory = ::mmap(nullptr, kFileSize, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            ::close(fd);
+            if (memory == MAP_FAILED){ return false; }
+
+            // the file starts out zeroed, which is a valid empty state for both rings.
+            memory_ = static_cast<char*>(memory);
+            path_ = path;
+            control_ = reinterpret_cast<Control*>(memory_);
+            control_->version_ = kVersion;
+            control_->slots_ = kSlots;
+            control_->slotSize_ = kSlotSize;
+            control_->magic_.store(kMagic, std::memory_order_release);
+            return true;
+        }
+
+        void Close(){
+            if (memory_ == nullptr){ return; }
+            ::munmap(memory_, kFileSize);
+            ::unlink(path_.c_str());
+            memory_ = nullptr;
+        }
+
+        Ring Requests() { return Ring(control_->requests_, memory_ + kSlotsOffset); }
+        Ring Responses() { return Ring(control_->responses_, memory_ + kSlotsOffset + static_cast<std::size_t>(kSlots) * kSlotSize); }
+
+    private:
+        char* memory_ = nullptr;
+        Control* control_ = nullptr;
+        std::string path_;
+};
+
+} // namespace shm
+#endif
@@ -0,0 +1,311 @@
+#pragma once
+
+// Point-in-time snapshots of a shard's books (see --snapshot-interval), so a restart bulk-loads the books and only replays the journal
+// records written after the snapshot, instead of pushing every order since the beginning through the matching engine again.
+//
+// The shard forks while it applies a Snapshot command: the child gets a copy-on-write image of the books exactly as of that command,
+// writes them out and exits, and the parent goes straight back to matching. The only stall is fork() itself (copying the page tables).
+// The child must not take locks or allocate (another thread may have held the malloc lock at the moment we forked), which is why
+// FileWriter writes through a fixed buffer with plain write() calls.
+//
+// Layout (packed, little-endian):
+//   FileHeader
+//   per book: BookHeader, then levelCount_ times a LevelHeader followed by that level's count_ OrderRecords in FIFO order.
+//             Bids first, best price first, then asks the same way.
+//   Footer: CRC32C of everything before it.
+// A snapshot is written as <name>-<sequence>.snap.tmp and only renamed to .snap once the child exited cleanly, so a .snap file is
+// always complete. sequence is the last journal record the snapshot includes; a restart replays the journal from the next one.
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <format>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "Journal.h" // Crc32c
+
+#if !defined(_WIN32)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+#if defined(__linux__)
+#include <csignal>
+#include <sys/prctl.h>
+#endif
+
+namespace snapshot{
+
+constexpr std::uint64_t kMagic = 0x50414E534B4F4F42; // "BOOKSNAP"
+constexpr std::uint32_t kVersion = 1;
+constexpr std::size_t kBookNameSize = 32;
+
+#pragma pack(push, 1)
+
+struct FileHeader{
+    std::uint64_t magic_;
+    std::uint32_t version_;
+    std::uint32_t bookCount_;
+    std::uint64_t sequence_;    // last journal record included
+    std::uint64_t orderCount_;  // over every book, so the loader can size things up front
+};
+
+struct BookHeader{
+    char name_[kBookNameSize];  // zero padded
+    std::uint32_t levelCount_;  // bid levels + ask levels
+    std::uint32_t reserved_;
+    std::uint64_t orderCount_;
+};
+
+struct LevelHeader{
+    std::int32_t price_;
+    std::uint32_t count_;       // orders in the level
+    std::uint8_t side_;         // 0 bid, 1 ask
+    std::uint8_t reserved_[7];
+};
+
+struct OrderRecord{
+    std::uint64_t orderId_;
+    std::uint32_t initialQuantity_;
+    std::uint32_t remainingQuantity_;
+    std::uint8_t orderType_;    // 0 GoodTillCancel, 1 FillAndKill
+    std::uint8_t reserved_[3];
+};
+
+struct Footer{
+    std::uint32_t crc_;
+    std::uint32_t reserved_;
+    std::uint64_t magic_;
+};
+
+#pragma pack(pop)
+
+static_assert(sizeof(FileHeader) == 32 && sizeof(BookHeader) == 48 && sizeof(LevelHeader) == 16 && sizeof(OrderRecord) == 20 && sizeof(Footer) == 16);
+
+inline std::string SnapshotPath(const std::string& directory, const std::string& name, std::uint64_t sequence){
+    return std::format("{}/{}-{:020}.snap", directory, name, sequence);
+}
+
+// sequence numbers of the complete snapshots of name in directory, oldest first.
+inline std::vector<std::uint64_t> ListSnapshots(const std::string& directory, const std::string& name){
+    std::vector<std::uint64_t> sequences;
+    std::error_code ec;
+    std::string prefix = name + "-";
+    for (const auto& entry : std::filesystem::directory_iterator(directory, ec)){
+        std::string file = entry.path().filename().string();
+        if (!file.starts_with(prefix) || !file.ends_with(".snap")){ continue; }
+        std::string digits = file.substr(prefix.size(), file.size() - prefix.size() - 5);
+        if (digits.empty() || !std::all_of(digits.begin(), digits.end(), [](char c){ return c >= '0' && c <= '9'; })){ continue; }
+        sequences.push_back(std::stoull(digits));
+    }
+    std::sort(sequences.begin(), sequences.end());
+    return sequences;
+}
+
+// deletes the snapshots of name older than sequence, and whatever .tmp files a crashed writer left behind (only call it while no writer
+// for name is running).
+inline void RemoveOlder(const std::string& directory, const std::string& name, std::uint64_t sequence){
+    std::error_code ec;
+    for (std::uint64_t older : ListSnapshots(directory, name)){
+        if (older < sequence){ std::filesystem::remove(SnapshotPath(directory, name, older), ec); }
+    }
+    std::string prefix = name + "-";
+    for (const auto& entry : std::filesystem::directory_iterator(directory, ec)){
+        std::string file = entry.path().filename().string();
+        if (file.starts_with(prefix) && file.ends_with(".snap.tmp")){
+            std::filesystem::remove(entry.path(), ec);
+        }
+    }
+}
+
+#if !defined(_WIN32)
+// Buffered, allocation-free writer for the forked child. The CRC is taken as the buffer goes out.
+class FileWriter{
+    public:
+        explicit FileWriter(int fd): fd_(fd) {}
+
+        template <typename T>
+        void Put(const T& value){ Write(&value, sizeof(value)); }
+
+        void Write(const void* data, std::size_t size){
+            const char* bytes = static_cast<const char*>(data);
+            while (size > 0){
+                std::size_t chunk = std::min(size, sizeof(buffer_) - used_);
+                std::memcpy(buffer_ + used_, bytes, chunk);
+                used_ += chunk;
+                bytes += chunk;
+                size -= chunk;
+                if (used_ == sizeof(buffer_)){ Flush(); }
+            }
+        }
+
+        // appends the footer and makes the file durable. false if any write failed.
+        bool Finish(){
+            Flush();
+            Footer footer{};
+            footer.crc_ = crc_;
+            footer.magic_ = kMagic;
+            Put(footer);
+            Flush();
+            return ok_ && ::fsync(fd_) == 0;
+        }
+
+    private:
+        void Flush(){
+            crc_ = journal::Crc32c(crc_, buffer_, used_);
+            for (std::size_t written = 0; written < used_ && ok_;){
+                ssize_t n = ::write(fd_, buffer_ + written, used_ - written);
+                if (n < 0 && errno == EINTR){ continue; }
+                if (n <= 0){ ok_ = false; }
+                else{ written += static_cast<std::size_t>(n); }
+            }
+            used_ = 0;
+        }
+
+        int fd_;
+        std::uint32_t crc_ = 0;
+        bool ok_ = true;
+        std::size_t used_ = 0;
+        char buffer_[1 << 16];
+};
+
+// Maps a snapshot file and hands out its records in order. Open() checks the header and the footer's CRC, so the loader only has to
+// check that the counts add up.
+class FileReader{
+    public:
+        FileReader() = default;
+        FileReader(const FileReader&) = delete;
+        FileReader& operator=(const FileReader&) = delete;
+        ~FileReader(){
+            if (memory_ != nullptr){ ::munmap(memory_, size_); }
+        }
+
+        bool Open(const std::string& path){
+            int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+            if (fd < 0){ return false; }
+            struct stat info;
+            if (::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(FileHeader) + sizeof(Footer)){
+                ::close(fd);
+                return false;
+            }
+            size_ = static_cast<std::size_t>(info.st_size);
+            int flags = MAP_PRIVATE;
+#if defined(__linux__)
+            flags |= MAP_POPULATE; // we read all of it straight away
+#endif
+            void* memory = ::mmap(nullptr, size_, PROT_READ, flags, fd, 0);
+            ::close(fd);
+            if (memory == MAP_FAILED){ return false; }
+            memory_ = static_cast<char*>(memory);
+
+            Footer footer;
+            std::memcpy(&footer, memory_ + size_ - sizeof(footer), sizeof(footer));
+            std::memcpy(&header_, memory_, sizeof(header_));
+            end_ = size_ - sizeof(footer);
+            offset_ = sizeof(header_);
+            return footer.magic_ == kMagic && header_.magic_ == kMagic && header_.version_ == kVersion &&
+                   journal::Crc32c(0, memory_, end_) == footer.crc_;
+        }
+
+        const FileHeader& Header() const { return header_; }
+
+        template <typename T>
+        bool Get(T& value){
+            if (end_ - offset_ < sizeof(value)){ return false; }
+            std::memcpy(&value, memory_ + offset_, sizeof(value));
+            offset_ += sizeof(value);
+            return true;
+        }
+
+        bool AtEnd() const { return offset_ == end_; }
+
+    private:
+        char* memory_ = nullptr;
+        std::size_t size_ = 0;
+        std::size_t end_ = 0;
+        std::size_t offset_ = 0;
+        FileHeader header_{};
+};
+
+// Forks a child that runs write(FileWriter&) into path and exits (0 if write returned true and the file made it to disk). Returns the
+// child's pid for WaitForWriter, or -1 if the file couldn't be created or fork failed. Everything write touches must already exist
+// before the call: the child can't allocate.
+template <typename Fn>
+int WriteInChild(const std::string& path, Fn&& write){
+    int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0){ return -1; }
+#if defined(__linux__)
+    pid_t parent = ::getpid();
+#endif
+    pid_t pid = ::fork();
+    if (pid == 0){
+#if defined(__linux__)
+        // don't outlive an engine that gets killed (it would hold on to its sockets until the snapshot is done)
+        ::prctl(PR_SET_PDEATHSIG, SIGKILL);
+        if (::getppid() != parent){ ::_exit(1); }
+#endif
+        FileWriter writer(fd);
+        bool ok = write(writer) && writer.Finish();
+        ::_exit(ok ? 0 : 1);
+    }
+    ::close(fd);
+    if (pid < 0){ ::unlink(path.c_str()); }
+    return static_cast<int>(pid);
+}
+
+// true if the child wrote its snapshot completely.
+inline bool WaitForWriter(int pid){
+    int status = 0;
+    while (::waitpid(static_cast<pid_t>(pid), &status, 0) < 0){
+        if (errno != EINTR){ return false; }
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+// renames the finished .tmp into place and makes the rename durable.
+inline bool Publish(const std::string& directory, const std::string& path){
+    if (::rename((path + ".tmp").c_str(), path.c_str()) != 0){ return false; }
+    int fd = ::open(directory.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd >= 0){
+        ::fsync(fd);
+        ::close(fd);
+    }
+    return true;
+}
+#else
+// no fork() on Windows, and the journal isn't available there either, so there is nothing to snapshot.
+class FileWriter{
+    public:
+        template <typename T>
+        void Put(const T&){}
+        void Write(const void*, std::size_t){}
+};
+
+class FileReader{
+    public:
+        bool Open(const std::string&){ return false; }
+        const FileHeader& Header() const { return header_; }
+        template <typename T>
+        bool Get(T&){ return false; }
+        bool AtEnd() const { return true; }
+
+    private:
+        FileHeader header_{};
+};
+
+template <typename Fn>
+int WriteInChild(const std::string&, Fn&&){ return -1; }
+
+inline bool WaitForWriter(int){ return false; }
+inline bool Publish(const std::string&, const std::string&){ return false; }
+#endif
+
+} // namespace snapshot
@@ -0,0 +1,802 @@
+// Unit tests for the engine's building blocks, one group per part. Each group is its own ctest entry (see CMakeLists.txt):
+//   cmake -S . -B build && cmake --build build -j && ctest --test-dir build --output-on-failure
+// or by hand:  g++ -std=c++23 -O2 Tests.cpp -pthread -o tests && ./tests [group]
+//
+// No test framework: CHECK counts the failures and prints where they happened, and main returns non-zero if there were any.
+
+#include "Orderbook.h"
+#include "BatchDecoder.h"
+#include "Journal.h"
+#include "Protocol.h"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <format>
+#include <functional>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <csignal>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+namespace {
+
+int gFailures = 0;
+
+#define CHECK(condition) Check((condition), #condition, __FILE__, __LINE__)
+
+bool Check(bool ok, const char* what, const char* file, int line) {
+    if (!ok) {
+        ++gFailures;
+        std::cerr << std::format("{}:{}: CHECK({}) failed\n", file, line, what);
+    }
+    return ok;
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------
+// PriceLadder
+
+using Asks = PriceLadder<int, std::less<Price>>;
+using Bids = PriceLadder<int, std::greater<Price>>;
+
+template <typename Ladder>
+std::vector<std::pair<Price, int>> Levels(const Ladder& ladder) {
+    std::vector<std::pair<Price, int>> levels;
+    ladder.ForEach([&](Price price, const int& level) { levels.emplace_back(price, level); });
+    return levels;
+}
+
+void TestLadderRecenter() {
+    Asks asks(64, 1);
+    asks[1000] = 1;
+    // just past the band: the two levels fit in 64 slots, so the band moves instead of using the map
+    asks[1040] = 2;
+    asks[990] = 3;
+    CHECK((Levels(asks) == std::vector<std::pair<Price, int>>{ { 990, 3 }, { 1000, 1 }, { 1040, 2 } }));
+    CHECK(asks.BestPrice() == 990);
+    CHECK(asks.Find(1000) != nullptr && *asks.Find(1000) == 1);
+    CHECK(asks.Find(1001) == nullptr);
+
+    asks.Erase(990);
+    CHECK(asks.BestPrice() == 1000);
+    CHECK(asks.Size() == 2);
+}
+
+void TestLadderOverflow() {
+    Asks asks(64, 1);
+    asks[1000] = 1;
+    asks[1010] = 2;
+    asks[5000] = 3;  // too far from the live levels to fit: goes to the map
+    asks[-50] = 4;   // so does this one, and it is the best ask now
+    CHECK((Levels(asks) == std::vector<std::pair<Price, int>>{ { -50, 4 }, { 1000, 1 }, { 1010, 2 }, { 5000, 3 } }));
+    CHECK(asks.BestPrice() == -50);
+    CHECK(asks.BestLevel() == 4);
+
+    asks.Erase(-50);
+    CHECK(asks.BestPrice() == 1000);
+    // emptying the array moves the band to the map's best level, which has to keep its contents
+    asks.Erase(1000);
+    asks.Erase(1010);
+    CHECK(asks.Size() == 1);
+    CHECK(asks.BestPrice() == 5000);
+    CHECK(asks.Find(5000) != nullptr && *asks.Find(5000) == 3);
+    asks[5001] = 5;
+    CHECK((Levels(asks) == std::vector<std::pair<Price, int>>{ { 5000, 3 }, { 5001, 5 } }));
+
+    Bids bids(64, 1);
+    bids[100] = 1;
+    bids[90] = 2;
+    bids[-1000] = 3;
+    CHECK((Levels(bids) == std::vector<std::pair<Price, int>>{ { 100, 1 }, { 90, 2 }, { -1000, 3 } }));
+    bids.Erase(100);
+    bids.Erase(90);
+    CHECK(bids.BestPrice() == -1000 && bids.BestLevel() == 3);
+
+    bids.Clear();
+    CHECK(bids.Empty());
+    CHECK(bids.Find(-1000) == nullptr);
+}
+
+// with a tick above 1 the band stays on the tick grid, whatever price came first; prices off the grid live in the map.
+void TestLadderOffTick() {
+    Asks asks(64, 5);
+    asks[103] = 1;
+    asks[100] = 2;
+    asks[105] = 3;
+    CHECK((Levels(asks) == std::vector<std::pair<Price, int>>{ { 100, 2 }, { 103, 1 }, { 105, 3 } }));
+    asks.Erase(100);
+    asks.Erase(105);
+    CHECK(asks.BestPrice() == 103 && asks.BestLevel() == 1);
+    asks[110] = 4;
+    asks[-5] = 5;
+    CHECK((Levels(asks) == std::vector<std::pair<Price, int>>{ { -5, 5 }, { 103, 1 }, { 110, 4 } }));
+}
+
+// random adds and erases against a std::map, with prices spread wide enough to recenter and overflow all the time.
+template <typename Ladder, typename Compare>
+void CompareWithMap(std::uint32_t seed, Price tick) {
+    Ladder ladder(128, tick);
+    std::map<Price, int, Compare> expected;
+    std::mt19937 random(seed);
+    Price mid = 10000;
+    for (int step = 0; step < 20000; ++step) {
+        mid += static_cast<Price>(random() % 21) - 10;
+        Price price = mid + static_cast<Price>(random() % 401) - 200;
+        if (random() % 3 != 0) {
+            int value = static_cast<int>(random() % 1000) + 1;
+            ladder[price] = value;
+            expected[price] = value;
+        } else if (!expected.empty()) {
+            auto it = std::next(expected.begin(), static_cast<std::ptrdiff_t>(random() % expected.size()));
+            ladder.Erase(it->first);
+            expected.erase(it);
+        }
+        if (step % 97 == 0) {
+            std::vector<std::pair<Price, int>> want(expected.begin(), expected.end());
+            if (!CHECK(Levels(ladder) == want)) return;
+            if (!expected.empty() && !CHECK(ladder.BestPrice() == expected.begin()->first)) return;
+        }
+    }
+    CHECK(ladder.Size() == expected.size());
+}
+
+void TestLadder() {
+    TestLadderRecenter();
+    TestLadderOverflow();
+    TestLadderOffTick();
+    CompareWithMap<Asks, std::less<Price>>(1, 1);
+    CompareWithMap<Bids, std::greater<Price>>(2, 1);
+    CompareWithMap<Asks, std::less<Price>>(3, 3);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------
+// OrderIndex
+
+// where OrderIndex::Home puts an id in a table of 2^bits buckets (the same fibonacci hash), to build colliding ids on purpose.
+std::size_t HomeOf(OrderId id, int bits) {
+    return static_cast<std::size_t>((id * 0x9E3779B97F4A7C15ULL) >> (64 - bits));
+}
+
+// erasing from the middle of a cluster must not cut off the entries behind it, including a cluster that wraps past the table's end.
+void TestIndexProbeChains() {
+    constexpr int kBits = 10; // an empty index starts with 1024 buckets
+    for (std::size_t home : { std::size_t{ 100 }, std::size_t{ 1022 } }) {
+        // ids for three neighbouring homes, so the cluster mixes entries that sit at their home with ones pushed along
+        std::vector<OrderId> ids;
+        std::vector<std::size_t> counts(3, 0);
+        for (OrderId id = 1; ids.size() < 12; ++id) {
+            std::size_t offset = (HomeOf(id, kBits) - home) & 1023;
+            if (offset < 3 && counts[offset] < 4) {
+                ++counts[offset];
+                ids.push_back(id);
+            }
+        }
+
+        OrderIndex index(0, IndexMode::Hashed);
+        for (std::size_t i = 0; i < ids.size(); ++i) {
+            CHECK(index.TryEmplace(ids[i], static_cast<OrderSlot>(i)));
+        }
+        CHECK(!index.TryEmplace(ids[5], 99));
+
+        // erase every other one, checking after each that everything still there is still found
+        std::vector<bool> live(ids.size(), true);
+        for (std::size_t i = 1; i < ids.size(); i += 2) {
+            CHECK(index.Extract(ids[i]) == static_cast<OrderSlot>(i));
+            live[i] = false;
+            for (std::size_t j = 0; j < ids.size(); ++j) {
+                CHECK(index.Find(ids[j]) == (live[j] ? static_cast<OrderSlot>(j) : kNoSlot));
+            }
+        }
+        CHECK(index.Extract(ids[1]) == kNoSlot);
+        CHECK(index.Size() == ids.size() / 2);
+
+        // the holes left behind must be usable again
+        for (std::size_t i = 1; i < ids.size(); i += 2) {
+            CHECK(index.TryEmplace(ids[i], static_cast<OrderSlot>(100 + i)));
+        }
+        for (std::size_t i = 0; i < ids.size(); ++i) {
+            CHECK(index.Find(ids[i]) == static_cast<OrderSlot>(i % 2 ? 100 + i : i));
+        }
+    }
+}
+
+// random inserts, erases and clears against a std::unordered_map, in both modes (the direct one also slides and turns into a hash).
+void CompareWithHashMap(IndexMode mode, std::uint32_t seed) {
+    OrderIndex index(0, mode);
+    std::unordered_map<OrderId, OrderSlot> expected;
+    std::mt19937_64 random(seed);
+    OrderId next = 1;
+    for (int step = 0; step < 200000; ++step) {
+        std::uint64_t roll = random() % 1000;
+        if (roll < 550) {
+            // mostly increasing ids, now and then one far away
+            OrderId id = roll < 545 ? next++ : random() % (std::uint64_t{ 1 } << 40);
+            OrderSlot slot = static_cast<OrderSlot>(random() % 1000000);
+            bool inserted = index.TryEmplace(id, slot);
+            if (!CHECK(inserted == expected.emplace(id, slot).second)) return;
+        } else if (roll < 999) {
+            OrderId id = next > 1000 ? next - 1 - random() % 1000 : random() % next;
+            auto it = expected.find(id);
+            OrderSlot want = it == expected.end() ? kNoSlot : it->second;
+            if (!CHECK(index.Extract(id) == want)) return;
+            if (it != expected.end()) expected.erase(it);
+        } else {
+            index.Clear();
+            expected.clear();
+        }
+        if (step % 4999 == 0) {
+            if (!CHECK(index.Size() == expected.size())) return;
+            for (const auto& [id, slot] : expected) {
+                if (!CHECK(index.Find(id) == slot)) return;
+            }
+        }
+    }
+}
+
+void TestIndexClear() {
+    for (IndexMode mode : { IndexMode::Hashed, IndexMode::Direct }) {
+        OrderIndex index(0, mode);
+        for (int round = 0; round < 3; ++round) {
+            for (OrderId id = 1; id <= 3000; ++id) {
+                CHECK(index.TryEmplace(id, static_cast<OrderSlot>(id + round)));
+            }
+            CHECK(index.Find(3000) == static_cast<OrderSlot>(3000 + round));
+            index.Clear();
+            CHECK(index.Size() == 0);
+            CHECK(index.Find(1) == kNoSlot);
+            CHECK(index.Find(3000) == kNoSlot);
+            CHECK(index.Extract(2000) == kNoSlot);
+        }
+    }
+
+    // a bulk load with a duplicate id says so, and a clear leaves the index usable
+    std::vector<std::pair<OrderId, OrderSlot>> entries = { { 7, 0 }, { 8, 1 }, { 7, 2 } };
+    OrderIndex index(0, IndexMode::Hashed);
+    CHECK(!index.InsertAll(entries));
+    index.Clear();
+    entries.pop_back();
+    CHECK(index.InsertAll(entries));
+    CHECK(index.Find(7) == 0 && index.Find(8) == 1 && index.Size() == 2);
+}
+
+// Contains() + Insert() is how a new order goes in: a hint taken before the cluster changed must not put the id where it can't be found.
+void TestIndexHint() {
+    constexpr int kBits = 10;
+    std::vector<OrderId> ids;
+    for (OrderId id = 1; ids.size() < 4; ++id) {
+        if (HomeOf(id, kBits) == 200) ids.push_back(id);
+    }
+
+    OrderIndex index(0, IndexMode::Hashed);
+    OrderIndex::Hint hint;
+    CHECK(index.TryEmplace(ids[0], 0));
+    CHECK(index.TryEmplace(ids[1], 1));
+    CHECK(index.Contains(ids[1], hint));
+
+    // a fresh hint is used as is
+    CHECK(!index.Contains(ids[2], hint));
+    index.Insert(ids[2], 2, hint);
+    CHECK(index.Find(ids[2]) == 2);
+
+    // the cluster shrinks between the lookup and the insert (the aggressor filled a resting order): the hint is stale
+    CHECK(!index.Contains(ids[3], hint));
+    CHECK(index.Extract(ids[0]) == 0);
+    index.Insert(ids[3], 3, hint);
+    CHECK(index.Find(ids[1]) == 1 && index.Find(ids[2]) == 2 && index.Find(ids[3]) == 3);
+    CHECK(index.Size() == 3);
+
+    // the table grows between the two
+    OrderIndex growing(0, IndexMode::Hashed);
+    CHECK(!growing.Contains(5000, hint));
+    for (OrderId id = 1; id <= 2000; ++id) CHECK(growing.TryEmplace(id, static_cast<OrderSlot>(id)));
+    growing.Insert(5000, 7, hint);
+    CHECK(growing.Find(5000) == 7 && growing.Find(1234) == 1234 && growing.Size() == 2001);
+
+    OrderIndex direct(0, IndexMode::Direct);
+    CHECK(!direct.Contains(10, hint));
+    direct.Insert(10, 1, hint);
+    CHECK(direct.Contains(10, hint) && direct.Find(10) == 1);
+}
+
+// a steady flow in direct mode: orders leave in about the order they came, so the window keeps sliding and its cells wrap around
+// the array many times over; the live set grows now and then (the window has to get bigger) and finally an id far away sends
+// everything to the hashed table.
+void TestIndexDirectFlow() {
+    OrderIndex index(0, IndexMode::Direct);
+    std::deque<OrderId> live;
+    OrderId next = 1;
+    auto slotOf = [](OrderId id) { return static_cast<OrderSlot>(id % 1000003); };
+    for (std::size_t target : { 100, 3000, 500, 20000, 800 }) {
+        for (int step = 0; step < 200000; ++step) {
+            if (live.size() < target || step % 2 == 0) {
+                if (!CHECK(index.TryEmplace(next, slotOf(next)))) return;
+                live.push_back(next++);
+            }
+            if (live.size() > target || step % 2 == 1) {
+                // mostly the oldest, now and then one from the middle so the window keeps a hole or two
+                std::size_t at = step % 97 == 0 ? live.size() / 2 : 0;
+                OrderId id = live[at];
+                if (!CHECK(index.Extract(id) == slotOf(id))) return;
+                live.erase(live.begin() + static_cast<std::ptrdiff_t>(at));
+            }
+        }
+        if (!CHECK(index.Size() == live.size())) return;
+        for (OrderId id : live) {
+            if (!CHECK(index.Find(id) == slotOf(id))) return;
+        }
+        CHECK(index.Find(next) == kNoSlot && index.Find(live.front() - 1) == kNoSlot);
+    }
+
+    CHECK(index.TryEmplace(next + (std::uint64_t{ 1 } << 30), 7));
+    CHECK(index.Size() == live.size() + 1);
+    for (OrderId id : live) {
+        if (!CHECK(index.Find(id) == slotOf(id))) return;
+    }
+}
+
+void TestIndex() {
+    TestIndexProbeChains();
+    TestIndexHint();
+    TestIndexClear();
+    CompareWithHashMap(IndexMode::Hashed, 1);
+    CompareWithHashMap(IndexMode::Direct, 2);
+    TestIndexDirectFlow();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------
+// JSON batch decoder
+
+struct Decoded {
+    bool ok = false;
+    std::string error;
+    std::vector<std::string> orders; // "id book type side price quantity"
+};
+
+// feeds body in pieces of at most step bytes (0: all at once).
+template <typename Decoder>
+Decoded Decode(std::string_view body, std::size_t step = 0) {
+    Decoder decoder;
+    Decoded result;
+    auto sink = [&](const batch::Order& order) {
+        result.orders.push_back(std::format("{} {} {} {} {} {}", order.orderId_, order.book_, order.tradeType_ == OrderType::GoodTillCancel ? "GTC" : "FAK",
+            order.side_ == Side::Buy ? "BUY" : "SELL", order.price_, order.quantity_));
+    };
+    if (step == 0) step = std::max<std::size_t>(body.size(), 1);
+    for (std::size_t offset = 0; offset < body.size(); offset += step) {
+        std::string piece(body.substr(offset, step)); // a copy, so the decoder can't read past the piece without ASan noticing
+        decoder.Feed(piece.data(), piece.size(), sink);
+    }
+    result.ok = decoder.Finish();
+    result.error = decoder.Error();
+    return result;
+}
+
+void TestJson() {
+    const std::string body = R"({"orders":[{"orderid":1,"book":"AAPL","tradetype":"GTC","side":"BUY","price":100,"quantity":10},)"
+                             R"( {"orderid":2, "book":"MSFT", "tradetype":"FAK", "side":"SELL", "price":-5, "quantity":3, "extra":[1,{"a":null}]}]})";
+    Decoded whole = Decode<batch::JsonDecoder>(body);
+    CHECK(whole.ok);
+    CHECK((whole.orders == std::vector<std::string>{ "1 AAPL GTC BUY 100 10", "2 MSFT FAK SELL -5 3" }));
+    // the strings are turned into the enums the way the per-order endpoint reads them: anything else, or nothing, is FAK / SELL
+    CHECK((Decode<batch::JsonDecoder>(R"({"orders":[{"orderid":3,"book":"AAPL","tradetype":"gtc","price":1,"quantity":1}]})").orders
+        == std::vector<std::string>{ "3 AAPL FAK SELL 1 1" }));
+    for (std::size_t step : { 1, 3, 16 }) {
+        Decoded pieces = Decode<batch::JsonDecoder>(body, step);
+        CHECK(pieces.ok && pieces.orders == whole.orders);
+    }
+
+    // cut off anywhere, the body must not pass
+    for (std::size_t length = 0; length < body.size(); ++length) {
+        if (!CHECK(!Decode<batch::JsonDecoder>(std::string_view(body).substr(0, length)).ok)) {
+            std::cerr << std::format("  a body cut at {} bytes was accepted\n", length);
+            break;
+        }
+    }
+    CHECK(Decode<batch::JsonDecoder>(body.substr(0, body.size() - 1)).error == "unexpected end of body");
+
+    CHECK(Decode<batch::JsonDecoder>(R"({"orders":[{"orderid":1]})").error == "unexpected closing bracket");
+    CHECK(Decode<batch::JsonDecoder>(R"({"orders":[{"orderid" 1}]})").error == "unexpected value");
+    CHECK(Decode<batch::JsonDecoder>(R"({"orders":[{"orderid":1,,"price":2}]})").error == "unexpected comma");
+    CHECK(Decode<batch::JsonDecoder>(R"({"orders":[{"orderid":99999999999999999999999}]})").error == "number out of range");
+    CHECK(Decode<batch::JsonDecoder>(R"({"orders":[]} x)").ok == false);
+    CHECK(Decode<batch::JsonDecoder>(std::string(200, '[')).error == "nested too deeply");
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------
+// Binary batch decoder
+
+std::string BinaryBatch(std::uint16_t recordSize, std::uint16_t bookIndex = 1, std::uint32_t orderCount = 2) {
+    wire::BatchHeader header{ wire::kBatchMagic, wire::kBatchVersion, 2, orderCount, recordSize, 0 };
+    std::string body(reinterpret_cast<const char*>(&header), sizeof(header));
+    for (std::string_view name : { "AAPL", "MSFT" }) {
+        char book[wire::kBookNameSize];
+        wire::SetBook(book, name);
+        body.append(book, sizeof(book));
+    }
+    for (std::uint32_t i = 0; i < orderCount; ++i) {
+        wire::BatchOrder order{ 10 + i, 100, 5, static_cast<std::uint16_t>(i == 0 ? 0 : bookIndex), wire::WireSide::Sell, wire::WireOrderType::GoodTillCancel };
+        std::string record(recordSize, '\x7f'); // a newer writer's extra bytes: whatever they hold, they are skipped
+        std::memcpy(record.data(), &order, sizeof(order));
+        body += record;
+    }
+    return body;
+}
+
+void TestBinary() {
+    const std::string body = BinaryBatch(sizeof(wire::BatchOrder));
+    Decoded whole = Decode<batch::BinaryDecoder>(body);
+    CHECK(whole.ok);
+    CHECK((whole.orders == std::vector<std::string>{ "10 AAPL GTC SELL 100 5", "11 MSFT GTC SELL 100 5" }));
+    for (std::size_t step : { 1, 7, 20 }) {
+        Decoded pieces = Decode<batch::BinaryDecoder>(body, step);
+        CHECK(pieces.ok && pieces.orders == whole.orders);
+    }
+    Decoded longer = Decode<batch::BinaryDecoder>(BinaryBatch(28), 5);
+    CHECK(longer.ok && longer.orders == whole.orders);
+
+    for (std::size_t length = 0; length < body.size(); ++length) {
+        Decoded cut = Decode<batch::BinaryDecoder>(std::string_view(body).substr(0, length));
+        if (!CHECK(!cut.ok && cut.error == "body ends early")) {
+            std::cerr << std::format("  a body cut at {} bytes gave \"{}\"\n", length, cut.error);
+            break;
+        }
+    }
+
+    CHECK(Decode<batch::BinaryDecoder>(body + "x").error == "more data than the header announced");
+    CHECK(Decode<batch::BinaryDecoder>(BinaryBatch(sizeof(wire::BatchOrder) - 1)).error == "bad record size");
+    CHECK(Decode<batch::BinaryDecoder>(BinaryBatch(1000)).error == "bad record size");
+    CHECK(Decode<batch::BinaryDecoder>(BinaryBatch(sizeof(wire::BatchOrder), 2)).error == "book index out of range");
+    std::string wrongMagic = body;
+    wrongMagic[0] ^= 1;
+    CHECK(Decode<batch::BinaryDecoder>(wrongMagic).error == "not a version 1 batch");
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------
+// Journal
+
+std::string TempDirectory(std::string_view what) {
+    std::filesystem::path path = std::filesystem::temp_directory_path() / std::format("engine-tests-{}-{}", what, ::getpid());
+    std::filesystem::remove_all(path);
+    return path.string();
+}
+
+std::string Payload(std::uint64_t sequence, std::size_t size) {
+    std::string payload = std::format("record {} ", sequence);
+    payload.resize(size, static_cast<char>('a' + sequence % 26));
+    return payload;
+}
+
+journal::Options JournalOptions(std::string_view what) {
+    journal::Options options;
+    options.directory_ = TempDirectory(what);
+    options.name_ = "AAPL";
+    options.mode_ = journal::SyncMode::None;
+    options.segmentSize_ = 64 << 10;
+    return options;
+}
+
+// appends records first..last, each size bytes, to a journal opened with options.
+void WriteJournal(const journal::Options& options, std::uint64_t first, std::uint64_t last, std::size_t size) {
+    journal::Journal journal;
+    CHECK(journal.Open(options));
+    CHECK(journal.LastSequence() == first - 1);
+    for (std::uint64_t sequence = first; sequence <= last; ++sequence) {
+        std::string payload = Payload(sequence, size);
+        CHECK(journal.Append(3, payload.data(), payload.size()) == sequence);
+    }
+}
+
+// everything Replay hands back after "after"; false if a record isn't the one that was written.
+bool ReplayMatches(const std::string& directory, const std::string& name, std::uint64_t after, std::uint64_t last, std::size_t size) {
+    std::uint64_t expected = after + 1;
+    bool ok = true;
+    std::uint64_t got = journal::Replay(directory, name, after, [&](std::uint64_t sequence, std::uint8_t kind, std::string_view payload) {
+        ok = ok && sequence == expected && kind == 3 && payload == Payload(sequence, size);
+        ++expected;
+    });
+    return ok && got == last && expected == last + 1;
+}
+
+// records spread over several segments come back in order, from the start or from any point.
+void TestJournalSegments() {
+    journal::Options options = JournalOptions("segments");
+    constexpr std::size_t kSize = 1000;
+    WriteJournal(options, 1, 200, kSize);
+    CHECK(journal::ListSegments(options.directory_, options.name_).size() >= 3);
+    CHECK(ReplayMatches(options.directory_, options.name_, 0, 200, kSize));
+    CHECK(ReplayMatches(options.directory_, options.name_, 150, 200, kSize));
+    CHECK(ReplayMatches(options.directory_, options.name_, 200, 200, kSize));
+
+    // reopening carries on after the last record
+    WriteJournal(options, 201, 210, kSize);
+    CHECK(ReplayMatches(options.directory_, options.name_, 0, 210, kSize));
+
+    // a snapshot newer than the journal (the last records never made it to disk): the journal carries on after the snapshot, and
+    // replay from an older point stops at the gap instead of skipping over it.
+    options.firstSequence_ = 251;
+    WriteJournal(options, 251, 251, kSize);
+    CHECK(ReplayMatches(options.directory_, options.name_, 250, 251, kSize));
+    CHECK(ReplayMatches(options.directory_, options.name_, 100, 210, kSize));
+
+    std::filesystem::remove_all(options.directory_);
+}
+
+// a record that is torn or corrupt ends the journal: replay stops there and the writer overwrites it.
+void TestJournalTornTail() {
+    journal::Options options = JournalOptions("torn");
+    constexpr std::size_t kSize = 100;
+    WriteJournal(options, 1, 10, kSize);
+
+    std::vector<std::uint64_t> segments = journal::ListSegments(options.directory_, options.name_);
+    CHECK(segments.size() == 1);
+    {
+        int fd = ::open(journal::SegmentPath(options.directory_, options.name_, segments.back()).c_str(), O_RDWR);
+        CHECK(fd >= 0);
+        char byte = 0;
+        off_t offset = static_cast<off_t>(journal::kRecordsOffset + 9 * journal::RecordSize(kSize) + sizeof(journal::RecordHeader) + 5);
+        CHECK(::pread(fd, &byte, 1, offset) == 1);
+        byte ^= 0x20;
+        CHECK(::pwrite(fd, &byte, 1, offset) == 1);
+        ::close(fd);
+    }
+    CHECK(ReplayMatches(options.directory_, options.name_, 0, 9, kSize));
+
+    WriteJournal(options, 10, 10, kSize);
+    CHECK(ReplayMatches(options.directory_, options.name_, 0, 10, kSize));
+
+    std::filesystem::remove_all(options.directory_);
+}
+
+void TestJournal() {
+    TestJournalSegments();
+    TestJournalTornTail();
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------
+// Journal replay after a snapshot
+
+// a snapshot up to some sequence lets the segments it covers go; a restart replays the rest, and must get every record after it.
+void TestReplayAfterSnapshot() {
+    journal::Options options = JournalOptions("snapshot");
+    constexpr std::size_t kSize = 1000;
+    WriteJournal(options, 1, 200, kSize);
+    std::size_t before = journal::ListSegments(options.directory_, options.name_).size();
+
+    journal::RemoveCovered(options.directory_, options.name_, 120);
+    std::size_t after = journal::ListSegments(options.directory_, options.name_).size();
+    CHECK(after < before && after >= 2);
+    CHECK(ReplayMatches(options.directory_, options.name_, 120, 200, kSize));
+    CHECK(ReplayMatches(options.directory_, options.name_, 199, 200, kSize));
+
+    // a snapshot of everything still keeps the newest segment (the writer has it open), and the journal carries on after it
+    journal::RemoveCovered(options.directory_, options.name_, 200);
+    CHECK(journal::ListSegments(options.directory_, options.name_).size() == 1);
+    options.firstSequence_ = 201;
+    WriteJournal(options, 201, 205, kSize);
+    CHECK(ReplayMatches(options.directory_, options.name_, 200, 205, kSize));
+
+    std::filesystem::remove_all(options.directory_);
+}
+
+// ---------------------------------------------------------------------------------------------------------------------------------
+// Wire protocol (against a running server, which is the only place it is decoded)
+
+int FreePort() {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(address);
+    int port = 0;
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == 0 &&
+        ::getsockname(fd, reinterpret_cast<sockaddr*>(&address), &length) == 0) {
+        port = ntohs(address.sin_port);
+    }
+    ::close(fd);
+    return port;
+}
+
+// starts the server and waits for its --ready-fd line. 0 if it didn't come up.
+pid_t StartServer(const std::string& path, int httpPort, int binaryPort) {
+    int ready[2];
+    if (::pipe(ready) != 0) return 0;
+    pid_t pid = ::fork();
+    if (pid == 0) {
+        ::close(ready[0]);
+        std::string port = std::to_string(httpPort);
+        std::string binary = std::format("--binary-port={}", binaryPort);
+        std::string readyFd = std::format("--ready-fd={}", ready[1]);
+        ::execl(path.c_str(), path.c_str(), port.c_str(), binary.c_str(), readyFd.c_str(), "--log-file=/dev/null", static_cast<char*>(nullptr));
+        ::_exit(127);
+    }
+    ::close(ready[1]);
+    pollfd wait{ ready[0], POLLIN, 0 };
+    char line[16] = {};
+    bool up = pid > 0 && ::poll(&wait, 1, 10000) == 1 && ::read(ready[0], line, sizeof(line)) > 0 && std::string_view(line).starts_with("ready");
+    ::close(ready[0]);
+    if (!up && pid > 0) {
+        ::kill(pid, SIGKILL);
+        ::waitpid(pid, nullptr, 0);
+        return 0;
+    }
+    return pid;
+}
+
+int Connect(int port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address{};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<std::uint16_t>(port));
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        ::close(fd);
+        return -1;
+    }
+    timeval timeout{ 5, 0 };
+    ::setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+    return fd;
+}
+
+bool SendAll(int fd, std::string_view data) {
+    while (!data.empty()) {
+        ssize_t sent = ::send(fd, data.data(), data.size(), MSG_NOSIGNAL);
+        if (sent <= 0) return false;
+        data.remove_prefix(static_cast<std::size_t>(sent));
+    }
+    return true;
+}
+
+// reads one reply (messages up to the one flagged kFlagLastInReply). Empty if the connection closed or timed out first.
+std::vector<std::string> ReadReply(int fd) {
+    std::vector<std::string> messages;
+    while (true) {
+        wire::MessageHeader header;
+        if (::recv(fd, &header, sizeof(header), MSG_WAITALL) != static_cast<ssize_t>(sizeof(header)) || header.length_ < sizeof(header)) return {};
+        std::string message(reinterpret_cast<const char*>(&header), sizeof(header));
+        message.resize(header.length_);
+        std::size_t rest = header.length_ - sizeof(header);
+        if (rest > 0 && ::recv(fd, message.data() + sizeof(header), rest, MSG_WAITALL) != static_cast<ssize_t>(rest)) return {};
+        messages.push_back(message);
+        if (header.flags_ & wire::kFlagLastInReply) return messages;
+    }
+}
+
+// true if the server closed the connection (rather than answering or leaving it open).
+bool Closed(int fd) {
+    char byte;
+    return ::recv(fd, &byte, 1, 0) <= 0 && errno != EAGAIN && errno != EWOULDBLOCK;
+}
+
+std::string NewOrderMessage(OrderId id) {
+    wire::NewOrder order{};
+    order.header_ = wire::HeaderFor<wire::NewOrder>(wire::MessageType::NewOrder);
+    order.orderId_ = id;
+    order.price_ = 100;
+    order.quantity_ = 10;
+    order.side_ = wire::WireSide::Buy;
+    order.orderType_ = wire::WireOrderType::GoodTillCancel;
+    wire::SetBook(order.book_, "TEST");
+    return std::string(reinterpret_cast<const char*>(&order), sizeof(order));
+}
+
+template <typename Message>
+Message As(const std::string& bytes) {
+    Message message{};
+    std::memcpy(&message, bytes.data(), std::min(bytes.size(), sizeof(message)));
+    return message;
+}
+
+void TestWire(const std::string& server) {
+    int httpPort = FreePort();
+    int binaryPort = FreePort();
+    pid_t pid = StartServer(server, httpPort, binaryPort);
+    if (!CHECK(pid > 0)) return;
+
+    int fd = Connect(binaryPort);
+    if (CHECK(fd >= 0)) {
+        // a message split over two reads is put back together
+        std::string order = NewOrderMessage(1);
+        CHECK(SendAll(fd, std::string_view(order).substr(0, 13)));
+        ::usleep(50000);
+        CHECK(SendAll(fd, std::string_view(order).substr(13)));
+        std::vector<std::string> reply = ReadReply(fd);
+        CHECK(reply.size() == 1 && As<wire::MessageHeader>(reply[0]).type_ == wire::MessageType::ExecReport);
+        CHECK(!reply.empty() && As<wire::ExecReport>(reply[0]).orderId_ == 1 && As<wire::ExecReport>(reply[0]).leaves_ == 10);
+
+        // a framable message whose length doesn't match its type is rejected, and the connection carries on
+        std::string shortOrder = order.substr(0, 20);
+        wire::MessageHeader header{ 20, wire::MessageType::NewOrder, 0 };
+        std::memcpy(shortOrder.data(), &header, sizeof(header));
+        CHECK(SendAll(fd, shortOrder));
+        reply = ReadReply(fd);
+        CHECK(reply.size() == 1 && As<wire::Reject>(reply[0]).reason_ == wire::RejectReason::Malformed);
+
+        // so is a type nobody sends
+        header = wire::MessageHeader{ sizeof(header), static_cast<wire::MessageType>(200), 0 };
+        CHECK(SendAll(fd, std::string_view(reinterpret_cast<const char*>(&header), sizeof(header))));
+        reply = ReadReply(fd);
+        CHECK(reply.size() == 1 && As<wire::Reject>(reply[0]).reason_ == wire::RejectReason::Malformed);
+
+        // a duplicate id in the same book is a business reject, not a framing problem
+        CHECK(SendAll(fd, NewOrderMessage(1)));
+        reply = ReadReply(fd);
+        CHECK(reply.size() == 1 && As<wire::Reject>(reply[0]).reason_ == wire::RejectReason::DuplicateOrderId);
+
+        // a length shorter than the header can't be framed: the server hangs up
+        header = wire::MessageHeader{ 2, wire::MessageType::NewOrder, 0 };
+        CHECK(SendAll(fd, std::string_view(reinterpret_cast<const char*>(&header), sizeof(header))));
+        CHECK(Closed(fd));
+        ::close(fd);
+    }
+
+    // and so is one longer than any message
+    fd = Connect(binaryPort);
+    if (CHECK(fd >= 0)) {
+        wire::MessageHeader header{ static_cast<std::uint16_t>(wire::kMaxMessageSize + 1), wire::MessageType::NewOrder, 0 };
+        std::string message(reinterpret_cast<const char*>(&header), sizeof(header));
+        message.resize(wire::kMaxMessageSize + 1, '\0');
+        CHECK(SendAll(fd, message));
+        CHECK(Closed(fd));
+        ::close(fd);
+    }
+
+    // a session that was hung up on doesn't take the server down with it
+    fd = Connect(binaryPort);
+    if (CHECK(fd >= 0)) {
+        CHECK(SendAll(fd, NewOrderMessage(2)));
+        CHECK(ReadReply(fd).size() == 1);
+        ::close(fd);
+    }
+
+    ::kill(pid, SIGTERM);
+    ::waitpid(pid, nullptr, 0);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    std::string only = argc > 1 ? argv[1] : "";
+    const std::vector<std::pair<std::string, std::function<void()>>> groups = {
+        { "ladder", TestLadder },
+        { "index", TestIndex },
+        { "json", TestJson },
+        { "binary", TestBinary },
+        { "journal", TestJournal },
+        { "snapshot", TestReplayAfterSnapshot },
+        // the binary protocol is only decoded inside the server, so this one starts the server binary named after the group
+        { "wire", [&] {
+            if (argc > 2) {
+                TestWire(argv[2]);
+            } else {
+                std::cerr << "wire: skipped (pass the path to the server after the group name)\n";
+            }
+        } },
+    };
+
+    bool found = false;
+    for (const auto& [name, run] : groups) {
+        if (!only.empty() && name != only) continue;
+        found = true;
+        int before = gFailures;
+        run();
+        std::cout << std::format("{}: {}\n", name, gFailures == before ? "ok" : "FAILED");
+    }
+    if (!found) {
+        std::cerr << std::format("no test group called {}\n", only);
+        return 2;
+    }
+    return gFailures == 0 ? 0 : 1;
+}
@@ -1,92 +1,443 @@
 package engine
 
 import (
+	"encoding/json"
 	"fmt"
+	"io"
+	"net"
 	"net/http"
+	"net/url"
 	"os"
 	"os/exec"
 	"path/filepath"
+	"runtime"
+	"strconv"
 	"sync"
 	"time"
 
+	"github.com/TanishqM1/Orderbook/internal/transport"
 	log "github.com/sirupsen/logrus"
 )
 
 // EngineInfo holds information about a running engine instance
 type EngineInfo struct {
 	Symbol  string
-	Port    int
+	Port    int    // also the engine's id when it listens on a Unix socket instead
+	Socket  string // Unix domain socket path, empty when the engine listens on Port
 	Process *os.Process
 	Healthy bool
+	Shm     *transport.ShmClient // shared-memory channel to the engine, nil when it only talks HTTP
+	Shard   int                  // the engine shard that owns the symbol's book (-1 if the engine couldn't say)
+	Shared  bool                 // the process is the shared engine (ENGINE_SHARED=1), which other symbols use too
+}
+
+// URL returns the base URL of the engine's HTTP endpoints (a Unix socket engine needs a client dialing through transport.UnixDialContext)
+func (e *EngineInfo) URL() string {
+	if e.Socket != "" {
+		return transport.UnixSocketURL(e.Port)
+	}
+	return fmt.Sprintf("http://localhost:%d", e.Port)
 }
 
 // Manager handles spawning and managing C++ engine processes
 type Manager struct {
 	mu           sync.RWMutex
-	engines      map[string]*EngineInfo // symbol -> engine info
+	engines      map[string]*EngineInfo   // symbol -> engine info
+	sharedMode   bool                     // ENGINE_SHARED=1: one engine process for every symbol
+	shared       *EngineInfo              // that process, once started
+	sharedStart  chan struct{}            // the shared engine is starting; closed once it's in shared (or failed)
+	pool         []*EngineInfo            // idle engines that are already up, waiting for a symbol
+	poolSize     int                      // how many the pool keeps (ENGINE_POOL)
+	refilling    bool                     // a goroutine is topping the pool up
+	spawning     map[string]chan struct{} // symbols whose engine is starting; closed once it's in engines (or failed)
+	starting     int                      // engine processes being started right now
+	generation   int                      // bumped by StopAllEngines, so engines started before it are stopped when they come up
 	nextPort     int
 	basePort     int
 	engineBinary string
 	client       *http.Client
 }
 
-// NewManager creates a new engine manager
+// NewManager creates a new engine manager.
+// ENGINE_POOL=N keeps N idle engines running (2 by default, 0 for none), so a new symbol takes one of those instead of waiting
+// for a process to start; see WarmPool. There's no pool with ENGINE_SHARED=1 (one process for everything) or with ENGINE_JOURNAL
+// (an engine recovers its symbol's journal as it starts, so it has to know the symbol by then).
 func NewManager(engineBinaryPath string) *Manager {
+	sharedMode := os.Getenv("ENGINE_SHARED") == "1"
+	poolSize := 2
+	if n, err := strconv.Atoi(os.Getenv("ENGINE_POOL")); err == nil && n >= 0 {
+		poolSize = n
+	}
+	if sharedMode || os.Getenv("ENGINE_JOURNAL") != "" {
+		poolSize = 0
+	}
 	return &Manager{
 		engines:      make(map[string]*EngineInfo),
+		sharedMode:   sharedMode,
+		poolSize:     poolSize,
+		spawning:     make(map[string]chan struct{}),
 		basePort:     6060,
 		nextPort:     6060,
 		engineBinary: engineBinaryPath,
 		client: &http.Client{
-			Timeout: 2 * time.Second,
+			Transport: &http.Transport{DialContext: transport.UnixDialContext(&net.Dialer{Timeout: time.Second})},
+			Timeout:   2 * time.Second,
 		},
 	}
 }
 
-// GetOrSpawnEngine returns an existing engine for the symbol or spawns a new one
+// GetOrSpawnEngine returns an existing engine for the symbol, or gives it one: an idle engine from the pool if there is one
+// (that takes no time at all), otherwise a new process.
+// With ENGINE_SHARED=1 every symbol goes to the same engine process instead, which holds all the books split over its shards
+// (ENGINE_SHARDS matching threads, one per core by default, pinned to cores 0..N-1). The first symbol starts it.
 func (m *Manager) GetOrSpawnEngine(symbol string) (*EngineInfo, error) {
 	m.mu.Lock()
-	defer m.mu.Unlock()
+	for {
+		// Check if engine already exists for this symbol
+		if info, exists := m.engines[symbol]; exists {
+			m.mu.Unlock()
+			return info, nil
+		}
+		// someone else is starting this symbol's engine: wait for it rather than start a second one
+		done, busy := m.spawning[symbol]
+		if !busy {
+			break
+		}
+		m.mu.Unlock()
+		<-done
+		m.mu.Lock()
+	}
 
-	// Check if engine already exists for this symbol
-	if info, exists := m.engines[symbol]; exists {
+	if m.sharedMode {
+		// as with an engine of its own, the lock isn't held while the shared engine starts or is asked for the symbol's shard
+		done := make(chan struct{})
+		m.spawning[symbol] = done
+		m.mu.Unlock()
+
+		info, generation, err := m.addToSharedEngine(symbol)
+
+		m.mu.Lock()
+		defer m.mu.Unlock()
+		delete(m.spawning, symbol)
+		close(done)
+		if err != nil {
+			return nil, err
+		}
+		if generation != m.generation {
+			return nil, fmt.Errorf("engines were stopped while %s was being added to the shared engine", symbol)
+		}
+		m.engines[symbol] = info
+		log.Infof("Routed %s to shard %d of the shared engine", symbol, info.Shard)
 		return info, nil
 	}
 
-	// Spawn a new engine
+	if n := len(m.pool); n > 0 {
+		info := m.pool[n-1]
+		m.pool = m.pool[:n-1]
+		info.Symbol = symbol
+		m.engines[symbol] = info
+		m.refillPool()
+		m.mu.Unlock()
+		log.Infof("Gave %s the pooled engine on port %d", symbol, info.Port)
+		return info, nil
+	}
+
+	// Spawn a new engine. The lock isn't held while it starts, so other symbols can start theirs at the same time.
 	port := m.nextPort
 	m.nextPort++
+	m.starting++
+	generation := m.generation
+	done := make(chan struct{})
+	m.spawning[symbol] = done
+	m.refillPool()
+	m.mu.Unlock()
 
 	log.Infof("Spawning new C++ engine for %s on port %d", symbol, port)
 
-	// Start the engine process with the port as an argument
-	cmd := exec.Command(m.engineBinary, fmt.Sprintf("%d", port))
+	// the journal goes in a directory per symbol, so it's the same one whichever port the engine gets next time
+	info, err := m.startEngine(symbol, port, "book-"+url.PathEscape(symbol))
+
+	m.mu.Lock()
+	defer m.mu.Unlock()
+	m.starting--
+	delete(m.spawning, symbol)
+	close(done)
+	if err != nil {
+		return nil, err
+	}
+	if generation != m.generation {
+		stopProcess(symbol, info)
+		return nil, fmt.Errorf("engines were stopped while the one for %s was starting", symbol)
+	}
+	m.engines[symbol] = info
+	return info, nil
+}
+
+// WarmPool starts filling the pool of idle engines in the background (main calls it once it knows the engine binary exists).
+func (m *Manager) WarmPool() {
+	m.mu.Lock()
+	defer m.mu.Unlock()
+	m.refillPool()
+}
+
+// refillPool starts a goroutine topping the pool up, unless one is already at it or the pool is full. m.mu is held.
+func (m *Manager) refillPool() {
+	if m.refilling || len(m.pool) >= m.poolSize {
+		return
+	}
+	m.refilling = true
+	go m.fillPool()
+}
+
+// fillPool starts idle engines one after another until the pool is full. One at a time so that a burst of new symbols, which
+// also start engines when the pool runs dry, doesn't have all those starting processes competing with a batch of pooled ones.
+func (m *Manager) fillPool() {
+	for {
+		m.mu.Lock()
+		if len(m.pool) >= m.poolSize {
+			m.refilling = false
+			m.mu.Unlock()
+			return
+		}
+		port := m.nextPort
+		m.nextPort++
+		m.starting++
+		generation := m.generation
+		m.mu.Unlock()
+
+		info, err := m.startEngine(fmt.Sprintf("the pooled engine on port %d", port), port, "")
+
+		m.mu.Lock()
+		m.starting--
+		if generation != m.generation {
+			// StopAllEngines ran meanwhile (and cleared refilling, so a newer fillPool may be running)
+			m.mu.Unlock()
+			if err == nil {
+				stopProcess("a pooled engine", info)
+			}
+			return
+		}
+		if err != nil || !info.Healthy {
+			// whatever went wrong would most likely go wrong again; the next symbol that takes an engine tries again
+			m.refilling = false
+			m.mu.Unlock()
+			if err == nil {
+				stopProcess("a pooled engine", info)
+				err = fmt.Errorf("engine on port %d never became ready", port)
+			}
+			log.Warnf("Could not start a pooled engine: %v", err)
+			return
+		}
+		m.pool = append(m.pool, info)
+		m.mu.Unlock()
+	}
+}
+
+// addToSharedEngine maps the symbol onto the shared engine, starting it first if this is the first symbol, and returns the symbol's
+// entry for m.engines with the generation it belongs to. m.mu is not held (the caller has the symbol in m.spawning).
+func (m *Manager) addToSharedEngine(symbol string) (*EngineInfo, int, error) {
+	shared, generation, err := m.sharedEngine()
+	if err != nil {
+		return nil, 0, err
+	}
+
+	shard, err := shardOf(m.client, shared, symbol)
+	if err != nil {
+		log.Warnf("Could not look up the shard for %s: %v", symbol, err)
+		shard = -1
+	}
+
+	info := &EngineInfo{
+		Symbol:  symbol,
+		Port:    shared.Port,
+		Socket:  shared.Socket,
+		Process: shared.Process,
+		Healthy: shared.Healthy,
+		Shm:     shared.Shm,
+		Shard:   shard,
+		Shared:  true,
+	}
+	return info, generation, nil
+}
+
+// sharedEngine returns the shared engine and the generation it belongs to, starting it if it isn't running yet. m.mu is not held.
+// Symbols arriving while it starts wait for that start instead of starting another one.
+func (m *Manager) sharedEngine() (*EngineInfo, int, error) {
+	m.mu.Lock()
+	for m.shared == nil && m.sharedStart != nil {
+		done := m.sharedStart
+		m.mu.Unlock()
+		<-done
+		m.mu.Lock()
+	}
+	generation := m.generation
+	if m.shared != nil {
+		shared := m.shared
+		m.mu.Unlock()
+		return shared, generation, nil
+	}
+	port := m.nextPort
+	m.nextPort++
+	m.starting++
+	done := make(chan struct{})
+	m.sharedStart = done
+	m.mu.Unlock()
+
+	shards := runtime.NumCPU()
+	if shards > 8 {
+		shards = 8
+	}
+	if n, err := strconv.Atoi(os.Getenv("ENGINE_SHARDS")); err == nil && n > 0 {
+		shards = n
+	}
+	log.Infof("Spawning shared C++ engine on port %d with %d shards", port, shards)
+
+	// no --id-index=direct: the ids are dense across all symbols, so each book only sees every Nth one
+	args := []string{fmt.Sprintf("--shards=%d", shards), "--sequencer-cpu=0"}
+	info, err := m.startEngineWith("the shared engine", port, args, "shared")
+
+	m.mu.Lock()
+	defer m.mu.Unlock()
+	m.starting--
+	m.sharedStart = nil
+	close(done)
+	if err != nil {
+		return nil, 0, err
+	}
+	if generation != m.generation {
+		stopProcess("the shared engine", info)
+		return nil, 0, fmt.Errorf("engines were stopped while the shared engine was starting")
+	}
+	m.shared = info
+	return info, generation, nil
+}
+
+// shardOf asks the shared engine which of its shards owns the symbol's book (GET /routes).
+func shardOf(client *http.Client, shared *EngineInfo, symbol string) (int, error) {
+	resp, err := client.Get(shared.URL() + "/routes?book=" + url.QueryEscape(symbol))
+	if err != nil {
+		return 0, err
+	}
+	defer resp.Body.Close()
+	if resp.StatusCode != 200 {
+		return 0, fmt.Errorf("routes returned status %d", resp.StatusCode)
+	}
+
+	var routes struct {
+		Routes map[string]int `json:"routes"`
+	}
+	if err := json.NewDecoder(resp.Body).Decode(&routes); err != nil {
+		return 0, err
+	}
+	shard, ok := routes.Routes[symbol]
+	if !ok {
+		return 0, fmt.Errorf("no route for %s", symbol)
+	}
+	return shard, nil
+}
+
+// startEngine starts a one-symbol engine (see startEngineWith).
+func (m *Manager) startEngine(name string, port int, journalDir string) (*EngineInfo, error) {
+	// Order ids come from api.GetNextOrderId (dense and increasing), so the engine can index them directly.
+	// Each engine holds a single book, so one matching shard is enough (more would just be idle threads).
+	return m.startEngineWith(name, port, []string{"--id-index=direct", "--shards=1"}, journalDir)
+}
+
+// startEngineWith starts an engine process on port with args plus whatever the ENGINE_* settings add, and waits until it's serving.
+// name is only for the logs; journalDir is the engine's directory under ENGINE_JOURNAL (never set for a pooled engine).
+func (m *Manager) startEngineWith(name string, port int, args []string, journalDir string) (*EngineInfo, error) {
+	// Start the engine process with the port as an argument.
+	args = append([]string{fmt.Sprintf("%d", port)}, args...)
+
+	// ENGINE_SHM=1 also opens a shared-memory channel next to the HTTP port, which the balancer uses for order flow.
+	shmPath := ""
+	if os.Getenv("ENGINE_SHM") == "1" && transport.ShmSupported() {
+		shmPath = fmt.Sprintf("/dev/shm/orderbook-engine-%d", port)
+		args = append(args, "--shm="+shmPath)
+	}
+
+	// ENGINE_UNIX_SOCKET=1 serves the HTTP endpoints on a Unix domain socket instead, so the port is only the engine's id
+	// and never has to be free.
+	socket := ""
+	if os.Getenv("ENGINE_UNIX_SOCKET") == "1" {
+		socket = transport.UnixSocketPath(port)
+		args = append(args, "--unix-socket="+socket)
+	}
+
+	// ENGINE_JOURNAL=DIR makes the engine journal its orders under DIR/journalDir. ENGINE_JOURNAL_SYNC picks the engine's
+	// --journal-sync mode (none, group or message), and ENGINE_SNAPSHOT_INTERVAL=SECONDS makes it snapshot its books that often,
+	// so a restart only replays the journal since then.
+	if dir := os.Getenv("ENGINE_JOURNAL"); dir != "" && journalDir != "" {
+		args = append(args, "--journal="+filepath.Join(dir, journalDir))
+		if mode := os.Getenv("ENGINE_JOURNAL_SYNC"); mode != "" {
+			args = append(args, "--journal-sync="+mode)
+		}
+		if seconds := os.Getenv("ENGINE_SNAPSHOT_INTERVAL"); seconds != "" {
+			args = append(args, "--snapshot-interval="+seconds)
+		}
+	}
+
+	// the engine says it's serving by writing to a pipe it inherits as fd 3 (--ready-fd), which we read straight away instead of
+	// polling it. Windows can't pass the engine extra files, so there we still poll.
+	var ready *os.File
+	var readyWriter *os.File
+	if runtime.GOOS != "windows" {
+		var err error
+		if ready, readyWriter, err = os.Pipe(); err != nil {
+			return nil, fmt.Errorf("failed to start engine for %s: %w", name, err)
+		}
+		defer ready.Close()
+		args = append(args, "--ready-fd=3")
+	}
+
+	cmd := exec.Command(m.engineBinary, args...)
 	cmd.Stdout = os.Stdout
 	cmd.Stderr = os.Stderr
+	if readyWriter != nil {
+		cmd.ExtraFiles = []*os.File{readyWriter}
+	}
 
 	// Set working directory to where the binary is located
 	cmd.Dir = filepath.Dir(m.engineBinary)
 
-	if err := cmd.Start(); err != nil {
-		return nil, fmt.Errorf("failed to start engine for %s: %w", symbol, err)
+	err := cmd.Start()
+	if readyWriter != nil {
+		// the engine has its own copy now; ours would keep the pipe open if the engine died
+		readyWriter.Close()
+	}
+	if err != nil {
+		return nil, fmt.Errorf("failed to start engine for %s: %w", name, err)
 	}
 
 	info := &EngineInfo{
-		Symbol:  symbol,
+		Symbol:  name,
 		Port:    port,
+		Socket:  socket,
 		Process: cmd.Process,
 		Healthy: false,
 	}
 
-	m.engines[symbol] = info
-
 	// Wait for engine to be ready
-	if err := m.waitForEngine(port); err != nil {
-		log.Warnf("Engine for %s may not be fully ready: %v", symbol, err)
+	waitForEngine := m.waitForEngine
+	if ready != nil {
+		waitForEngine = func(info *EngineInfo) error { return waitForReady(ready, info) }
+	}
+	if err := waitForEngine(info); err != nil {
+		log.Warnf("Engine for %s may not be fully ready: %v", name, err)
 	} else {
 		info.Healthy = true
 	}
 
+	// the engine creates the channel before it starts listening, so it's there once /metrics answers
+	if shmPath != "" && info.Healthy {
+		client, err := transport.DialShm(shmPath)
+		if err != nil {
+			log.Warnf("Shared-memory channel for %s unavailable, using HTTP: %v", name, err)
+		} else {
+			info.Shm = client
+		}
+	}
+
 	return info, nil
 }
 
@@ -128,24 +479,40 @@ func (m *Manager) SpawnEnginesForSymbols(symbols []string) (map[string]*EngineIn
 	return results, nil
 }
 
+// waitForReady reads the engine's readiness pipe: "ready" once it's serving, or the pipe closing without it if the engine exited first.
+func waitForReady(ready *os.File, info *EngineInfo) error {
+	ready.SetReadDeadline(time.Now().Add(5 * time.Second))
+	buf := make([]byte, 16)
+	n, err := io.ReadAtLeast(ready, buf, len("ready\n"))
+	if err != nil && n == 0 {
+		return fmt.Errorf("engine %s did not become ready: %w", info.URL(), err)
+	}
+	if string(buf[:n]) != "ready\n" {
+		return fmt.Errorf("engine %s sent %q instead of ready", info.URL(), buf[:n])
+	}
+	log.Infof("Engine %s is ready", info.URL())
+	return nil
+}
+
 // waitForEngine polls the engine until it responds or times out
-func (m *Manager) waitForEngine(port int) error {
+func (m *Manager) waitForEngine(info *EngineInfo) error {
 	maxAttempts := 50 // 5 seconds total (50 * 100ms)
-	url := fmt.Sprintf("http://localhost:%d/status", port)
+	// /metrics is cheap (a few numbers per book), where /status would serialize every level of every book
+	url := info.URL() + "/metrics"
 
 	for i := 0; i < maxAttempts; i++ {
 		resp, err := m.client.Get(url)
 		if err == nil {
 			resp.Body.Close()
 			if resp.StatusCode == 200 {
-				log.Infof("Engine on port %d is ready", port)
+				log.Infof("Engine %s is ready", info.URL())
 				return nil
 			}
 		}
 		time.Sleep(100 * time.Millisecond)
 	}
 
-	return fmt.Errorf("engine on port %d did not become ready in time", port)
+	return fmt.Errorf("engine %s did not become ready in time", info.URL())
 }
 
 // GetEngineForSymbol returns the engine info for a symbol (nil if not exists)
@@ -177,7 +544,7 @@ func (m *Manager) GetEngineURL(symbol string) (string, error) {
 		return "", fmt.Errorf("no engine for symbol %s", symbol)
 	}
 
-	return fmt.Sprintf("http://localhost:%d", info.Port), nil
+	return info.URL(), nil
 }
 
 // HealthCheck checks the health of all engines
@@ -189,17 +556,22 @@ func (m *Manager) HealthCheck() map[string]bool {
 	}
 	m.mu.RUnlock()
 
+	// symbols on the shared engine all have the same URL, and one probe answers for all of them
+	symbolsByURL := make(map[string][]string)
+	for symbol, info := range engines {
+		symbolsByURL[info.URL()] = append(symbolsByURL[info.URL()], symbol)
+	}
+
 	results := make(map[string]bool)
 	var wg sync.WaitGroup
 	var resultMu sync.Mutex
 
-	for symbol, info := range engines {
+	for baseURL, symbols := range symbolsByURL {
 		wg.Add(1)
-		go func(sym string, eng *EngineInfo) {
+		go func(baseURL string, symbols []string) {
 			defer wg.Done()
 
-			url := fmt.Sprintf("http://localhost:%d/status", eng.Port)
-			resp, err := m.client.Get(url)
+			resp, err := m.client.Get(baseURL + "/metrics")
 
 			healthy := false
 			if err == nil {
@@ -208,23 +580,27 @@ func (m *Manager) HealthCheck() map[string]bool {
 			}
 
 			resultMu.Lock()
-			results[sym] = healthy
+			for _, sym := range symbols {
+				results[sym] = healthy
+			}
 			resultMu.Unlock()
 
 			// Update engine health status
 			m.mu.Lock()
-			if e, exists := m.engines[sym]; exists {
-				e.Healthy = healthy
+			for _, sym := range symbols {
+				if e, exists := m.engines[sym]; exists {
+					e.Healthy = healthy
+				}
 			}
 			m.mu.Unlock()
-		}(symbol, info)
+		}(baseURL, symbols)
 	}
 
 	wg.Wait()
 	return results
 }
 
-// StopEngine stops a specific engine
+// StopEngine stops a specific engine. A symbol on the shared engine is only forgotten; the process keeps running for the others.
 func (m *Manager) StopEngine(symbol string) error {
 	m.mu.Lock()
 	defer m.mu.Unlock()
@@ -234,14 +610,12 @@ func (m *Manager) StopEngine(symbol string) error {
 		return fmt.Errorf("no engine for symbol %s", symbol)
 	}
 
-	if info.Process != nil {
-		if err := info.Process.Kill(); err != nil {
-			log.Warnf("Failed to kill engine process for %s: %v", symbol, err)
-		}
-	}
-
 	delete(m.engines, symbol)
-	log.Infof("Stopped engine for %s", symbol)
+	if info.Shared {
+		log.Infof("Removed %s from the shared engine", symbol)
+		return nil
+	}
+	stopProcess(symbol, info)
 	return nil
 }
 
@@ -251,19 +625,45 @@ func (m *Manager) StopAllEngines() {
 	defer m.mu.Unlock()
 
 	for symbol, info := range m.engines {
-		if info.Process != nil {
-			if err := info.Process.Kill(); err != nil {
-				log.Warnf("Failed to kill engine process for %s: %v", symbol, err)
-			}
+		if !info.Shared {
+			stopProcess(symbol, info)
 		}
-		log.Infof("Stopped engine for %s", symbol)
+	}
+	if m.shared != nil {
+		stopProcess("the shared engine", m.shared)
+	}
+	for _, info := range m.pool {
+		stopProcess("a pooled engine", info)
 	}
 
 	m.engines = make(map[string]*EngineInfo)
-	m.nextPort = m.basePort
+	m.shared = nil
+	m.pool = nil
+	m.refilling = false
+	m.generation++
+	// engines still starting get stopped once they're up; until then their ports aren't free
+	if m.starting == 0 {
+		m.nextPort = m.basePort
+	}
+}
+
+func stopProcess(name string, info *EngineInfo) {
+	if info.Shm != nil {
+		info.Shm.Close()
+	}
+	if info.Process != nil {
+		if err := info.Process.Kill(); err != nil {
+			log.Warnf("Failed to kill engine process for %s: %v", name, err)
+		}
+	}
+	// a killed engine can't remove its socket itself
+	if info.Socket != "" {
+		os.Remove(info.Socket)
+	}
+	log.Infof("Stopped engine for %s", name)
 }
 
-// ResetEngine resets a specific engine's orderbook
+// ResetEngine resets a specific engine's orderbook (only the symbol's book, so the shared engine's other books are left alone)
 func (m *Manager) ResetEngine(symbol string) error {
 	m.mu.RLock()
 	info, exists := m.engines[symbol]
@@ -273,8 +673,7 @@ func (m *Manager) ResetEngine(symbol string) error {
 		return fmt.Errorf("no engine for symbol %s", symbol)
 	}
 
-	url := fmt.Sprintf("http://localhost:%d/reset", info.Port)
-	resp, err := m.client.Post(url, "application/json", nil)
+	resp, err := m.client.Post(info.URL()+"/reset?book="+url.QueryEscape(symbol), "application/json", nil)
 	if err != nil {
 		return fmt.Errorf("failed to reset engine for %s: %w", symbol, err)
 	}
@@ -315,3 +714,29 @@ func (m *Manager) GetMapping() map[string]int {
 	}
 	return mapping
 }
+
+// GetShmClients returns the shared-memory channels of the engines that have one
+func (m *Manager) GetShmClients() map[string]*transport.ShmClient {
+	m.mu.RLock()
+	defer m.mu.RUnlock()
+
+	clients := make(map[string]*transport.ShmClient)
+	for symbol, info := range m.engines {
+		if info.Shm != nil {
+			clients[symbol] = info.Shm
+		}
+	}
+	return clients
+}
+
+// GetEngineURLs returns the base URL of every engine by symbol
+func (m *Manager) GetEngineURLs() map[string]string {
+	m.mu.RLock()
+	defer m.mu.RUnlock()
+
+	urls := make(map[string]string, len(m.engines))
+	for symbol, info := range m.engines {
+		urls[symbol] = info.URL()
+	}
+	return urls
+}
@@ -8,12 +8,15 @@ import (
 	"net/url"
 	"strconv"
 	"strings"
+	"time"
 
 	"github.com/TanishqM1/Orderbook/api"
+	"github.com/TanishqM1/Orderbook/internal/loadbalancer"
 	log "github.com/sirupsen/logrus"
 )
 
 func Cancel(w http.ResponseWriter, r *http.Request) {
+	start := time.Now()
 	var params = api.CancelFields{}
 	err := json.NewDecoder(r.Body).Decode(&params)
 
@@ -39,7 +42,9 @@ func Cancel(w http.ResponseWriter, r *http.Request) {
 	// Try distributed mode first
 	if balancer != nil {
 		if _, exists := balancer.GetEngineURL(params.Book); exists {
+			sent := time.Now()
 			resp, err := balancer.ForwardCancel(urlValues)
+			upstream := time.Since(sent)
 			if err != nil {
 				log.Errorf("Failed to forward cancel via load balancer: %v", err)
 				api.HandleInternalError(w)
@@ -48,6 +53,7 @@ func Cancel(w http.ResponseWriter, r *http.Request) {
 			defer resp.Body.Close()
 
 			w.Header().Set("Content-Type", "application/json")
+			loadbalancer.PassServerTiming(w.Header(), resp, upstream, time.Since(start))
 			w.WriteHeader(resp.StatusCode)
 
 			if _, err := io.Copy(w, resp.Body); err != nil {
@@ -60,11 +66,11 @@ func Cancel(w http.ResponseWriter, r *http.Request) {
 	}
 
 	// Fallback to single engine mode
-	cancelSingleEngine(w, urlValues, params.OrderId)
+	cancelSingleEngine(w, start, urlValues, params.OrderId)
 }
 
 // cancelSingleEngine forwards cancel to the default single engine
-func cancelSingleEngine(w http.ResponseWriter, urlValues url.Values, orderId int) {
+func cancelSingleEngine(w http.ResponseWriter, start time.Time, urlValues url.Values, orderId int) {
 	reqBody := strings.NewReader(urlValues.Encode())
 	client := http.Client{}
 
@@ -80,7 +86,9 @@ func cancelSingleEngine(w http.ResponseWriter, urlValues url.Values, orderId int
 	}
 
 	cppReq.Header.Set("Content-Type", "application/x-www-form-urlencoded")
+	sent := time.Now()
 	cppResp, err := client.Do(cppReq)
+	upstream := time.Since(sent)
 
 	if err != nil {
 		log.Errorf("Failed to connect to C++ engine at :6060. Is the C++ server running? Error: %v", err)
@@ -90,6 +98,7 @@ func cancelSingleEngine(w http.ResponseWriter, urlValues url.Values, orderId int
 	defer cppResp.Body.Close()
 
 	w.Header().Set("Content-Type", "application/json")
+	loadbalancer.PassServerTiming(w.Header(), cppResp, upstream, time.Since(start))
 	w.WriteHeader(cppResp.StatusCode)
 
 	if _, err := io.Copy(w, cppResp.Body); err != nil {
@@ -2,7 +2,6 @@ package handlers
 
 import (
 	"encoding/json"
-	"fmt"
 	"net/http"
 
 	log "github.com/sirupsen/logrus"
@@ -14,6 +13,7 @@ type EngineStatus struct {
 	Port    int    `json:"port"`
 	Healthy bool   `json:"healthy"`
 	URL     string `json:"url"`
+	Shard   int    `json:"shard"` // the engine shard that owns the book (always 0 for a one-symbol engine)
 }
 
 // HealthResponse represents the health check response
@@ -30,7 +30,7 @@ func Health(w http.ResponseWriter, r *http.Request) {
 
 	if engineManager == nil {
 		// No distributed mode - check single engine
-		resp, err := http.Get("http://localhost:6060/status")
+		resp, err := http.Get("http://localhost:6060/metrics")
 		if err != nil {
 			json.NewEncoder(w).Encode(HealthResponse{
 				Status:         "degraded",
@@ -78,7 +78,8 @@ func Health(w http.ResponseWriter, r *http.Request) {
 			Symbol:  symbol,
 			Port:    info.Port,
 			Healthy: healthy,
-			URL:     fmt.Sprintf("http://localhost:%d", info.Port),
+			URL:     info.URL(),
+			Shard:   info.Shard,
 		})
 	}
 
@@ -129,7 +130,8 @@ func Engines(w http.ResponseWriter, r *http.Request) {
 			Symbol:  symbol,
 			Port:    info.Port,
 			Healthy: healthResults[symbol],
-			URL:     "http://localhost:" + string(rune(info.Port)),
+			URL:     info.URL(),
+			Shard:   info.Shard,
 		})
 	}
 
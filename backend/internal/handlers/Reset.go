@@ -27,8 +27,8 @@ func Reset(w http.ResponseWriter, r *http.Request) {
 		return
 	}
 
-	// Get all engine URLs
-	engineURLs := balancer.GetAllEngineURLs()
+	// Get all engine URLs (each once: a reset clears every book in the engine)
+	engineURLs := balancer.GetDistinctEngineURLs()
 	if len(engineURLs) == 0 {
 		// No engines running
 		json.NewEncoder(w).Encode(ResetResponse{
@@ -38,18 +38,17 @@ func Reset(w http.ResponseWriter, r *http.Request) {
 		return
 	}
 
-	// Reset all engines in parallel
-	client := &http.Client{Timeout: 5 * time.Second}
+	// Reset all engines in parallel (through the balancer's client, which also reaches engines on a Unix domain socket)
 	var wg sync.WaitGroup
 	resetCount := 0
 	var countMu sync.Mutex
 
-	for symbol, baseURL := range engineURLs {
+	for baseURL, symbol := range engineURLs {
 		wg.Add(1)
 		go func(sym, url string) {
 			defer wg.Done()
 
-			resp, err := client.Post(url+"/reset", "application/json", nil)
+			resp, err := balancer.ForwardEngineReset(url)
 			if err != nil {
 				log.Warnf("Failed to reset engine for %s: %v", sym, err)
 				return
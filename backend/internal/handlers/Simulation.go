@@ -74,8 +74,8 @@ func Simulation(w http.ResponseWriter, r *http.Request) {
 	}
 
 	// Register engines with load balancer
-	mapping := engineManager.GetMapping()
-	balancer.RegisterEngines(mapping)
+	balancer.RegisterEngineURLs(engineManager.GetEngineURLs())
+	balancer.RegisterShmClients(engineManager.GetShmClients())
 
 	// Step 2: Reset all engines in parallel
 	log.Info("Resetting all engines...")
@@ -22,8 +22,8 @@ func Status(w http.ResponseWriter, r *http.Request) {
 		return
 	}
 
-	// Get all engine URLs
-	engineURLs := balancer.GetAllEngineURLs()
+	// Get all engine URLs (each once: /status returns every book in the engine)
+	engineURLs := balancer.GetDistinctEngineURLs()
 	if len(engineURLs) == 0 {
 		// No engines running, return empty status
 		w.WriteHeader(http.StatusOK)
@@ -31,18 +31,17 @@ func Status(w http.ResponseWriter, r *http.Request) {
 		return
 	}
 
-	// Query all engines in parallel
-	client := &http.Client{Timeout: 5 * time.Second}
+	// Query all engines in parallel (through the balancer's client, which also reaches engines on a Unix domain socket)
 	results := make(map[string]json.RawMessage)
 	var resultMu sync.Mutex
 	var wg sync.WaitGroup
 
-	for symbol, baseURL := range engineURLs {
+	for baseURL, symbol := range engineURLs {
 		wg.Add(1)
 		go func(sym, url string) {
 			defer wg.Done()
 
-			resp, err := client.Get(url + "/status")
+			resp, err := balancer.ForwardEngineStatus(url)
 			if err != nil {
 				log.Warnf("Failed to get status from engine for %s: %v", sym, err)
 				return
@@ -56,7 +55,7 @@ func Status(w http.ResponseWriter, r *http.Request) {
 			}
 
 			// The response should be a JSON object with the symbol as key
-			// Each engine only has one book, so extract that
+			// (one book per engine, or all of them for the shared engine)
 			var engineStatus map[string]json.RawMessage
 			if err := json.Unmarshal(body, &engineStatus); err != nil {
 				log.Warnf("Failed to parse status response for %s: %v", sym, err)
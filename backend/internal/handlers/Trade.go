@@ -8,12 +8,15 @@ import (
 	"net/url"
 	"strconv"
 	"strings"
+	"time"
 
 	"github.com/TanishqM1/Orderbook/api"
+	"github.com/TanishqM1/Orderbook/internal/loadbalancer"
 	log "github.com/sirupsen/logrus"
 )
 
 func Trade(w http.ResponseWriter, r *http.Request) {
+	start := time.Now()
 	var params = api.AddFields{}
 	err := json.NewDecoder(r.Body).Decode(&params)
 
@@ -39,7 +42,9 @@ func Trade(w http.ResponseWriter, r *http.Request) {
 	if balancer != nil {
 		// Check if we have an engine for this symbol
 		if _, exists := balancer.GetEngineURL(params.Name); exists {
+			sent := time.Now()
 			resp, err := balancer.ForwardTrade(urlValues)
+			upstream := time.Since(sent)
 			if err != nil {
 				log.Errorf("Failed to forward trade via load balancer: %v", err)
 				api.HandleInternalError(w)
@@ -48,6 +53,7 @@ func Trade(w http.ResponseWriter, r *http.Request) {
 			defer resp.Body.Close()
 
 			w.Header().Set("Content-Type", "application/json")
+			loadbalancer.PassServerTiming(w.Header(), resp, upstream, time.Since(start))
 			w.WriteHeader(resp.StatusCode)
 
 			if _, err := io.Copy(w, resp.Body); err != nil {
@@ -60,11 +66,11 @@ func Trade(w http.ResponseWriter, r *http.Request) {
 	}
 
 	// Fallback to single engine mode
-	tradeSingleEngine(w, urlValues, orderId)
+	tradeSingleEngine(w, start, urlValues, orderId)
 }
 
 // tradeSingleEngine forwards trade to the default single engine
-func tradeSingleEngine(w http.ResponseWriter, urlValues url.Values, orderId uint64) {
+func tradeSingleEngine(w http.ResponseWriter, start time.Time, urlValues url.Values, orderId uint64) {
 	reqBody := strings.NewReader(urlValues.Encode())
 	client := http.Client{}
 
@@ -81,7 +87,9 @@ func tradeSingleEngine(w http.ResponseWriter, urlValues url.Values, orderId uint
 
 	cppReq.Header.Set("Content-Type", "application/x-www-form-urlencoded")
 
+	sent := time.Now()
 	cppResp, err := client.Do(cppReq)
+	upstream := time.Since(sent)
 	if err != nil {
 		log.Errorf("Failed to connect to C++ engine at :6060. Is the C++ server running? Error: %v", err)
 		api.HandleInternalError(w)
@@ -90,6 +98,7 @@ func tradeSingleEngine(w http.ResponseWriter, urlValues url.Values, orderId uint
 	defer cppResp.Body.Close()
 
 	w.Header().Set("Content-Type", "application/json")
+	loadbalancer.PassServerTiming(w.Header(), cppResp, upstream, time.Since(start))
 	w.WriteHeader(cppResp.StatusCode)
 
 	if _, err := io.Copy(w, cppResp.Body); err != nil {
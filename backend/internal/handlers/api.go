@@ -31,6 +31,8 @@ func Handler(r *chi.Mux) {
 			w.Header().Set("Access-Control-Allow-Origin", "*")
 			w.Header().Set("Access-Control-Allow-Methods", "GET, POST, PUT, DELETE, OPTIONS")
 			w.Header().Set("Access-Control-Allow-Headers", "Content-Type, Authorization")
+			// lets a browser on another origin read the Server-Timing breakdown
+			w.Header().Set("Timing-Allow-Origin", "*")
 
 			if req.Method == "OPTIONS" {
 				w.WriteHeader(http.StatusOK)
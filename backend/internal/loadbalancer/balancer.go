@@ -12,13 +12,15 @@ import (
 	"sync"
 	"time"
 
+	"github.com/TanishqM1/Orderbook/internal/transport"
 	log "github.com/sirupsen/logrus"
 )
 
 // Balancer routes requests to engine servers based on symbol mapping
 type Balancer struct {
 	mu      sync.RWMutex
-	mapping map[string]string // symbol -> base URL (e.g., "AAPL" -> "http://localhost:6060")
+	mapping map[string]string               // symbol -> base URL (e.g., "AAPL" -> "http://localhost:6060")
+	shm     map[string]*transport.ShmClient // symbol -> shared-memory channel, for engines started with one (see shm.go)
 	client  *http.Client
 }
 
@@ -26,10 +28,11 @@ type Balancer struct {
 func New() *Balancer {
 	// Tuned transport for maximum throughput and connection reuse
 	tr := &http.Transport{
-		DialContext: (&net.Dialer{
+		// engines on a Unix domain socket are dialed there, the rest over TCP
+		DialContext: transport.UnixDialContext(&net.Dialer{
 			Timeout:   100 * time.Millisecond,
 			KeepAlive: 30 * time.Second,
-		}).DialContext,
+		}),
 		MaxIdleConns:          1000,
 		MaxIdleConnsPerHost:   200,
 		IdleConnTimeout:       90 * time.Second,
@@ -40,6 +43,7 @@ func New() *Balancer {
 
 	return &Balancer{
 		mapping: make(map[string]string),
+		shm:     make(map[string]*transport.ShmClient),
 		client: &http.Client{
 			Transport: tr,
 			Timeout:   5 * time.Second,
@@ -64,11 +68,21 @@ func (b *Balancer) RegisterEngines(mapping map[string]int) {
 	}
 }
 
+// RegisterEngineURLs registers multiple symbols to their engine base URLs (see engine.Manager.GetEngineURLs)
+func (b *Balancer) RegisterEngineURLs(urls map[string]string) {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	for symbol, baseURL := range urls {
+		b.mapping[symbol] = baseURL
+	}
+}
+
 // UnregisterEngine removes a symbol from the mapping
 func (b *Balancer) UnregisterEngine(symbol string) {
 	b.mu.Lock()
 	defer b.mu.Unlock()
 	delete(b.mapping, symbol)
+	delete(b.shm, symbol)
 	log.Infof("Unregistered engine for %s", symbol)
 }
 
@@ -91,10 +105,28 @@ func (b *Balancer) GetAllEngineURLs() map[string]string {
 	return result
 }
 
+// GetDistinctEngineURLs returns each engine's base URL once, with one of the symbols it serves
+// (with ENGINE_SHARED=1 every symbol has the same engine, and a request for all books only needs to go there once)
+func (b *Balancer) GetDistinctEngineURLs() map[string]string {
+	b.mu.RLock()
+	defer b.mu.RUnlock()
+	result := make(map[string]string)
+	for symbol, baseURL := range b.mapping {
+		result[baseURL] = symbol
+	}
+	return result
+}
+
 // ForwardTrade sends a trade request to the appropriate engine
 func (b *Balancer) ForwardTrade(form url.Values) (*http.Response, error) {
 	book := form.Get("book")
 
+	if client := b.shmClient(book); client != nil {
+		if msg, ok := newOrderFromForm(form); ok {
+			return b.forwardTradeShm(client, msg)
+		}
+	}
+
 	b.mu.RLock()
 	baseURL, exists := b.mapping[book]
 	b.mu.RUnlock()
@@ -113,10 +145,32 @@ func (b *Balancer) ForwardTrade(form url.Values) (*http.Response, error) {
 	return b.client.Do(req)
 }
 
+// PassServerTiming copies the engine's Server-Timing breakdown (decode, queue, match, serialize and engine, its own total) onto the
+// client's response and adds the hops on this side: upstream is the round trip to the engine, so upstream minus engine is the network
+// and HTTP in between, and gateway is the whole request here. Replies over shared memory have no header, so only our two are sent then.
+func PassServerTiming(header http.Header, resp *http.Response, upstream, gateway time.Duration) {
+	ms := func(d time.Duration) float64 { return float64(d.Nanoseconds()) / 1e6 }
+	timing := fmt.Sprintf("upstream;dur=%.4f, gateway;dur=%.4f", ms(upstream), ms(gateway))
+	if engine := resp.Header.Get("Server-Timing"); engine != "" {
+		timing = engine + ", " + timing
+	}
+	header.Set("Server-Timing", timing)
+}
+
 // FireTrade sends a trade request without waiting for response (fire-and-forget)
 func (b *Balancer) FireTrade(form url.Values) {
 	book := form.Get("book")
 
+	// pushing onto the ring doesn't block, so no goroutine needed
+	if client := b.shmClient(book); client != nil {
+		if msg, ok := newOrderFromForm(form); ok {
+			if err := client.Send(msg); err != nil {
+				log.Warnf("Failed to send trade to engine: %v", err)
+			}
+			return
+		}
+	}
+
 	b.mu.RLock()
 	baseURL, exists := b.mapping[book]
 	b.mu.RUnlock()
@@ -150,6 +204,12 @@ func (b *Balancer) FireTrade(form url.Values) {
 func (b *Balancer) ForwardCancel(form url.Values) (*http.Response, error) {
 	book := form.Get("book")
 
+	if client := b.shmClient(book); client != nil {
+		if resp, handled, err := b.forwardCancelShm(client, form); handled {
+			return resp, err
+		}
+	}
+
 	b.mu.RLock()
 	baseURL, exists := b.mapping[book]
 	b.mu.RUnlock()
@@ -181,7 +241,7 @@ func (b *Balancer) ForwardStatus(symbol string) (*http.Response, error) {
 	return b.client.Get(baseURL + "/status")
 }
 
-// ForwardReset resets a specific engine
+// ForwardReset clears the symbol's book in its engine (only that book, when the engine holds others too)
 func (b *Balancer) ForwardReset(symbol string) (*http.Response, error) {
 	b.mu.RLock()
 	baseURL, exists := b.mapping[symbol]
@@ -191,6 +251,17 @@ func (b *Balancer) ForwardReset(symbol string) (*http.Response, error) {
 		return nil, fmt.Errorf("no engine registered for symbol %s", symbol)
 	}
 
+	return b.client.Post(baseURL+"/reset?book="+url.QueryEscape(symbol), "application/json", nil)
+}
+
+// ForwardEngineStatus gets the status of every book in the engine at baseURL (one of GetDistinctEngineURLs).
+// It goes through the balancer's client, so engines on a Unix domain socket are reached there too.
+func (b *Balancer) ForwardEngineStatus(baseURL string) (*http.Response, error) {
+	return b.client.Get(baseURL + "/status")
+}
+
+// ForwardEngineReset clears every book in the engine at baseURL (one of GetDistinctEngineURLs)
+func (b *Balancer) ForwardEngineReset(baseURL string) (*http.Response, error) {
 	return b.client.Post(baseURL+"/reset", "application/json", nil)
 }
 
@@ -230,6 +301,10 @@ type BatchResponse struct {
 // ForwardBatch sends a batch of orders to the appropriate engine
 // Since each engine handles one symbol, we route directly
 func (b *Balancer) ForwardBatch(symbol string, orders []BatchOrder) (*BatchResponse, error) {
+	if client := b.shmClient(symbol); client != nil {
+		return b.forwardBatchShm(client, orders)
+	}
+
 	b.mu.RLock()
 	baseURL, exists := b.mapping[symbol]
 	b.mu.RUnlock()
@@ -238,13 +313,12 @@ func (b *Balancer) ForwardBatch(symbol string, orders []BatchOrder) (*BatchRespo
 		return nil, fmt.Errorf("no engine registered for symbol %s", symbol)
 	}
 
-	batchReq := BatchRequest{Orders: orders}
-	body, err := json.Marshal(batchReq)
+	req, err := newBatchRequest(baseURL+"/batch", orders)
 	if err != nil {
-		return nil, fmt.Errorf("failed to marshal batch request: %w", err)
+		return nil, err
 	}
 
-	resp, err := b.client.Post(baseURL+"/batch", "application/json", bytes.NewReader(body))
+	resp, err := b.client.Do(req)
 	if err != nil {
 		return nil, fmt.Errorf("failed to send batch request: %w", err)
 	}
@@ -263,6 +337,41 @@ func (b *Balancer) ForwardBatch(symbol string, orders []BatchOrder) (*BatchRespo
 	return &batchResp, nil
 }
 
+// newBatchRequest encodes the orders in the engine's binary batch format (a fraction of the size of the JSON, and nothing for the
+// engine to parse), falling back to JSON for the odd batch that doesn't fit it (book names over 31 characters).
+func newBatchRequest(target string, orders []BatchOrder) (*http.Request, error) {
+	writer := transport.NewBatchWriter(len(orders))
+	for _, order := range orders {
+		if err := writer.Add(order.OrderId, order.Book, wireSide(order.Side), wireOrderType(order.TradeType), int32(order.Price), uint32(order.Quantity)); err != nil {
+			return newJSONBatchRequest(target, orders)
+		}
+	}
+
+	body, length := writer.Body()
+	req, err := http.NewRequest("POST", target, body)
+	if err != nil {
+		return nil, err
+	}
+	req.ContentLength = length
+	req.Header.Set("Content-Type", transport.BatchContentType)
+	return req, nil
+}
+
+func newJSONBatchRequest(target string, orders []BatchOrder) (*http.Request, error) {
+	batchReq := BatchRequest{Orders: orders}
+	body, err := json.Marshal(batchReq)
+	if err != nil {
+		return nil, fmt.Errorf("failed to marshal batch request: %w", err)
+	}
+
+	req, err := http.NewRequest("POST", target, bytes.NewReader(body))
+	if err != nil {
+		return nil, err
+	}
+	req.Header.Set("Content-Type", "application/json")
+	return req, nil
+}
+
 // ForwardBatchParallel sends batches to multiple engines in parallel
 func (b *Balancer) ForwardBatchParallel(ordersBySymbol map[string][]BatchOrder) (map[string]*BatchResponse, error) {
 	results := make(map[string]*BatchResponse)
@@ -0,0 +1,171 @@
+package loadbalancer
+
+import (
+	"fmt"
+	"io"
+	"net/http"
+	"net/url"
+	"strconv"
+	"strings"
+
+	"github.com/TanishqM1/Orderbook/internal/transport"
+)
+
+// Engines on this host can also be reached over a shared-memory channel (see transport.ShmClient). When a symbol has one,
+// trades, cancels and batches skip loopback TCP, HTTP and JSON; the replies are turned back into what the engine's HTTP
+// endpoints would have answered, so callers can't tell the difference.
+
+// maxBookName is the longest book name the binary messages carry (BookName::kMaxSize in the engine).
+const maxBookName = 31
+
+// RegisterShmClients registers shared-memory channels for symbols (symbols without one keep using HTTP)
+func (b *Balancer) RegisterShmClients(clients map[string]*transport.ShmClient) {
+	b.mu.Lock()
+	defer b.mu.Unlock()
+	for symbol, client := range clients {
+		b.shm[symbol] = client
+	}
+}
+
+func (b *Balancer) shmClient(symbol string) *transport.ShmClient {
+	b.mu.RLock()
+	defer b.mu.RUnlock()
+	return b.shm[symbol]
+}
+
+// jsonResponse builds the response the engine's HTTP endpoint would have sent.
+func jsonResponse(status int, body string) *http.Response {
+	return &http.Response{
+		Status:        fmt.Sprintf("%d %s", status, http.StatusText(status)),
+		StatusCode:    status,
+		Proto:         "HTTP/1.1",
+		ProtoMajor:    1,
+		ProtoMinor:    1,
+		Header:        http.Header{"Content-Type": {"application/json"}},
+		Body:          io.NopCloser(strings.NewReader(body)),
+		ContentLength: int64(len(body)),
+	}
+}
+
+// wireSide and wireOrderType read the fields the same way the engine does (anything else is a sell / a fillandkill).
+func wireSide(side string) byte {
+	if side == "BUY" {
+		return transport.SideBuy
+	}
+	return transport.SideSell
+}
+
+func wireOrderType(tradeType string) byte {
+	if tradeType == "GTC" {
+		return transport.GoodTillCancel
+	}
+	return transport.FillAndKill
+}
+
+// newOrderFromForm encodes a /trade form. false if a field doesn't parse; the caller then uses HTTP, which reports the error as usual.
+func newOrderFromForm(form url.Values) ([]byte, bool) {
+	book := form.Get("book")
+	orderId, err := strconv.ParseUint(form.Get("orderid"), 10, 64)
+	if err != nil || book == "" || len(book) > maxBookName {
+		return nil, false
+	}
+	price, err := strconv.ParseInt(form.Get("price"), 10, 32)
+	if err != nil {
+		return nil, false
+	}
+	quantity, err := strconv.ParseUint(form.Get("quantity"), 10, 32)
+	if err != nil {
+		return nil, false
+	}
+	return transport.EncodeNewOrder(orderId, book, wireSide(form.Get("side")), wireOrderType(form.Get("tradetype")), int32(price), uint32(quantity)), true
+}
+
+func (b *Balancer) forwardTradeShm(client *transport.ShmClient, msg []byte) (*http.Response, error) {
+	if _, err := client.Do(msg); err != nil {
+		return nil, err
+	}
+	return jsonResponse(http.StatusOK, `{"message": "Order placed successfully"}`), nil
+}
+
+func (b *Balancer) forwardCancelShm(client *transport.ShmClient, form url.Values) (*http.Response, bool, error) {
+	book := form.Get("book")
+	orderId, err := strconv.ParseUint(form.Get("orderid"), 10, 64)
+	if err != nil || book == "" || len(book) > maxBookName {
+		return nil, false, nil
+	}
+
+	reply, err := client.Do(transport.EncodeCancel(orderId, book))
+	if err != nil {
+		return nil, true, err
+	}
+	for _, msg := range reply {
+		if transport.MessageType(msg) == transport.MsgReject {
+			return jsonResponse(http.StatusNotFound, `{"message": "Order ID not found"}`), true, nil
+		}
+	}
+	return jsonResponse(http.StatusOK, `{"message": "Order Info Received"}`), true, nil
+}
+
+// forwardBatchShm pipelines the whole batch onto the channel, counts the fills from the exec reports, and asks each book for
+// its summary at the end (the engine applies requests for a book in order, so the summary sees every order of the batch).
+func (b *Balancer) forwardBatchShm(client *transport.ShmClient, orders []BatchOrder) (*BatchResponse, error) {
+	type pendingOrder struct {
+		book  string
+		reply <-chan [][]byte
+	}
+
+	pending := make([]pendingOrder, 0, len(orders))
+	for _, order := range orders {
+		// the engine skips these too
+		if order.Book == "" || order.OrderId == 0 {
+			continue
+		}
+		if len(order.Book) > maxBookName {
+			return nil, fmt.Errorf("book name %q is longer than %d characters", order.Book, maxBookName)
+		}
+
+		msg := transport.EncodeNewOrder(order.OrderId, order.Book, wireSide(order.Side), wireOrderType(order.TradeType), int32(order.Price), uint32(order.Quantity))
+		reply, err := client.DoAsync(msg)
+		if err != nil {
+			return nil, fmt.Errorf("failed to send batch over shared memory: %w", err)
+		}
+		pending = append(pending, pendingOrder{book: order.Book, reply: reply})
+	}
+
+	results := make(map[string]BatchResult)
+	for _, p := range pending {
+		stats := results[p.book]
+		for _, msg := range <-p.reply {
+			if transport.MessageType(msg) != transport.MsgExecReport {
+				continue
+			}
+			if report := transport.DecodeExecReport(msg); report.ExecType == transport.ExecTrade {
+				stats.TradesExecuted++
+				stats.VolumeTraded += int64(report.Quantity)
+			}
+		}
+		results[p.book] = stats
+	}
+
+	for book, stats := range results {
+		reply, err := client.Do(transport.EncodeSummary(book))
+		if err != nil {
+			return nil, fmt.Errorf("failed to get book summary over shared memory: %w", err)
+		}
+		for _, msg := range reply {
+			if transport.MessageType(msg) != transport.MsgBookSummary {
+				continue
+			}
+			summary := transport.DecodeBookSummary(msg)
+			stats.RemainingBids = int(summary.BidCount)
+			stats.RemainingAsks = int(summary.AskCount)
+			stats.BestBidPrice = int(summary.BestBid)
+			stats.BestAskPrice = int(summary.BestAsk)
+			stats.BidLevels = int(summary.BidLevels)
+			stats.AskLevels = int(summary.AskLevels)
+		}
+		results[book] = stats
+	}
+
+	return &BatchResponse{ProcessedCount: len(pending), Results: results}, nil
+}
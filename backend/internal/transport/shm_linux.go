@@ -0,0 +1,263 @@
+//go:build linux
+
+package transport
+
+import (
+	"encoding/binary"
+	"errors"
+	"fmt"
+	"os"
+	"runtime"
+	"sync"
+	"sync/atomic"
+	"syscall"
+	"time"
+	"unsafe"
+)
+
+// Layout of the shared file, mirrored from ShmRing.h. Change both together.
+const (
+	shmMagic       = 0x474E495248534B42 // "BKSHRING"
+	shmVersion     = 1
+	shmSlots       = 4096
+	shmSlotSize    = 64
+	shmSlotsOffset = 4096
+	shmFileSize    = shmSlotsOffset + 2*shmSlots*shmSlotSize
+
+	requestRingOffset  = 64
+	responseRingOffset = 256
+
+	futexWait = 0
+	futexWake = 1
+
+	idleWait = 100 * time.Millisecond
+)
+
+var errClosed = errors.New("shared-memory channel closed")
+
+// ShmSupported reports whether this platform has the shared-memory transport.
+func ShmSupported() bool {
+	return true
+}
+
+// ring is one direction of the channel, over the mapped file.
+type ring struct {
+	head    *uint64
+	tail    *uint64
+	signal  *uint32
+	waiting *uint32
+	slots   []byte
+}
+
+func newRing(mem []byte, headerOffset int, slotsOffset int) ring {
+	return ring{
+		head:    (*uint64)(unsafe.Pointer(&mem[headerOffset])),
+		tail:    (*uint64)(unsafe.Pointer(&mem[headerOffset+64])),
+		signal:  (*uint32)(unsafe.Pointer(&mem[headerOffset+128])),
+		waiting: (*uint32)(unsafe.Pointer(&mem[headerOffset+132])),
+		slots:   mem[slotsOffset : slotsOffset+shmSlots*shmSlotSize],
+	}
+}
+
+func (r *ring) tryPush(msg []byte) bool {
+	head := atomic.LoadUint64(r.head)
+	if head-atomic.LoadUint64(r.tail) == shmSlots {
+		return false
+	}
+	copy(r.slots[(head%shmSlots)*shmSlotSize:], msg)
+	atomic.StoreUint64(r.head, head+1)
+	return true
+}
+
+// wakeConsumer only makes the futex call when the engine said it is going to sleep.
+func (r *ring) wakeConsumer() {
+	if atomic.LoadUint32(r.waiting) != 0 {
+		atomic.AddUint32(r.signal, 1)
+		syscall.Syscall6(syscall.SYS_FUTEX, uintptr(unsafe.Pointer(r.signal)), futexWake, 1, 0, 0, 0)
+	}
+}
+
+func (r *ring) tryPop(out []byte) bool {
+	tail := atomic.LoadUint64(r.tail)
+	if tail == atomic.LoadUint64(r.head) {
+		return false
+	}
+	copy(out, r.slots[(tail%shmSlots)*shmSlotSize:(tail%shmSlots+1)*shmSlotSize])
+	atomic.StoreUint64(r.tail, tail+1)
+	return true
+}
+
+func (r *ring) hasData() bool {
+	return atomic.LoadUint64(r.tail) != atomic.LoadUint64(r.head)
+}
+
+// waitForData spins for a moment, then sleeps on the futex until the engine wakes us (or the timeout passes).
+func (r *ring) waitForData(timeout time.Duration) {
+	for i := 0; i < 256; i++ {
+		if r.hasData() {
+			return
+		}
+		runtime.Gosched()
+	}
+	signal := atomic.LoadUint32(r.signal)
+	atomic.StoreUint32(r.waiting, 1)
+	if !r.hasData() {
+		ts := syscall.NsecToTimespec(timeout.Nanoseconds())
+		syscall.Syscall6(syscall.SYS_FUTEX, uintptr(unsafe.Pointer(r.signal)), futexWait, uintptr(signal), uintptr(unsafe.Pointer(&ts)), 0, 0)
+	}
+	atomic.StoreUint32(r.waiting, 0)
+}
+
+// ShmClient is the balancer's end of an engine's shared-memory channel. It is safe for concurrent use: requests are
+// serialised onto the ring, and the replies (which come back in request order) are handed to the callers in that order.
+type ShmClient struct {
+	mem       []byte
+	requests  ring
+	responses ring
+
+	mu      sync.Mutex // the request ring has a single producer
+	pending chan chan [][]byte
+	closed  chan struct{}
+	once    sync.Once
+	reader  sync.WaitGroup
+}
+
+// DialShm maps the channel an engine created with --shm=path.
+func DialShm(path string) (*ShmClient, error) {
+	file, err := os.OpenFile(path, os.O_RDWR, 0)
+	if err != nil {
+		return nil, err
+	}
+	defer file.Close()
+
+	mem, err := syscall.Mmap(int(file.Fd()), 0, shmFileSize, syscall.PROT_READ|syscall.PROT_WRITE, syscall.MAP_SHARED)
+	if err != nil {
+		return nil, fmt.Errorf("failed to map %s: %w", path, err)
+	}
+
+	magic := atomic.LoadUint64((*uint64)(unsafe.Pointer(&mem[0])))
+	version := binary.LittleEndian.Uint32(mem[8:])
+	slots := binary.LittleEndian.Uint32(mem[12:])
+	slotSize := binary.LittleEndian.Uint32(mem[16:])
+	if magic != shmMagic || version != shmVersion || slots != shmSlots || slotSize != shmSlotSize {
+		syscall.Munmap(mem)
+		return nil, fmt.Errorf("%s is not a compatible engine channel", path)
+	}
+
+	c := &ShmClient{
+		mem:       mem,
+		requests:  newRing(mem, requestRingOffset, shmSlotsOffset),
+		responses: newRing(mem, responseRingOffset, shmSlotsOffset+shmSlots*shmSlotSize),
+		pending:   make(chan chan [][]byte, shmSlots),
+		closed:    make(chan struct{}),
+	}
+	c.reader.Add(1)
+	go c.readLoop()
+	return c, nil
+}
+
+// Do sends one request and waits for all of its reply messages.
+func (c *ShmClient) Do(request []byte) ([][]byte, error) {
+	reply, err := c.DoAsync(request)
+	if err != nil {
+		return nil, err
+	}
+	select {
+	case msgs := <-reply:
+		return msgs, nil
+	case <-c.closed:
+		return nil, errClosed
+	}
+}
+
+// DoAsync sends one request and returns a channel that gets its reply messages. Callers can pipeline as many as they like.
+func (c *ShmClient) DoAsync(request []byte) (<-chan [][]byte, error) {
+	reply := make(chan [][]byte, 1)
+	if err := c.submit(request, reply); err != nil {
+		return nil, err
+	}
+	return reply, nil
+}
+
+// Send sends one request without waiting for the reply (fire-and-forget).
+func (c *ShmClient) Send(request []byte) error {
+	return c.submit(request, nil)
+}
+
+func (c *ShmClient) submit(request []byte, reply chan [][]byte) error {
+	c.mu.Lock()
+	defer c.mu.Unlock()
+
+	select {
+	case <-c.closed:
+		return errClosed
+	default:
+	}
+
+	// the waiter goes in first, so it is queued before the engine can possibly answer
+	select {
+	case c.pending <- reply:
+	case <-c.closed:
+		return errClosed
+	}
+	for !c.requests.tryPush(request) {
+		// the engine is behind; make sure it's awake and give it a moment
+		c.requests.wakeConsumer()
+		select {
+		case <-c.closed:
+			return errClosed
+		default:
+		}
+		runtime.Gosched()
+	}
+	c.requests.wakeConsumer()
+	return nil
+}
+
+func (c *ShmClient) readLoop() {
+	defer c.reader.Done()
+
+	slot := make([]byte, shmSlotSize)
+	var reply [][]byte
+	for {
+		if !c.responses.tryPop(slot) {
+			select {
+			case <-c.closed:
+				return
+			default:
+			}
+			c.responses.waitForData(idleWait)
+			continue
+		}
+
+		length := int(binary.LittleEndian.Uint16(slot))
+		if length < headerSize || length > shmSlotSize {
+			length = headerSize
+		}
+		reply = append(reply, append([]byte(nil), slot[:length]...))
+
+		if slot[3]&flagLastInReply != 0 {
+			select {
+			case waiter := <-c.pending:
+				if waiter != nil {
+					waiter <- reply
+				}
+			case <-c.closed:
+				return
+			}
+			reply = nil
+		}
+	}
+}
+
+// Close stops the reader and unmaps the channel. Requests still waiting for a reply get an error.
+func (c *ShmClient) Close() {
+	c.once.Do(func() {
+		close(c.closed)
+		c.reader.Wait()
+		c.mu.Lock()
+		syscall.Munmap(c.mem)
+		c.mem = nil
+		c.mu.Unlock()
+	})
+}
@@ -0,0 +1,36 @@
+//go:build !linux
+
+package transport
+
+import "errors"
+
+// ShmSupported reports whether this platform has the shared-memory transport (it needs futexes, so Linux only).
+func ShmSupported() bool {
+	return false
+}
+
+// ShmClient is not available on this platform; DialShm always fails and the balancer stays on HTTP.
+type ShmClient struct{}
+
+// DialShm always fails on this platform.
+func DialShm(path string) (*ShmClient, error) {
+	return nil, errors.New("shared-memory transport is only available on linux")
+}
+
+// Do is never reached on this platform.
+func (c *ShmClient) Do(request []byte) ([][]byte, error) {
+	return nil, errors.New("shared-memory transport is only available on linux")
+}
+
+// DoAsync is never reached on this platform.
+func (c *ShmClient) DoAsync(request []byte) (<-chan [][]byte, error) {
+	return nil, errors.New("shared-memory transport is only available on linux")
+}
+
+// Send is never reached on this platform.
+func (c *ShmClient) Send(request []byte) error {
+	return errors.New("shared-memory transport is only available on linux")
+}
+
+// Close does nothing on this platform.
+func (c *ShmClient) Close() {}
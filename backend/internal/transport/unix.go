@@ -0,0 +1,41 @@
+package transport
+
+import (
+	"context"
+	"fmt"
+	"net"
+	"os"
+	"path/filepath"
+	"strings"
+)
+
+// Engines started with --unix-socket serve their HTTP endpoints on a Unix domain socket instead of a TCP port. The HTTP
+// clients still use ordinary URLs: the socket's file name is the host name, and UnixDialContext turns it back into a path.
+// The file name is made from the engine's id (the number that would otherwise be its port), so no registry is needed.
+
+const (
+	unixSocketPrefix = "orderbook-engine-"
+	unixSocketSuffix = ".sock"
+)
+
+// UnixSocketPath is where the engine with the given id puts its socket.
+func UnixSocketPath(id int) string {
+	return filepath.Join(os.TempDir(), fmt.Sprintf("%s%d%s", unixSocketPrefix, id, unixSocketSuffix))
+}
+
+// UnixSocketURL is the base URL for the engine with the given id (only reachable through UnixDialContext).
+func UnixSocketURL(id int) string {
+	return fmt.Sprintf("http://%s%d%s", unixSocketPrefix, id, unixSocketSuffix)
+}
+
+// UnixDialContext wraps a dialer for http.Transport: hosts made by UnixSocketURL are dialed over their socket, everything
+// else as usual.
+func UnixDialContext(dialer *net.Dialer) func(ctx context.Context, network, addr string) (net.Conn, error) {
+	return func(ctx context.Context, network, addr string) (net.Conn, error) {
+		if host, _, err := net.SplitHostPort(addr); err == nil &&
+			strings.HasPrefix(host, unixSocketPrefix) && strings.HasSuffix(host, unixSocketSuffix) {
+			return dialer.DialContext(ctx, "unix", filepath.Join(os.TempDir(), host))
+		}
+		return dialer.DialContext(ctx, network, addr)
+	}
+}
@@ -0,0 +1,233 @@
+// Package transport holds the ways the balancer can reach engines on the same host other than HTTP over loopback TCP: the
+// binary order-entry messages (backend/engine/Protocol.h), the shared-memory channel (backend/engine/ShmRing.h), and HTTP
+// over a Unix domain socket.
+package transport
+
+import (
+	"bytes"
+	"encoding/binary"
+	"errors"
+	"io"
+)
+
+// Message types and layouts, mirrored from Protocol.h (packed, little-endian). Change both together.
+const (
+	MsgNewOrder    = 1
+	MsgCancel      = 2
+	MsgModify      = 3
+	MsgExecReport  = 4
+	MsgReject      = 5
+	MsgSummary     = 6
+	MsgBookSummary = 7
+
+	flagLastInReply = 1
+
+	headerSize   = 4
+	bookNameSize = 32
+
+	newOrderSize = 56
+	cancelSize   = 44
+	summarySize  = 36
+)
+
+// Binary /batch body, mirrored from Protocol.h: a header, the book names, then one fixed-size record per order.
+const (
+	BatchContentType = "application/x-orderbook-batch"
+
+	batchMagic      = 0x3142424F // "OBB1"
+	batchVersion    = 1
+	batchHeaderSize = 16
+	batchRecordSize = 20
+	maxBookNameSize = bookNameSize - 1
+	maxBatchBooks   = 1<<16 - 1
+)
+
+// Sides and order types as they go on the wire.
+const (
+	SideBuy  = 0
+	SideSell = 1
+
+	GoodTillCancel = 0
+	FillAndKill    = 1
+)
+
+// Exec types of an ExecReport.
+const (
+	ExecNew       = 0
+	ExecTrade     = 1
+	ExecCancelled = 2
+	ExecReplaced  = 3
+)
+
+// Reject reasons.
+const (
+	RejectMalformed        = 0
+	RejectDuplicateOrderId = 1
+	RejectUnknownOrder     = 2
+	RejectNoLiquidity      = 3
+	RejectEngineError      = 4
+)
+
+func putHeader(buf []byte, msgType byte) {
+	binary.LittleEndian.PutUint16(buf[0:], uint16(len(buf)))
+	buf[2] = msgType
+	buf[3] = 0
+}
+
+func putBook(buf []byte, book string) {
+	n := copy(buf[:bookNameSize-1], book)
+	for i := n; i < bookNameSize; i++ {
+		buf[i] = 0
+	}
+}
+
+// EncodeNewOrder builds a NewOrder message.
+func EncodeNewOrder(orderId uint64, book string, side byte, orderType byte, price int32, quantity uint32) []byte {
+	buf := make([]byte, newOrderSize)
+	putHeader(buf, MsgNewOrder)
+	binary.LittleEndian.PutUint64(buf[4:], orderId)
+	binary.LittleEndian.PutUint32(buf[12:], uint32(price))
+	binary.LittleEndian.PutUint32(buf[16:], quantity)
+	buf[20] = side
+	buf[21] = orderType
+	putBook(buf[24:], book)
+	return buf
+}
+
+// EncodeCancel builds a Cancel message.
+func EncodeCancel(orderId uint64, book string) []byte {
+	buf := make([]byte, cancelSize)
+	putHeader(buf, MsgCancel)
+	binary.LittleEndian.PutUint64(buf[4:], orderId)
+	putBook(buf[12:], book)
+	return buf
+}
+
+// EncodeSummary builds a Summary request for one book.
+func EncodeSummary(book string) []byte {
+	buf := make([]byte, summarySize)
+	putHeader(buf, MsgSummary)
+	putBook(buf[4:], book)
+	return buf
+}
+
+// MessageType returns the type of a message received from the engine.
+func MessageType(msg []byte) byte {
+	return msg[2]
+}
+
+// ExecReport is a decoded ExecReport message.
+type ExecReport struct {
+	OrderId      uint64
+	Counterparty uint64
+	Price        int32
+	Quantity     uint32
+	Leaves       uint32
+	ExecType     byte
+}
+
+// DecodeExecReport decodes an ExecReport message.
+func DecodeExecReport(msg []byte) ExecReport {
+	return ExecReport{
+		OrderId:      binary.LittleEndian.Uint64(msg[4:]),
+		Counterparty: binary.LittleEndian.Uint64(msg[12:]),
+		Price:        int32(binary.LittleEndian.Uint32(msg[20:])),
+		Quantity:     binary.LittleEndian.Uint32(msg[24:]),
+		Leaves:       binary.LittleEndian.Uint32(msg[28:]),
+		ExecType:     msg[32],
+	}
+}
+
+// Reject is a decoded Reject message.
+type Reject struct {
+	OrderId  uint64
+	Rejected byte
+	Reason   byte
+}
+
+// DecodeReject decodes a Reject message.
+func DecodeReject(msg []byte) Reject {
+	return Reject{
+		OrderId:  binary.LittleEndian.Uint64(msg[4:]),
+		Rejected: msg[12],
+		Reason:   msg[13],
+	}
+}
+
+// BookSummary is a decoded BookSummary message (prices are -1 for an empty side).
+type BookSummary struct {
+	BidCount  uint32
+	AskCount  uint32
+	BestBid   int32
+	BestAsk   int32
+	BidLevels uint32
+	AskLevels uint32
+}
+
+// DecodeBookSummary decodes a BookSummary message.
+func DecodeBookSummary(msg []byte) BookSummary {
+	return BookSummary{
+		BidCount:  binary.LittleEndian.Uint32(msg[4:]),
+		AskCount:  binary.LittleEndian.Uint32(msg[8:]),
+		BestBid:   int32(binary.LittleEndian.Uint32(msg[12:])),
+		BestAsk:   int32(binary.LittleEndian.Uint32(msg[16:])),
+		BidLevels: binary.LittleEndian.Uint32(msg[20:]),
+		AskLevels: binary.LittleEndian.Uint32(msg[24:]),
+	}
+}
+
+// BatchWriter builds a binary /batch body. Each book name goes into the header once and the orders refer to it by index.
+type BatchWriter struct {
+	books   map[string]uint16
+	names   []string
+	records []byte
+	count   uint32
+}
+
+// NewBatchWriter returns a writer with room for the given number of orders.
+func NewBatchWriter(orders int) *BatchWriter {
+	return &BatchWriter{
+		books:   make(map[string]uint16),
+		records: make([]byte, 0, orders*batchRecordSize),
+	}
+}
+
+var errBatchBook = errors.New("book name too long or too many books for a binary batch")
+
+// Add appends one order.
+func (w *BatchWriter) Add(orderId uint64, book string, side byte, orderType byte, price int32, quantity uint32) error {
+	index, ok := w.books[book]
+	if !ok {
+		if len(book) > maxBookNameSize || len(w.names) == maxBatchBooks {
+			return errBatchBook
+		}
+		index = uint16(len(w.names))
+		w.books[book] = index
+		w.names = append(w.names, book)
+	}
+
+	var record [batchRecordSize]byte
+	binary.LittleEndian.PutUint64(record[0:], orderId)
+	binary.LittleEndian.PutUint32(record[8:], uint32(price))
+	binary.LittleEndian.PutUint32(record[12:], quantity)
+	binary.LittleEndian.PutUint16(record[16:], index)
+	record[18] = side
+	record[19] = orderType
+	w.records = append(w.records, record[:]...)
+	w.count++
+	return nil
+}
+
+// Body returns the finished body and its length. The records are not copied again.
+func (w *BatchWriter) Body() (io.Reader, int64) {
+	head := make([]byte, batchHeaderSize+len(w.names)*bookNameSize)
+	binary.LittleEndian.PutUint32(head[0:], batchMagic)
+	binary.LittleEndian.PutUint16(head[4:], batchVersion)
+	binary.LittleEndian.PutUint16(head[6:], uint16(len(w.names)))
+	binary.LittleEndian.PutUint32(head[8:], w.count)
+	binary.LittleEndian.PutUint16(head[12:], batchRecordSize)
+	for i, name := range w.names {
+		putBook(head[batchHeaderSize+i*bookNameSize:], name)
+	}
+	return io.MultiReader(bytes.NewReader(head), bytes.NewReader(w.records)), int64(len(head) + len(w.records))
+}
@@ -43,14 +43,12 @@ cleanup() {
         kill "$GO_PID" 2>/dev/null || true
     fi
 
-    # Kill any remaining C++ engines on ports 6060-6099
+    # Kill any remaining C++ engines by path, whatever port or socket they got
     echo -e "${BLUE}Cleaning up any remaining C++ engines...${NC}"
-    for port in $(seq 6060 6099); do
-        pid=$(lsof -ti:$port 2>/dev/null || true)
-        if [ -n "$pid" ]; then
-            kill $pid 2>/dev/null || true
-        fi
-    done
+    pkill -f "^$SCRIPT_DIR/backend/engine/server" 2>/dev/null || true
+
+    # ...and the sockets of the ones serving a Unix socket instead (ENGINE_UNIX_SOCKET=1)
+    rm -f "${TMPDIR:-/tmp}"/orderbook-engine-*.sock
 
     echo -e "${GREEN}All services stopped.${NC}"
     exit 0
@@ -138,7 +136,9 @@ if ! kill -0 "$GO_PID" 2>/dev/null; then
     exit 1
 fi
 echo -e "${GREEN}Go API started (PID: $GO_PID)${NC}"
-echo -e "${BLUE}Go API will spawn C++ engines on ports 6060+ as needed${NC}"
+echo -e "${BLUE}Go API will spawn C++ engines on ports 6060+ as needed (ENGINE_UNIX_SOCKET=1 uses Unix sockets instead)${NC}"
+echo -e "${BLUE}ENGINE_SHARED=1 puts every stock in one engine process instead, over ENGINE_SHARDS pinned matching threads${NC}"
+echo -e "${BLUE}ENGINE_POOL=N keeps N idle engines running for new stocks to take (default 2)${NC}"
 
 cd "$SCRIPT_DIR"
 